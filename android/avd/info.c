@@ -16,6 +16,7 @@
 #include "android/utils/tempfile.h"
 #include "android/utils/debug.h"
 #include "android/utils/dirscanner.h"
+#include "android/utils/timeline.h"
 #include <ctype.h>
 #include <stddef.h>
 #include <string.h>
@@ -513,11 +514,14 @@ imageLoader_lock( ImageLoader*  l, unsigned  flags )
 
     D("    locking %s image at %s", l->imageText, path);
 
+    timeline_begin("image-lock");
     if (filelock_create(path) != NULL) {
         /* succesful lock */
         l->pState[0] = IMAGE_STATE_LOCKED;
+        timeline_end("image-lock");
         return;
     }
+    timeline_end("image-lock");
 
     if (flags & IMAGE_IGNORE_IF_LOCKED) {
         dwarning("ignoring locked %s image at %s", l->imageText, path);
@@ -574,11 +578,13 @@ imageLoader_copyFrom( ImageLoader*  l, const char*  srcPath )
     imageLoader_lock(l, 0);
 
     /* make the copy */
+    timeline_begin("image-copy");
     if (path_copy_file(dstPath, srcPath) < 0) {
         derror("can't initialize %s image from SDK: %s: %s",
                l->imageText, dstPath, strerror(errno));
         exit(2);
     }
+    timeline_end("image-copy");
 }
 
 /* this will load and eventually lock and image file, depending
@@ -1093,8 +1099,14 @@ avdInfo_new( const char*  name, AvdInfoParams*  params )
     iniFile_free(i->rootIni);
     i->rootIni = NULL;
 
-    if ( _getImagePaths(i, params) < 0 ||
-         _getSkin      (i, params) < 0 )
+    timeline_begin("avd-images");
+    if ( _getImagePaths(i, params) < 0 ) {
+        timeline_end("avd-images");
+        goto FAIL;
+    }
+    timeline_end("avd-images");
+
+    if ( _getSkin(i, params) < 0 )
         goto FAIL;
 
     return i;
@@ -1214,11 +1226,13 @@ _getBuildImagePaths( AvdInfo*  i, AvdInfoParams*  params )
                    l->imageText, _imageFileNames[l->id]);
             exit(2);
         }
+        timeline_begin("image-copy");
         if (path_copy_file( l->pPath[0], srcData ) < 0) {
             derror("could not initialize %s image from %s: %s",
                    l->imageText, temp, strerror(errno));
             exit(2);
         }
+        timeline_end("image-copy");
     }
 
     AFREE(srcData);
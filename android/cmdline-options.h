@@ -120,6 +120,7 @@ OPT_PARAM( cpu_delay, "<cpudelay>", "throttle CPU emulation" )
 OPT_FLAG ( no_boot_anim, "disable animation for faster boot" )
 
 OPT_FLAG( no_window, "disable graphical window display" )
+OPT_FLAG( render_thread, "convert and scale the display in a separate thread" )
 OPT_FLAG( version, "display emulator version number" )
 
 OPT_PARAM( report_console, "<socket>", "report console port to remote socket" )
@@ -130,6 +131,7 @@ OPT_FLAG ( old_system, "support old (pre 1.4) system images" )
 OPT_PARAM( tcpdump, "<file>", "capture network packets to file" )
 
 OPT_PARAM( bootchart, "<timeout>", "enable bootcharting")
+OPT_PARAM( timeline, "<file>", "write a startup timeline in Chrome trace format" )
 
 OPT_LIST(  prop, "<name>=<value>", "set system property on boot")
 
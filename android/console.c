@@ -46,6 +46,7 @@
 #include <fcntl.h>
 #include "android/hw-events.h"
 #include "android/skin/keyboard.h"
+#include "android/skin/window.h"
 
 #if defined(CONFIG_SLIRP)
 #include "libslirp.h"
@@ -2102,6 +2103,35 @@ do_window_scale( ControlClient  client, char*  args )
     return 0;
 }
 
+extern int  android_emulator_get_window_stats( SkinWindowStats*  stats );
+
+static int
+do_window_stats( ControlClient  client, char*  args )
+{
+    SkinWindowStats  stats;
+    double           avg_ms = 0.;
+
+    if (android_emulator_get_window_stats( &stats ) < 0) {
+        control_write( client, "KO: no emulator window\r\n" );
+        return -1;
+    }
+    if (!stats.threaded) {
+        control_write( client, "rendering:     main loop (use -render-thread)\r\n" );
+        return 0;
+    }
+    if (stats.frames > 0)
+        avg_ms = stats.total_us / 1000. / stats.frames;
+
+    control_write( client, "rendering:     thread\r\n" );
+    control_write( client, "updates:       %d\r\n", stats.updates );
+    control_write( client, "frames:        %d\r\n", stats.frames );
+    control_write( client, "frame time:    %.2f ms average, %.2f ms max\r\n",
+                   avg_ms, stats.max_us / 1000. );
+    control_write( client, "queue depth:   %d max, %d pending\r\n",
+                   stats.max_depth, stats.pending );
+    return 0;
+}
+
 static const CommandDefRec  window_commands[] =
 {
     { "scale", "change the window scale",
@@ -2110,6 +2140,10 @@ static const CommandDefRec  window_commands[] =
     "the 'dpi' prefix (as in '120dpi')\r\n",
     NULL, do_window_scale, NULL },
 
+    { "stats", "show rendering statistics",
+    "'window stats' shows how many display updates were rendered, and how long it took\r\n",
+    NULL, do_window_stats, NULL },
+
     { NULL, NULL, NULL, NULL, NULL, NULL }
 };
 
@@ -1264,6 +1264,22 @@ help_bootchart(stralloc_t  *out)
     );
 }
 
+static void
+help_timeline(stralloc_t  *out)
+{
+    PRINTF(
+    "  use '-timeline <file>' to record how long each phase of the emulator's\n"
+    "  startup takes: virtual device setup, image locking and copying, skin\n"
+    "  loading, machine initialization, snapshot loading, and the time until\n"
+    "  the emulated system displays its first frame.\n\n"
+
+    "  the file is written in the Chrome trace event format when the first\n"
+    "  frame is displayed, and again when the emulator exits. It can be viewed\n"
+    "  with chrome://tracing. Compare the files of two runs to see where cold\n"
+    "  and warm startups spend their time.\n\n"
+    );
+}
+
 static void
 help_tcpdump(stralloc_t  *out)
 {
@@ -1282,6 +1298,19 @@ help_tcpdump(stralloc_t  *out)
     );
 }
 
+static void
+help_render_thread(stralloc_t  *out)
+{
+    PRINTF(
+    "  use '-render-thread' to convert and scale the emulated display in a\n"
+    "  separate thread. The main loop then only has to present the frames\n"
+    "  that are ready, which helps when the window is scaled or rotated.\n\n"
+
+    "  the 'window stats' console command reports the number of frames and\n"
+    "  the time spent rendering them.\n\n"
+    );
+}
+
 static void
 help_prop(stralloc_t  *out)
 {
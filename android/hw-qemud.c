@@ -69,7 +69,11 @@
  * then the payload itself), before sending them to a generic receiver.
  *
  * The QemudSerial object can also be used to send messages to the daemon
- * through the serial port (see qemud_serial_send())
+ * through the serial port (see qemud_serial_send()). Outgoing messages are
+ * not written immediately: they are appended to a per-channel buffer, and
+ * all the messages queued for a given channel during a main loop iteration
+ * are sent as a few full-sized serial packets by a bottom-half. The buffers
+ * are kept between flushes, so that sending a message doesn't allocate.
  *
  * The multiplexer is connected to one or more 'service' objects.
  * are themselves connected through a charpipe to an emulated device or
@@ -130,15 +134,6 @@ qemud_sink_fill( QemudSink*  ss, const uint8_t* *pmsg, int  *plen)
     return (ss->len == ss->size);
 }
 
-/* returns the number of bytes needed to fill a sink's destination
- * buffer.
- */
-static int
-qemud_sink_needed( QemudSink*  ss )
-{
-    return ss->size - ss->len;
-}
-
 /** HANDLING SERIAL PORT CONNECTION
  **/
 
@@ -177,6 +172,28 @@ typedef enum {
 
 #define  BUFFER_SIZE    MAX_SERIAL_PAYLOAD
 
+/* size of a full serial packet, header included */
+#define  PACKET_SIZE    (HEADER_SIZE + MAX_SERIAL_PAYLOAD)
+
+/* channel ids are 2-hexchar strings */
+#define  MAX_CHANNELS   256
+
+/* a channel's pending output is flushed immediately when it grows
+ * over this limit, instead of waiting for the bottom-half.
+ */
+#define  MAX_PENDING_OUTPUT  (16*PACKET_SIZE)
+
+/* the output queued for a given channel, as a sequence of serial
+ * packets. all packets but the last one are full, and their headers
+ * are only written when the buffer is flushed.
+ */
+typedef struct QemudOutput {
+    uint8_t*  buff;
+    int       len;
+    int       size;
+    ABool     queued;   /* TRUE if in the serial's flush queue */
+} QemudOutput;
+
 /* out of convenience, the incoming message is zero-terminated
  * and can be modified by the receiver (e.g. for tokenization).
  */
@@ -197,6 +214,12 @@ typedef struct QemudSerial {
     QemudSink     payload[1];
     uint8_t       data0[MAX_SERIAL_PAYLOAD+1];
 
+    /* managing outgoing packets */
+    QemudOutput   out[MAX_CHANNELS];
+    uint8_t       out_queue[MAX_CHANNELS];  /* channels to flush, in order */
+    int           out_count;
+    QEMUBH*       out_bh;
+
     /* receiver */
     QemudSerialReceive  recv_func;    /* receiver callback */
     void*               recv_opaque;  /* receiver user-specific data */
@@ -215,12 +238,11 @@ qemud_serial_can_read( void*  opaque )
         return s->overflow;
     }
 
-    /* if in_size is 0, we're reading the header */
-    if (s->need_header)
-        return qemud_sink_needed(s->header);
-
-    /* otherwise, we're reading the payload */
-    return qemud_sink_needed(s->payload);
+    /* qemud_serial_read() can handle any number of packets, take
+     * at least a full one so that the charpipe doesn't have to
+     * split headers and payloads into separate calls.
+     */
+    return PACKET_SIZE;
 }
 
 /* called by the charpipe to read data from the serial
@@ -245,6 +267,7 @@ qemud_serial_read( void*  opaque, const uint8_t*  from, int  len )
 
             from += avail;
             len  -= avail;
+            s->overflow -= avail;
             continue;
         }
 
@@ -380,6 +403,180 @@ qemud_serial_send_legacy_probe( QemudSerial*  s )
 }
 #endif /* SUPPORT_LEGACY_QEMUD */
 
+/* write the header of a serial packet */
+static void
+qemud_serial_write_header( QemudSerial*  s,
+                           uint8_t*      header,
+                           int           channel,
+                           int           len )
+{
+#if SUPPORT_LEGACY_QEMUD
+    if (s->version == QEMUD_VERSION_LEGACY) {
+        int2hex(header + LEGACY_LENGTH_OFFSET,  LENGTH_SIZE,  len);
+        int2hex(header + LEGACY_CHANNEL_OFFSET, CHANNEL_SIZE, channel);
+    } else {
+        int2hex(header + LENGTH_OFFSET,  LENGTH_SIZE,  len);
+        int2hex(header + CHANNEL_OFFSET, CHANNEL_SIZE, channel);
+    }
+#else
+    int2hex(header + LENGTH_OFFSET,  LENGTH_SIZE,  len);
+    int2hex(header + CHANNEL_OFFSET, CHANNEL_SIZE, channel);
+#endif
+    T("%s: '%.*s'", __FUNCTION__, HEADER_SIZE, header);
+}
+
+/* make room for 'len' more payload bytes in an output buffer,
+ * including the headers of the packets they may start.
+ */
+static void
+qemud_output_reserve( QemudOutput*  o, int  len )
+{
+    int  needed = o->len + len + HEADER_SIZE*(len/MAX_SERIAL_PAYLOAD + 2);
+    int  size   = o->size;
+
+    if (needed <= size)
+        return;
+
+    if (size < PACKET_SIZE)
+        size = PACKET_SIZE;
+    while (size < needed)
+        size += size/2;
+
+    AARRAY_RENEW(o->buff, size);
+    o->size = size;
+}
+
+/* append payload bytes to an output buffer, starting a new packet
+ * each time the current one is full. the caller must have called
+ * qemud_output_reserve() before.
+ */
+static void
+qemud_output_append( QemudOutput*  o, const uint8_t*  data, int  len )
+{
+    while (len > 0) {
+        int  used = o->len % PACKET_SIZE;
+        int  avail;
+
+        if (used == 0) {
+            /* the header is written by qemud_serial_flush_channel() */
+            o->len += HEADER_SIZE;
+            used    = HEADER_SIZE;
+        }
+        avail = PACKET_SIZE - used;
+        if (avail > len)
+            avail = len;
+
+        memcpy(o->buff + o->len, data, avail);
+        o->len += avail;
+        data   += avail;
+        len    -= avail;
+    }
+}
+
+/* send all the packets queued for a given channel */
+static void
+qemud_serial_flush_channel( QemudSerial*  s, int  channel )
+{
+    QemudOutput*  o = &s->out[channel];
+    int           pos;
+
+    if (o->len == 0)
+        return;
+
+    for (pos = 0; pos < o->len; pos += PACKET_SIZE) {
+        int  avail = o->len - pos - HEADER_SIZE;
+
+        if (avail > MAX_SERIAL_PAYLOAD)
+            avail = MAX_SERIAL_PAYLOAD;
+
+        qemud_serial_write_header(s, o->buff + pos, channel, avail);
+    }
+    qemu_chr_write(s->cs, o->buff, o->len);
+    o->len = 0;
+}
+
+/* send all queued packets. this is also the bottom-half callback
+ * scheduled by qemud_serial_send().
+ */
+static void
+qemud_serial_flush( void*  opaque )
+{
+    QemudSerial*  s = opaque;
+    int           nn;
+
+    for (nn = 0; nn < s->out_count; nn++) {
+        int  channel = s->out_queue[nn];
+
+        s->out[channel].queued = 0;
+        qemud_serial_flush_channel(s, channel);
+    }
+    s->out_count = 0;
+}
+
+/* drop the packets queued for a channel that was closed by the daemon,
+ * they must not be delivered to a new client that reuses its id.
+ */
+static void
+qemud_serial_discard( QemudSerial*  s, int  channel )
+{
+    if (channel >= 0 && channel < MAX_CHANNELS)
+        s->out[channel].len = 0;
+}
+
+/* queue a message for the serial port. This will add the necessary
+ * headers. 'frame' is either NULL or the frame header to insert
+ * before the message, as encoded by qemud_frame_header().
+ *
+ * messages for channel 0 are sent immediately, after everything
+ * queued before them, since they can announce a disconnection.
+ */
+static void
+qemud_serial_send( QemudSerial*    s,
+                   int             channel,
+                   const uint8_t*  frame,
+                   const uint8_t*  msg,
+                   int             msglen )
+{
+    QemudOutput*  o;
+
+    if (msglen <= 0 || channel < 0 || channel >= MAX_CHANNELS)
+        return;
+
+    D("%s: channel=%2d len=%3d '%s'",
+      __FUNCTION__, channel, msglen,
+      quote_bytes((const void*)msg, msglen));
+
+    o = &s->out[channel];
+    qemud_output_reserve(o, msglen + (frame ? FRAME_HEADER_SIZE : 0));
+    if (frame)
+        qemud_output_append(o, frame, FRAME_HEADER_SIZE);
+    qemud_output_append(o, msg, msglen);
+
+    if (channel == 0) {
+        qemud_serial_flush(s);
+        qemud_serial_flush_channel(s, 0);
+        return;
+    }
+
+    if (o->len >= MAX_PENDING_OUTPUT) {
+        qemud_serial_flush_channel(s, channel);
+        return;
+    }
+
+    if (!o->queued) {
+        o->queued = 1;
+        s->out_queue[s->out_count++] = channel;
+        qemu_bh_schedule(s->out_bh);
+    }
+}
+
+/* encode the frame header of a 'msglen' bytes message */
+static void
+qemud_frame_header( uint8_t*  frame, int  msglen )
+{
+    int2hex(frame, FRAME_HEADER_SIZE, msglen);
+}
+
 /* intialize a QemudSerial object with a charpipe endpoint
  * and a receiver.
  */
@@ -394,6 +591,8 @@ qemud_serial_init( QemudSerial*        s,
     s->recv_opaque  = recv_opaque;
     s->need_header  = 1;
     s->overflow     = 0;
+    s->out_count    = 0;
+    s->out_bh       = qemu_bh_new(qemud_serial_flush, s);
 
     qemud_sink_reset( s->header, HEADER_SIZE, s->data0 );
     s->in_size      = 0;
@@ -411,72 +610,6 @@ qemud_serial_init( QemudSerial*        s,
                            s );
 }
 
-/* send a message to the serial port. This will add the necessary
- * header.
- */
-static void
-qemud_serial_send( QemudSerial*    s,
-                   int             channel,
-                   ABool           framing,
-                   const uint8_t*  msg,
-                   int             msglen )
-{
-    uint8_t   header[HEADER_SIZE];
-    uint8_t   frame[FRAME_HEADER_SIZE];
-    int       avail, len = msglen;
-
-    if (msglen <= 0 || channel < 0)
-        return;
-
-    D("%s: channel=%2d len=%3d '%s'",
-      __FUNCTION__, channel, msglen,
-      quote_bytes((const void*)msg, msglen));
-
-    if (framing) {
-        len += FRAME_HEADER_SIZE;
-    }
-
-    /* packetize the payload for the serial MTU */
-    while (len > 0) 
-    {
-        avail = len;
-        if (avail > MAX_SERIAL_PAYLOAD)
-            avail = MAX_SERIAL_PAYLOAD;
-
-        /* write this packet's header */
-#if SUPPORT_LEGACY_QEMUD
-        if (s->version == QEMUD_VERSION_LEGACY) {
-            int2hex(header + LEGACY_LENGTH_OFFSET,  LENGTH_SIZE,  avail);
-            int2hex(header + LEGACY_CHANNEL_OFFSET, CHANNEL_SIZE, channel);
-        } else {
-            int2hex(header + LENGTH_OFFSET,  LENGTH_SIZE,  avail);
-            int2hex(header + CHANNEL_OFFSET, CHANNEL_SIZE, channel);
-        }
-#else
-        int2hex(header + LENGTH_OFFSET,  LENGTH_SIZE,  avail);
-        int2hex(header + CHANNEL_OFFSET, CHANNEL_SIZE, channel);
-#endif
-        T("%s: '%.*s'", __FUNCTION__, HEADER_SIZE, header);
-        qemu_chr_write(s->cs, header, HEADER_SIZE);
-
-        /* insert frame header when needed */
-        if (framing) {
-            int2hex(frame, FRAME_HEADER_SIZE, msglen);
-            T("%s: '%.*s'", __FUNCTION__, FRAME_HEADER_SIZE, frame);
-            qemu_chr_write(s->cs, frame, FRAME_HEADER_SIZE);
-            avail  -= FRAME_HEADER_SIZE;
-            len    -= FRAME_HEADER_SIZE;
-            framing = 0;
-        }
-
-        /* write message content */
-        T("%s: '%.*s'", __FUNCTION__, avail, msg);
-        qemu_chr_write(s->cs, msg, avail);
-        msg += avail;
-        len -= avail;
-    }
-}
-
 /** CLIENTS
  **/
 
@@ -506,6 +639,13 @@ struct QemudClient {
     QemudSink         header[1];
     uint8_t           header0[FRAME_HEADER_SIZE];
     QemudSink         payload[1];
+    uint8_t*          payload0;       /* kept between frames */
+    int               payload0_size;
+
+    /* set while calling clie_recv, a client closed from its own
+     * callback is only freed when qemud_client_recv() returns. */
+    ABool             receiving;
+    ABool             closed;
 };
 
 static void  qemud_service_remove_client( QemudService*  service,
@@ -534,6 +674,14 @@ qemud_client_prepend( QemudClient*  c, QemudClient** plist )
         c->next->pref = &c->next;
 }
 
+/* free a QemudClient and its buffers */
+static void
+qemud_client_free( QemudClient*  c )
+{
+    AFREE(c->payload0);
+    AFREE(c);
+}
+
 /* receive a new message from a client, and dispatch it to
  * the real service implementation.
  */
@@ -550,52 +698,60 @@ qemud_client_recv( void*  opaque, uint8_t*  msg, int  msglen )
     }
 
     /* framing */
+    c->receiving = 1;
 
-#if 1
-    /* special case, in 99% of cases, everything is in
-     * the incoming message, and we can do all we need
-     * directly without dynamic allocation.
-     */
-    if (msglen > FRAME_HEADER_SIZE   &&
-        c->need_header == 1          &&
-        qemud_sink_needed(c->header) == 0)
-    {
-        int  len = hex2int( msg, FRAME_HEADER_SIZE );
-
-        if (len >= 0 && msglen == len + FRAME_HEADER_SIZE) {
-            if (c->clie_recv)
-                c->clie_recv( c->clie_opaque, 
-                              msg+FRAME_HEADER_SIZE,
-                              msglen-FRAME_HEADER_SIZE, c );
-            return;
+    while (msglen > 0 && c->clie_recv != NULL) {
+        /* in most cases, the incoming message contains one or more
+         * complete frames, which can be passed directly to the
+         * service. the byte that follows each frame is temporarily
+         * replaced by the terminating zero.
+         */
+        if (c->need_header                   &&
+            c->header->len == 0              &&
+            msglen > FRAME_HEADER_SIZE)
+        {
+            int  len = hex2int( msg, FRAME_HEADER_SIZE );
+
+            if (len > 0 && len <= msglen - FRAME_HEADER_SIZE) {
+                uint8_t*  data  = msg + FRAME_HEADER_SIZE;
+                uint8_t   saved = data[len];
+
+                data[len] = 0;
+                c->clie_recv( c->clie_opaque, data, len, c );
+                data[len] = saved;
+
+                msg    += FRAME_HEADER_SIZE + len;
+                msglen -= FRAME_HEADER_SIZE + len;
+                continue;
+            }
         }
-    }
-#endif
 
-    while (msglen > 0) {
         /* read the header */
         if (c->need_header) {
-            int       frame_size;
-            uint8_t*  data;
+            int  frame_size;
 
             if (!qemud_sink_fill(c->header, (const uint8_t**)&msg, &msglen))
                 break;
 
-            frame_size = hex2int(c->header0, 4);
+            c->header->len = 0;
+            frame_size = hex2int(c->header0, FRAME_HEADER_SIZE);
             if (frame_size == 0) {
                 D("%s: ignoring empty frame", __FUNCTION__);
                 continue;
             }
             if (frame_size < 0) {
-                D("%s: ignoring corrupted frame header '.*s'",
+                D("%s: ignoring corrupted frame header '%.*s'",
                   __FUNCTION__, FRAME_HEADER_SIZE, c->header0 );
                 continue;
             }
 
-            AARRAY_NEW(data, frame_size+1);  /* +1 for terminating zero */
-            qemud_sink_reset(c->payload, frame_size, data);
+            /* +1 for terminating zero */
+            if (frame_size+1 > c->payload0_size) {
+                AARRAY_RENEW(c->payload0, frame_size+1);
+                c->payload0_size = frame_size+1;
+            }
+            qemud_sink_reset(c->payload, frame_size, c->payload0);
             c->need_header = 0;
-            c->header->len = 0;
         }
 
         /* read the payload */
@@ -603,14 +759,14 @@ qemud_client_recv( void*  opaque, uint8_t*  msg, int  msglen )
             break;
 
         c->payload->buff[c->payload->size] = 0;
-
-
-        if (c->clie_recv)
-            c->clie_recv( c->clie_opaque, c->payload->buff, c->payload->size, c );
-
-        AFREE(c->payload->buff);
         c->need_header = 1;
+
+        c->clie_recv( c->clie_opaque, c->payload->buff, c->payload->size, c );
     }
+
+    c->receiving = 0;
+    if (c->closed)
+        qemud_client_free(c);
 }
 
 /* disconnect a client. this automatically frees the QemudClient.
@@ -629,7 +785,7 @@ qemud_client_disconnect( void*  opaque )
     if (c->channel > 0) {
         char  tmp[128], *p=tmp, *end=p+sizeof(tmp);
         p = bufprint(tmp, end, "disconnect:%02x", c->channel);
-        qemud_serial_send(c->serial, 0, 0, (uint8_t*)tmp, p-tmp);
+        qemud_serial_send(c->serial, 0, NULL, (uint8_t*)tmp, p-tmp);
     }
 
     /* call the client close callback */
@@ -645,7 +801,11 @@ qemud_client_disconnect( void*  opaque )
         c->service = NULL;
     }
 
-    AFREE(c);
+    if (c->receiving) {
+        c->closed = 1;
+        return;
+    }
+    qemud_client_free(c);
 }
 
 /* allocate a new QemudClient object */
@@ -877,6 +1037,7 @@ qemud_multiplexer_disconnect( QemudMultiplexer*  m,
              * m->clients automatically.
              */
             c->channel = -1; /* no need to send disconnect:<id> */
+            qemud_serial_discard(m->serial, channel);
             qemud_client_disconnect(c);
             return;
         }
@@ -942,7 +1103,7 @@ qemud_multiplexer_control_recv( void*         opaque,
         else {
             p = bufprint(tmp, end, "ok:connect:%02x", channel);
         }
-        qemud_serial_send(mult->serial, 0, 0, (uint8_t*)tmp, p-tmp);
+        qemud_serial_send(mult->serial, 0, NULL, (uint8_t*)tmp, p-tmp);
         return;
     }
 
@@ -1018,7 +1179,7 @@ qemud_multiplexer_control_recv( void*         opaque,
 
     /* anything else is a problem */
     p = bufprint(tmp, end, "ko:unknown command");
-    qemud_serial_send(mult->serial, 0, 0, (uint8_t*)tmp, p-tmp);
+    qemud_serial_send(mult->serial, 0, NULL, (uint8_t*)tmp, p-tmp);
 }
 
 /* initialize the global QemudMultiplexer.
@@ -1085,7 +1246,13 @@ qemud_client_new( QemudService*     service,
 void
 qemud_client_send ( QemudClient*  client, const uint8_t*  msg, int  msglen )
 {
-    qemud_serial_send(client->serial, client->channel, client->framing != 0, msg, msglen);
+    uint8_t  frame[FRAME_HEADER_SIZE];
+
+    if (client->framing) {
+        qemud_frame_header(frame, msglen);
+        qemud_serial_send(client->serial, client->channel, frame, msg, msglen);
+    } else
+        qemud_serial_send(client->serial, client->channel, NULL, msg, msglen);
 }
 
 /* enable framing for this client. When TRUE, this will
@@ -1095,12 +1262,10 @@ qemud_client_send ( QemudClient*  client, const uint8_t*  msg, int  msglen )
 void
 qemud_client_set_framing( QemudClient*  client, int  framing )
 {
-    /* release dynamic buffer if we're disabling framing */
+    /* drop any partial frame if we're disabling framing */
     if (client->framing) {
-        if (!client->need_header) {
-            AFREE(client->payload->buff);
-            client->need_header = 1;
-        }
+        client->need_header = 1;
+        client->header->len = 0;
     }
     client->framing = !!framing;
 }
@@ -1192,9 +1357,14 @@ qemud_service_broadcast( QemudService*  sv,
                          int             msglen )
 {
     QemudClient*  c;
+    uint8_t       frame[FRAME_HEADER_SIZE];
+
+    /* the frame header is the same for all clients */
+    qemud_frame_header(frame, msglen);
 
     for (c = sv->clients; c; c = c->next_serv)
-        qemud_client_send(c, msg, msglen);
+        qemud_serial_send(c->serial, c->channel,
+                          c->framing ? frame : NULL, msg, msglen);
 }
 
 
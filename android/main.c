@@ -66,6 +66,7 @@
 
 #include "android/globals.h"
 #include "tcpdump.h"
+#include "android/utils/timeline.h"
 
 /* in vl.c */
 extern void  qemu_help(int  code);
@@ -304,6 +305,13 @@ static void
 qemulator_fb_update( void*   _emulator, int  x, int  y, int  w, int  h )
 {
     QEmulator*  emulator = _emulator;
+    static int  first_frame = 1;
+
+    if (first_frame) {
+        first_frame = 0;
+        timeline_mark("guest-first-frame");
+        timeline_flush();
+    }
 
     if (emulator->window)
         skin_window_update_display( emulator->window, x, y, w, h );
@@ -481,6 +489,19 @@ android_emulator_set_window_scale( double  scale, int  is_dpi )
         skin_window_set_scale( emulator->window, scale );
 }
 
+/* return the statistics of the emulator window, or -1 if there is none */
+int
+android_emulator_get_window_stats( SkinWindowStats*  stats )
+{
+    QEmulator*  emulator = qemulator;
+
+    if (emulator->window == NULL)
+        return -1;
+
+    skin_window_get_stats( emulator->window, stats );
+    return 0;
+}
+
 
 static void
 qemulator_set_title( QEmulator*  emulator )
@@ -599,6 +620,9 @@ qemulator_setup( QEmulator*  emulator )
         skin_window_enable_dpad  ( emulator->window, android_hw->hw_dPad != 0 );
         skin_window_enable_qwerty( emulator->window, android_hw->hw_keyboard != 0 );
         skin_window_enable_trackball( emulator->window, android_hw->hw_trackBall != 0 );
+
+        if (opts->render_thread)
+            skin_window_enable_render_thread( emulator->window, 1 );
     }
 
     /* initialize hardware control support */
@@ -635,6 +659,9 @@ static void sdl_refresh(DisplayState *ds)
     if (window == NULL)
         return;
 
+    /* show what the render thread did since the last refresh */
+    skin_window_present( window );
+
     while(SDL_PollEvent(&ev)){
         switch(ev.type){
         case SDL_VIDEOEXPOSE:
@@ -1721,6 +1748,27 @@ _forceAvdImagePath( AvdImageType  imageType,
     android_avdParams->forcePaths[imageType] = path;
 }
 
+/* 32-bit x86 hosts are built with -msse2 (see Makefile.android), so
+ * refuse to start on a processor without it instead of crashing on an
+ * illegal instruction later */
+static void
+_checkHostCpu( void )
+{
+#if defined(__i386__) && defined(__SSE2__)
+    unsigned int  eax = 1, ebx, ecx = 0, edx;
+
+    /* %ebx may be the PIC register, preserve it */
+    __asm__ __volatile__( "movl %%ebx, %1\n\t"
+                          "cpuid\n\t"
+                          "xchgl %%ebx, %1"
+                          : "+a" (eax), "=&r" (ebx), "+c" (ecx), "=d" (edx) );
+    if (!(edx & (1 << 26))) {
+        derror("This emulator requires a host processor with SSE2 support");
+        exit(1);
+    }
+#endif
+}
+
 #ifdef _WIN32
 #undef main  /* we don't want SDL to define main */
 #endif
@@ -1750,12 +1798,20 @@ int main(int argc, char **argv)
 
     AndroidOptions  opts[1];
 
+    _checkHostCpu();
+
+    timeline_begin("startup");
+    timeline_begin("android-init");
+
     args[0] = argv[0];
 
     if ( android_parse_options( &argc, &argv, opts ) < 0 ) {
         exit(1);
     }
 
+    if (opts->timeline)
+        timeline_set_output(opts->timeline);
+
     while (argc-- > 1) {
         opt = (++argv)[0];
 
@@ -2033,6 +2089,7 @@ int main(int argc, char **argv)
     /* setup the virtual device differently depending on whether
      * we are in the Android build system or not
      */
+    timeline_begin("avd-info");
     if (opts->avd != NULL)
     {
         android_avdInfo = avdInfo_new( opts->avd, android_avdParams );
@@ -2057,6 +2114,7 @@ int main(int argc, char **argv)
             exit(1);
         }
     }
+    timeline_end("avd-info");
 
     /* get the skin from the virtual device configuration */
     opts->skin    = (char*) avdInfo_getSkinName( android_avdInfo );
@@ -2172,7 +2230,9 @@ int main(int argc, char **argv)
     }
 
     emulator_config_init();
+    timeline_begin("skin-ui");
     init_skinned_ui(opts->skindir, opts->skin, opts);
+    timeline_end("skin-ui");
 
     if (!opts->netspeed) {
         if (skin_network_speed)
@@ -2601,6 +2661,8 @@ int main(int argc, char **argv)
             fprintf(stdout, "emulator: argv[%02d] = \"%s\"\n", i, args[i]);
         }
     }
+    timeline_end("android-init");
+    timeline_begin("qemu-init");
     return qemu_main(n, args);
 }
 
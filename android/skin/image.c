@@ -11,8 +11,22 @@
 */
 #include "android/skin/image.h"
 #include "android/resource.h"
+#include "android/utils/bufprint.h"
+#include "android/utils/path.h"
+#include "android/utils/timeline.h"
 #include <assert.h>
 #include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#  include <io.h>
+#  include <process.h>
+#else
+#  include <unistd.h>
+#  include <sys/mman.h>
+#endif
 
 #define  DEBUG  0
 
@@ -204,9 +218,14 @@ skin_image_desc_equal( SkinImageDesc*  a,
 /********************************************************************************/
 
 enum {
-    SKIN_IMAGE_CLONE = (1 << 0)   /* this image is a clone */
+    SKIN_IMAGE_CLONE  = (1 << 0),  /* this image is a clone */
+    SKIN_IMAGE_MAPPED = (1 << 1),  /* the pixels are mapped from the disk cache */
+    SKIN_IMAGE_ERROR  = (1 << 2)   /* the pixels could not be loaded */
 };
 
+/* images are created with their size only, read from the PNG header. the
+ * pixels and the SDL surface are loaded the first time they are used, see
+ * skin_image_decode() */
 struct SkinImage {
     unsigned         hash;
     SkinImage*       link;
@@ -217,6 +236,9 @@ struct SkinImage {
     unsigned         flags;
     unsigned         w, h;
     void*            pixels;  /* 32-bit ARGB */
+    void*            map_base;
+    size_t           map_size;
+    uint64_t         key;     /* hash of the PNG file, 0 if not computed */
     SkinImageDesc    desc;
 };
 
@@ -224,7 +246,7 @@ struct SkinImage {
 
 
 static const SkinImage  _no_image[1] = {
-    { 0, NULL, 0, NULL, NULL, NULL, 0, 0, 0, NULL, { "<none>", SKIN_ROTATION_0, 0 } }
+    { 0, NULL, 0, NULL, NULL, NULL, 0, 0, 0, NULL, NULL, 0, 0, { "<none>", SKIN_ROTATION_0, 0 } }
 };
 
 SkinImage*  SKIN_IMAGE_NONE = (SkinImage*)&_no_image;
@@ -239,6 +261,15 @@ skin_image_free( SkinImage*  image )
             image->surface = NULL;
         }
 
+        if (image->flags & SKIN_IMAGE_MAPPED) {
+#ifdef _WIN32
+            free( image->map_base );
+#else
+            munmap( image->map_base, image->map_size );
+#endif
+            image->pixels = NULL;
+        }
+
         if (image->pixels) {
             free( image->pixels );
             image->pixels = NULL;
@@ -269,40 +300,370 @@ skin_image_alloc( SkinImageDesc*  desc, unsigned  hash )
 }
 
 
-extern void *loadpng(const char *fn, unsigned *_width, unsigned *_height);
 extern void *readpng(const unsigned char*  base, size_t  size, unsigned *_width, unsigned *_height);
 
+/* the content of a PNG file, which is either a built-in resource or a file
+ * on disk. in the latter case, '*pfree' is set to the heap block that must
+ * be freed by the caller */
+static const unsigned char*
+skin_image_load_png( const char*  path, size_t  *psize, void*  *pfree )
+{
+    const unsigned char*  base;
+
+    *pfree = NULL;
+
+    if (path[0] == ':') {
+        if (path[1] == '/' || path[1] == '\\')
+            path += 1;
+
+        base = android_resource_find( path+1, psize );
+        if (base == NULL)
+            fprintf(stderr, "failed to locate built-in image file '%s'\n", path );
+    } else {
+        base = path_load_file( path, psize );
+        if (base == NULL)
+            fprintf(stderr, "failed to load image file '%s'\n", path );
+        *pfree = (void*)base;
+    }
+    return base;
+}
+
+
+/* read the size of an image from the header of its PNG file, which starts
+ * with an 8-byte signature followed by the IHDR chunk. this is all we need
+ * until the pixels are used */
 static int
-skin_image_load( SkinImage*  image )
+skin_image_read_size( SkinImage*  image )
 {
-    void*     data;
-    unsigned  w, h;
-    const char*  path = image->desc.path;
+    static const unsigned char  png_sig[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    unsigned char  header[24];
+    const char*    path = image->desc.path;
+    unsigned       w, h;
 
     if (path[0] == ':') {
         size_t                size;
         const unsigned char*  base;
+        void*                 to_free;
 
-        if (path[1] == '/' || path[1] == '\\')
-            path += 1;
+        base = skin_image_load_png( path, &size, &to_free );
+        if (base == NULL)
+            return -1;
 
-        base = android_resource_find( path+1, &size );
-        if (base == NULL) {
-            fprintf(stderr, "failed to locate built-in image file '%s'\n", path );
+        if (size < sizeof(header))
+            goto BadHeader;
+
+        memcpy( header, base, sizeof(header) );
+    } else {
+        FILE*  f = fopen( path, "rb" );
+        int    ret;
+
+        if (f == NULL) {
+            fprintf(stderr, "failed to load image file '%s'\n", path );
             return -1;
         }
+        ret = fread( header, sizeof(header), 1, f );
+        fclose(f);
+        if (ret != 1)
+            goto BadHeader;
+    }
+
+    if (memcmp( header, png_sig, 8 ) != 0 || memcmp( header+12, "IHDR", 4 ) != 0)
+        goto BadHeader;
+
+    w = ((unsigned)header[16] << 24) | (header[17] << 16) | (header[18] << 8) | header[19];
+    h = ((unsigned)header[20] << 24) | (header[21] << 16) | (header[22] << 8) | header[23];
+
+    /* the IHDR limit is 2^31-1, but we don't want w*h*4 to overflow */
+    if (w == 0 || h == 0 || w > 32768 || h > 32768)
+        goto BadHeader;
+
+    image->w = w;
+    image->h = h;
+    return 0;
+
+BadHeader:
+    fprintf(stderr, "invalid PNG header in image file '%s'\n", path );
+    return -1;
+}
+
+
+/* 64-bit FNV-1a hash of a PNG file, used as the disk cache key */
+static uint64_t
+skin_image_hash_png( const unsigned char*  base, size_t  size )
+{
+    const unsigned char*  end = base + size;
+    uint64_t              h   = 0xcbf29ce484222325ULL;
+
+    for ( ; base < end; base++ ) {
+        h ^= base[0];
+        h *= 0x100000001b3ULL;
+    }
+    /* 0 means 'not computed yet' */
+    if (h == 0)
+        h = 1;
+    return h;
+}
+
+
+static int
+skin_image_get_key( SkinImage*  image )
+{
+    if (image->key == 0) {
+        size_t                size;
+        void*                 to_free;
+        const unsigned char*  base = skin_image_load_png( image->desc.path, &size, &to_free );
 
-        data = readpng(base, size, &w, &h);
-        if (data == NULL) {
-            fprintf(stderr, "failed to load built-in image file '%s'\n", path );
+        if (base == NULL)
             return -1;
+
+        image->key = skin_image_hash_png( base, size );
+        free( to_free );
+    }
+    return 0;
+}
+
+/********************************************************************************/
+/********************************************************************************/
+/*****                                                                      *****/
+/*****            D I S K   C A C H E                                       *****/
+/*****                                                                      *****/
+/********************************************************************************/
+/********************************************************************************/
+
+/* decoded images are saved in ~/.android/skin-cache, one file per variant,
+ * named after the hash of the PNG file, the rotation and the blend level.
+ * each file is a 64-byte header followed by the 32-bit ARGB pixels in the
+ * native byte order, so they can be mapped directly in memory by the next
+ * launches. the page-aligned mapping and the header size keep the pixels
+ * aligned.
+ */
+
+#define  SKIN_CACHE_MAGIC       "SKINARGB"
+#define  SKIN_CACHE_BYTE_ORDER  0x01020304
+
+typedef struct {
+    char      magic[8];
+    uint32_t  byte_order;
+    uint32_t  width;
+    uint32_t  height;
+    uint32_t  rotation;
+    uint32_t  blend;
+    uint32_t  reserved;
+    uint64_t  key;
+    char      padding[24];
+} SkinCacheHeader;
+
+#ifndef O_BINARY
+#define O_BINARY  0
+#endif
+
+static const char*
+skin_cache_dir( void )
+{
+    static char  dir[PATH_MAX];
+    static int   state;   /* 0: not initialized, 1: ok, -1: disabled */
+
+    if (state == 0) {
+        char*  end = dir + sizeof(dir);
+        char*  p   = bufprint_config_file( dir, end, "skin-cache" );
+
+        state = 1;
+        if (p >= end || path_mkdir_if_needed( dir, 0755 ) < 0) {
+            D( "skin_cache: disabled, can't create '%s'\n", dir );
+            state = -1;
         }
-    } else {
-        data = loadpng(path, &w, &h);
-        if (data == NULL) {
-            fprintf(stderr, "failed to load image file '%s'\n", path );
+    }
+    return (state > 0) ? dir : NULL;
+}
+
+
+static int
+skin_cache_path( char*  buff, char*  end, SkinImage*  image )
+{
+    const char*  dir = skin_cache_dir();
+    char*        p;
+
+    if (dir == NULL)
+        return -1;
+
+    p = bufprint( buff, end, "%s" PATH_SEP "%08x%08x-r%d-b%d", dir,
+                  (unsigned)(image->key >> 32), (unsigned)image->key,
+                  image->desc.rotation, image->desc.blend );
+
+    return (p < end) ? 0 : -1;
+}
+
+
+/* try to map the pixels of 'image' from the disk cache */
+static int
+skin_cache_load( SkinImage*  image )
+{
+    char             path[PATH_MAX];
+    SkinCacheHeader  header;
+    struct stat      st;
+    size_t           size = sizeof(header) + (size_t)image->w*image->h*4;
+    void*            base;
+    int              fd;
+
+    if (skin_cache_path( path, path + sizeof(path), image ) < 0)
+        return -1;
+
+    fd = open( path, O_RDONLY | O_BINARY );
+    if (fd < 0)
+        return -1;
+
+    if (read( fd, &header, sizeof(header) ) != sizeof(header) ||
+        memcmp( header.magic, SKIN_CACHE_MAGIC, 8 ) != 0      ||
+        header.byte_order != SKIN_CACHE_BYTE_ORDER             ||
+        header.width      != image->w                          ||
+        header.height     != image->h                          ||
+        header.rotation   != (uint32_t)image->desc.rotation    ||
+        header.blend      != (uint32_t)image->desc.blend       ||
+        header.key        != image->key                        ||
+        fstat( fd, &st ) < 0 || (size_t)st.st_size != size)
+    {
+        D( "skin_cache: ignoring invalid file '%s'\n", path );
+        close(fd);
+        return -1;
+    }
+
+#ifdef _WIN32
+    base = malloc( size );
+    if (base != NULL) {
+        int  len = size - sizeof(header);
+
+        memcpy( base, &header, sizeof(header) );
+        if (read( fd, (char*)base + sizeof(header), len ) != len) {
+            free(base);
+            base = NULL;
+        }
+    }
+#else
+    /* private and writable, since skin_image_blend_clone() modifies
+     * the pixels of clones in place */
+    base = mmap( NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0 );
+    if (base == MAP_FAILED)
+        base = NULL;
+#endif
+    close(fd);
+
+    if (base == NULL)
+        return -1;
+
+    image->map_base = base;
+    image->map_size = size;
+    image->pixels   = (char*)base + sizeof(header);
+    image->flags   |= SKIN_IMAGE_MAPPED;
+
+    D( "skin_cache: mapped '%s' (rot=%d, blend=%d) from '%s'\n",
+       image->desc.path, image->desc.rotation, image->desc.blend, path );
+    return 0;
+}
+
+
+static int
+skin_cache_write( int  fd, const void*  data, size_t  size )
+{
+    const char*  p = data;
+
+    while (size > 0) {
+        int  ret = write( fd, p, size );
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
             return -1;
         }
+        p    += ret;
+        size -= ret;
+    }
+    return 0;
+}
+
+
+/* save the pixels of 'image' to the disk cache. this writes to a temporary
+ * file first, so that concurrent launches never see a partial file */
+static void
+skin_cache_store( SkinImage*  image )
+{
+    char             path[PATH_MAX];
+    char             temp[PATH_MAX];
+    char*            end = temp + sizeof(temp);
+    SkinCacheHeader  header;
+    int              fd, ret;
+
+    if (skin_cache_path( path, path + sizeof(path), image ) < 0)
+        return;
+
+    if (bufprint( temp, end, "%s.%d", path, getpid() ) >= end)
+        return;
+
+    memset( &header, 0, sizeof(header) );
+    memcpy( header.magic, SKIN_CACHE_MAGIC, 8 );
+    header.byte_order = SKIN_CACHE_BYTE_ORDER;
+    header.width      = image->w;
+    header.height     = image->h;
+    header.rotation   = image->desc.rotation;
+    header.blend      = image->desc.blend;
+    header.key        = image->key;
+
+    fd = open( temp, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644 );
+    if (fd < 0)
+        return;
+
+    ret = skin_cache_write( fd, &header, sizeof(header) );
+    if (ret == 0)
+        ret = skin_cache_write( fd, image->pixels, (size_t)image->w*image->h*4 );
+    if (close(fd) < 0)
+        ret = -1;
+
+    if (ret < 0 || rename( temp, path ) < 0) {
+        D( "skin_cache: could not write '%s': %s\n", path, strerror(errno) );
+        unlink( temp );
+    }
+}
+
+/********************************************************************************/
+/********************************************************************************/
+/*****                                                                      *****/
+/*****            L A Z Y   D E C O D I N G                                 *****/
+/*****                                                                      *****/
+/********************************************************************************/
+/********************************************************************************/
+
+/* decode the PNG file of a rotation 0, full blend image */
+static int
+skin_image_load( SkinImage*  image )
+{
+    void*                 data;
+    void*                 to_free;
+    unsigned              w, h;
+    size_t                size;
+    const unsigned char*  base;
+
+    base = skin_image_load_png( image->desc.path, &size, &to_free );
+    if (base == NULL)
+        return -1;
+
+    image->key = skin_image_hash_png( base, size );
+
+    if (skin_cache_load(image) == 0) {
+        free( to_free );
+        return 0;
+    }
+
+    timeline_begin("png-decode");
+    data = readpng(base, size, &w, &h);
+    timeline_end("png-decode");
+    free( to_free );
+
+    if (data == NULL) {
+        fprintf(stderr, "failed to load image file '%s'\n", image->desc.path );
+        return -1;
+    }
+    if (w != image->w || h != image->h) {
+        fprintf(stderr, "image file '%s' changed while loading\n", image->desc.path );
+        free(data);
+        return -1;
     }
 
    /* the data is loaded into memory as RGBA bytes by libpng. we want to manage
@@ -327,15 +688,96 @@ skin_image_load( SkinImage*  image )
     }
 
     image->pixels = data;
-    image->w      = w;
-    image->h      = h;
+    skin_cache_store(image);
+    return 0;
+}
+
+
+/* compute the pixels of a rotated or blended image from its parent */
+static int  skin_image_decode( SkinImage*  image );
+
+static int
+skin_image_derive( SkinImage*  image )
+{
+    SkinImageDesc  desc0 = image->desc;
+    SkinImage*     parent;
+    int            ret = -1;
+
+    desc0.rotation = SKIN_ROTATION_0;
+    desc0.blend    = SKIN_BLEND_FULL;
 
-    image->surface = sdl_surface_from_argb32( image->pixels, w, h );
-    if (image->surface == NULL) {
-        fprintf(stderr, "failed to create SDL surface for '%s' image\n", path);
+    parent = skin_image_find( &desc0 );
+    if (parent == SKIN_IMAGE_NONE)
         return -1;
+
+    if (skin_image_get_key(parent) < 0)
+        goto Exit;
+
+    image->key = parent->key;
+    if (skin_cache_load(image) == 0) {
+        ret = 0;
+        goto Exit;
     }
-    return 0;
+
+    if (skin_image_decode(parent) < 0)
+        goto Exit;
+
+    SDL_LockSurface(parent->surface);
+    image->pixels = rotate_image( parent->pixels, parent->w, parent->h,
+                                  image->desc.rotation );
+    SDL_UnlockSurface(parent->surface);
+
+    if (image->pixels == NULL)
+        goto Exit;
+
+    if (image->desc.blend != SKIN_BLEND_FULL)
+        blend_image( image->pixels, image->pixels, image->w, image->h, image->desc.blend );
+
+    skin_cache_store(image);
+    ret = 0;
+
+Exit:
+    skin_image_unref(&parent);
+    return ret;
+}
+
+
+/* make sure the pixels and surface of 'image' are available. failures are
+ * only reported once, the image is then drawn as empty */
+static int
+skin_image_decode( SkinImage*  image )
+{
+    int  ret;
+
+    if (image == _no_image)
+        return -1;
+
+    if (image->surface != NULL)
+        return 0;
+
+    if (image->flags & SKIN_IMAGE_ERROR)
+        return -1;
+
+    timeline_begin("skin-decode");
+    if (image->desc.rotation == SKIN_ROTATION_0 &&
+        image->desc.blend    == SKIN_BLEND_FULL)
+        ret = skin_image_load(image);
+    else
+        ret = skin_image_derive(image);
+
+    if (ret == 0) {
+        image->surface = sdl_surface_from_argb32( image->pixels, image->w, image->h );
+        if (image->surface == NULL) {
+            fprintf(stderr, "failed to create SDL surface for '%s' image\n", image->desc.path);
+            ret = -1;
+        }
+    }
+    timeline_end("skin-decode");
+
+    if (ret < 0)
+        image->flags |= SKIN_IMAGE_ERROR;
+
+    return ret;
 }
 
 
@@ -434,6 +876,7 @@ skin_image_cache_flush( SkinImageCache*  cache )
 
         if (image->ref_count == 0) {
             skin_image_cache_remove(cache, image);
+            skin_image_free(image);
             count += 1;
         }
         image = prev;
@@ -475,7 +918,7 @@ skin_image_create( SkinImageDesc*  desc, unsigned  hash )
     if (desc->rotation == SKIN_ROTATION_0 &&
         desc->blend    == SKIN_BLEND_FULL)
     {
-        if (skin_image_load(node) < 0) {
+        if (skin_image_read_size(node) < 0) {
             skin_image_free(node);
             return SKIN_IMAGE_NONE;
         }
@@ -489,10 +932,10 @@ skin_image_create( SkinImageDesc*  desc, unsigned  hash )
         desc0.blend    = SKIN_BLEND_FULL;
 
         parent = skin_image_find( &desc0 );
-        if (parent == SKIN_IMAGE_NONE)
+        if (parent == SKIN_IMAGE_NONE) {
+            skin_image_free(node);
             return SKIN_IMAGE_NONE;
-
-        SDL_LockSurface(parent->surface);
+        }
 
         if (desc->rotation == SKIN_ROTATION_90 ||
             desc->rotation == SKIN_ROTATION_270)
@@ -503,26 +946,7 @@ skin_image_create( SkinImageDesc*  desc, unsigned  hash )
             node->w = parent->w;
             node->h = parent->h;
         }
-
-        node->pixels = rotate_image( parent->pixels, parent->w, parent->h,
-                                    desc->rotation );
-
-        SDL_UnlockSurface(parent->surface);
         skin_image_unref(&parent);
-
-        if (node->pixels  == NULL) {
-            skin_image_free(node);
-            return SKIN_IMAGE_NONE;
-        }
-
-        if (desc->blend != SKIN_BLEND_FULL)
-            blend_image( node->pixels, node->pixels, node->w, node->h, desc->blend );
-
-        node->surface = sdl_surface_from_argb32( node->pixels, node->w, node->h );
-        if (node->surface == NULL) {
-            skin_image_free(node);
-            return SKIN_IMAGE_NONE;
-        }
     }
     return node;
 }
@@ -631,7 +1055,7 @@ skin_image_clone( SkinImage*  source )
 {
     SkinImage*   image;
 
-    if (source == NULL || source == _no_image)
+    if (source == NULL || skin_image_decode(source) < 0)
         return SKIN_IMAGE_NONE;
 
     image = calloc(1,sizeof(*image));
@@ -691,6 +1115,9 @@ skin_image_clone_full( SkinImage*    source,
 extern void
 skin_image_blend_clone( SkinImage*  clone, SkinImage*  source, int  blend )
 {
+    if (skin_image_decode(clone) < 0 || skin_image_decode(source) < 0)
+        return;
+
     SDL_LockSurface( clone->surface );
     blend_image( clone->pixels, source->pixels, source->w, source->h, blend );
     SDL_UnlockSurface( clone->surface );
@@ -735,8 +1162,17 @@ skin_image_org_h( SkinImage*  image )
     return 0;
 }
 
+int
+skin_image_prepare( SkinImage*  image )
+{
+    if (image == NULL)
+        return -1;
+
+    return skin_image_decode(image);
+}
+
 SDL_Surface*
 skin_image_surface( SkinImage*  image )
 {
-    return image ? image->surface : NULL;
+    return  image ? image->surface : NULL;
 }
@@ -42,7 +42,15 @@ typedef struct SkinImageDesc {
 /* a special value returned when an image cannot be properly loaded */
 extern SkinImage*    SKIN_IMAGE_NONE;
 
-/* return the SDL_Surface* pointer of a given skin image */
+/* decode the pixels of a skin image and create its SDL surface, if this
+ * wasn't done yet. this must be called from the main thread, before the
+ * image is drawn. returns 0 on success, or -1 if the image can't be loaded
+ */
+extern int           skin_image_prepare( SkinImage*  image );
+
+/* return the SDL_Surface* pointer of a given skin image, or NULL if it
+ * wasn't prepared. this has no side effect and can be called from the
+ * render thread */
 extern SDL_Surface*  skin_image_surface( SkinImage*  image );
 extern int           skin_image_w      ( SkinImage*  image );
 extern int           skin_image_h      ( SkinImage*  image );
@@ -87,10 +87,12 @@ skin_scaler_scale( SkinScaler*   scaler,
                    int           sx,
                    int           sy,
                    int           sw,
-                   int           sh )
+                   int           sh,
+                   SDL_Rect*     drect )
 {
     ScaleOp   op;
 
+    drect->w = drect->h = 0;
     if ( !scaler->valid )
         return;
 
@@ -131,5 +133,5 @@ skin_scaler_scale( SkinScaler*   scaler,
     SDL_UnlockSurface( dst_surface );
     SDL_UnlockSurface( src_surface );
 
-    SDL_UpdateRects( dst_surface, 1, &op.rd );
+    *drect = op.rd;
 }
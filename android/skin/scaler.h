@@ -28,12 +28,15 @@ extern int          skin_scaler_set( SkinScaler*  scaler,
 
 extern void         skin_scaler_free( SkinScaler*  scaler );
 
+/* scale the (sx,sy,sw,sh) area of 'src' into 'dst'. the screen is not
+ * updated, the modified area of 'dst' is returned in 'drect' instead */
 extern void         skin_scaler_scale( SkinScaler*   scaler,
                                        SDL_Surface*  dst,
                                        SDL_Surface*  src,
                                        int           sx,
                                        int           sy,
                                        int           sw,
-                                       int           sh );
+                                       int           sh,
+                                       SDL_Rect*     drect );
 
 #endif /* _ANDROID_SKIN_SCALER_H */
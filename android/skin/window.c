@@ -16,8 +16,14 @@
 #include "android/utils/debug.h"
 #include "android/hw-sensors.h"
 #include <SDL_syswm.h>
+#include <SDL_thread.h>
 #include "qemu-common.h"
 #include <math.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/time.h>
+#endif
 
 #include "framebuffer.h"
 
@@ -47,6 +53,7 @@ background_init( Background*  back, SkinBackground*  sback, SkinLocation*  loc,
     SkinRect  r;
 
     back->image = skin_image_rotate( sback->image, loc->rotation );
+    skin_image_prepare( back->image );
     skin_rect_rotate( &r, &sback->rect, loc->rotation );
     r.pos.x += loc->anchor.x;
     r.pos.y += loc->anchor.y;
@@ -166,6 +173,7 @@ display_set_onion( ADisplay*  disp, SkinImage*  onion, SkinRotation  rotation, i
 
     skin_image_unref( &disp->onion );
     disp->onion = skin_image_clone_full( onion, rotation, blend );
+    skin_image_prepare( disp->onion );
 
     onion_w = skin_image_w(disp->onion);
     onion_h = skin_image_h(disp->onion);
@@ -366,8 +374,12 @@ lcd_off_argb32( unsigned char*  pixels, SkinRect*  r, int  pitch )
 }
 
 
-static void
-display_redraw( ADisplay*  disp, SkinRect*  rect, SDL_Surface*  surface )
+/* convert the framebuffer pixels in 'data' to 'surface', without updating
+ * the screen. returns 1 and the modified area in 'out' if the display
+ * intersects 'rect' */
+static int
+display_render( ADisplay*  disp, SkinRect*  rect, SDL_Surface*  surface,
+                const void*  data, SkinRect*  out )
 {
     SkinRect  r;
 
@@ -382,7 +394,7 @@ display_redraw( ADisplay*  disp, SkinRect*  rect, SDL_Surface*  surface )
         int           dst_pitch = surface->pitch;
         uint8_t*      dst_line  = (uint8_t*)surface->pixels + r.pos.x*4 + r.pos.y*dst_pitch;
         int           src_pitch = disp->datasize.w*2;
-        uint8_t*      src_line  = (uint8_t*)disp->data;
+        uint8_t*      src_line  = (uint8_t*)data;
         int           yy, xx;
 #if 0
         fprintf(stderr, "--- display redraw r.pos(%d,%d) r.size(%d,%d) "
@@ -501,8 +513,19 @@ display_redraw( ADisplay*  disp, SkinRect*  rect, SDL_Surface*  surface )
             }
         }
 
-        SDL_UpdateRect( surface, r.pos.x, r.pos.y, w, h );
+        *out = r;
+        return 1;
     }
+    return 0;
+}
+
+static void
+display_redraw( ADisplay*  disp, SkinRect*  rect, SDL_Surface*  surface )
+{
+    SkinRect  r;
+
+    if (display_render( disp, rect, surface, disp->data, &r ))
+        SDL_UpdateRect( surface, r.pos.x, r.pos.y, r.size.w, r.size.h );
 }
 
 
@@ -804,6 +827,25 @@ Fail:
     return -1;
 }
 
+/* When enabled, framebuffer updates are converted and scaled by a separate
+ * thread. The main thread only copies the changed pixels to 'shadow', and
+ * later presents what the thread rendered, because SDL can only talk to
+ * the window system from the main thread.
+ */
+typedef struct SkinRenderer {
+    SDL_Thread*      thread;
+    SDL_mutex*       lock;     /* protects the fields below */
+    SDL_cond*        cond;
+    int              quit;
+    uint8_t*         shadow;   /* framebuffer copy, updated by the main thread */
+    int              width;
+    int              height;
+    int              pitch;
+    SkinBox          damage;   /* framebuffer area changed since the last frame */
+    int              depth;    /* number of updates merged in 'damage' */
+    SkinWindowStats  stats;
+} SkinRenderer;
+
 struct SkinWindow {
     SDL_Surface*  surface;
     Layout        layout;
@@ -836,8 +878,28 @@ struct SkinWindow {
     double        effective_scale;
     double        effective_x;
     double        effective_y;
+
+    /* protects the layout and the surfaces when 'renderer' is used */
+    SDL_mutex*     lock;
+    SkinRenderer*  renderer;
+    SkinBox        present;   /* rendered by the thread, not presented yet */
 };
 
+static void
+skin_window_lock( SkinWindow*  window )
+{
+    /* SDL mutexes are recursive */
+    if (window->lock)
+        SDL_mutexP( window->lock );
+}
+
+static void
+skin_window_unlock( SkinWindow*  window )
+{
+    if (window->lock)
+        SDL_mutexV( window->lock );
+}
+
 static void
 add_finger_event(unsigned x, unsigned y, unsigned state)
 {
@@ -965,6 +1027,7 @@ skin_window_move_mouse( SkinWindow*  window,
         }
 
         if (hover != NULL) {
+            skin_image_prepare( hover->image );
             hover->down = 1;
             skin_window_redraw( window, &hover->rect );
             button->hover = hover;
@@ -994,7 +1057,9 @@ skin_window_set_trackball( SkinWindow*  window, SkinTrackBall*  ball )
 {
     BallState*  state = &window->ball;
 
+    skin_window_lock( window );
     ball_state_set( state, ball );
+    skin_window_unlock( window );
 }
 
 void
@@ -1003,7 +1068,9 @@ skin_window_show_trackball( SkinWindow*  window, int  enable )
     BallState*  state = &window->ball;
 
     if (state->ball != NULL && window->enable_trackball) {
+        skin_window_lock( window );
         ball_state_show(state, enable);
+        skin_window_unlock( window );
     }
 }
 
@@ -1077,6 +1144,8 @@ skin_window_set_title( SkinWindow*  window, const char*  title )
 static void
 skin_window_resize( SkinWindow*  window )
 {
+    skin_box_minmax_init( &window->present );
+
     /* now resize window */
     if (window->surface) {
         SDL_FreeSurface(window->surface);
@@ -1224,10 +1293,15 @@ skin_window_reset_internal ( SkinWindow*  window, SkinLayout*  slayout )
 int
 skin_window_reset ( SkinWindow*  window, SkinLayout*  slayout )
 {
+    int  ret;
+
     if (!window->fullscreen) {
         SDL_WM_GetPos(&window->x_pos, &window->y_pos);
     }
-    return skin_window_reset_internal( window, slayout );
+    skin_window_lock( window );
+    ret = skin_window_reset_internal( window, slayout );
+    skin_window_unlock( window );
+    return ret;
 }
 
 void
@@ -1236,15 +1310,20 @@ skin_window_set_lcd_brightness( SkinWindow*  window, int  brightness )
     ADisplay*  disp = window->layout.displays;
 
     if (disp != NULL) {
+        skin_window_lock( window );
         disp->brightness = brightness;
         skin_window_redraw( window, NULL );
+        skin_window_unlock( window );
     }
 }
 
+static void  skin_renderer_stop( SkinWindow*  window );
+
 void
 skin_window_free  ( SkinWindow*  window )
 {
     if (window) {
+        skin_renderer_stop( window );
         if (window->surface) {
             SDL_FreeSurface(window->surface);
             window->surface = NULL;
@@ -1266,6 +1345,8 @@ skin_window_free  ( SkinWindow*  window )
             window->scaler = NULL;
         }
         layout_done( &window->layout );
+        if (window->lock)
+            SDL_DestroyMutex( window->lock );
         qemu_free(window);
     }
 }
@@ -1279,6 +1360,8 @@ skin_window_set_onion( SkinWindow*   window,
     ADisplay*  disp;
     SkinImage*  old = window->onion;
 
+    skin_window_lock( window );
+
     window->onion          = skin_image_ref(onion);
     window->onion_rotation = onion_rotation;
     window->onion_alpha    = onion_alpha;
@@ -1289,84 +1372,110 @@ skin_window_set_onion( SkinWindow*   window,
 
     if (disp != NULL)
         display_set_onion( disp, window->onion, onion_rotation, onion_alpha );
-}
 
-static void
-skin_window_update_shrink( SkinWindow*  window, SkinRect*  rect )
-{
-    skin_scaler_scale( window->scaler, window->shrink_surface, window->surface,
-                       rect->pos.x, rect->pos.y, rect->size.w, rect->size.h );
+    skin_window_unlock( window );
 }
 
 void
 skin_window_set_scale( SkinWindow*  window, double  scale )
 {
+    skin_window_lock( window );
+
     window->shrink       = (scale != 1.0);
     window->shrink_scale = scale;
 
     skin_window_resize( window );
     skin_window_redraw( window, NULL );
+
+    skin_window_unlock( window );
 }
 
-void
-skin_window_redraw( SkinWindow*  window, SkinRect*  rect )
+/* the surface that is shown on screen */
+static SDL_Surface*
+skin_window_screen( SkinWindow*  window )
 {
-    if (window != NULL && window->surface != NULL) {
-        Layout*  layout = &window->layout;
+    if (window->effective_scale != 1.0)
+        return window->shrink_surface;
+    return window->surface;
+}
 
-        if (rect == NULL)
-            rect = &layout->rect;
+/* compose the 'rect' area of the window, and scale it if needed, without
+ * updating the screen. if 'fb' is not NULL, it replaces the framebuffer
+ * pixels of the displays. the area of the screen to update is returned
+ * in 'out' */
+static void
+skin_window_render( SkinWindow*  window, SkinRect*  rect, const void*  fb, SkinRect*  out )
+{
+    Layout*  layout = &window->layout;
 
-        {
-            SkinRect  r;
+    {
+        SkinRect  r;
 
-            if ( skin_rect_intersect( &r, rect, &layout->rect ) ) {
-                SDL_Rect  rd;
-                rd.x = r.pos.x;
-                rd.y = r.pos.y;
-                rd.w = r.size.w;
-                rd.h = r.size.h;
+        if ( skin_rect_intersect( &r, rect, &layout->rect ) ) {
+            SDL_Rect  rd;
+            rd.x = r.pos.x;
+            rd.y = r.pos.y;
+            rd.w = r.size.w;
+            rd.h = r.size.h;
 
-                SDL_FillRect( window->surface, &rd, layout->color );
-            }
+            SDL_FillRect( window->surface, &rd, layout->color );
         }
+    }
 
-        {
-            Background*  back = layout->backgrounds;
-            Background*  end  = back + layout->num_backgrounds;
-            for ( ; back < end; back++ )
-                background_redraw( back, rect, window->surface );
-        }
+    {
+        Background*  back = layout->backgrounds;
+        Background*  end  = back + layout->num_backgrounds;
+        for ( ; back < end; back++ )
+            background_redraw( back, rect, window->surface );
+    }
 
-        {
-            ADisplay*  disp = layout->displays;
-            ADisplay*  end  = disp + layout->num_displays;
-            for ( ; disp < end; disp++ )
-                display_redraw( disp, rect, window->surface );
+    {
+        ADisplay*  disp = layout->displays;
+        ADisplay*  end  = disp + layout->num_displays;
+        for ( ; disp < end; disp++ ) {
+            SkinRect  r;
+            display_render( disp, rect, window->surface,
+                            fb ? fb : disp->data, &r );
         }
+    }
 
-        {
-            Button*  button = layout->buttons;
-            Button*  end    = button + layout->num_buttons;
-            for ( ; button < end; button++ )
-                button_redraw( button, rect, window->surface );
-        }
+    {
+        Button*  button = layout->buttons;
+        Button*  end    = button + layout->num_buttons;
+        for ( ; button < end; button++ )
+            button_redraw( button, rect, window->surface );
+    }
 
-        if ( window->ball.tracking )
-            ball_state_redraw( &window->ball, rect, window->surface );
+    if ( window->ball.tracking )
+        ball_state_redraw( &window->ball, rect, window->surface );
 
-        if (window->effective_scale != 1.0)
-            skin_window_update_shrink( window, rect );
-        else
-        {
-            SDL_Rect  rd;
-            rd.x = rect->pos.x;
-            rd.y = rect->pos.y;
-            rd.w = rect->size.w;
-            rd.h = rect->size.h;
+    if (window->effective_scale != 1.0)
+    {
+        SDL_Rect  rd;
+        skin_scaler_scale( window->scaler, window->shrink_surface, window->surface,
+                           rect->pos.x, rect->pos.y, rect->size.w, rect->size.h,
+                           &rd );
+        skin_rect_init( out, rd.x, rd.y, rd.w, rd.h );
+    }
+    else
+        *out = *rect;
+}
 
-            SDL_UpdateRects( window->surface, 1, &rd );
-        }
+void
+skin_window_redraw( SkinWindow*  window, SkinRect*  rect )
+{
+    if (window != NULL && window->surface != NULL) {
+        SkinRect  r;
+
+        skin_window_lock( window );
+        if (rect == NULL)
+            rect = &window->layout.rect;
+
+        skin_window_render( window, rect, NULL, &r );
+        if (r.size.w > 0 && r.size.h > 0)
+            SDL_UpdateRect( skin_window_screen(window),
+                            r.pos.x, r.pos.y, r.size.w, r.size.h );
+        skin_window_unlock( window );
     }
 }
 
@@ -1377,9 +1486,11 @@ skin_window_toggle_fullscreen( SkinWindow*  window )
         if (!window->fullscreen)
             SDL_WM_GetPos( &window->x_pos, &window->y_pos );
 
+        skin_window_lock( window );
         window->fullscreen = !window->fullscreen;
         skin_window_resize( window );
         skin_window_redraw( window, NULL );
+        skin_window_unlock( window );
     }
 }
 
@@ -1418,6 +1529,8 @@ skin_window_process_event( SkinWindow*  window, SDL_Event*  ev )
     if (!window->surface)
         return;
 
+    skin_window_lock( window );
+
     switch (ev->type) {
     case SDL_MOUSEBUTTONDOWN:
         if ( window->ball.tracking ) {
@@ -1442,6 +1555,7 @@ skin_window_process_event( SkinWindow*  window, SDL_Event*  ev )
             window->button.pressed = NULL;
             button = window->button.hover;
             if(button) {
+                skin_image_prepare( button->image );
                 button->down += 1;
                 skin_window_redraw( window, &button->rect );
                 window->button.pressed = button;
@@ -1497,6 +1611,8 @@ skin_window_process_event( SkinWindow*  window, SDL_Event*  ev )
         }
         break;
     }
+
+    skin_window_unlock( window );
 }
 
 static ADisplay*
@@ -1505,6 +1621,63 @@ skin_window_display( SkinWindow*  window )
     return window->layout.displays;
 }
 
+/* convert an area of the framebuffer to window coordinates */
+static void
+display_map_rect( ADisplay*  disp, SkinRect*  r, int  x, int  y, int  w, int  h )
+{
+    r->pos.x  = x;
+    r->pos.y  = y;
+    r->size.w = w;
+    r->size.h = h;
+
+    skin_rect_rotate( r, r, disp->rotation );
+    r->pos.x += disp->origin.x;
+    r->pos.y += disp->origin.y;
+}
+
+/* copy the rows [y, y+h[ of the framebuffer to the shadow buffer of the
+ * render thread, and wake it up */
+static void
+skin_renderer_publish( SkinRenderer*  rend, ADisplay*  disp, int  y, int  h )
+{
+    int       pitch  = disp->datasize.w*2;
+    int       height = disp->datasize.h;
+    SkinRect  r;
+
+    SDL_mutexP( rend->lock );
+
+    if (rend->pitch != pitch || rend->height != height) {
+        /* first update, or the framebuffer changed: copy everything */
+        qemu_free( rend->shadow );
+        rend->shadow = qemu_malloc( pitch*height );
+        rend->width  = disp->datasize.w;
+        rend->height = height;
+        rend->pitch  = pitch;
+        y = 0;
+        h = height;
+    }
+    if (y < 0) {
+        h += y;
+        y  = 0;
+    }
+    if (y + h > height)
+        h = height - y;
+
+    if (h > 0) {
+        memcpy( rend->shadow + y*pitch, (uint8_t*)disp->data + y*pitch, h*pitch );
+
+        skin_rect_init( &r, 0, y, rend->width, h );
+        skin_box_minmax_update( &rend->damage, &r );
+        rend->depth += 1;
+        if (rend->depth > rend->stats.max_depth)
+            rend->stats.max_depth = rend->depth;
+        rend->stats.updates += 1;
+        SDL_CondSignal( rend->cond );
+    }
+
+    SDL_mutexV( rend->lock );
+}
+
 void
 skin_window_update_display( SkinWindow*  window, int  x, int  y, int  w, int  h )
 {
@@ -1515,14 +1688,13 @@ skin_window_update_display( SkinWindow*  window, int  x, int  y, int  w, int  h
 
     if (disp != NULL) {
         SkinRect  r;
-        r.pos.x  = x;
-        r.pos.y  = y;
-        r.size.w = w;
-        r.size.h = h;
 
-        skin_rect_rotate( &r, &r, disp->rotation );
-        r.pos.x += disp->origin.x;
-        r.pos.y += disp->origin.y;
+        if (window->renderer != NULL) {
+            skin_renderer_publish( window->renderer, disp, y, h );
+            return;
+        }
+
+        display_map_rect( disp, &r, x, y, w, h );
 
         if (window->effective_scale != 1.0)
             skin_window_redraw( window, &r );
@@ -1530,3 +1702,187 @@ skin_window_update_display( SkinWindow*  window, int  x, int  y, int  w, int  h
             display_redraw( disp, &r, window->surface );
     }
 }
+
+static uint64_t
+skin_renderer_now_us( void )
+{
+#ifdef _WIN32
+    LARGE_INTEGER  now, freq;
+
+    QueryPerformanceCounter( &now );
+    QueryPerformanceFrequency( &freq );
+    return (uint64_t)now.QuadPart * 1000000 / freq.QuadPart;
+#else
+    struct timeval  tv;
+
+    gettimeofday( &tv, NULL );
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+static int
+skin_renderer_thread( void*  opaque )
+{
+    SkinWindow*    window = opaque;
+    SkinRenderer*  rend   = window->renderer;
+    uint8_t*       pixels = NULL;
+    int            size   = 0;
+
+    for (;;) {
+        SkinRect   damage, r, out;
+        ADisplay*  disp;
+        uint64_t   start, elapsed;
+        int        width;
+
+        /* wait for an update, and take a private copy of the damaged rows
+         * so that the main thread never waits for the conversion */
+        SDL_mutexP( rend->lock );
+        while (!rend->quit && rend->depth == 0)
+            SDL_CondWait( rend->cond, rend->lock );
+
+        if (rend->quit) {
+            SDL_mutexV( rend->lock );
+            break;
+        }
+        if (size != rend->pitch*rend->height) {
+            size   = rend->pitch*rend->height;
+            pixels = qemu_realloc( pixels, size );
+            skin_rect_init( &damage, 0, 0, rend->width, rend->height );
+        } else {
+            skin_box_minmax_to_rect( &rend->damage, &damage );
+        }
+        memcpy( pixels + damage.pos.y*rend->pitch,
+                rend->shadow + damage.pos.y*rend->pitch,
+                damage.size.h*rend->pitch );
+        width = rend->width;
+        skin_box_minmax_init( &rend->damage );
+        rend->depth = 0;
+        SDL_mutexV( rend->lock );
+
+        start = skin_renderer_now_us();
+
+        skin_window_lock( window );
+        disp = skin_window_display(window);
+        if (window->surface != NULL && disp != NULL && disp->datasize.w == width)
+        {
+            display_map_rect( disp, &r, 0, damage.pos.y, width, damage.size.h );
+
+            if (window->effective_scale != 1.0)
+                skin_window_render( window, &r, pixels, &out );
+            else if (!display_render( disp, &r, window->surface, pixels, &out ))
+                out.size.w = out.size.h = 0;
+
+            if (out.size.w > 0 && out.size.h > 0)
+                skin_box_minmax_update( &window->present, &out );
+        }
+        skin_window_unlock( window );
+
+        elapsed = skin_renderer_now_us() - start;
+
+        SDL_mutexP( rend->lock );
+        rend->stats.frames   += 1;
+        rend->stats.total_us += elapsed;
+        if (elapsed > rend->stats.max_us)
+            rend->stats.max_us = elapsed;
+        SDL_mutexV( rend->lock );
+    }
+
+    qemu_free( pixels );
+    return 0;
+}
+
+static void
+skin_renderer_stop( SkinWindow*  window )
+{
+    SkinRenderer*  rend = window->renderer;
+
+    if (rend == NULL)
+        return;
+
+    SDL_mutexP( rend->lock );
+    rend->quit = 1;
+    SDL_CondSignal( rend->cond );
+    SDL_mutexV( rend->lock );
+
+    SDL_WaitThread( rend->thread, NULL );
+
+    skin_window_lock( window );
+    window->renderer = NULL;
+    skin_window_unlock( window );
+
+    SDL_DestroyCond( rend->cond );
+    SDL_DestroyMutex( rend->lock );
+    qemu_free( rend->shadow );
+    qemu_free( rend );
+}
+
+void
+skin_window_enable_render_thread( SkinWindow*  window, int  enabled )
+{
+    SkinRenderer*  rend;
+
+    if (!enabled) {
+        skin_renderer_stop( window );
+        return;
+    }
+    if (window->renderer != NULL)
+        return;
+
+    if (window->lock == NULL)
+        window->lock = SDL_CreateMutex();
+
+    rend = qemu_mallocz(sizeof(*rend));
+    rend->lock = SDL_CreateMutex();
+    rend->cond = SDL_CreateCond();
+    rend->stats.threaded = 1;
+    skin_box_minmax_init( &rend->damage );
+
+    skin_window_lock( window );
+    skin_box_minmax_init( &window->present );
+    window->renderer = rend;
+    skin_window_unlock( window );
+
+    rend->thread = SDL_CreateThread( skin_renderer_thread, window );
+    if (rend->thread == NULL) {
+        fprintf(stderr, "could not start the render thread: %s\n", SDL_GetError());
+        skin_window_lock( window );
+        window->renderer = NULL;
+        skin_window_unlock( window );
+        SDL_DestroyCond( rend->cond );
+        SDL_DestroyMutex( rend->lock );
+        qemu_free( rend );
+    }
+}
+
+void
+skin_window_present( SkinWindow*  window )
+{
+    SkinRect  r;
+
+    if (window->renderer == NULL)
+        return;
+
+    skin_window_lock( window );
+    if (window->surface != NULL &&
+        skin_box_minmax_to_rect( &window->present, &r ) &&
+        r.size.w > 0 && r.size.h > 0)
+        SDL_UpdateRect( skin_window_screen(window),
+                        r.pos.x, r.pos.y, r.size.w, r.size.h );
+    skin_box_minmax_init( &window->present );
+    skin_window_unlock( window );
+}
+
+void
+skin_window_get_stats( SkinWindow*  window, SkinWindowStats*  stats )
+{
+    SkinRenderer*  rend = window->renderer;
+
+    if (rend == NULL) {
+        memset( stats, 0, sizeof(*stats) );
+        return;
+    }
+    SDL_mutexP( rend->lock );
+    *stats = rend->stats;
+    stats->pending = rend->depth;
+    SDL_mutexV( rend->lock );
+}
@@ -15,6 +15,7 @@
 #include "android/skin/file.h"
 #include "android/skin/trackball.h"
 #include <SDL.h>
+#include <stdint.h>
 
 typedef struct SkinWindow  SkinWindow;
 
@@ -62,4 +63,22 @@ typedef struct {
 extern void             skin_window_get_display( SkinWindow*  window, ADisplayInfo  *info );
 extern void             skin_window_update_display( SkinWindow*  window, int  x, int  y, int  w, int  h );
 
+/* convert and scale the framebuffer updates in a separate thread. the
+ * result is only shown by skin_window_present(), which must be called
+ * periodically from the main thread */
+extern void             skin_window_enable_render_thread( SkinWindow*  window, int  enabled );
+extern void             skin_window_present( SkinWindow*  window );
+
+typedef struct {
+    int       threaded;    /* 1 if the render thread is used */
+    int       updates;     /* framebuffer updates received */
+    int       frames;      /* frames rendered, updates are merged */
+    int       max_depth;   /* max number of updates merged in a frame */
+    int       pending;     /* updates waiting for the render thread */
+    uint64_t  total_us;    /* time spent rendering */
+    uint64_t  max_us;      /* longest frame */
+} SkinWindowStats;
+
+extern void             skin_window_get_stats( SkinWindow*  window, SkinWindowStats*  stats );
+
 #endif /* _SKIN_WINDOW_H */
@@ -0,0 +1,171 @@
+/* Copyright (C) 2009 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+#include "android/utils/timeline.h"
+#include "android/utils/debug.h"
+#include "android/utils/system.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#ifdef _WIN32
+#  define WIN32_LEAN_AND_MEAN
+#  include <windows.h>
+#else
+#  include <sys/time.h>
+#  include <time.h>
+#endif
+
+#define  D(...)  VERBOSE_PRINT(init,__VA_ARGS__)
+
+/* enough for the startup, later events are dropped */
+#define  TIMELINE_MAX_EVENTS  1024
+
+typedef struct {
+    const char*  name;
+    char         phase;   /* 'B', 'E' or 'i' as in the trace format */
+    uint64_t     time;
+} TimelineEvent;
+
+static TimelineEvent  _events[TIMELINE_MAX_EVENTS];
+static int            _nb_events;
+static int            _dropped;
+static int            _started;
+static uint64_t       _start;
+static char*          _output;
+
+static uint64_t
+_timeline_clock( void )
+{
+#ifdef _WIN32
+    static LARGE_INTEGER  freq;
+    LARGE_INTEGER         now;
+
+    if (freq.QuadPart == 0)
+        QueryPerformanceFrequency( &freq );
+    QueryPerformanceCounter( &now );
+    return (uint64_t)((double)now.QuadPart * 1e9 / freq.QuadPart);
+#else
+#  ifdef __linux__
+    struct timespec  ts;
+
+    if (clock_gettime( CLOCK_MONOTONIC, &ts ) == 0)
+        return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#  endif
+    {
+        struct timeval  tv;
+
+        gettimeofday( &tv, NULL );
+        return (uint64_t)tv.tv_sec * 1000000000 + (uint64_t)tv.tv_usec * 1000;
+    }
+#endif
+}
+
+uint64_t
+timeline_now( void )
+{
+    uint64_t  now = _timeline_clock();
+
+    if (!_started) {
+        _started = 1;
+        _start   = now;
+    }
+    return now - _start;
+}
+
+static void
+_timeline_add( const char*  name, char  phase )
+{
+    TimelineEvent*  ev;
+    uint64_t        now = timeline_now();
+
+    if (_nb_events == TIMELINE_MAX_EVENTS) {
+        _dropped++;
+        return;
+    }
+    ev = &_events[_nb_events++];
+    ev->name  = name;
+    ev->phase = phase;
+    ev->time  = now;
+}
+
+void
+timeline_begin( const char*  name )
+{
+    _timeline_add( name, 'B' );
+}
+
+void
+timeline_end( const char*  name )
+{
+    _timeline_add( name, 'E' );
+}
+
+void
+timeline_mark( const char*  name )
+{
+    _timeline_add( name, 'i' );
+}
+
+int
+timeline_dump( const char*  path )
+{
+    FILE*  f = fopen( path, "w" );
+    int    nn;
+
+    if (f == NULL) {
+        derror( "could not create timeline file '%s': %s", path, strerror(errno) );
+        return -1;
+    }
+
+    /* timestamps are in microseconds in the trace format */
+    fprintf( f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n" );
+    for (nn = 0; nn < _nb_events; nn++) {
+        TimelineEvent*  ev = &_events[nn];
+
+        fprintf( f, "%s{\"name\":\"%s\",\"cat\":\"startup\",\"ph\":\"%c\","
+                    "\"ts\":%.3f,\"pid\":1,\"tid\":1%s}",
+                 nn > 0 ? ",\n" : "", ev->name, ev->phase,
+                 ev->time / 1000.0,
+                 ev->phase == 'i' ? ",\"s\":\"g\"" : "" );
+    }
+    fprintf( f, "\n]}\n" );
+
+    if (fclose( f ) != 0) {
+        derror( "could not write timeline file '%s': %s", path, strerror(errno) );
+        return -1;
+    }
+    D( "timeline: %d events written to %s (%d dropped)", _nb_events, path, _dropped );
+    return 0;
+}
+
+static void
+_timeline_atexit( void )
+{
+    timeline_flush();
+}
+
+void
+timeline_set_output( const char*  path )
+{
+    if (_output == NULL)
+        atexit( _timeline_atexit );
+    AFREE( _output );
+    _output = ASTRDUP( path );
+}
+
+void
+timeline_flush( void )
+{
+    if (_output != NULL)
+        timeline_dump( _output );
+}
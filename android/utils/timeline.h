@@ -0,0 +1,48 @@
+/* Copyright (C) 2009 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+#ifndef _ANDROID_UTILS_TIMELINE_H
+#define _ANDROID_UTILS_TIMELINE_H
+
+#include <stdint.h>
+
+/** STARTUP TIMELINE
+ **
+ ** records named spans and instant events during the startup of the
+ ** emulator, and writes them in the Chrome trace event format, which
+ ** can be opened in chrome://tracing and similar viewers.
+ **
+ ** recording an event only reads the clock and fills a slot of a static
+ ** array, so the calls are always compiled in. names are not copied and
+ ** must be string literals. events must be recorded from the main thread.
+ **/
+
+/* nanoseconds elapsed since the first timeline event */
+extern uint64_t  timeline_now( void );
+
+/* start and end a span, spans can be nested */
+extern void      timeline_begin( const char*  name );
+extern void      timeline_end( const char*  name );
+
+/* record an instant event */
+extern void      timeline_mark( const char*  name );
+
+/* write the events recorded so far to 'path', returns 0 on success
+ * or -1 on error */
+extern int       timeline_dump( const char*  path );
+
+/* set the file that timeline_flush() and program exit write to */
+extern void      timeline_set_output( const char*  path );
+
+/* write the timeline to the output file, if any */
+extern void      timeline_flush( void );
+
+#endif /* _ANDROID_UTILS_TIMELINE_H */
@@ -1049,7 +1049,9 @@ static struct audio_pcm_ops alsa_pcm_ops = {
     alsa_fini_in,
     alsa_run_in,
     alsa_read,
-    alsa_ctl_in
+    alsa_ctl_in,
+
+    NULL
 };
 
 struct audio_driver alsa_audio_driver = {
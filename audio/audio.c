@@ -190,6 +190,18 @@ static struct {
 
 AudioState glob_audio_state;
 
+/*
+ * When no timer period is configured, the audio timer only runs while a
+ * voice is enabled, and is scheduled for when the buffered output will
+ * have drained to its low watermark, instead of running on each
+ * iteration of the main loop.
+ */
+static int audio_watermark_timer;
+
+#define AUDIO_LOW_WATERMARK(hw)  ((hw)->samples / 4)
+#define AUDIO_MIN_PERIOD_US      1000
+#define AUDIO_MAX_PERIOD_US      10000
+
 volume_t nominal_volume = {
     0,
 #ifdef FLOAT_MIXENG
@@ -1091,6 +1103,15 @@ int audio_pcm_hw_get_live_out (HWVoiceOut *hw)
     return live;
 }
 
+/* samples waiting to be played, in the mixing buffer and in the backend */
+static int audio_pcm_hw_get_buffered_out (HWVoiceOut *hw, int live)
+{
+    if (hw->pcm_ops->buffered_out) {
+        live += hw->pcm_ops->buffered_out (hw);
+    }
+    return live;
+}
+
 /*
  * Soft voice (playback)
  */
@@ -1181,6 +1202,14 @@ static void audio_pcm_print_info (const char *cap, struct audio_pcm_info *info)
 #undef DAC
 #include "audio_template.h"
 
+/* run the audio timer as soon as possible, if it is idle */
+static void audio_wakeup (AudioState *s)
+{
+    if (audio_watermark_timer && s->ts && !qemu_timer_pending (s->ts)) {
+        qemu_mod_timer (s->ts, qemu_get_clock (vm_clock));
+    }
+}
+
 int AUD_write (SWVoiceOut *sw, void *buf, int size)
 {
     int bytes;
@@ -1247,6 +1276,7 @@ void AUD_set_active_out (SWVoiceOut *sw, int on)
                     hw->pcm_ops->ctl_out (hw, VOICE_ENABLE);
                 END_NOSIGALRM
             }
+            audio_wakeup (&glob_audio_state);
         }
         else {
             if (hw->enabled) {
@@ -1291,6 +1321,7 @@ void AUD_set_active_in (SWVoiceIn *sw, int on)
                 END_NOSIGALRM
             }
             sw->total_hw_samples_acquired = hw->total_samples_captured;
+            audio_wakeup (&glob_audio_state);
         }
         else {
             if (hw->enabled) {
@@ -1406,7 +1437,8 @@ static void audio_run_out (AudioState *s)
 
     while ((hw = audio_pcm_hw_find_any_enabled_out (s, hw))) {
         int played;
-        int live, free, nb_live, cleanup_required, prev_rpos;
+        int live, free, nb_live, cleanup_required, prev_rpos, buffered;
+        int drained;
 
         live = audio_pcm_hw_get_live_out2 (hw, &nb_live);
         if (!nb_live) {
@@ -1418,6 +1450,18 @@ static void audio_run_out (AudioState *s)
             continue;
         }
 
+        /* the backend played everything since the last wakeup. this is
+           only an underrun if the voices still have data to give, see
+           below, and not the end of the stream */
+        buffered = audio_pcm_hw_get_buffered_out (hw, live);
+        drained = !buffered && hw->last_buffered;
+        hw->last_buffered = buffered;
+        hw->wakeups++;
+        hw->latency_sum += buffered;
+        if (buffered > hw->latency_max) {
+            hw->latency_max = buffered;
+        }
+
         if (hw->pending_disable && !nb_live) {
             SWVoiceCap *sc;
 #ifdef DEBUG_OUT
@@ -1444,6 +1488,13 @@ static void audio_run_out (AudioState *s)
                     }
                 }
             }
+            live = audio_pcm_hw_get_live_out (hw);
+            if (live) {
+                if (drained) {
+                    hw->underruns++;
+                }
+                hw->last_buffered = live;
+            }
             continue;
         }
 
@@ -1589,6 +1640,66 @@ static void audio_run_capture (AudioState *s)
     }
 }
 
+/* return the delay until the next run of the audio timer in
+ * microseconds, or -1 if no voice is enabled */
+static int64_t audio_next_wakeup (AudioState *s)
+{
+    HWVoiceOut *hwo = NULL;
+    HWVoiceIn *hwi = NULL;
+    int64_t delay = -1;
+
+    while ((hwo = audio_pcm_hw_find_any_enabled_out (s, hwo))) {
+        int buffered = audio_pcm_hw_get_buffered_out (
+            hwo, audio_pcm_hw_get_live_out (hwo));
+        int low = AUDIO_LOW_WATERMARK (hwo);
+        int64_t us = AUDIO_MIN_PERIOD_US;
+
+        if (buffered > low && hwo->info.freq > 0) {
+            us = (int64_t) (buffered - low) * 1000000 / hwo->info.freq;
+        }
+        if (delay < 0 || us < delay) {
+            delay = us;
+        }
+    }
+
+    /* fetch the captured samples before the backend buffer fills up */
+    while ((hwi = audio_pcm_hw_find_any_enabled_in (s, hwi))) {
+        int64_t us = AUDIO_MIN_PERIOD_US;
+
+        if (hwi->info.freq > 0) {
+            us = (int64_t) (hwi->samples / 2) * 1000000 / hwi->info.freq;
+        }
+        if (delay < 0 || us < delay) {
+            delay = us;
+        }
+    }
+
+    if (delay < 0) {
+        return -1;
+    }
+    return audio_MIN (audio_MAX (delay, AUDIO_MIN_PERIOD_US),
+                      AUDIO_MAX_PERIOD_US);
+}
+
+static void audio_reset_timer (AudioState *s)
+{
+    int64_t now = qemu_get_clock (vm_clock);
+
+    if (audio_watermark_timer) {
+        int64_t delay = audio_next_wakeup (s);
+
+        if (delay < 0) {
+            /* idle, audio_wakeup() restarts the timer */
+            qemu_del_timer (s->ts);
+            return;
+        }
+        qemu_mod_timer (s->ts, now + delay * ticks_per_sec / 1000000);
+    }
+    else {
+        qemu_mod_timer (s->ts, now + conf.period.ticks);
+    }
+}
+
 static void audio_timer (void *opaque)
 {
     AudioState* s = opaque;
@@ -1621,11 +1732,17 @@ static void audio_timer (void *opaque)
 	}
 	last = now;
 #endif
+    /* Mixing stays on this thread rather than a dedicated one: the voice
+     * callbacks below run device code (goldfish_audio_callback() reads
+     * guest memory and raises interrupts) that is not thread-safe, and
+     * the drivers that need one (SDL, esd) already play from their own
+     * thread, fed from hw->mix_buf. */
     audio_run_out (s);
     audio_run_in (s);
     audio_run_capture (s);
+    s->wakeups++;
 
-    qemu_mod_timer (s->ts, qemu_get_clock (vm_clock) + conf.period.ticks);
+    audio_reset_timer (s);
 }
 
 static struct audio_option audio_options[] = {
@@ -1745,6 +1862,33 @@ void AUD_help (void)
         );
 }
 
+void AUD_show_stats (FILE *f, int (*fprintf_fn) (FILE *f, const char *fmt, ...))
+{
+    AudioState *s = &glob_audio_state;
+    HWVoiceOut *hw;
+
+    fprintf_fn (f, "timer: %s, %" PRId64 " wakeups\n",
+                audio_watermark_timer ? "watermark" : "fixed period",
+                s->wakeups);
+
+    for (hw = s->hw_head_out.lh_first; hw; hw = hw->entries.le_next) {
+        double avg_ms = 0, max_ms = 0;
+
+        if (hw->wakeups && hw->info.freq) {
+            avg_ms = 1000.0 * hw->latency_sum / hw->wakeups / hw->info.freq;
+            max_ms = 1000.0 * hw->latency_max / hw->info.freq;
+        }
+        fprintf_fn (f, "output: %d Hz, %d channels, %s\n",
+                    hw->info.freq, hw->info.nchannels,
+                    hw->enabled ? "enabled" : "disabled");
+        fprintf_fn (f, "  wakeups %" PRId64 ", underruns %" PRId64 "\n",
+                    hw->wakeups, hw->underruns);
+        fprintf_fn (f, "  buffered %.1f ms average, %.1f ms max "
+                    "(buffer %.1f ms)\n", avg_ms, max_ms,
+                    hw->info.freq ? 1000.0 * hw->samples / hw->info.freq : 0.0);
+    }
+}
+
 static int audio_driver_init (AudioState *s, struct audio_driver *drv, int  out)
 {
     void*   opaque;
@@ -1806,6 +1950,10 @@ static void audio_vm_change_state_handler (void *opaque, int running)
             hwi->pcm_ops->ctl_in (hwi, op);
         }
     END_NOSIGALRM
+
+    if (running) {
+        audio_wakeup (s);
+    }
 }
 
 // to make sure audio_atexit() is only called once
@@ -1990,6 +2138,7 @@ AudioState *AUD_init (void)
                        conf.period.hz);
             }
             conf.period.ticks = 1;
+            audio_watermark_timer = 1;
         }
         else {
             conf.period.ticks = ticks_per_sec / conf.period.hz;
@@ -2010,7 +2159,7 @@ AudioState *AUD_init (void)
 
     LIST_INIT (&s->card_head);
     register_savevm ("audio", 0, 1, audio_save, audio_load, s);
-    qemu_mod_timer (s->ts, qemu_get_clock (vm_clock) + conf.period.ticks);
+    audio_reset_timer (s);
     return s;
 }
 
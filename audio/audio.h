@@ -99,6 +99,7 @@ extern AudioState glob_audio_state;
 
 AudioState *AUD_init (void);
 void AUD_help (void);
+void AUD_show_stats (FILE *f, int (*fprintf_fn) (FILE *f, const char *fmt, ...));
 void AUD_register_card (AudioState *s, const char *name, QEMUSoundCard *card);
 void AUD_remove_card (QEMUSoundCard *card);
 CaptureVoiceOut *AUD_add_capture (
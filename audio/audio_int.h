@@ -85,6 +85,13 @@ typedef struct HWVoiceOut {
     LIST_HEAD (sw_cap_listhead, SWVoiceCap) cap_head;
     struct audio_pcm_ops *pcm_ops;
     LIST_ENTRY (HWVoiceOut) entries;
+
+    /* statistics, see AUD_show_stats() */
+    int last_buffered;          /* samples buffered after the last wakeup */
+    int64_t wakeups;
+    int64_t underruns;
+    int64_t latency_sum;        /* sum of the samples buffered at wakeups */
+    int latency_max;
 } HWVoiceOut;
 
 typedef struct HWVoiceIn {
@@ -162,6 +169,9 @@ struct audio_pcm_ops {
     int  (*run_in)  (HWVoiceIn *hw);
     int  (*read)    (SWVoiceIn *sw, void *buf, int size);
     int  (*ctl_in)  (HWVoiceIn *hw, int cmd, ...);
+
+    /* optional, samples taken by run_out that were not played yet */
+    int  (*buffered_out) (HWVoiceOut *hw);
 };
 
 struct capture_callback {
@@ -196,6 +206,7 @@ struct AudioState {
     LIST_HEAD (cap_listhead, CaptureVoiceOut) cap_head;
     int nb_hw_voices_out;
     int nb_hw_voices_in;
+    int64_t wakeups;
 };
 
 extern struct audio_driver no_audio_driver;
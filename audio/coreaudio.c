@@ -788,14 +788,16 @@ static struct audio_pcm_ops coreaudio_pcm_ops = {
     coreaudio_fini_in,
     coreaudio_run_in,
     coreaudio_read,
-    coreaudio_ctl_in
+    coreaudio_ctl_in,
 #else
     NULL,
     NULL,
     NULL,
     NULL,
-    NULL
+    NULL,
 #endif
+
+    NULL
 };
 
 struct audio_driver coreaudio_audio_driver = {
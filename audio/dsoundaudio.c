@@ -1067,7 +1067,9 @@ static struct audio_pcm_ops dsound_pcm_ops = {
     dsound_fini_in,
     dsound_run_in,
     dsound_read,
-    dsound_ctl_in
+    dsound_ctl_in,
+
+    NULL
 };
 
 struct audio_driver dsound_audio_driver = {
@@ -664,6 +664,8 @@ struct audio_pcm_ops qesd_pcm_ops = {
     qesd_run_in,
     qesd_read,
     qesd_ctl_in,
+
+    NULL
 };
 
 struct audio_driver esd_audio_driver = {
@@ -667,7 +667,9 @@ static struct audio_pcm_ops fmod_pcm_ops = {
     fmod_fini_in,
     fmod_run_in,
     fmod_read,
-    fmod_ctl_in
+    fmod_ctl_in,
+
+    NULL
 };
 
 struct audio_driver fmod_audio_driver = {
@@ -154,7 +154,9 @@ static struct audio_pcm_ops no_pcm_ops = {
     no_fini_in,
     no_run_in,
     no_read,
-    no_ctl_in
+    no_ctl_in,
+
+    NULL
 };
 
 struct audio_driver no_audio_driver = {
@@ -755,7 +755,9 @@ static struct audio_pcm_ops oss_pcm_ops = {
     oss_fini_in,
     oss_run_in,
     oss_read,
-    oss_ctl_in
+    oss_ctl_in,
+
+    NULL
 };
 
 struct audio_driver oss_audio_driver = {
@@ -418,6 +418,20 @@ static int sdl_run_out (HWVoiceOut *hw)
     return  total >> hw->info.shift;
 }
 
+static int sdl_buffered_out (HWVoiceOut *hw)
+{
+    SDLAudioState *s = &glob_sdl;
+    int  count;
+
+    if (sdl_lock (s, "sdl_buffered_out")) {
+        return 0;
+    }
+    count = s->count;
+    sdl_unlock (s, "sdl_buffered_out");
+
+    return  count >> hw->info.shift;
+}
+
 #else /* !NEW_AUDIO */
 static int sdl_run_out (HWVoiceOut *hw)
 {
@@ -642,7 +656,13 @@ static struct audio_pcm_ops sdl_pcm_ops = {
     NULL,
     NULL,
     NULL,
+    NULL,
+
+#if NEW_AUDIO
+    sdl_buffered_out
+#else
     NULL
+#endif
 };
 
 struct audio_driver sdl_audio_driver = {
@@ -449,14 +449,16 @@ struct audio_pcm_ops wav_pcm_ops = {
     wav_in_fini,
     wav_in_run,
     wav_in_read,
-    wav_in_ctl
+    wav_in_ctl,
 #else
     NULL,
     NULL,
     NULL,
     NULL,
-    NULL
+    NULL,
 #endif
+
+    NULL
 };
 
 struct audio_driver wav_audio_driver = {
@@ -648,7 +648,9 @@ static struct audio_pcm_ops winaudio_pcm_ops = {
     winaudio_in_fini,
     winaudio_in_run,
     winaudio_in_read,
-    winaudio_in_ctl
+    winaudio_in_ctl,
+
+    NULL
 };
 
 struct audio_driver win_audio_driver = {
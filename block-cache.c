@@ -0,0 +1,415 @@
+/* Copyright (C) 2009 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+#include "qemu-common.h"
+#include "console.h"
+#include "block_int.h"
+#include "block-cache.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+
+/* the segment is made of a header, followed by an array of slot
+ * descriptors, followed by the cluster data. slots are grouped in
+ * sets of BCACHE_WAYS entries, and a cluster can only live in the
+ * set selected by the hash of its key. eviction picks the least
+ * recently used slot of the set.
+ *
+ * all instances access the segment concurrently without locks:
+ * each slot has a sequence counter that is odd while its content
+ * is being replaced. writers take a slot by atomically moving the
+ * counter from even to odd, and readers validate their copy by
+ * checking that the counter didn't change while they copied.
+ *
+ * a writer that dies between these two steps would leave its slot
+ * odd forever, so a slot that stayed odd for more than
+ * BCACHE_STALE_SECONDS is taken over by the next writer of its set.
+ * the previous owner then fails to publish it, see bcache_write_cluster.
+ */
+#define  BCACHE_MAGIC         0x42434832   /* BCH2 */
+#define  BCACHE_CLUSTER_BITS  12
+#define  BCACHE_CLUSTER_SIZE  (1 << BCACHE_CLUSTER_BITS)
+#define  BCACHE_CLUSTER_SECTORS  (BCACHE_CLUSTER_SIZE/512)
+#define  BCACHE_WAYS          8
+#define  BCACHE_HEADER_SIZE   4096
+#define  BCACHE_STALE_SECONDS  10
+
+typedef struct {
+    uint32_t           magic;
+    uint32_t           cluster_size;
+    uint32_t           num_sets;
+    uint32_t           ways;
+    volatile uint32_t  clock;      /* bumped on each insertion */
+    /* host-wide statistics, updated by all instances */
+    volatile uint32_t  hits;
+    volatile uint32_t  misses;
+    volatile uint32_t  inserts;
+    volatile uint32_t  evictions;
+} BCacheHeader;
+
+typedef struct {
+    volatile uint32_t  seq;
+    volatile uint32_t  lru;
+    volatile uint32_t  busy_since;  /* time(), set before taking the slot */
+    uint32_t           pad;
+    uint64_t           image;
+    uint64_t           cluster;  /* cluster index + 1, 0 means empty */
+} BCacheSlot;
+
+static BCacheHeader*  bcache;
+static BCacheSlot*    bcache_slots;
+static uint8_t*       bcache_data;
+static size_t         bcache_size;
+
+/* per-instance statistics */
+static uint64_t  bcache_hits;
+static uint64_t  bcache_misses;
+static uint64_t  bcache_inserts;
+static uint64_t  bcache_evictions;
+static uint64_t  bcache_collisions;  /* slot busy in another instance */
+
+#define  BCACHE_SEGMENT_NAME  "/qemu-bcache-%d"
+
+#ifndef _WIN32
+int bdrv_cache_init(int size_mb)
+{
+    char         name[64];
+    int          fd, created = 0;
+    struct stat  st;
+    void*        base;
+    uint32_t     num_sets;
+    size_t       set_size = BCACHE_WAYS * (sizeof(BCacheSlot) + BCACHE_CLUSTER_SIZE);
+
+    if (bcache != NULL)
+        return 0;
+
+    snprintf(name, sizeof name, BCACHE_SEGMENT_NAME, (int)getuid());
+
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd >= 0) {
+        created = 1;
+        num_sets = 1;
+        while ((uint64_t)num_sets * 2 * set_size <= (uint64_t)size_mb << 20)
+            num_sets *= 2;
+        bcache_size = BCACHE_HEADER_SIZE + num_sets * set_size;
+        if (ftruncate(fd, bcache_size) < 0) {
+            close(fd);
+            shm_unlink(name);
+            return -1;
+        }
+    } else {
+        fd = shm_open(name, O_RDWR, 0600);
+        if (fd < 0)
+            return -1;
+        if (fstat(fd, &st) < 0 || st.st_size < BCACHE_HEADER_SIZE) {
+            close(fd);
+            return -1;
+        }
+        bcache_size = st.st_size;
+    }
+
+    base = mmap(NULL, bcache_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return -1;
+
+    bcache = base;
+    if (created) {
+        bcache->cluster_size = BCACHE_CLUSTER_SIZE;
+        bcache->num_sets     = num_sets;
+        bcache->ways         = BCACHE_WAYS;
+        __sync_synchronize();
+        bcache->magic        = BCACHE_MAGIC;
+    } else {
+        int  tries;
+        /* the creator may still be initializing the header */
+        for (tries = 0; bcache->magic != BCACHE_MAGIC && tries < 100; tries++)
+            usleep(1000);
+
+        if (bcache->magic != BCACHE_MAGIC                    ||
+            bcache->cluster_size != BCACHE_CLUSTER_SIZE      ||
+            bcache->ways != BCACHE_WAYS                      ||
+            BCACHE_HEADER_SIZE + (uint64_t)bcache->num_sets * set_size > bcache_size) {
+            munmap(base, bcache_size);
+            bcache = NULL;
+            return -1;
+        }
+    }
+    num_sets     = bcache->num_sets;
+    bcache_slots = (BCacheSlot*)((uint8_t*)base + BCACHE_HEADER_SIZE);
+    bcache_data  = (uint8_t*)(bcache_slots + num_sets * BCACHE_WAYS);
+    return 0;
+}
+
+uint64_t bdrv_cache_image_id(BlockDriverState *bs)
+{
+    struct stat  st;
+    uint64_t     id = 14695981039346656037ULL;  /* FNV-1a */
+    uint64_t     fields[5];
+    const char*  format;
+    int          nn;
+
+    if (bcache == NULL || bs->drv == NULL || bs->is_temporary)
+        return 0;
+
+    if (stat(bs->filename, &st) < 0 || !S_ISREG(st.st_mode))
+        return 0;
+
+    fields[0] = st.st_dev;
+    fields[1] = st.st_ino;
+    fields[2] = st.st_size;
+    fields[3] = st.st_mtime;
+    /* an image rewritten within the same second keeps its size and often
+     * its inode, so use the sub-second part of the time when available */
+#if defined(__APPLE__)
+    fields[4] = st.st_mtimespec.tv_nsec;
+#elif defined(__linux__)
+    fields[4] = st.st_mtim.tv_nsec;
+#else
+    fields[4] = 0;
+#endif
+    for (nn = 0; nn < (int)sizeof(fields); nn++) {
+        id ^= ((uint8_t*)fields)[nn];
+        id *= 1099511628211ULL;
+    }
+    for (format = bs->drv->format_name; *format; format++) {
+        id ^= (uint8_t)*format;
+        id *= 1099511628211ULL;
+    }
+
+    /* the content of an overlay depends on its backing file too */
+    if (bs->backing_hd) {
+        uint64_t  backing = bdrv_cache_image_id(bs->backing_hd);
+        if (backing == 0)
+            return 0;
+        id = (id ^ backing) * 1099511628211ULL;
+    }
+    return id ? id : 1;
+}
+
+static BCacheSlot*
+bcache_set(uint64_t image_id, uint64_t cluster)
+{
+    uint64_t  h = (image_id ^ (cluster * 0x9E3779B97F4A7C15ULL));
+
+    h ^= h >> 29;
+    return bcache_slots + (h & (bcache->num_sets - 1)) * BCACHE_WAYS;
+}
+
+static uint8_t*
+bcache_slot_data(BCacheSlot*  slot)
+{
+    return bcache_data + (size_t)(slot - bcache_slots) * BCACHE_CLUSTER_SIZE;
+}
+
+/* copy 'len' bytes at 'offset' within the cluster, returns 1 on hit */
+static int
+bcache_read_cluster(uint64_t image_id, uint64_t cluster,
+                    uint8_t* dst, int offset, int len)
+{
+    BCacheSlot*  slot = bcache_set(image_id, cluster);
+    int          nn;
+
+    for (nn = 0; nn < BCACHE_WAYS; nn++, slot++) {
+        uint32_t  seq = slot->seq;
+
+        /* don't let the key checks below be reordered before this load */
+        __sync_synchronize();
+        if ((seq & 1) != 0 ||
+            slot->image != image_id || slot->cluster != cluster + 1)
+            continue;
+
+        __sync_synchronize();
+        memcpy(dst, bcache_slot_data(slot) + offset, len);
+        __sync_synchronize();
+
+        if (slot->seq != seq)
+            return 0;
+
+        slot->lru = bcache->clock;
+        return 1;
+    }
+    return 0;
+}
+
+int bdrv_cache_lookup(uint64_t image_id, int64_t sector_num,
+                      uint8_t *buf, int nb_sectors)
+{
+    int64_t  offset = sector_num * 512;
+    int      len    = nb_sectors * 512;
+
+    if (bcache == NULL || image_id == 0)
+        return 0;
+
+    while (len > 0) {
+        uint64_t  cluster = offset >> BCACHE_CLUSTER_BITS;
+        int       start   = offset & (BCACHE_CLUSTER_SIZE-1);
+        int       avail   = BCACHE_CLUSTER_SIZE - start;
+
+        if (avail > len)
+            avail = len;
+
+        if (!bcache_read_cluster(image_id, cluster, buf, start, avail)) {
+            bcache_misses++;
+            __sync_fetch_and_add(&bcache->misses, 1);
+            return 0;
+        }
+        buf    += avail;
+        offset += avail;
+        len    -= avail;
+    }
+    bcache_hits++;
+    __sync_fetch_and_add(&bcache->hits, 1);
+    return 1;
+}
+
+static void
+bcache_write_cluster(uint64_t image_id, uint64_t cluster, const uint8_t* src)
+{
+    BCacheSlot*  set    = bcache_set(image_id, cluster);
+    BCacheSlot*  victim = NULL;
+    uint32_t     clock  = bcache->clock;
+    uint32_t     now    = (uint32_t)time(NULL);
+    uint32_t     seq, owned;
+    int          nn;
+
+    for (nn = 0; nn < BCACHE_WAYS; nn++) {
+        BCacheSlot*  slot = set + nn;
+
+        if ((slot->seq & 1) &&
+            (int32_t)(now - slot->busy_since) > BCACHE_STALE_SECONDS) {
+            /* a writer died while filling this slot, take it over */
+            victim = slot;
+            break;
+        }
+
+        if (slot->image == image_id && slot->cluster == cluster + 1)
+            return;  /* already there, or being added */
+
+        if (slot->seq & 1)
+            continue;
+
+        if (slot->cluster == 0) {
+            victim = slot;
+            break;
+        }
+        /* least recently used, taking the clock wrap into account */
+        if (victim == NULL ||
+            (int32_t)(clock - slot->lru) > (int32_t)(clock - victim->lru))
+            victim = slot;
+    }
+    if (victim == NULL)
+        return;
+
+    /* refresh the time first, so that the slot never looks stale while
+     * a live writer owns it. an odd counter moves to the next odd value,
+     * which makes the dead owner's final compare-and-swap fail */
+    seq   = victim->seq;
+    if ((seq & 1) &&
+        (int32_t)(now - victim->busy_since) <= BCACHE_STALE_SECONDS) {
+        bcache_collisions++;
+        return;
+    }
+    owned = (seq | 1) + 2*(seq & 1);
+    victim->busy_since = now;
+    __sync_synchronize();
+    if (!__sync_bool_compare_and_swap(&victim->seq, seq, owned)) {
+        bcache_collisions++;
+        return;
+    }
+    if (victim->cluster != 0) {
+        bcache_evictions++;
+        __sync_fetch_and_add(&bcache->evictions, 1);
+    }
+    victim->image   = image_id;
+    victim->cluster = cluster + 1;
+    memcpy(bcache_slot_data(victim), src, BCACHE_CLUSTER_SIZE);
+    victim->lru     = __sync_add_and_fetch(&bcache->clock, 1);
+    if (!__sync_bool_compare_and_swap(&victim->seq, owned, owned + 1)) {
+        /* stalled for so long that another writer took the slot over */
+        bcache_collisions++;
+        return;
+    }
+
+    bcache_inserts++;
+    __sync_fetch_and_add(&bcache->inserts, 1);
+}
+
+void bdrv_cache_insert(uint64_t image_id, int64_t sector_num,
+                       const uint8_t *buf, int nb_sectors)
+{
+    int64_t  end = sector_num + nb_sectors;
+    int64_t  first;
+
+    if (bcache == NULL || image_id == 0)
+        return;
+
+    /* only clusters that are entirely covered by the request */
+    first = (sector_num + BCACHE_CLUSTER_SECTORS - 1) & ~(int64_t)(BCACHE_CLUSTER_SECTORS-1);
+    buf  += (first - sector_num) * 512;
+
+    for ( ; first + BCACHE_CLUSTER_SECTORS <= end; first += BCACHE_CLUSTER_SECTORS) {
+        bcache_write_cluster(image_id, first / BCACHE_CLUSTER_SECTORS, buf);
+        buf += BCACHE_CLUSTER_SIZE;
+    }
+}
+
+void bdrv_cache_info(void)
+{
+    uint64_t  lookups = bcache_hits + bcache_misses;
+
+    if (bcache == NULL)
+        return;
+
+    term_printf("shared cache: size=%dKB"
+                " hits=%" PRIu64 " misses=%" PRIu64 " hit_rate=%d%%"
+                " inserts=%" PRIu64 " evictions=%" PRIu64
+                " collisions=%" PRIu64 "\n",
+                (int)(bcache_size >> 10),
+                bcache_hits, bcache_misses,
+                lookups ? (int)(bcache_hits*100/lookups) : 0,
+                bcache_inserts, bcache_evictions, bcache_collisions);
+    term_printf("shared cache (all instances): hits=%u misses=%u"
+                " inserts=%u evictions=%u\n",
+                bcache->hits, bcache->misses,
+                bcache->inserts, bcache->evictions);
+}
+
+#else /* _WIN32 */
+
+int bdrv_cache_init(int size_mb)
+{
+    return -1;
+}
+
+uint64_t bdrv_cache_image_id(BlockDriverState *bs)
+{
+    return 0;
+}
+
+int bdrv_cache_lookup(uint64_t image_id, int64_t sector_num,
+                      uint8_t *buf, int nb_sectors)
+{
+    return 0;
+}
+
+void bdrv_cache_insert(uint64_t image_id, int64_t sector_num,
+                       const uint8_t *buf, int nb_sectors)
+{
+}
+
+void bdrv_cache_info(void)
+{
+}
+
+#endif /* _WIN32 */
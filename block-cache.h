@@ -0,0 +1,49 @@
+/* Copyright (C) 2009 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+#ifndef BLOCK_CACHE_H
+#define BLOCK_CACHE_H
+
+#include "block.h"
+
+/* The shared block cache keeps clusters of read-only images (typically
+ * system images and the backing files of copy-on-write overlays) in a
+ * shared memory segment that every emulator instance of the same user
+ * maps. Instances started from the same images thus read each cluster
+ * from the disk only once, and share a single copy of it in memory.
+ *
+ * Clusters are keyed by an image identity derived from the file's
+ * device, inode, size and modification time, so an image that changes
+ * on disk simply stops matching its old entries.
+ */
+
+/* create or attach to the shared segment. 'size_mb' is only used when
+ * the segment doesn't exist yet. returns 0 on success, -1 otherwise
+ * (the cache then stays disabled) */
+int      bdrv_cache_init(int size_mb);
+
+/* return the identity of the image opened in 'bs', or 0 if its
+ * content can't be shared */
+uint64_t bdrv_cache_image_id(BlockDriverState *bs);
+
+/* try to fill 'buf' from the cache, returns 1 if the whole range
+ * was found, 0 otherwise (in which case 'buf' content is undefined) */
+int      bdrv_cache_lookup(uint64_t image_id, int64_t sector_num,
+                           uint8_t *buf, int nb_sectors);
+
+/* add all clusters fully covered by the range to the cache */
+void     bdrv_cache_insert(uint64_t image_id, int64_t sector_num,
+                           const uint8_t *buf, int nb_sectors);
+
+/* print statistics for "info blockstats" */
+void     bdrv_cache_info(void);
+
+#endif /* BLOCK_CACHE_H */
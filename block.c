@@ -24,6 +24,7 @@
 #include "qemu-common.h"
 #include "console.h"
 #include "block_int.h"
+#include "block-cache.h"
 
 #ifdef _BSD
 #include <sys/types.h>
@@ -332,6 +333,7 @@ int bdrv_open2(BlockDriverState *bs, const char *filename, int flags,
     bs->read_only = 0;
     bs->is_temporary = 0;
     bs->encrypted = 0;
+    bs->cache_id = 0;
 
     if (flags & BDRV_O_SNAPSHOT) {
         BlockDriverState *bs1;
@@ -427,7 +429,11 @@ int bdrv_open2(BlockDriverState *bs, const char *filename, int flags,
                      filename, bs->backing_file);
         if (bdrv_open(bs->backing_hd, backing_filename, 0) < 0)
             goto fail;
+        /* backing files are only written to by bdrv_commit() */
+        bs->backing_hd->cache_id = bdrv_cache_image_id(bs->backing_hd);
     }
+    if (bs->read_only)
+        bs->cache_id = bdrv_cache_image_id(bs);
 
     /* call the change callback */
     bs->media_changed = 1;
@@ -451,6 +457,7 @@ void bdrv_close(BlockDriverState *bs)
 #endif
         bs->opaque = NULL;
         bs->drv = NULL;
+        bs->cache_id = 0;
 
         /* call the change callback */
         bs->media_changed = 1;
@@ -521,6 +528,7 @@ int bdrv_read(BlockDriverState *bs, int64_t sector_num,
               uint8_t *buf, int nb_sectors)
 {
     BlockDriver *drv = bs->drv;
+    int ret;
 
     if (!drv)
         return -ENOMEDIUM;
@@ -533,8 +541,15 @@ int bdrv_read(BlockDriverState *bs, int64_t sector_num,
         if (nb_sectors == 0)
             return 0;
     }
+    /* when emulated on top of aio, the lookup is done by bdrv_aio_read */
+    if (bs->cache_id && drv->bdrv_read != bdrv_read_em &&
+        bdrv_cache_lookup(bs->cache_id, sector_num, buf, nb_sectors)) {
+        bs->rd_bytes += (unsigned) nb_sectors * SECTOR_SIZE;
+        bs->rd_ops ++;
+        return 0;
+    }
     if (drv->bdrv_pread) {
-        int ret, len;
+        int len;
         len = nb_sectors * 512;
         ret = drv->bdrv_pread(bs, sector_num * 512, buf, len);
         if (ret < 0)
@@ -544,11 +559,14 @@ int bdrv_read(BlockDriverState *bs, int64_t sector_num,
         else {
 	    bs->rd_bytes += (unsigned) len;
 	    bs->rd_ops ++;
-            return 0;
+            ret = 0;
 	}
     } else {
-        return drv->bdrv_read(bs, sector_num, buf, nb_sectors);
+        ret = drv->bdrv_read(bs, sector_num, buf, nb_sectors);
     }
+    if (ret == 0 && bs->cache_id)
+        bdrv_cache_insert(bs->cache_id, sector_num, buf, nb_sectors);
+    return ret;
 }
 
 /* Return < 0 if error. Important errors are:
@@ -565,6 +583,8 @@ int bdrv_write(BlockDriverState *bs, int64_t sector_num,
         return -ENOMEDIUM;
     if (bs->read_only)
         return -EACCES;
+    /* the image no longer matches what other instances see */
+    bs->cache_id = 0;
     if (sector_num == 0 && bs->boot_sector_enabled && nb_sectors > 0) {
         memcpy(bs->boot_sector_data, buf, 512);
     }
@@ -703,6 +723,7 @@ int bdrv_pwrite(BlockDriverState *bs, int64_t offset,
 
     if (!drv)
         return -ENOMEDIUM;
+    bs->cache_id = 0;
     if (!drv->bdrv_pwrite)
         return bdrv_pwrite_em(bs, offset, buf1, count1);
     return drv->bdrv_pwrite(bs, offset, buf1, count1);
@@ -718,6 +739,7 @@ int bdrv_truncate(BlockDriverState *bs, int64_t offset)
         return -ENOMEDIUM;
     if (!drv->bdrv_truncate)
         return -ENOTSUP;
+    bs->cache_id = 0;
     return drv->bdrv_truncate(bs, offset);
 }
 
@@ -976,6 +998,7 @@ void bdrv_info_stats (void)
 		     bs->rd_bytes, bs->wr_bytes,
 		     bs->rd_ops, bs->wr_ops);
     }
+    bdrv_cache_info();
 }
 
 void bdrv_get_backing_filename(BlockDriverState *bs,
@@ -996,6 +1019,7 @@ int bdrv_write_compressed(BlockDriverState *bs, int64_t sector_num,
         return -ENOMEDIUM;
     if (!drv->bdrv_write_compressed)
         return -ENOTSUP;
+    bs->cache_id = 0;
     return drv->bdrv_write_compressed(bs, sector_num, buf, nb_sectors);
 }
 
@@ -1133,12 +1157,62 @@ char *bdrv_snapshot_dump(char *buf, int buf_size, QEMUSnapshotInfo *sn)
 /**************************************************************/
 /* async I/Os */
 
+/* completion of an aio read served from the shared block cache */
+typedef struct BlockCacheAIOCB {
+    BlockDriverAIOCB common;
+    QEMUBH *bh;
+    struct BlockCacheAIOCB *next;
+} BlockCacheAIOCB;
+
+static BlockCacheAIOCB *bdrv_cache_pending;
+
+static void bdrv_cache_aio_release(BlockCacheAIOCB *acb)
+{
+    BlockCacheAIOCB **pacb = &bdrv_cache_pending;
+
+    while (*pacb != acb)
+        pacb = &(*pacb)->next;
+    *pacb = acb->next;
+    qemu_bh_delete(acb->bh);
+    qemu_free(acb);
+}
+
+static void bdrv_cache_aio_bh_cb(void *opaque)
+{
+    BlockCacheAIOCB *acb = opaque;
+    BlockDriverCompletionFunc *cb = acb->common.cb;
+    void *cb_opaque = acb->common.opaque;
+
+    bdrv_cache_aio_release(acb);
+    cb(cb_opaque, 0);
+}
+
+static BlockDriverAIOCB *bdrv_cache_aio_read(BlockDriverState *bs,
+        int64_t sector_num, uint8_t *buf, int nb_sectors,
+        BlockDriverCompletionFunc *cb, void *opaque)
+{
+    BlockCacheAIOCB *acb;
+
+    if (!bdrv_cache_lookup(bs->cache_id, sector_num, buf, nb_sectors))
+        return NULL;
+
+    acb = qemu_mallocz(sizeof(*acb));
+    acb->common.bs = bs;
+    acb->common.cb = cb;
+    acb->common.opaque = opaque;
+    acb->bh = qemu_bh_new(bdrv_cache_aio_bh_cb, acb);
+    acb->next = bdrv_cache_pending;
+    bdrv_cache_pending = acb;
+    qemu_bh_schedule(acb->bh);
+    return &acb->common;
+}
+
 BlockDriverAIOCB *bdrv_aio_read(BlockDriverState *bs, int64_t sector_num,
                                 uint8_t *buf, int nb_sectors,
                                 BlockDriverCompletionFunc *cb, void *opaque)
 {
     BlockDriver *drv = bs->drv;
-    BlockDriverAIOCB *ret;
+    BlockDriverAIOCB *ret = NULL;
 
     if (!drv)
         return NULL;
@@ -1151,7 +1225,13 @@ BlockDriverAIOCB *bdrv_aio_read(BlockDriverState *bs, int64_t sector_num,
         buf += 512;
     }
 
-    ret = drv->bdrv_aio_read(bs, sector_num, buf, nb_sectors, cb, opaque);
+    /* the aio emulation goes through bdrv_read, which handles the cache.
+       native aio misses are not inserted, only sync reads populate it */
+    if (bs->cache_id && drv->bdrv_aio_read != bdrv_aio_read_em)
+        ret = bdrv_cache_aio_read(bs, sector_num, buf, nb_sectors, cb, opaque);
+
+    if (!ret)
+        ret = drv->bdrv_aio_read(bs, sector_num, buf, nb_sectors, cb, opaque);
 
     if (ret) {
 	/* Update stats even though technically transfer has not happened. */
@@ -1173,6 +1253,7 @@ BlockDriverAIOCB *bdrv_aio_write(BlockDriverState *bs, int64_t sector_num,
         return NULL;
     if (bs->read_only)
         return NULL;
+    bs->cache_id = 0;
     if (sector_num == 0 && bs->boot_sector_enabled && nb_sectors > 0) {
         memcpy(bs->boot_sector_data, buf, 512);
     }
@@ -1191,7 +1272,14 @@ BlockDriverAIOCB *bdrv_aio_write(BlockDriverState *bs, int64_t sector_num,
 void bdrv_aio_cancel(BlockDriverAIOCB *acb)
 {
     BlockDriver *drv = acb->bs->drv;
+    BlockCacheAIOCB *cacb;
 
+    for (cacb = bdrv_cache_pending; cacb != NULL; cacb = cacb->next) {
+        if (&cacb->common == acb) {
+            bdrv_cache_aio_release(cacb);
+            return;
+        }
+    }
     drv->bdrv_aio_cancel(acb);
 }
 
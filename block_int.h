@@ -114,6 +114,8 @@ struct BlockDriverState {
     int media_changed;
 
     BlockDriverState *backing_hd;
+    /* identity of the image in the shared block cache, 0 if not cached */
+    uint64_t cache_id;
     /* async read/write emulation */
 
     void *sync_aiocb;
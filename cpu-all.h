@@ -729,6 +729,9 @@ extern unsigned long qemu_host_page_mask;
    code */
 #define PAGE_WRITE_ORG 0x0010
 #define PAGE_RESERVED  0x0020
+/* softmmu: mapping private to the current address space, dropped by
+   tlb_flush(env, 0) */
+#define PAGE_NONGLOBAL 0x0040
 
 void page_dump(FILE *f);
 int page_get_flags(target_ulong address);
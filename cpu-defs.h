@@ -92,9 +92,19 @@ typedef uint64_t target_phys_addr_t;
 #define TB_JMP_ADDR_MASK (TB_JMP_PAGE_SIZE - 1)
 #define TB_JMP_PAGE_MASK (TB_JMP_CACHE_SIZE - TB_JMP_PAGE_SIZE)
 
+/* Size of the direct mapped TLB of each MMU mode.  It can be overridden
+   at build time with -DCPU_TLB_BITS=n, except on ARM hosts whose backend
+   can only mask 8 bits of page index in a single instruction.  */
+#ifndef CPU_TLB_BITS
 #define CPU_TLB_BITS 8
+#endif
 #define CPU_TLB_SIZE (1 << CPU_TLB_BITS)
 
+/* Fully associative victim TLB holding the entries most recently evicted
+   from the direct mapped one.  It is only searched on the slow path,
+   before falling back to tlb_fill() and a page table walk.  */
+#define CPU_VTLB_SIZE 8
+
 #if TARGET_PHYS_ADDR_BITS == 32 && TARGET_LONG_BITS == 32
 #define CPU_TLB_ENTRY_BITS 4
 #else
@@ -154,6 +164,12 @@ typedef struct icount_decr_u16 {
     /* The meaning of the MMU modes is defined in the target code. */   \
     CPUTLBEntry tlb_table[NB_MMU_MODES][CPU_TLB_SIZE];                  \
     target_phys_addr_t iotlb[NB_MMU_MODES][CPU_TLB_SIZE];               \
+    CPUTLBEntry tlb_v_table[NB_MMU_MODES][CPU_VTLB_SIZE];               \
+    target_phys_addr_t iotlb_v[NB_MMU_MODES][CPU_VTLB_SIZE];            \
+    int vtlb_index; /* next victim TLB slot to replace */               \
+    /* entries of the current address space only (PAGE_NONGLOBAL) */   \
+    uint8_t tlb_nonglobal[NB_MMU_MODES][CPU_TLB_SIZE];                  \
+    uint8_t tlb_v_nonglobal[NB_MMU_MODES][CPU_VTLB_SIZE];               \
     struct TranslationBlock *tb_jmp_cache[TB_JMP_CACHE_SIZE];           \
     /* buffer for temporaries in the code generator */                  \
     long temp_buf[CPU_TEMP_BUF_NLONGS];                                 \
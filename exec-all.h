@@ -86,6 +86,9 @@ void tb_invalidate_phys_page_range(target_phys_addr_t start, target_phys_addr_t
 void tb_invalidate_page_range(target_ulong start, target_ulong end);
 void tlb_flush_page(CPUState *env, target_ulong addr);
 void tlb_flush(CPUState *env, int flush_global);
+void tlb_flush_cause(CPUState *env, int flush_global, int cause);
+int tlb_victim_lookup(CPUState *env, int mmu_idx, int index,
+                      size_t elt_ofs, target_ulong page);
 int tlb_set_page_exec(CPUState *env, target_ulong vaddr,
                       target_phys_addr_t paddr, int prot,
                       int mmu_idx, int is_softmmu);
@@ -98,6 +101,30 @@ static inline int tlb_set_page(CPUState *env1, target_ulong vaddr,
     return tlb_set_page_exec(env1, vaddr, paddr, prot, mmu_idx, is_softmmu);
 }
 
+/* reasons for a TLB flush, counted in TLBStats */
+enum {
+    TLB_FLUSH_OTHER,        /* reset, vm state load, debugger */
+    TLB_FLUSH_MMU_CTRL,     /* MMU enable or access control change */
+    TLB_FLUSH_GUEST,        /* explicit TLB maintenance by the guest */
+    TLB_FLUSH_CONTEXT,      /* address space switch */
+    TLB_FLUSH_NB_CAUSES
+};
+
+/* softmmu TLB statistics, reported by "info jit" */
+typedef struct TLBStats {
+    int64_t miss[NB_MMU_MODES];       /* direct mapped TLB misses */
+    int64_t victim_hit[NB_MMU_MODES]; /* misses served by the victim TLB */
+    int64_t refill[NB_MMU_MODES];     /* entries installed by tlb_fill() */
+    int64_t flush_page;
+    int64_t flush[TLB_FLUSH_NB_CAUSES];
+    int64_t flush_nonglobal;          /* flushes that kept global pages */
+#ifdef CONFIG_PROFILER
+    int64_t refill_time;              /* cycles spent in tlb_fill() */
+#endif
+} TLBStats;
+
+extern TLBStats tlb_stats;
+
 #define CODE_GEN_ALIGN           16 /* must be >= of the size of a icache line */
 
 #define CODE_GEN_PHYS_HASH_BITS     15
@@ -159,6 +186,10 @@ struct TranslationBlock {
     uint64_t prev_time;
 #endif
     uint32_t icount;
+    /* execution statistics, NULL if the block profiler is disabled */
+    struct TBProfile *profile;
+    /* translated by tb_speculate() and not looked up since */
+    uint8_t speculative;
 };
 
 static inline unsigned int tb_jmp_cache_hash_page(target_ulong pc)
@@ -192,6 +223,26 @@ extern TranslationBlock *tb_phys_hash[CODE_GEN_PHYS_HASH_SIZE];
 extern uint8_t *code_gen_ptr;
 extern int code_gen_max_blocks;
 
+/* Speculative translation. The translators report the statically known
+   successors of each block they generate with tb_add_successor(), and
+   tb_speculate() translates the most recent ones while the CPU is idle,
+   so that they are ready when the guest reaches them. */
+extern int tb_speculate_enabled;
+void tb_add_successor(target_ulong pc);
+/* translate at most 'max_tbs' blocks, return non zero if more are queued */
+int tb_speculate(CPUState *env, int max_tbs);
+
+/* reported by "info jit" */
+typedef struct TBSpecStats {
+    int64_t queued;      /* successors recorded */
+    int64_t translated;  /* blocks translated ahead of use */
+    int64_t hits;        /* ... later used */
+    int64_t wasted;      /* ... flushed or invalidated before being used */
+    int64_t skipped;     /* successors whose code was not in the TLB */
+} TBSpecStats;
+
+extern TBSpecStats tb_spec_stats;
+
 #if defined(USE_DIRECT_JUMP)
 
 #if defined(__powerpc__)
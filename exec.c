@@ -38,6 +38,7 @@
 #include "qemu-common.h"
 #include "tcg.h"
 #include "hw/hw.h"
+#include "tb-profile.h"
 #if defined(CONFIG_USER_ONLY)
 #include <qemu.h>
 #endif
@@ -89,6 +90,34 @@ int nb_tbs;
 /* any access to the tbs or the page table must use this lock */
 spinlock_t tb_lock = SPIN_LOCK_UNLOCKED;
 
+int tb_speculate_enabled;
+TBSpecStats tb_spec_stats;
+
+/* successors reported while translating the current block */
+#define TB_SPEC_MAX_SUCC 2
+static target_ulong tb_spec_succ[TB_SPEC_MAX_SUCC];
+static int tb_spec_nb_succ;
+
+/* blocks waiting to be translated ahead of time. this is a ring
+   where the newest entries overwrite the oldest ones, and are
+   translated first */
+#define TB_SPEC_QUEUE_SIZE 64
+/* don't follow the successors of speculative blocks further than that */
+#define TB_SPEC_MAX_DEPTH  2
+
+typedef struct TBSpecEntry {
+    target_ulong pc;
+    target_ulong cs_base;
+    int flags;
+    int depth;
+} TBSpecEntry;
+
+static TBSpecEntry tb_spec_queue[TB_SPEC_QUEUE_SIZE];
+static int tb_spec_head;
+static int tb_spec_count;
+/* depth of the block being translated by tb_speculate(), 0 otherwise */
+static int tb_spec_depth;
+
 #if defined(__arm__) || defined(__sparc_v9__)
 /* The prologue must be reachable with a direct jump. ARM and Sparc64
  have limited branch ranges (possibly also PPC) so place it in a
@@ -189,6 +218,7 @@ static int log_append = 0;
 static int tlb_flush_count;
 static int tb_flush_count;
 static int tb_phys_invalidate_count;
+TLBStats tlb_stats;
 
 #define SUBPAGE_IDX(addr) ((addr) & ~TARGET_PAGE_MASK)
 typedef struct subpage_t {
@@ -564,6 +594,16 @@ void tb_flush(CPUState *env1)
     if ((unsigned long)(code_gen_ptr - code_gen_buffer) > code_gen_buffer_size)
         cpu_abort(env1, "Internal error: code buffer overflow\n");
 
+    if (tb_profile_enabled)
+        tb_profile_flush_samples();
+
+    if (tb_speculate_enabled) {
+        int i;
+        for(i = 0; i < nb_tbs; i++) {
+            if (tbs[i].speculative)
+                tb_spec_stats.wasted++;
+        }
+    }
     nb_tbs = 0;
 
     for(env = first_cpu; env != NULL; env = env->next_cpu) {
@@ -757,6 +797,10 @@ void tb_phys_invalidate(TranslationBlock *tb, target_ulong page_addr)
     }
     tb->jmp_first = (TranslationBlock *)((long)tb | 2); /* fail safe */
 
+    if (tb->speculative) {
+        tb->speculative = 0;
+        tb_spec_stats.wasted++;
+    }
     tb_phys_invalidate_count++;
 }
 
@@ -845,7 +889,14 @@ TranslationBlock *tb_gen_code(CPUState *env,
     tb->bb_rec = NULL;
     tb->prev_time = 0;
 #endif
+    tb->profile = NULL;
+    if (tb_profile_enabled)
+        tb->profile = tb_profile_get(pc, flags);
+    tb->speculative = 0;
+    tb_spec_nb_succ = 0;
     cpu_gen_code(env, tb, &code_gen_size);
+    if (tb->profile)
+        tb->profile->icount = tb->icount;
     code_gen_ptr = (void *)(((unsigned long)code_gen_ptr + code_gen_size + CODE_GEN_ALIGN - 1) & ~(CODE_GEN_ALIGN - 1));
 
     /* check next page if needed */
@@ -855,9 +906,139 @@ TranslationBlock *tb_gen_code(CPUState *env,
         phys_page2 = get_phys_addr_code(env, virt_page2);
     }
     tb_link_phys(tb, phys_pc, phys_page2);
+
+    if (tb_speculate_enabled && tb_spec_depth < TB_SPEC_MAX_DEPTH) {
+        int i;
+        for(i = 0; i < tb_spec_nb_succ; i++) {
+            TBSpecEntry *e;
+            if (tb_spec_succ[i] == pc)
+                continue;
+            e = &tb_spec_queue[tb_spec_head];
+            e->pc = tb_spec_succ[i];
+            e->cs_base = cs_base;
+            e->flags = flags;
+            e->depth = tb_spec_depth + 1;
+            tb_spec_head = (tb_spec_head + 1) & (TB_SPEC_QUEUE_SIZE - 1);
+            if (tb_spec_count < TB_SPEC_QUEUE_SIZE)
+                tb_spec_count++;
+            tb_spec_stats.queued++;
+        }
+    }
     return tb;
 }
 
+void tb_add_successor(target_ulong pc)
+{
+    if (tb_speculate_enabled && tb_spec_nb_succ < TB_SPEC_MAX_SUCC)
+        tb_spec_succ[tb_spec_nb_succ++] = pc;
+}
+
+#if defined(TARGET_ARM) && !defined(CONFIG_USER_ONLY)
+/* return non zero if the code page of 'addr' is mapped in the TLB, so
+   that it can be read without raising an exception. I/O pages have
+   TLB_MMIO set in addr_code and never match */
+static int tb_spec_code_mapped(CPUState *env1, target_ulong addr,
+                               target_ulong *phys_addr)
+{
+    int mmu_idx, page_index;
+    CPUTLBEntry *te;
+
+    page_index = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+    mmu_idx = cpu_mmu_index(env1);
+    te = &env1->tlb_table[mmu_idx][page_index];
+    if (te->addr_code != (addr & TARGET_PAGE_MASK))
+        return 0;
+    *phys_addr = addr + te->addend - (unsigned long)phys_ram_base;
+    return 1;
+}
+
+static TranslationBlock *tb_spec_lookup(target_ulong pc, target_ulong phys_pc,
+                                        target_ulong cs_base, int flags)
+{
+    TranslationBlock *tb;
+
+    tb = tb_phys_hash[tb_phys_hash_func(phys_pc)];
+    for(; tb != NULL; tb = tb->phys_hash_next) {
+        if (tb->pc == pc &&
+            tb->page_addr[0] == (phys_pc & TARGET_PAGE_MASK) &&
+            tb->cs_base == cs_base &&
+            tb->flags == flags)
+            return tb;
+    }
+    return NULL;
+}
+
+/* Translate the queued successors while the CPU is halted. The blocks
+   are generated with the same translator as the normal ones, so the
+   CPU state they depend on must be set up temporarily. Only the Thumb
+   and IT block state is changed: the other flags are read directly
+   from the CPU state by the translator, so the blocks that don't match
+   them are left for later. A successor is also skipped if its code is
+   not in the TLB, since a translation must never fault, and when the
+   code buffer is full, since a guess must never cause a flush. */
+int tb_speculate(CPUState *env1, int max_tbs)
+{
+    CPUState *saved_env;
+    target_ulong cur_pc, cur_cs_base, phys_pc, phys_page2;
+    uint64_t cur_flags;
+    uint32_t saved_thumb, saved_condexec;
+    TranslationBlock *tb;
+    TBSpecEntry e;
+
+    saved_env = cpu_single_env;
+    cpu_single_env = env1;
+    saved_thumb = env1->thumb;
+    saved_condexec = env1->condexec_bits;
+    cpu_get_tb_cpu_state(env1, &cur_pc, &cur_cs_base, &cur_flags);
+
+    while (max_tbs > 0 && tb_spec_count > 0) {
+        if (nb_tbs >= code_gen_max_blocks ||
+            (code_gen_ptr - code_gen_buffer) >= code_gen_buffer_max_size) {
+            tb_spec_count = 0;
+            break;
+        }
+        tb_spec_head = (tb_spec_head - 1) & (TB_SPEC_QUEUE_SIZE - 1);
+        tb_spec_count--;
+        e = tb_spec_queue[tb_spec_head];
+
+        if ((e.flags & ~0xff01) != (cur_flags & ~0xff01) ||
+            e.cs_base != cur_cs_base) {
+            tb_spec_stats.skipped++;
+            continue;
+        }
+        env1->thumb = e.flags & 1;
+        env1->condexec_bits = e.flags >> 8;
+        /* a Thumb-2 instruction can cross the end of the page */
+        if (!tb_spec_code_mapped(env1, e.pc, &phys_pc) ||
+            (env1->thumb &&
+             !tb_spec_code_mapped(env1, e.pc + TARGET_PAGE_SIZE, &phys_page2))) {
+            tb_spec_stats.skipped++;
+            continue;
+        }
+        if (tb_spec_lookup(e.pc, phys_pc, e.cs_base, e.flags))
+            continue;
+
+        tb_spec_depth = e.depth;
+        tb = tb_gen_code(env1, e.pc, e.cs_base, e.flags, 0);
+        tb_spec_depth = 0;
+        tb->speculative = 1;
+        tb_spec_stats.translated++;
+        max_tbs--;
+    }
+
+    env1->thumb = saved_thumb;
+    env1->condexec_bits = saved_condexec;
+    cpu_single_env = saved_env;
+    return tb_spec_count;
+}
+#else
+int tb_speculate(CPUState *env1, int max_tbs)
+{
+    tb_spec_count = 0;
+    return 0;
+}
+#endif
+
 /* invalidate all TBs which intersect with the target physical page
    starting in range [start;end[. NOTE: start and end must refer to
    the same physical page. 'is_cpu_write_access' should be true if called
@@ -1624,18 +1805,94 @@ static inline void tlb_flush_jmp_cache(CPUState *env, target_ulong addr)
 	    TB_JMP_PAGE_SIZE * sizeof(TranslationBlock *));
 }
 
-/* NOTE: if flush_global is true, also flush global entries (not
-   implemented yet) */
+static inline void tlb_invalidate_entry(CPUTLBEntry *tlb_entry)
+{
+    tlb_entry->addr_read = -1;
+    tlb_entry->addr_write = -1;
+    tlb_entry->addr_code = -1;
+}
+
+/* return true if the code of 'tb' is still mapped by a TLB entry */
+static int tlb_maps_tb(CPUState *env, TranslationBlock *tb)
+{
+    target_ulong page, last_page;
+    CPUTLBEntry *te;
+    int mmu_idx, i;
+
+    page = tb->pc & TARGET_PAGE_MASK;
+    last_page = (tb->pc + tb->size - 1) & TARGET_PAGE_MASK;
+    if (last_page != page)
+        return 0;
+    i = (page >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        te = &env->tlb_table[mmu_idx][i];
+        if (page == (te->addr_code & (TARGET_PAGE_MASK | TLB_INVALID_MASK)))
+            return 1;
+    }
+    return 0;
+}
+
+/* Drop the entries of the current address space, keeping the global
+   ones (typically the kernel mappings).  The jump cache is indexed by
+   virtual pc, so it must also forget every TB that may belong to the
+   old address space: we only keep those whose page is still mapped by
+   a global entry.  */
+static void tlb_flush_nonglobal(CPUState *env)
+{
+    TranslationBlock *tb;
+    int mmu_idx, i;
+
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        for (i = 0; i < CPU_TLB_SIZE; i++) {
+            if (env->tlb_nonglobal[mmu_idx][i]) {
+                tlb_invalidate_entry(&env->tlb_table[mmu_idx][i]);
+                env->tlb_nonglobal[mmu_idx][i] = 0;
+            }
+        }
+        for (i = 0; i < CPU_VTLB_SIZE; i++) {
+            if (env->tlb_v_nonglobal[mmu_idx][i]) {
+                tlb_invalidate_entry(&env->tlb_v_table[mmu_idx][i]);
+                env->tlb_v_nonglobal[mmu_idx][i] = 0;
+            }
+        }
+    }
+
+    for (i = 0; i < TB_JMP_CACHE_SIZE; i++) {
+        tb = env->tb_jmp_cache[i];
+        if (tb && !tlb_maps_tb(env, tb))
+            env->tb_jmp_cache[i] = NULL;
+    }
+}
+
+/* NOTE: if flush_global is false, entries installed with
+   PAGE_NONGLOBAL are flushed and the others are kept */
 void tlb_flush(CPUState *env, int flush_global)
 {
-    int i;
+    tlb_flush_cause(env, flush_global, TLB_FLUSH_OTHER);
+}
+
+void tlb_flush_cause(CPUState *env, int flush_global, int cause)
+{
+    int i, mmu_idx;
 
 #if defined(DEBUG_TLB)
-    printf("tlb_flush:\n");
+    printf("tlb_flush: global=%d cause=%d\n", flush_global, cause);
 #endif
     /* must reset current TB so that interrupts cannot modify the
        links while we are modifying them */
     env->current_tb = NULL;
+    tlb_stats.flush[cause]++;
+
+    if (!flush_global) {
+        tlb_flush_nonglobal(env);
+        tlb_stats.flush_nonglobal++;
+#ifdef USE_KQEMU
+        if (env->kqemu_enabled) {
+            kqemu_flush(env, flush_global);
+        }
+#endif
+        return;
+    }
 
     for(i = 0; i < CPU_TLB_SIZE; i++) {
         env->tlb_table[0][i].addr_read = -1;
@@ -1655,6 +1912,10 @@ void tlb_flush(CPUState *env, int flush_global)
 #endif
 #endif
     }
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        for (i = 0; i < CPU_VTLB_SIZE; i++)
+            tlb_invalidate_entry(&env->tlb_v_table[mmu_idx][i]);
+    }
 
     memset (env->tb_jmp_cache, 0, TB_JMP_CACHE_SIZE * sizeof (void *));
 
@@ -1666,23 +1927,25 @@ void tlb_flush(CPUState *env, int flush_global)
     tlb_flush_count++;
 }
 
+static inline int tlb_entry_matches(CPUTLBEntry *tlb_entry, target_ulong addr)
+{
+    return addr == (tlb_entry->addr_read &
+                    (TARGET_PAGE_MASK | TLB_INVALID_MASK)) ||
+           addr == (tlb_entry->addr_write &
+                    (TARGET_PAGE_MASK | TLB_INVALID_MASK)) ||
+           addr == (tlb_entry->addr_code &
+                    (TARGET_PAGE_MASK | TLB_INVALID_MASK));
+}
+
 static inline void tlb_flush_entry(CPUTLBEntry *tlb_entry, target_ulong addr)
 {
-    if (addr == (tlb_entry->addr_read &
-                 (TARGET_PAGE_MASK | TLB_INVALID_MASK)) ||
-        addr == (tlb_entry->addr_write &
-                 (TARGET_PAGE_MASK | TLB_INVALID_MASK)) ||
-        addr == (tlb_entry->addr_code &
-                 (TARGET_PAGE_MASK | TLB_INVALID_MASK))) {
-        tlb_entry->addr_read = -1;
-        tlb_entry->addr_write = -1;
-        tlb_entry->addr_code = -1;
-    }
+    if (tlb_entry_matches(tlb_entry, addr))
+        tlb_invalidate_entry(tlb_entry);
 }
 
 void tlb_flush_page(CPUState *env, target_ulong addr)
 {
-    int i;
+    int i, mmu_idx;
 
 #if defined(DEBUG_TLB)
     printf("tlb_flush_page: " TARGET_FMT_lx "\n", addr);
@@ -1701,8 +1964,13 @@ void tlb_flush_page(CPUState *env, target_ulong addr)
     tlb_flush_entry(&env->tlb_table[3][i], addr);
 #endif
 #endif
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        for (i = 0; i < CPU_VTLB_SIZE; i++)
+            tlb_flush_entry(&env->tlb_v_table[mmu_idx][i], addr);
+    }
 
     tlb_flush_jmp_cache(env, addr);
+    tlb_stats.flush_page++;
 
 #ifdef USE_KQEMU
     if (env->kqemu_enabled) {
@@ -1745,7 +2013,7 @@ void cpu_physical_memory_reset_dirty(ram_addr_t start, ram_addr_t end,
 {
     CPUState *env;
     unsigned long length, start1;
-    int i, mask, len;
+    int i, mask, len, mmu_idx;
     uint8_t *p;
 
     start &= TARGET_PAGE_MASK;
@@ -1788,6 +2056,11 @@ void cpu_physical_memory_reset_dirty(ram_addr_t start, ram_addr_t end,
             tlb_reset_dirty_range(&env->tlb_table[3][i], start1, length);
 #endif
 #endif
+        for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+            for (i = 0; i < CPU_VTLB_SIZE; i++)
+                tlb_reset_dirty_range(&env->tlb_v_table[mmu_idx][i],
+                                      start1, length);
+        }
     }
 }
 
@@ -1807,7 +2080,7 @@ static inline void tlb_update_dirty(CPUTLBEntry *tlb_entry)
 /* update the TLB according to the current state of the dirty bits */
 void cpu_tlb_update_dirty(CPUState *env)
 {
-    int i;
+    int i, mmu_idx;
     for(i = 0; i < CPU_TLB_SIZE; i++)
         tlb_update_dirty(&env->tlb_table[0][i]);
     for(i = 0; i < CPU_TLB_SIZE; i++)
@@ -1820,6 +2093,10 @@ void cpu_tlb_update_dirty(CPUState *env)
         tlb_update_dirty(&env->tlb_table[3][i]);
 #endif
 #endif
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        for (i = 0; i < CPU_VTLB_SIZE; i++)
+            tlb_update_dirty(&env->tlb_v_table[mmu_idx][i]);
+    }
 }
 
 static inline void tlb_set_dirty1(CPUTLBEntry *tlb_entry, target_ulong vaddr)
@@ -1832,7 +2109,7 @@ static inline void tlb_set_dirty1(CPUTLBEntry *tlb_entry, target_ulong vaddr)
    so that it is no longer dirty */
 static inline void tlb_set_dirty(CPUState *env, target_ulong vaddr)
 {
-    int i;
+    int i, mmu_idx;
 
     vaddr &= TARGET_PAGE_MASK;
     i = (vaddr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
@@ -1844,6 +2121,45 @@ static inline void tlb_set_dirty(CPUState *env, target_ulong vaddr)
     tlb_set_dirty1(&env->tlb_table[3][i], vaddr);
 #endif
 #endif
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        for (i = 0; i < CPU_VTLB_SIZE; i++)
+            tlb_set_dirty1(&env->tlb_v_table[mmu_idx][i], vaddr);
+    }
+}
+
+/* Look for 'page' in the victim TLB of 'mmu_idx', the field at 'elt_ofs'
+   in CPUTLBEntry (addr_read, addr_write or addr_code) being compared.
+   On a hit the entry is swapped with the direct mapped one at 'index',
+   so that the next access takes the fast path again.  Returns 1 on hit,
+   0 if tlb_fill() must be called.  */
+int tlb_victim_lookup(CPUState *env, int mmu_idx, int index,
+                      size_t elt_ofs, target_ulong page)
+{
+    CPUTLBEntry *vte, tmp;
+    target_phys_addr_t iotlb;
+    target_ulong cmp;
+    int i, nonglobal;
+
+    tlb_stats.miss[mmu_idx]++;
+    for (i = 0; i < CPU_VTLB_SIZE; i++) {
+        vte = &env->tlb_v_table[mmu_idx][i];
+        cmp = *(target_ulong *)((uint8_t *)vte + elt_ofs);
+        if (page == (cmp & (TARGET_PAGE_MASK | TLB_INVALID_MASK))) {
+            tmp = env->tlb_table[mmu_idx][index];
+            env->tlb_table[mmu_idx][index] = *vte;
+            *vte = tmp;
+            iotlb = env->iotlb[mmu_idx][index];
+            env->iotlb[mmu_idx][index] = env->iotlb_v[mmu_idx][i];
+            env->iotlb_v[mmu_idx][i] = iotlb;
+            nonglobal = env->tlb_nonglobal[mmu_idx][index];
+            env->tlb_nonglobal[mmu_idx][index] =
+                env->tlb_v_nonglobal[mmu_idx][i];
+            env->tlb_v_nonglobal[mmu_idx][i] = nonglobal;
+            tlb_stats.victim_hit[mmu_idx]++;
+            return 1;
+        }
+    }
+    return 0;
 }
 
 /* add a new TLB entry. At most one entry for a given virtual address
@@ -1913,8 +2229,24 @@ int tlb_set_page_exec(CPUState *env, target_ulong vaddr,
     }
 
     index = (vaddr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
-    env->iotlb[mmu_idx][index] = iotlb - vaddr;
     te = &env->tlb_table[mmu_idx][index];
+
+    /* keep the victim TLB free of stale copies of this page, then move
+       the entry we are about to replace into it */
+    for (i = 0; i < CPU_VTLB_SIZE; i++)
+        tlb_flush_entry(&env->tlb_v_table[mmu_idx][i], vaddr);
+    if ((te->addr_read & te->addr_write & te->addr_code &
+         TLB_INVALID_MASK) == 0 && !tlb_entry_matches(te, vaddr)) {
+        i = env->vtlb_index;
+        env->vtlb_index = (i + 1) & (CPU_VTLB_SIZE - 1);
+        env->tlb_v_table[mmu_idx][i] = *te;
+        env->iotlb_v[mmu_idx][i] = env->iotlb[mmu_idx][index];
+        env->tlb_v_nonglobal[mmu_idx][i] = env->tlb_nonglobal[mmu_idx][index];
+    }
+    tlb_stats.refill[mmu_idx]++;
+
+    env->iotlb[mmu_idx][index] = iotlb - vaddr;
+    env->tlb_nonglobal[mmu_idx][index] = (prot & PAGE_NONGLOBAL) != 0;
     te->addend = addend - vaddr;
     if (prot & PAGE_READ) {
         te->addr_read = address;
@@ -1950,6 +2282,10 @@ void tlb_flush(CPUState *env, int flush_global)
 {
 }
 
+void tlb_flush_cause(CPUState *env, int flush_global, int cause)
+{
+}
+
 void tlb_flush_page(CPUState *env, target_ulong addr)
 {
 }
@@ -3174,6 +3510,49 @@ void dump_exec_info(FILE *f,
     cpu_fprintf(f, "TB flush count      %d\n", tb_flush_count);
     cpu_fprintf(f, "TB invalidate count %d\n", tb_phys_invalidate_count);
     cpu_fprintf(f, "TLB flush count     %d\n", tlb_flush_count);
+    if (tb_speculate_enabled) {
+        int64_t translated = tb_spec_stats.translated;
+        cpu_fprintf(f, "TB speculation      queued %" PRId64 " translated %" PRId64
+                    " skipped %" PRId64 "\n",
+                    tb_spec_stats.queued, translated, tb_spec_stats.skipped);
+        cpu_fprintf(f, "                    hits %" PRId64 " (%d%%) wasted %"
+                    PRId64 " (%d%%)\n",
+                    tb_spec_stats.hits,
+                    translated ? (int)(tb_spec_stats.hits * 100 / translated) : 0,
+                    tb_spec_stats.wasted,
+                    translated ? (int)(tb_spec_stats.wasted * 100 / translated) : 0);
+    }
+#if !defined(CONFIG_USER_ONLY)
+    cpu_fprintf(f, "TLB page flushes    %" PRId64 "\n", tlb_stats.flush_page);
+    cpu_fprintf(f, "TLB flushes         other %" PRId64 " mmu ctrl %" PRId64
+                " guest %" PRId64 " context %" PRId64
+                " (%" PRId64 " kept global pages)\n",
+                tlb_stats.flush[TLB_FLUSH_OTHER],
+                tlb_stats.flush[TLB_FLUSH_MMU_CTRL],
+                tlb_stats.flush[TLB_FLUSH_GUEST],
+                tlb_stats.flush[TLB_FLUSH_CONTEXT],
+                tlb_stats.flush_nonglobal);
+    cpu_fprintf(f, "TLB size            %d entries + %d victims per mode\n",
+                CPU_TLB_SIZE, CPU_VTLB_SIZE);
+    for (i = 0; i < NB_MMU_MODES; i++) {
+        int64_t miss = tlb_stats.miss[i];
+        cpu_fprintf(f, "TLB mode %d          miss %" PRId64
+                    " victim hit %" PRId64 " (%d%%) refill %" PRId64 "\n",
+                    i, miss, tlb_stats.victim_hit[i],
+                    miss ? (int)(tlb_stats.victim_hit[i] * 100 / miss) : 0,
+                    tlb_stats.refill[i]);
+    }
+#ifdef CONFIG_PROFILER
+    {
+        int64_t refills = 0;
+        for (i = 0; i < NB_MMU_MODES; i++)
+            refills += tlb_stats.refill[i];
+        cpu_fprintf(f, "TLB refill cycles   %" PRId64 " (avg %0.1f)\n",
+                    tlb_stats.refill_time,
+                    refills ? (double)tlb_stats.refill_time / refills : 0);
+    }
+#endif
+#endif
     tcg_dump_info(f, cpu_fprintf);
 }
 
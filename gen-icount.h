@@ -31,6 +31,27 @@ static inline void gen_icount_start(void)
 #endif
 }
 
+/* count the executions of the block for the block profiler */
+static inline void gen_tb_profile_start(TranslationBlock *tb)
+{
+    TCGv ptr, count;
+
+    if (!tb->profile)
+        return;
+
+#if TCG_TARGET_REG_BITS == 64
+    ptr = tcg_const_i64((tcg_target_long)&tb->profile->count);
+#else
+    ptr = tcg_const_i32((tcg_target_long)&tb->profile->count);
+#endif
+    count = tcg_temp_new(TCG_TYPE_I64);
+    tcg_gen_ld_i64(count, ptr, 0);
+    tcg_gen_addi_i64(count, count, 1);
+    tcg_gen_st_i64(count, ptr, 0);
+    tcg_temp_free(count);
+    tcg_temp_free(ptr);
+}
+
 static void gen_icount_end(TranslationBlock *tb, int num_insns)
 {
     if (use_icount) {
@@ -54,14 +54,43 @@ enum {
 	/* number of bytes available in read buffer */
 	AUDIO_READ_BUFFER_AVAILABLE  = 0x24,
 
+	/* AUDIO_FEATURE_XXX bits supported by the device */
+	AUDIO_FEATURES        = 0x28,
+	/* guest physical address of the output descriptor ring */
+	AUDIO_SET_RING_ADDR   = 0x2C,
+	/* number of descriptors in the ring, a power of 2. 0 leaves ring mode */
+	AUDIO_SET_RING_SIZE   = 0x30,
+	/* driver writes the index following the last queued descriptor */
+	AUDIO_RING_TAIL       = 0x34,
+	/* index of the next descriptor to play */
+	AUDIO_RING_HEAD       = 0x38,
+	/* raise AUDIO_INT_RING_PROGRESS after this many descriptors */
+	AUDIO_SET_IRQ_BATCH   = 0x3C,
+
 	/* AUDIO_INT_STATUS bits */
 
 	/* this bit set when it is safe to write more bytes to the buffer */
 	AUDIO_INT_WRITE_BUFFER_1_EMPTY	= 1U << 0,
 	AUDIO_INT_WRITE_BUFFER_2_EMPTY	= 1U << 1,
 	AUDIO_INT_READ_BUFFER_FULL      = 1U << 2,
+	/* descriptors were played, cleared when the status is read */
+	AUDIO_INT_RING_PROGRESS         = 1U << 3,
+
+	/* AUDIO_FEATURES bits */
+	AUDIO_FEATURE_RING              = 1U << 0,
 };
 
+/* In ring mode, the driver queues any number of buffers in a ring of
+ * descriptors in guest memory, each one made of two little-endian
+ * 32-bit words: the guest physical address of the samples, and their
+ * size in bytes. Indices are free-running and wrap at 2^32. The samples
+ * are read directly from guest memory by the mixer, descriptors that
+ * are contiguous in memory are sent with a single AUD_write(), and one
+ * interrupt is raised every AUDIO_SET_IRQ_BATCH descriptors, or when
+ * the ring becomes empty.
+ */
+#define  AUDIO_RING_MAX_SIZE   1024
+
 
 struct goldfish_audio_state {
     struct goldfish_device dev;
@@ -99,6 +128,17 @@ struct goldfish_audio_state {
     uint8* data_2;
     uint32_t data_2_length;
 
+    // output descriptor ring, used when ring_size is not zero
+    uint32_t ring_addr;
+    uint32_t ring_size;
+    uint32_t ring_head;
+    uint32_t ring_tail;
+    // bytes of the head descriptor already played
+    uint32_t ring_offset;
+    // descriptors played since the last interrupt
+    uint32_t ring_done;
+    uint32_t ring_irq_batch;
+
 
     // for QEMU sound output
     QEMUSoundCard card;
@@ -109,7 +149,7 @@ struct goldfish_audio_state {
 };
 
 /* update this whenever you change the goldfish_audio_state structure */
-#define  AUDIO_STATE_SAVE_VERSION  1
+#define  AUDIO_STATE_SAVE_VERSION  2
 
 #define  QFIELD_STRUCT   struct goldfish_audio_state
 QFIELD_BEGIN(audio_state_fields)
@@ -126,6 +166,13 @@ QFIELD_BEGIN(audio_state_fields)
     QFIELD_INT32(current_buffer),
     QFIELD_INT32(data_1_length),
     QFIELD_INT32(data_2_length),
+    QFIELD_INT32(ring_addr),
+    QFIELD_INT32(ring_size),
+    QFIELD_INT32(ring_head),
+    QFIELD_INT32(ring_tail),
+    QFIELD_INT32(ring_offset),
+    QFIELD_INT32(ring_done),
+    QFIELD_INT32(ring_irq_batch),
 QFIELD_END
 
 static void  audio_state_save( QEMUFile*  f, void* opaque )
@@ -152,14 +199,15 @@ static int   audio_state_load( QEMUFile*  f, void*  opaque, int  version_id )
         s->data_1 = qemu_get_be32(f) + phys_ram_base;
         s->data_2 = qemu_get_be32(f) + phys_ram_base;
     }
-    return -1;
+    return ret;
 }
 
 static void enable_audio(struct goldfish_audio_state *s, int enable)
 {
     // enable or disable the output voice
     if (s->voice != NULL)
-        AUD_set_active_out(s->voice,   (enable & (AUDIO_INT_WRITE_BUFFER_1_EMPTY | AUDIO_INT_WRITE_BUFFER_2_EMPTY)) != 0);
+        AUD_set_active_out(s->voice,   (enable & (AUDIO_INT_WRITE_BUFFER_1_EMPTY | AUDIO_INT_WRITE_BUFFER_2_EMPTY |
+                                                  AUDIO_INT_RING_PROGRESS)) != 0);
 
     if (s->voicein)
         AUD_set_active_in (s->voicein, (enable & AUDIO_INT_READ_BUFFER_FULL) != 0);
@@ -168,6 +216,105 @@ static void enable_audio(struct goldfish_audio_state *s, int enable)
     s->data_2_length = 0;
     s->current_buffer = 0;
     s->read_pos = 0;
+    // the descriptor ring is only reset by AUDIO_SET_RING_SIZE, so that
+    // re-arming interrupts doesn't drop the queued descriptors
+}
+
+static void set_ring_size(struct goldfish_audio_state *s, uint32_t size)
+{
+    if (size > AUDIO_RING_MAX_SIZE || (size & (size - 1)) != 0) {
+        D("%s: invalid ring size %d", __FUNCTION__, size);
+        size = 0;
+    }
+    s->ring_size   = size;
+    s->ring_head   = 0;
+    s->ring_tail   = 0;
+    s->ring_offset = 0;
+    s->ring_done   = 0;
+}
+
+/* read descriptor 'index' of the ring. a descriptor outside of the guest
+ * RAM is returned as empty, so that it is skipped */
+static void ring_get(struct goldfish_audio_state *s, uint32_t index,
+                     uint32_t *addr, uint32_t *length)
+{
+    target_phys_addr_t  desc = s->ring_addr + (index & (s->ring_size - 1)) * 8;
+
+    *addr   = ldl_phys(desc);
+    *length = ldl_phys(desc + 4);
+
+    if (*addr >= ram_size || *length > ram_size - *addr) {
+        D("%s: invalid descriptor %d (0x%x, %d bytes)", __FUNCTION__,
+          index, *addr, *length);
+        *length = 0;
+    }
+}
+
+/* play up to 'free' bytes from the ring, and return the number of
+ * descriptors that were completed */
+static int ring_write(struct goldfish_audio_state *s, int free)
+{
+    int  done = 0;
+
+    while (free > 0 && s->ring_head != s->ring_tail) {
+        uint32_t  index = s->ring_head;
+        uint32_t  addr, length, start, size;
+        int       written = 0;
+
+        ring_get(s, index, &addr, &length);
+        if (s->ring_offset >= length) {
+            /* the guest shrank the head descriptor below what was already
+             * played, or it is empty: retire it */
+            s->ring_offset = 0;
+            s->ring_head++;
+            done++;
+            continue;
+        }
+        start = addr + s->ring_offset;
+        size  = length - s->ring_offset;
+
+        /* merge the following descriptors if they are contiguous */
+        for (index++; size < (uint32_t)free && index != s->ring_tail; index++) {
+            ring_get(s, index, &addr, &length);
+            if (addr != start + size)
+                break;
+            size += length;
+        }
+        if (size > (uint32_t)free)
+            size = free;
+
+        /* ring_get() keeps each descriptor inside the guest RAM, and the
+         * merged ones are contiguous, but check again before reading */
+        if (start >= ram_size || size > ram_size - start) {
+            D("%s: invalid ring span (0x%x, %d bytes)", __FUNCTION__,
+              start, size);
+            s->ring_offset = 0;
+            s->ring_head++;
+            done++;
+            continue;
+        }
+
+        if (size > 0) {
+            written = AUD_write(s->voice, phys_ram_base + start, size);
+            D("%s: sent %d bytes to audio output", __FUNCTION__, written);
+        }
+        free -= written;
+
+        /* retire the descriptors that were entirely played */
+        s->ring_offset += written;
+        while (s->ring_head != s->ring_tail) {
+            ring_get(s, s->ring_head, &addr, &length);
+            if (s->ring_offset < length)
+                break;
+            s->ring_offset -= length;
+            s->ring_head++;
+            done++;
+        }
+
+        if ((uint32_t)written < size)
+            break;
+    }
+    return done;
 }
 
 #if USE_QEMU_AUDIO_IN
@@ -263,6 +410,7 @@ static uint32_t goldfish_audio_read(void *opaque, target_phys_addr_t offset)
             if(ret) {
                 goldfish_device_set_irq(&s->dev, 0, 0);
             }
+            s->int_status &= ~AUDIO_INT_RING_PROGRESS;
             return ret;
 
 	case AUDIO_READ_SUPPORTED:
@@ -279,6 +427,12 @@ static uint32_t goldfish_audio_read(void *opaque, target_phys_addr_t offset)
                s->read_buffer_available);
 	    return s->read_buffer_available;
 
+        case AUDIO_FEATURES:
+            return AUDIO_FEATURE_RING;
+
+        case AUDIO_RING_HEAD:
+            return s->ring_head;
+
         default:
             cpu_abort (cpu_single_env, "goldfish_audio_read: Bad offset %x\n", offset);
             return 0;
@@ -335,6 +489,29 @@ static void goldfish_audio_write(void *opaque, target_phys_addr_t offset, uint32
             goldfish_device_set_irq(&s->dev, 0, (s->int_status & s->int_enable));
             break;
 
+        case AUDIO_SET_RING_ADDR:
+            s->ring_addr = val;
+            break;
+
+        case AUDIO_SET_RING_SIZE:
+            D( "%s: AUDIO_SET_RING_SIZE %d", __FUNCTION__, val );
+            set_ring_size(s, val);
+            break;
+
+        case AUDIO_RING_TAIL:
+            /* ignore descriptors that would overwrite the queued ones */
+            if (s->ring_size == 0 || val - s->ring_head > s->ring_size) {
+                D( "%s: invalid AUDIO_RING_TAIL %d (head %d)", __FUNCTION__,
+                   val, s->ring_head );
+                break;
+            }
+            s->ring_tail = val;
+            break;
+
+        case AUDIO_SET_IRQ_BATCH:
+            s->ring_irq_batch = val;
+            break;
+
         default:
             cpu_abort (cpu_single_env, "goldfish_audio_write: Bad offset %x\n", offset);
     }
@@ -345,6 +522,18 @@ static void goldfish_audio_callback(void *opaque, int free)
     struct goldfish_audio_state *s = opaque;
     int new_status = 0;
 
+    if (s->ring_size) {
+        int  done = ring_write(s, free);
+
+        if (done) {
+            s->ring_done += done;
+            if (s->ring_done >= s->ring_irq_batch || s->ring_head == s->ring_tail) {
+                s->ring_done = 0;
+                new_status |= AUDIO_INT_RING_PROGRESS;
+            }
+        }
+    }
+
     /* loop until free is zero or both buffers are empty */
     while (free && s->current_buffer) {
 
@@ -14,6 +14,7 @@
 #include "mmc.h"
 #include "sd.h"
 #include "block.h"
+#include "ram-restore.h"
 
 enum {
     /* status register */
@@ -317,6 +318,7 @@ static void goldfish_mmc_do_command(struct goldfish_mmc_state *s, uint32_t cmd,
                 if (arg & 511) fprintf(stderr, "offset %d is not multiple of 512 when reading\n", arg);
                 arg /= s->block_length;
             }
+            ram_restore_touch(s->buffer, s->block_count * 512);
             result = bdrv_read(s->bs, arg, s->buffer, s->block_count);
             new_status |= MMC_STAT_END_OF_DATA;
             s->resp[0] = SET_R1_CURRENT_STATE(4) | R1_READY_FOR_DATA; // 2304
@@ -335,6 +337,7 @@ static void goldfish_mmc_do_command(struct goldfish_mmc_state *s, uint32_t cmd,
                 arg /= s->block_length;
             }
             // arg is byte offset
+            ram_restore_touch(s->buffer, s->block_count * 512);
             result = bdrv_write(s->bs, arg, s->buffer, s->block_count);
 //            bdrv_flush(s->bs);
             new_status |= MMC_STAT_END_OF_DATA;
@@ -634,3 +634,135 @@ bad_arg_and_value:
     exit(1);
 }
 
+
+/* Writable NAND images of a running emulator can be saved to a directory
+ * as nand-<devname>.img files, and later loaded in other instances which
+ * are cloned from it. The files are cloned (reflinked) when the host file
+ * system supports it, which makes both operations immediate and lets the
+ * instances share the unmodified blocks, and copied otherwise.
+ *
+ * Since the clones usually run with the same options, a clone doesn't
+ * write to the images given on its command line: each writable device
+ * gets a private copy in the same directory, which is unlinked as soon
+ * as it is opened and thus discarded when the instance exits.
+ */
+#if defined(__linux__) && !defined(FICLONE)
+#  include <sys/ioctl.h>
+#  define  FICLONE  _IOW(0x94, 9, int)
+#endif
+
+static int nand_copy_fd(nand_dev *dev, int dst, int src)
+{
+    int64_t size = 0;
+    int len;
+
+#ifdef FICLONE
+    if (ioctl(dst, FICLONE, src) == 0)
+        return 0;
+#endif
+    if (lseek(src, 0, SEEK_SET) < 0 || lseek(dst, 0, SEEK_SET) < 0)
+        return -1;
+    for (;;) {
+        len = do_read(src, dev->data, dev->erase_size);
+        if (len < 0)
+            return -1;
+        if (len == 0)
+            break;
+        if (do_write(dst, dev->data, len) != len)
+            return -1;
+        size += len;
+    }
+    return ftruncate(dst, size);
+}
+
+static char *nand_image_path(nand_dev *dev, const char *dir)
+{
+    size_t len = strlen(dir) + dev->devname_len + 16;
+    char *path = malloc(len);
+
+    if (path != NULL)
+        snprintf(path, len, "%s/nand-%.*s.img", dir,
+                 (int)dev->devname_len, dev->devname);
+    return path;
+}
+
+int nand_save_images(const char *dir)
+{
+    uint32_t i;
+    int ret = 0;
+
+    for (i = 0; i < nand_dev_count; i++) {
+        nand_dev *dev = &nand_devs[i];
+        char *path;
+        int fd;
+
+        if (dev->flags & NAND_DEV_FLAG_READ_ONLY)
+            continue;
+        path = nand_image_path(dev, dir);
+        if (path == NULL)
+            return -1;
+        fd = open(path, O_BINARY | O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0 || nand_copy_fd(dev, fd, dev->fd) < 0) {
+            XLOG("could not save %s: %s\n", path, strerror(errno));
+            ret = -1;
+        }
+        if (fd >= 0)
+            close(fd);
+        free(path);
+    }
+    return ret;
+}
+
+int nand_load_images(const char *dir)
+{
+#ifdef _WIN32
+    XLOG("NAND images can't be cloned on this host\n");
+    return -1;
+#else
+    uint32_t i;
+    int ret = 0;
+
+    for (i = 0; i < nand_dev_count; i++) {
+        nand_dev *dev = &nand_devs[i];
+        char *path, *copy;
+        int fd, copy_fd = -1;
+
+        if (dev->flags & NAND_DEV_FLAG_READ_ONLY)
+            continue;
+        path = nand_image_path(dev, dir);
+        if (path == NULL)
+            return -1;
+        copy = malloc(strlen(path) + 8);
+        if (copy == NULL) {
+            free(path);
+            return -1;
+        }
+        sprintf(copy, "%s.XXXXXX", path);
+
+        fd = open(path, O_BINARY | O_RDONLY);
+        if (fd >= 0)
+            copy_fd = mkstemp(copy);
+        if (copy_fd >= 0)
+            unlink(copy);
+        if (fd < 0 || copy_fd < 0 || nand_copy_fd(dev, copy_fd, fd) < 0) {
+            XLOG("could not load %s: %s\n", path, strerror(errno));
+            if (copy_fd >= 0)
+                close(copy_fd);
+            ret = -1;
+        } else {
+            /* the image given on the command line is left untouched */
+            atexit_close_fd_remove(dev->fd);
+            close(dev->fd);
+            dev->fd = copy_fd;
+            if (VERBOSE_CHECK(init))
+                dprint("loaded '%.*s' NAND image from %s",
+                       (int)dev->devname_len, dev->devname, path);
+        }
+        if (fd >= 0)
+            close(fd);
+        free(copy);
+        free(path);
+    }
+    return ret;
+#endif
+}
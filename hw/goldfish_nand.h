@@ -15,6 +15,12 @@
 void nand_dev_init(uint32_t base);
 void nand_add_dev(const char *arg);
 
+/* save the content of the writable NAND devices to nand-<devname>.img
+ * files in 'dir', or switch them to private copies of these files.
+ * returns -1 on error */
+int  nand_save_images(const char *dir);
+int  nand_load_images(const char *dir);
+
 typedef struct {
     uint64_t     limit;
     uint64_t     counter;
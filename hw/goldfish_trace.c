@@ -15,6 +15,7 @@
  */
 #include "qemu_file.h"
 #include "goldfish_trace.h"
+#include "tb-profile.h"
 
 //#define DEBUG   1
 
@@ -147,6 +148,7 @@ static void trace_dev_write(void *opaque, target_phys_addr_t offset, uint32_t va
     case TRACE_DEV_REG_DYN_SYM:         // add dynamic symbol
         vstrcpy(value, arg, CLIENT_PAGE_SIZE);
         trace_dynamic_symbol_add(dsaddr, arg);
+        tb_profile_symbol_add(dsaddr, arg);
 #ifdef DEBUG
         printf("QEMU.trace: dynamic symbol %lx:%s\n", dsaddr, arg);
 #endif
@@ -154,6 +156,7 @@ static void trace_dev_write(void *opaque, target_phys_addr_t offset, uint32_t va
         break;
     case TRACE_DEV_REG_REMOVE_ADDR:         // remove dynamic symbol addr
         trace_dynamic_symbol_remove(value);
+        tb_profile_symbol_remove(value);
 #ifdef DEBUG
         printf("QEMU.trace: dynamic symbol remove %lx\n", dsaddr);
 #endif
@@ -37,6 +37,9 @@
 #include "cpu-defs.h"
 #include <dirent.h>
 #include "qemu-timer.h"
+#include "tb-profile.h"
+#include "ram-restore.h"
+#include "savevm-stream.h"
 
 //#define DEBUG
 //#define DEBUG_COMPLETION
@@ -338,6 +341,18 @@ static void do_info_jit(void)
     dump_exec_info(NULL, monitor_fprintf);
 }
 
+#ifdef HAS_AUDIO
+static void do_info_audio(void)
+{
+    AUD_show_stats(NULL, monitor_fprintf);
+}
+#endif
+
+static void do_info_tbprofile(void)
+{
+    tb_profile_dump(NULL, monitor_fprintf, 30);
+}
+
 static void do_info_history (void)
 {
     int i;
@@ -1357,6 +1372,12 @@ static term_cmd_t term_cmds[] = {
     { "loadvm", "F", do_loadvm,
       "filename", "restore the whole virtual machine state from 'filename'" },
 #endif
+    { "savevm_file", "F", do_savevm_file,
+      "filename", "save the virtual machine state to a standalone file" },
+    { "loadvm_file", "F", do_loadvm_file,
+      "filename", "restore the virtual machine state from a file written by savevm_file" },
+    { "clone_save", "F", do_clone_save,
+      "dir", "save the state of the virtual machine to 'dir', for instances started with -clone-from" },
     { "stop", "", do_stop,
       "", "stop emulation", },
     { "c|cont", "", do_cont,
@@ -1429,6 +1450,12 @@ static term_cmd_t info_cmds[] = {
 #endif
     { "jit", "", do_info_jit,
       "", "show dynamic compiler info", },
+    { "tbprofile", "", do_info_tbprofile,
+      "", "show the most executed translated blocks", },
+    { "ramrestore", "", ram_restore_info,
+      "", "show the progress of the snapshot RAM restore", },
+    { "savevm", "", snapshot_stream_info,
+      "", "show statistics about the last snapshot file saved or loaded", },
     { "kqemu", "", do_info_kqemu,
       "", "show kqemu information", },
     { "usb", "", usb_info,
@@ -1439,6 +1466,10 @@ static term_cmd_t info_cmds[] = {
       "", "show profiling information", },
     { "capture", "", do_info_capture,
       "show capture information" },
+#ifdef HAS_AUDIO
+    { "audio", "", do_info_audio,
+      "", "show audio latency and underrun statistics", },
+#endif
     { NULL, NULL, },
 };
 
@@ -214,6 +214,165 @@ void qemu_vfree(void *ptr)
 
 #endif
 
+#ifdef _WIN32
+
+void *qemu_ram_vmalloc(size_t size, const char *mem_path, int hugepages)
+{
+    if (mem_path || hugepages)
+        fprintf(stderr, "warning: -mem-path and -mem-hugepages are not "
+                "supported on this host\n");
+    return qemu_vmalloc(size);
+}
+
+#else
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/vfs.h>
+#define HUGETLBFS_MAGIC 0x958458f6
+#endif
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+#define QEMU_HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+/* back the RAM with an unlinked file created in directory 'dir' */
+static void *ram_dir_alloc(size_t size, const char *dir)
+{
+    char filename[1024];
+    size_t align = getpagesize();
+    void *area;
+    int fd;
+#ifdef __linux__
+    struct statfs fs;
+
+    /* hugetlbfs files must be sized in huge pages */
+    if (statfs(dir, &fs) == 0 && fs.f_type == HUGETLBFS_MAGIC)
+        align = fs.f_bsize;
+#endif
+
+    snprintf(filename, sizeof(filename), "%s/qemu_ram.XXXXXX", dir);
+    fd = mkstemp(filename);
+    if (fd < 0) {
+        fprintf(stderr, "Could not create memory file in '%s': %s\n",
+                dir, strerror(errno));
+        return NULL;
+    }
+    unlink(filename);
+
+    size = (size + align - 1) & ~(align - 1);
+    if (ftruncate(fd, size) < 0) {
+        fprintf(stderr, "Could not size memory file in '%s': %s\n",
+                dir, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+    area = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (area == MAP_FAILED) {
+        fprintf(stderr, "Could not map memory file in '%s': %s\n",
+                dir, strerror(errno));
+        return NULL;
+    }
+    return area;
+}
+
+/* map 'path' privately at the start of the RAM, the rest (if the file
+   is shorter) being anonymous memory */
+static void *ram_file_alloc(size_t size, const char *path, off_t file_size)
+{
+    size_t page = getpagesize();
+    size_t len;
+    void *area, *map;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Could not open memory file '%s': %s\n",
+                path, strerror(errno));
+        return NULL;
+    }
+    area = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (area == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+    len = file_size < (off_t)size ? (size_t)file_size : size;
+    len = (len + page - 1) & ~(page - 1);
+    if (len > 0) {
+        map = mmap(area, len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_FIXED, fd, 0);
+        if (map == MAP_FAILED) {
+            fprintf(stderr, "Could not map memory file '%s': %s\n",
+                    path, strerror(errno));
+            munmap(area, size);
+            area = NULL;
+        }
+    }
+    close(fd);
+    return area;
+}
+
+/* anonymous memory aligned on huge pages, and flagged for transparent
+   huge pages where the kernel supports them */
+static void *ram_hugepage_alloc(size_t size)
+{
+    uint8_t *area, *start;
+    size_t head;
+
+    area = mmap(NULL, size + QEMU_HUGEPAGE_SIZE, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (area == MAP_FAILED)
+        return NULL;
+    start = (uint8_t *)(((unsigned long)area + QEMU_HUGEPAGE_SIZE - 1) &
+                        ~(unsigned long)(QEMU_HUGEPAGE_SIZE - 1));
+    head = start - area;
+    if (head)
+        munmap(area, head);
+    munmap(start + size, QEMU_HUGEPAGE_SIZE - head);
+#ifdef MADV_HUGEPAGE
+    if (madvise(start, size, MADV_HUGEPAGE) < 0)
+        fprintf(stderr, "warning: transparent huge pages unavailable: %s\n",
+                strerror(errno));
+#else
+    fprintf(stderr, "warning: transparent huge pages not supported by "
+            "this build\n");
+#endif
+    return start;
+}
+
+/* Allocate the guest RAM.  When 'mem_path' is a directory (typically a
+   hugetlbfs mount) the RAM is backed by an unlinked file created in it.
+   When it is a regular file, the file is mapped privately: its content
+   is the initial RAM content, and its pages are shared with the page
+   cache, and thus with other instances mapping the same file, until
+   they are written.  Otherwise, 'hugepages' asks for anonymous memory
+   using transparent huge pages.  */
+void *qemu_ram_vmalloc(size_t size, const char *mem_path, int hugepages)
+{
+    struct stat st;
+
+    if (mem_path) {
+        if (stat(mem_path, &st) < 0) {
+            fprintf(stderr, "Could not access memory path '%s': %s\n",
+                    mem_path, strerror(errno));
+            return NULL;
+        }
+        if (S_ISDIR(st.st_mode))
+            return ram_dir_alloc(size, mem_path);
+        return ram_file_alloc(size, mem_path, st.st_size);
+    }
+    if (hugepages)
+        return ram_hugepage_alloc(size);
+    return qemu_vmalloc(size);
+}
+
+#endif
+
 int qemu_create_pidfile(const char *filename)
 {
     char buffer[128];
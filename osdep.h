@@ -71,6 +71,7 @@
 void *qemu_memalign(size_t alignment, size_t size);
 void *qemu_vmalloc(size_t size);
 void qemu_vfree(void *ptr);
+void *qemu_ram_vmalloc(size_t size, const char *mem_path, int hugepages);
 
 int qemu_create_pidfile(const char *filename);
 
@@ -0,0 +1,428 @@
+/* Copyright (C) 2009 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+#include "qemu-common.h"
+#include "console.h"
+#include "qemu-timer.h"
+#include "ram-restore.h"
+
+#include <zlib.h>
+#ifndef _WIN32
+#include <signal.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#endif
+
+/* the background restore decompresses RESTORE_BATCH chunks every
+ * RESTORE_PERIOD_MS milliseconds */
+#define  RESTORE_BATCH       16
+#define  RESTORE_PERIOD_MS   5
+
+int ram_restore_lazy;
+
+typedef struct {
+    uint8_t*    base;
+    size_t      size;
+    int         chunk_size;
+    int         nb_chunks;
+    RamChunk*   chunks;
+    uint8_t*    data;
+    size_t      data_size;
+    /* one byte per chunk, NULL when no lazy restore is in progress */
+    uint8_t*    restored;
+    int         nb_missing;
+    int         next;        /* next chunk for the background restore */
+    QEMUTimer*  timer;
+
+    /* statistics of the last restore */
+    int         lazy;
+    int         faults;      /* chunks restored on first access */
+    int         touched;     /* ... before being used by a system call */
+    int         prefetched;  /* ... in the background */
+    int64_t     start_ms;
+    int64_t     resume_ms;
+    int64_t     end_ms;
+} RamRestore;
+
+static RamRestore  rr;
+
+/* inflate() only allocates its window when the output doesn't fit in a
+ * single call, so restoring a chunk with Z_FINISH never calls malloc and
+ * is safe in the signal handler */
+static z_stream    rr_inflate;
+static int         rr_inflate_ready;
+
+static z_stream    rr_deflate;
+static int         rr_deflate_ready;
+
+int ram_chunk_is_zero(const uint8_t *p, int len)
+{
+    const unsigned long*  w = (const unsigned long*)p;
+    int                   i, n = len / sizeof(long);
+
+    for (i = 0; i < n; i++) {
+        if (w[i] != 0)
+            return 0;
+    }
+    for (i = n * sizeof(long); i < len; i++) {
+        if (p[i] != 0)
+            return 0;
+    }
+    return 1;
+}
+
+int ram_chunk_compress(uint8_t *dst, const uint8_t *src, int len)
+{
+    if (ram_chunk_is_zero(src, len))
+        return 0;
+
+    if (!rr_deflate_ready) {
+        if (deflateInit(&rr_deflate, 1) != Z_OK)
+            goto store;
+        rr_deflate_ready = 1;
+    } else {
+        deflateReset(&rr_deflate);
+    }
+    rr_deflate.next_in   = (Bytef*)src;
+    rr_deflate.avail_in  = len;
+    rr_deflate.next_out  = dst;
+    rr_deflate.avail_out = len - 1;
+    if (deflate(&rr_deflate, Z_FINISH) == Z_STREAM_END)
+        return len - 1 - rr_deflate.avail_out;
+store:
+    memcpy(dst, src, len);
+    return len;
+}
+
+static int ram_chunk_len(int n)
+{
+    size_t  start = (size_t)n * rr.chunk_size;
+
+    if (rr.size - start < (size_t)rr.chunk_size)
+        return rr.size - start;
+    return rr.chunk_size;
+}
+
+static int ram_chunk_restore(int n)
+{
+    RamChunk*  c   = &rr.chunks[n];
+    uint8_t*   dst = rr.base + (size_t)n * rr.chunk_size;
+    int        len = ram_chunk_len(n);
+
+    if (c->length == 0) {
+        memset(dst, 0, len);
+        return 0;
+    }
+    if (c->length == (uint32_t)len) {
+        memcpy(dst, rr.data + c->offset, len);
+        return 0;
+    }
+    if (inflateReset(&rr_inflate) != Z_OK)
+        return -1;
+    rr_inflate.next_in   = rr.data + c->offset;
+    rr_inflate.avail_in  = c->length;
+    rr_inflate.next_out  = dst;
+    rr_inflate.avail_out = len;
+    if (inflate(&rr_inflate, Z_FINISH) != Z_STREAM_END ||
+        rr_inflate.avail_out != 0)
+        return -1;
+    return 0;
+}
+
+static void ram_restore_free(void)
+{
+    qemu_free(rr.chunks);
+    qemu_free(rr.data);
+    qemu_free(rr.restored);
+    rr.chunks   = NULL;
+    rr.data     = NULL;
+    rr.restored = NULL;
+    if (rr.timer) {
+        qemu_del_timer(rr.timer);
+        qemu_free_timer(rr.timer);
+        rr.timer = NULL;
+    }
+}
+
+#ifndef _WIN32
+
+static struct sigaction  rr_old_segv;
+static struct sigaction  rr_old_bus;
+
+/* the thread that started the lazy restore, the only one allowed to
+ * touch the guest RAM until it completes */
+static pthread_t         rr_thread;
+
+static size_t ram_page_round(size_t len)
+{
+    size_t  page = getpagesize();
+
+    return (len + page - 1) & ~(page - 1);
+}
+
+/* this can be called from the fault handler, so no stdio */
+static void ram_lazy_fatal(const char *msg, size_t len)
+{
+    if (write(2, msg, len) < 0) {
+        /* nothing more we can do */
+    }
+    abort();
+}
+
+#define  RAM_LAZY_FATAL(msg)  ram_lazy_fatal(msg, sizeof(msg) - 1)
+
+/* restore chunk 'n' of a lazy restore, which must be missing */
+static void ram_lazy_restore_chunk(int n)
+{
+    uint8_t*  dst = rr.base + (size_t)n * rr.chunk_size;
+
+    if (mprotect(dst, ram_page_round(ram_chunk_len(n)),
+                 PROT_READ | PROT_WRITE) < 0 ||
+        ram_chunk_restore(n) < 0) {
+        /* the guest can't continue with a hole in its memory */
+        RAM_LAZY_FATAL("qemu: could not restore RAM from snapshot\n");
+    }
+    rr.restored[n] = 1;
+    if (--rr.nb_missing == 0)
+        rr.end_ms = qemu_get_clock(rt_clock);
+}
+
+static void ram_lazy_fault(int sig, siginfo_t *info, void *puc)
+{
+    uint8_t*  addr = info->si_addr;
+
+    if (rr.restored != NULL && addr >= rr.base && addr < rr.base + rr.size) {
+        int  n = (addr - rr.base) / rr.chunk_size;
+
+        if (!rr.restored[n]) {
+            /* the chunk is made accessible before it is decompressed,
+             * so another thread could see it half-written, and the
+             * restore state isn't locked */
+            if (!pthread_equal(pthread_self(), rr_thread))
+                RAM_LAZY_FATAL("qemu: guest RAM accessed by another thread "
+                               "during a lazy restore\n");
+            ram_lazy_restore_chunk(n);
+            rr.faults++;
+            return;
+        }
+    }
+    /* not ours: the access will fault again and go to the previous
+     * handler, which usually means the default action */
+    sigaction(sig, sig == SIGSEGV ? &rr_old_segv : &rr_old_bus, NULL);
+}
+
+static void ram_lazy_done(void)
+{
+    ram_restore_free();
+    sigaction(SIGSEGV, &rr_old_segv, NULL);
+    sigaction(SIGBUS, &rr_old_bus, NULL);
+}
+
+static void ram_lazy_tick(void *opaque)
+{
+    int  count = 0;
+
+    while (rr.nb_missing > 0 && count < RESTORE_BATCH) {
+        if (!rr.restored[rr.next]) {
+            ram_lazy_restore_chunk(rr.next);
+            rr.prefetched++;
+            count++;
+        }
+        rr.next++;
+    }
+    if (rr.nb_missing == 0) {
+        ram_lazy_done();
+        return;
+    }
+    qemu_mod_timer(rr.timer, qemu_get_clock(rt_clock) + RESTORE_PERIOD_MS);
+}
+
+/* stop a lazy restore that is still in progress, leaving the missing
+ * chunks undefined */
+static void ram_lazy_cancel(void)
+{
+    if (rr.restored == NULL)
+        return;
+    mprotect(rr.base, ram_page_round(rr.size), PROT_READ | PROT_WRITE);
+    ram_lazy_done();
+}
+
+static int ram_lazy_start(void)
+{
+    struct sigaction  act;
+    size_t            page = getpagesize();
+
+    /* chunks must be protected independently, which isn't possible
+     * with huge pages */
+    if ((rr.chunk_size % page) != 0 || ((unsigned long)rr.base % page) != 0)
+        return -1;
+    if (mprotect(rr.base, rr.chunk_size, PROT_NONE) < 0)
+        return -1;
+    if (mprotect(rr.base, rr.chunk_size, PROT_READ | PROT_WRITE) < 0)
+        return -1;
+
+    rr.restored   = qemu_mallocz(rr.nb_chunks);
+    rr.nb_missing = rr.nb_chunks;
+    rr.next       = 0;
+    rr_thread     = pthread_self();
+
+    memset(&act, 0, sizeof(act));
+    sigfillset(&act.sa_mask);
+    act.sa_flags     = SA_SIGINFO;
+    act.sa_sigaction = ram_lazy_fault;
+    sigaction(SIGSEGV, &act, &rr_old_segv);
+    /* some hosts report protection faults with SIGBUS */
+    sigaction(SIGBUS, &act, &rr_old_bus);
+
+    mprotect(rr.base, ram_page_round(rr.size), PROT_NONE);
+
+    rr.timer = qemu_new_timer(rt_clock, ram_lazy_tick, NULL);
+    qemu_mod_timer(rr.timer, qemu_get_clock(rt_clock) + RESTORE_PERIOD_MS);
+    return 0;
+}
+
+void ram_restore_touch(const void *ptr, size_t len)
+{
+    const uint8_t*  p = ptr;
+    int             n, last;
+
+    if (rr.restored == NULL || len == 0)
+        return;
+    if (p + len <= rr.base || p >= rr.base + rr.size)
+        return;
+    if (p < rr.base) {
+        len -= rr.base - p;
+        p = rr.base;
+    }
+    if (p + len > rr.base + rr.size)
+        len = rr.base + rr.size - p;
+
+    last = (p + len - 1 - rr.base) / rr.chunk_size;
+    for (n = (p - rr.base) / rr.chunk_size; n <= last; n++) {
+        if (!rr.restored[n]) {
+            ram_lazy_restore_chunk(n);
+            rr.touched++;
+        }
+    }
+}
+
+void ram_restore_finish(void)
+{
+    int  n;
+
+    if (rr.restored == NULL)
+        return;
+    for (n = 0; n < rr.nb_chunks; n++) {
+        if (!rr.restored[n]) {
+            ram_lazy_restore_chunk(n);
+            rr.prefetched++;
+        }
+    }
+    ram_lazy_done();
+}
+
+#else /* _WIN32 */
+
+static void ram_lazy_cancel(void)
+{
+}
+
+static int ram_lazy_start(void)
+{
+    return -1;
+}
+
+void ram_restore_touch(const void *ptr, size_t len)
+{
+}
+
+void ram_restore_finish(void)
+{
+}
+
+#endif /* _WIN32 */
+
+int ram_restore(uint8_t *base, size_t size, int chunk_size,
+                RamChunk *chunks, int nb_chunks,
+                uint8_t *data, size_t data_size)
+{
+    int  n;
+
+    ram_lazy_cancel();
+
+    rr.base       = base;
+    rr.size       = size;
+    rr.chunk_size = chunk_size;
+    rr.nb_chunks  = nb_chunks;
+    rr.chunks     = chunks;
+    rr.data       = data;
+    rr.data_size  = data_size;
+    rr.faults     = 0;
+    rr.touched    = 0;
+    rr.prefetched = 0;
+    rr.start_ms   = qemu_get_clock(rt_clock);
+
+    for (n = 0; n < nb_chunks; n++) {
+        RamChunk*  c = &chunks[n];
+
+        if (c->length > (uint32_t)ram_chunk_len(n) ||
+            c->offset > data_size || c->length > data_size - c->offset)
+            goto fail;
+    }
+
+    if (!rr_inflate_ready) {
+        if (inflateInit(&rr_inflate) != Z_OK)
+            goto fail;
+        rr_inflate_ready = 1;
+    }
+
+    rr.lazy = ram_restore_lazy && ram_lazy_start() == 0;
+    if (!rr.lazy) {
+        for (n = 0; n < nb_chunks; n++) {
+            if (ram_chunk_restore(n) < 0)
+                goto fail;
+        }
+        ram_restore_free();
+    }
+    rr.resume_ms = qemu_get_clock(rt_clock);
+    if (!rr.lazy)
+        rr.end_ms = rr.resume_ms;
+    return 0;
+
+fail:
+    ram_restore_free();
+    return -1;
+}
+
+void ram_restore_info(void)
+{
+    int64_t  now = qemu_get_clock(rt_clock);
+
+    if (rr.start_ms == 0) {
+        term_printf("no snapshot RAM restored\n");
+        return;
+    }
+    term_printf("ram restore: %s, %d chunks of %dKB",
+                rr.lazy ? "lazy" : "eager", rr.nb_chunks, rr.chunk_size >> 10);
+    if (rr.lazy)
+        term_printf(", %d on access, %d before I/O, %d in background",
+                    rr.faults, rr.touched, rr.prefetched);
+    if (rr.restored != NULL)
+        term_printf(", %d missing", rr.nb_missing);
+    term_printf("\n");
+    term_printf("ram restore: resumed after %" PRId64 " ms",
+                rr.resume_ms - rr.start_ms);
+    if (rr.restored != NULL)
+        term_printf(", in progress for %" PRId64 " ms\n", now - rr.start_ms);
+    else
+        term_printf(", complete after %" PRId64 " ms\n",
+                    rr.end_ms - rr.start_ms);
+}
@@ -0,0 +1,69 @@
+/* Copyright (C) 2009 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+#ifndef RAM_RESTORE_H
+#define RAM_RESTORE_H
+
+#include <stddef.h>
+#include <inttypes.h>
+
+/* Snapshots store the guest RAM as independently compressed chunks, so
+ * that it can be restored in any order. In lazy mode, the whole RAM is
+ * made inaccessible when a snapshot is loaded and the guest resumes
+ * immediately: each chunk is decompressed by the SIGSEGV handler the
+ * first time it is touched, while a timer restores the remaining ones
+ * in the background.
+ *
+ * The restore isn't thread-safe: until it completes, only the thread
+ * that loaded the snapshot may touch the guest RAM, and the fault
+ * handler aborts if a missing chunk is accessed by any other thread.
+ * Code that hands guest memory to another thread must call
+ * ram_restore_finish() first.
+ */
+
+/* a chunk of 'length' bytes at 'offset' in the compressed data. a length
+ * of 0 means the chunk is filled with zeroes, and a length equal to the
+ * chunk size that it is stored uncompressed */
+typedef struct RamChunk {
+    uint32_t  offset;
+    uint32_t  length;
+} RamChunk;
+
+/* non-zero to restore the RAM lazily, set by -lazy-restore */
+extern int  ram_restore_lazy;
+
+/* returns non-zero if the 'len' bytes at 'p' are all zeroes */
+int   ram_chunk_is_zero(const uint8_t *p, int len);
+
+/* compress the 'len' bytes at 'src' into 'dst', which must be at least
+ * 'len' bytes long. returns the chunk length as described above */
+int   ram_chunk_compress(uint8_t *dst, const uint8_t *src, int len);
+
+/* restore 'size' bytes of RAM at 'base' from 'nb_chunks' chunks of
+ * 'chunk_size' bytes, whose compressed content is in 'data'. takes
+ * ownership of 'chunks' and 'data'. returns 0 on success, -1 if the
+ * data is corrupted */
+int   ram_restore(uint8_t *base, size_t size, int chunk_size,
+                  RamChunk *chunks, int nb_chunks,
+                  uint8_t *data, size_t data_size);
+
+/* make sure the RAM in [ptr, ptr+len[ is restored. This must be called
+ * before guest memory is passed to a system call, which would fail
+ * with EFAULT instead of raising SIGSEGV */
+void  ram_restore_touch(const void *ptr, size_t len);
+
+/* restore everything that is still missing */
+void  ram_restore_finish(void);
+
+/* print statistics for "info ramrestore" */
+void  ram_restore_info(void);
+
+#endif /* RAM_RESTORE_H */
@@ -0,0 +1,997 @@
+/* Copyright (C) 2009 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+#include "qemu-common.h"
+#include "qemu-char.h"
+#include "qemu-timer.h"
+#include "console.h"
+#include "savevm-stream.h"
+
+#include <zlib.h>
+#include <fcntl.h>
+#ifndef _WIN32
+#include <pthread.h>
+#include <signal.h>
+#define SNAPSHOT_STREAM_THREADS
+#endif
+
+/* File layout, all integers are big-endian:
+ *
+ *   header:  be32 magic, be32 version, be32 block size, be32 0
+ *   blocks:  be32 raw length, be32 stored length, stored bytes
+ *            (the block is stored uncompressed if both lengths are
+ *            equal, and a raw length of 0 ends the list)
+ *   index:   be32 count, then for each section: byte length, id
+ *            string, be32 instance id, be32 version id, be64 offset
+ *            and be64 length in the uncompressed stream
+ *   footer:  be64 index offset, be32 index size, be32 magic
+ */
+#define STREAM_MAGIC        0x51534e50  /* 'QSNP' */
+#define STREAM_VERSION      1
+#define STREAM_HEADER_SIZE  16
+#define STREAM_FOOTER_SIZE  16
+
+#define STREAM_BLOCK_SIZE   (1 << 20)
+#define STREAM_MAX_BLOCK    (16 << 20)
+
+/* all writes but the last one are STREAM_WRITE_SIZE bytes long, at
+ * offsets that are a multiple of it */
+#define STREAM_WRITE_SIZE   (1 << 20)
+
+/* blocks between the main thread and the writer or reader thread. this
+ * bounds the memory used, and how much of the state can still be
+ * compressed and written after the guest resumes */
+#define STREAM_SLOTS        16
+#define STREAM_MAX_WORKERS  4
+
+enum {
+    SLOT_FREE,      /* can be filled by the main thread or the reader */
+    SLOT_PENDING,   /* waiting for a worker */
+    SLOT_BUSY,      /* being compressed */
+    SLOT_DONE,      /* waiting for the writer */
+    SLOT_READY,     /* decompressed, waiting for the main thread */
+    SLOT_EOF        /* end of the blocks, or read error */
+};
+
+typedef struct StreamSlot {
+    int      state;
+    uint8_t *raw;
+    int      raw_len;
+    uint8_t *out;
+    int      out_len;   /* equal to raw_len if the block is stored */
+} StreamSlot;
+
+typedef struct StreamSection {
+    char     idstr[256];
+    int      instance_id;
+    int      version_id;
+    int64_t  offset;
+    int64_t  length;
+} StreamSection;
+
+typedef struct StreamStats {
+    char     filename[256];
+    int64_t  raw_bytes;
+    int64_t  file_bytes;
+    int      blocks;
+    int      workers;
+    int      error;
+    int64_t  start_ms;
+    int64_t  resume_ms;     /* end of the serialization */
+    int64_t  stall_ms;      /* main thread waiting for free slots */
+    int64_t  end_ms;
+} StreamStats;
+
+struct SnapshotStream {
+    int            fd;
+    int            is_writable;
+    char          *filename;
+    int            block_size;
+    StreamSlot     slots[STREAM_SLOTS];
+    int            next_main;      /* block filled or consumed by the main thread */
+    int            main_pos;       /* position in that block */
+    int            next_compress;
+    int            next_io;        /* block written or read by the I/O thread */
+    int            finishing;
+    int            quit;
+    int            error;          /* first errno, set once */
+    z_stream       zs;             /* used by the I/O thread */
+    uint8_t       *stage;
+    int            stage_len;
+    int64_t        stage_offset;   /* file offset of the staging buffer */
+    StreamSection *sections;
+    int            nb_sections;
+    int            max_sections;
+    StreamStats    stats;
+#ifdef SNAPSHOT_STREAM_THREADS
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    pthread_t       io_thread;
+    pthread_t       workers[STREAM_MAX_WORKERS];
+    int             nb_workers;
+    int             threads_started;
+    int             notify[2];
+#endif
+};
+
+static StreamStats      last_save, last_load;
+static SnapshotStream  *stream_pending;
+
+#ifdef SNAPSHOT_STREAM_THREADS
+#define stream_lock(s)       pthread_mutex_lock(&(s)->lock)
+#define stream_unlock(s)     pthread_mutex_unlock(&(s)->lock)
+#define stream_signal(s)     pthread_cond_broadcast(&(s)->cond)
+#define stream_wait(s)       pthread_cond_wait(&(s)->cond, &(s)->lock)
+#else
+#define stream_lock(s)       do { } while (0)
+#define stream_unlock(s)     do { } while (0)
+#define stream_signal(s)     do { } while (0)
+#endif
+
+static void put_be32(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static uint32_t get_be32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static void put_be64(uint8_t *p, uint64_t v)
+{
+    put_be32(p, v >> 32);
+    put_be32(p + 4, v);
+}
+
+static uint64_t get_be64(const uint8_t *p)
+{
+    return ((uint64_t)get_be32(p) << 32) | get_be32(p + 4);
+}
+
+static void stream_set_error(SnapshotStream *s, int err)
+{
+    stream_lock(s);
+    if (s->error == 0)
+        s->error = err;
+    stream_unlock(s);
+}
+
+static int stream_write_full(int fd, const uint8_t *buf, int len)
+{
+    while (len > 0) {
+        int ret = write(fd, buf, len);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += ret;
+        len -= ret;
+    }
+    return 0;
+}
+
+/* returns the number of bytes read, which is less than 'len' at the end
+ * of the file, or -1 on error */
+static int stream_read_full(int fd, uint8_t *buf, int len)
+{
+    int done = 0;
+
+    while (done < len) {
+        int ret = read(fd, buf + done, len - done);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (ret == 0)
+            break;
+        done += ret;
+    }
+    return done;
+}
+
+/***********************************************************/
+/* writing */
+
+static void stream_flush_stage(SnapshotStream *s)
+{
+    if (s->stage_len == 0)
+        return;
+    if (!s->error && stream_write_full(s->fd, s->stage, s->stage_len) < 0)
+        stream_set_error(s, errno);
+    s->stage_offset += s->stage_len;
+    s->stage_len = 0;
+}
+
+static void stream_stage(SnapshotStream *s, const uint8_t *buf, int len)
+{
+    while (len > 0) {
+        int n = STREAM_WRITE_SIZE - s->stage_len;
+
+        if (n > len)
+            n = len;
+        memcpy(s->stage + s->stage_len, buf, n);
+        s->stage_len += n;
+        buf += n;
+        len -= n;
+        if (s->stage_len == STREAM_WRITE_SIZE)
+            stream_flush_stage(s);
+    }
+}
+
+static void stream_compress(z_stream *zs, int zs_ok, StreamSlot *slot)
+{
+    slot->out_len = slot->raw_len;
+    if (!zs_ok || deflateReset(zs) != Z_OK)
+        return;
+
+    zs->next_in   = slot->raw;
+    zs->avail_in  = slot->raw_len;
+    zs->next_out  = slot->out;
+    zs->avail_out = slot->raw_len - 1;
+    if (deflate(zs, Z_FINISH) == Z_STREAM_END)
+        slot->out_len = slot->raw_len - 1 - zs->avail_out;
+}
+
+static void stream_write_block(SnapshotStream *s, StreamSlot *slot)
+{
+    uint8_t hdr[8];
+
+    put_be32(hdr, slot->raw_len);
+    put_be32(hdr + 4, slot->out_len);
+    stream_stage(s, hdr, 8);
+    if (slot->out_len == slot->raw_len)
+        stream_stage(s, slot->raw, slot->raw_len);
+    else
+        stream_stage(s, slot->out, slot->out_len);
+}
+
+static void stream_write_trailer(SnapshotStream *s)
+{
+    uint8_t buf[24];
+    int64_t index_offset;
+    int i, len;
+
+    /* end of the blocks */
+    memset(buf, 0, 8);
+    stream_stage(s, buf, 8);
+
+    index_offset = s->stage_offset + s->stage_len;
+    put_be32(buf, s->nb_sections);
+    stream_stage(s, buf, 4);
+    for (i = 0; i < s->nb_sections; i++) {
+        StreamSection *sec = &s->sections[i];
+
+        len = strlen(sec->idstr);
+        buf[0] = len;
+        stream_stage(s, buf, 1);
+        stream_stage(s, (uint8_t *)sec->idstr, len);
+        put_be32(buf, sec->instance_id);
+        put_be32(buf + 4, sec->version_id);
+        put_be64(buf + 8, sec->offset);
+        put_be64(buf + 16, sec->length);
+        stream_stage(s, buf, 24);
+    }
+
+    put_be64(buf, index_offset);
+    put_be32(buf + 8, s->stage_offset + s->stage_len - index_offset);
+    put_be32(buf + 12, STREAM_MAGIC);
+    stream_stage(s, buf, STREAM_FOOTER_SIZE);
+    stream_flush_stage(s);
+}
+
+/* called once the file is complete, or the stream aborted */
+static void stream_complete(SnapshotStream *s)
+{
+    if (s->error == 0 && close(s->fd) < 0)
+        s->error = errno;
+    else if (s->error != 0)
+        close(s->fd);
+    s->fd = -1;
+    if (s->error != 0)
+        unlink(s->filename);
+    s->stats.file_bytes = s->stage_offset;
+    s->stats.error = s->error;
+    s->stats.end_ms = qemu_get_clock(rt_clock);
+}
+
+#ifdef SNAPSHOT_STREAM_THREADS
+static void stream_block_signals(void)
+{
+    sigset_t set;
+
+    /* signals are handled by the main thread */
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+}
+
+static void *stream_worker_thread(void *opaque)
+{
+    SnapshotStream *s = opaque;
+    z_stream zs;
+    int zs_ok;
+
+    stream_block_signals();
+    memset(&zs, 0, sizeof(zs));
+    zs_ok = (deflateInit(&zs, Z_BEST_SPEED) == Z_OK);
+
+    stream_lock(s);
+    for (;;) {
+        StreamSlot *slot = &s->slots[s->next_compress % STREAM_SLOTS];
+
+        if (s->quit)
+            break;
+        if (slot->state != SLOT_PENDING) {
+            if (s->finishing && s->next_compress == s->next_main)
+                break;
+            stream_wait(s);
+            continue;
+        }
+        slot->state = SLOT_BUSY;
+        s->next_compress++;
+        stream_unlock(s);
+
+        stream_compress(&zs, zs_ok, slot);
+
+        stream_lock(s);
+        slot->state = SLOT_DONE;
+        stream_signal(s);
+    }
+    stream_unlock(s);
+
+    if (zs_ok)
+        deflateEnd(&zs);
+    return NULL;
+}
+
+static void *stream_writer_thread(void *opaque)
+{
+    SnapshotStream *s = opaque;
+    char c = 0;
+
+    stream_block_signals();
+
+    stream_lock(s);
+    for (;;) {
+        StreamSlot *slot = &s->slots[s->next_io % STREAM_SLOTS];
+
+        if (s->quit)
+            break;
+        if (slot->state != SLOT_DONE) {
+            if (s->finishing && s->next_io == s->next_main)
+                break;
+            stream_wait(s);
+            continue;
+        }
+        stream_unlock(s);
+
+        stream_write_block(s, slot);
+
+        stream_lock(s);
+        slot->state = SLOT_FREE;
+        s->next_io++;
+        stream_signal(s);
+    }
+    stream_unlock(s);
+
+    if (!s->quit) {
+        stream_write_trailer(s);
+        stream_complete(s);
+    }
+    if (write(s->notify[1], &c, 1) < 0) {
+        /* snapshot_stream_flush() joins the threads anyway */
+    }
+    return NULL;
+}
+
+static int stream_nb_workers(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    /* leave one CPU to the main thread */
+    n -= 1;
+    if (n < 1)
+        n = 1;
+    if (n > STREAM_MAX_WORKERS)
+        n = STREAM_MAX_WORKERS;
+    return n;
+}
+
+static void stream_join(SnapshotStream *s)
+{
+    int i;
+
+    if (s->threads_started)
+        pthread_join(s->io_thread, NULL);
+    for (i = 0; i < s->nb_workers; i++)
+        pthread_join(s->workers[i], NULL);
+    s->threads_started = 0;
+    s->nb_workers = 0;
+}
+
+static void stream_stop(SnapshotStream *s)
+{
+    stream_lock(s);
+    s->quit = 1;
+    stream_signal(s);
+    stream_unlock(s);
+    stream_join(s);
+}
+#endif /* SNAPSHOT_STREAM_THREADS */
+
+static SnapshotStream *stream_new(const char *filename, int is_writable)
+{
+    SnapshotStream *s = qemu_mallocz(sizeof(*s));
+
+    s->fd = -1;
+    s->is_writable = is_writable;
+    s->filename = qemu_strdup(filename);
+    s->block_size = STREAM_BLOCK_SIZE;
+    pstrcpy(s->stats.filename, sizeof(s->stats.filename), filename);
+    s->stats.start_ms = qemu_get_clock(rt_clock);
+#ifdef SNAPSHOT_STREAM_THREADS
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->cond, NULL);
+    s->notify[0] = s->notify[1] = -1;
+#endif
+    return s;
+}
+
+static void stream_free(SnapshotStream *s)
+{
+    int i;
+
+    if (s->fd >= 0)
+        close(s->fd);
+    if (s->is_writable)
+        deflateEnd(&s->zs);
+    else
+        inflateEnd(&s->zs);
+    for (i = 0; i < STREAM_SLOTS; i++) {
+        qemu_free(s->slots[i].raw);
+        qemu_free(s->slots[i].out);
+    }
+#ifdef SNAPSHOT_STREAM_THREADS
+    if (s->notify[0] >= 0) {
+        qemu_set_fd_handler(s->notify[0], NULL, NULL, NULL);
+        close(s->notify[0]);
+        close(s->notify[1]);
+    }
+    pthread_cond_destroy(&s->cond);
+    pthread_mutex_destroy(&s->lock);
+#endif
+    qemu_free(s->sections);
+    qemu_free(s->stage);
+    qemu_free(s->filename);
+    qemu_free(s);
+}
+
+static int stream_alloc_slots(SnapshotStream *s)
+{
+    int i;
+
+    for (i = 0; i < STREAM_SLOTS; i++) {
+        s->slots[i].raw = qemu_malloc(s->block_size);
+        s->slots[i].out = qemu_malloc(s->block_size);
+        if (!s->slots[i].raw || !s->slots[i].out)
+            return -1;
+    }
+    return 0;
+}
+
+/* release a stream whose file is complete */
+static void stream_release(SnapshotStream *s)
+{
+#ifdef SNAPSHOT_STREAM_THREADS
+    stream_join(s);
+#endif
+    if (stream_pending == s)
+        stream_pending = NULL;
+    last_save = s->stats;
+    if (s->error != 0)
+        term_printf("savevm: could not write '%s': %s\n",
+                    s->filename, strerror(s->error));
+    stream_free(s);
+}
+
+#ifdef SNAPSHOT_STREAM_THREADS
+static void stream_notify(void *opaque)
+{
+    SnapshotStream *s = opaque;
+    char buf[4];
+
+    if (read(s->notify[0], buf, sizeof(buf)) < 0) {
+        /* the writer thread has exited anyway */
+    }
+    stream_release(s);
+}
+#endif
+
+void snapshot_stream_flush(void)
+{
+    if (stream_pending)
+        stream_release(stream_pending);
+}
+
+SnapshotStream *snapshot_stream_create(const char *filename)
+{
+    SnapshotStream *s;
+    uint8_t hdr[STREAM_HEADER_SIZE];
+
+    snapshot_stream_flush();
+
+    s = stream_new(filename, 1);
+    if (deflateInit(&s->zs, Z_BEST_SPEED) != Z_OK)
+        goto fail;
+    s->stage = qemu_malloc(STREAM_WRITE_SIZE);
+    if (!s->stage || stream_alloc_slots(s) < 0)
+        goto fail;
+
+    s->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+    if (s->fd < 0)
+        goto fail;
+
+    put_be32(hdr, STREAM_MAGIC);
+    put_be32(hdr + 4, STREAM_VERSION);
+    put_be32(hdr + 8, s->block_size);
+    put_be32(hdr + 12, 0);
+    stream_stage(s, hdr, STREAM_HEADER_SIZE);
+
+#ifdef SNAPSHOT_STREAM_THREADS
+    /* without threads, the blocks are compressed and written by
+     * the main thread */
+    if (pipe(s->notify) == 0) {
+        int i, n = stream_nb_workers();
+
+        for (i = 0; i < n; i++) {
+            if (pthread_create(&s->workers[i], NULL,
+                               stream_worker_thread, s) != 0)
+                break;
+            s->nb_workers++;
+        }
+        s->stats.workers = s->nb_workers;
+        if (s->nb_workers > 0 &&
+            pthread_create(&s->io_thread, NULL, stream_writer_thread, s) == 0) {
+            s->threads_started = 1;
+        } else {
+            stream_stop(s);
+            s->quit = 0;
+            s->stats.workers = 0;
+        }
+    } else {
+        s->notify[0] = s->notify[1] = -1;
+    }
+#endif
+    return s;
+
+fail:
+    stream_free(s);
+    return NULL;
+}
+
+/* hand the block being filled to the workers */
+static void stream_submit(SnapshotStream *s)
+{
+    StreamSlot *slot = &s->slots[s->next_main % STREAM_SLOTS];
+
+    slot->raw_len = s->main_pos;
+    s->main_pos = 0;
+    s->stats.blocks++;
+#ifdef SNAPSHOT_STREAM_THREADS
+    if (s->threads_started) {
+        stream_lock(s);
+        slot->state = SLOT_PENDING;
+        s->next_main++;
+        stream_signal(s);
+        stream_unlock(s);
+        return;
+    }
+#endif
+    stream_compress(&s->zs, 1, slot);
+    stream_write_block(s, slot);
+    s->next_main++;
+}
+
+/* wait until the next block can be filled */
+static void stream_wait_slot(SnapshotStream *s)
+{
+#ifdef SNAPSHOT_STREAM_THREADS
+    StreamSlot *slot = &s->slots[s->next_main % STREAM_SLOTS];
+    int64_t start;
+
+    if (!s->threads_started)
+        return;
+    stream_lock(s);
+    if (slot->state != SLOT_FREE) {
+        start = qemu_get_clock(rt_clock);
+        while (slot->state != SLOT_FREE)
+            stream_wait(s);
+        s->stats.stall_ms += qemu_get_clock(rt_clock) - start;
+    }
+    stream_unlock(s);
+#endif
+}
+
+int snapshot_stream_write(SnapshotStream *s, const uint8_t *buf, int len)
+{
+    s->stats.raw_bytes += len;
+    while (len > 0) {
+        StreamSlot *slot = &s->slots[s->next_main % STREAM_SLOTS];
+        int n = s->block_size - s->main_pos;
+
+        if (s->main_pos == 0)
+            stream_wait_slot(s);
+        if (n > len)
+            n = len;
+        memcpy(slot->raw + s->main_pos, buf, n);
+        s->main_pos += n;
+        buf += n;
+        len -= n;
+        if (s->main_pos == s->block_size)
+            stream_submit(s);
+    }
+    return s->error ? -1 : 0;
+}
+
+void snapshot_stream_add_section(SnapshotStream *s, const char *idstr,
+                                 int instance_id, int version_id,
+                                 int64_t offset, int64_t length)
+{
+    StreamSection *sec;
+
+    if (s->nb_sections == s->max_sections) {
+        s->max_sections = s->max_sections ? 2 * s->max_sections : 32;
+        s->sections = qemu_realloc(s->sections,
+                                   s->max_sections * sizeof(StreamSection));
+    }
+    sec = &s->sections[s->nb_sections++];
+    pstrcpy(sec->idstr, sizeof(sec->idstr), idstr);
+    sec->instance_id = instance_id;
+    sec->version_id = version_id;
+    sec->offset = offset;
+    sec->length = length;
+}
+
+void snapshot_stream_finish(SnapshotStream *s)
+{
+    static int registered;
+
+    /* don't leave an incomplete file if the emulator exits first */
+    if (!registered) {
+        atexit(snapshot_stream_flush);
+        registered = 1;
+    }
+
+    if (s->main_pos > 0)
+        stream_submit(s);
+    s->stats.resume_ms = qemu_get_clock(rt_clock);
+
+#ifdef SNAPSHOT_STREAM_THREADS
+    if (s->threads_started) {
+        stream_pending = s;
+        qemu_set_fd_handler(s->notify[0], stream_notify, NULL, s);
+        stream_lock(s);
+        s->finishing = 1;
+        stream_signal(s);
+        stream_unlock(s);
+        return;
+    }
+#endif
+    stream_write_trailer(s);
+    stream_complete(s);
+    stream_release(s);
+}
+
+/***********************************************************/
+/* loading */
+
+/* read and decompress the next block. returns 1 on success, 0 at the
+ * end of the blocks and -1 on error */
+static int stream_read_block(SnapshotStream *s, StreamSlot *slot)
+{
+    uint8_t hdr[8];
+    uint32_t raw_len, out_len;
+
+    if (stream_read_full(s->fd, hdr, 8) != 8)
+        goto fail;
+    raw_len = get_be32(hdr);
+    out_len = get_be32(hdr + 4);
+    if (raw_len == 0)
+        return 0;
+    if (raw_len > (uint32_t)s->block_size || out_len > raw_len || out_len == 0)
+        goto fail;
+
+    slot->raw_len = raw_len;
+    if (out_len == raw_len)
+        return (stream_read_full(s->fd, slot->raw, raw_len) == raw_len) ? 1 : -1;
+
+    if (stream_read_full(s->fd, slot->out, out_len) != out_len ||
+        inflateReset(&s->zs) != Z_OK)
+        goto fail;
+    s->zs.next_in   = slot->out;
+    s->zs.avail_in  = out_len;
+    s->zs.next_out  = slot->raw;
+    s->zs.avail_out = raw_len;
+    if (inflate(&s->zs, Z_FINISH) != Z_STREAM_END || s->zs.avail_out != 0)
+        goto fail;
+    return 1;
+
+fail:
+    stream_set_error(s, EINVAL);
+    return -1;
+}
+
+#ifdef SNAPSHOT_STREAM_THREADS
+static void *stream_reader_thread(void *opaque)
+{
+    SnapshotStream *s = opaque;
+
+    stream_block_signals();
+
+    stream_lock(s);
+    for (;;) {
+        StreamSlot *slot = &s->slots[s->next_io % STREAM_SLOTS];
+        int ret;
+
+        if (s->quit)
+            break;
+        if (slot->state != SLOT_FREE) {
+            stream_wait(s);
+            continue;
+        }
+        stream_unlock(s);
+
+        ret = stream_read_block(s, slot);
+
+        stream_lock(s);
+        slot->state = (ret > 0) ? SLOT_READY : SLOT_EOF;
+        s->next_io++;
+        stream_signal(s);
+        if (ret <= 0)
+            break;
+    }
+    stream_unlock(s);
+    return NULL;
+}
+#endif
+
+static int stream_read_index(SnapshotStream *s)
+{
+    uint8_t buf[STREAM_FOOTER_SIZE];
+    uint8_t *index, *p, *end;
+    int64_t file_size, index_offset;
+    uint32_t index_size, count, i;
+    int ret = -1;
+
+    file_size = lseek(s->fd, 0, SEEK_END);
+    if (file_size < STREAM_HEADER_SIZE + 8 + 4 + STREAM_FOOTER_SIZE ||
+        lseek(s->fd, file_size - STREAM_FOOTER_SIZE, SEEK_SET) < 0 ||
+        stream_read_full(s->fd, buf, STREAM_FOOTER_SIZE) != STREAM_FOOTER_SIZE)
+        return -1;
+
+    index_offset = get_be64(buf);
+    index_size = get_be32(buf + 8);
+    if (get_be32(buf + 12) != STREAM_MAGIC ||
+        index_offset < STREAM_HEADER_SIZE || index_size < 4 ||
+        index_offset + index_size != file_size - STREAM_FOOTER_SIZE)
+        return -1;
+
+    index = qemu_malloc(index_size);
+    if (lseek(s->fd, index_offset, SEEK_SET) < 0 ||
+        stream_read_full(s->fd, index, index_size) != (int)index_size)
+        goto out;
+
+    p = index;
+    end = index + index_size;
+    count = get_be32(p);
+    p += 4;
+    for (i = 0; i < count; i++) {
+        char idstr[256];
+        int len;
+
+        if (p >= end)
+            goto out;
+        len = *p++;
+        if (end - p < len + 24)
+            goto out;
+        memcpy(idstr, p, len);
+        idstr[len] = '\0';
+        p += len;
+        snapshot_stream_add_section(s, idstr, get_be32(p), get_be32(p + 4),
+                                    get_be64(p + 8), get_be64(p + 16));
+        p += 24;
+    }
+    ret = 0;
+out:
+    qemu_free(index);
+    return ret;
+}
+
+SnapshotStream *snapshot_stream_open(const char *filename)
+{
+    SnapshotStream *s;
+    uint8_t hdr[STREAM_HEADER_SIZE];
+    uint32_t block_size;
+
+    /* the file may be the one being written */
+    snapshot_stream_flush();
+
+    s = stream_new(filename, 0);
+    if (inflateInit(&s->zs) != Z_OK)
+        goto fail;
+
+    s->fd = open(filename, O_RDONLY | O_BINARY);
+    if (s->fd < 0)
+        goto fail;
+
+    if (stream_read_full(s->fd, hdr, STREAM_HEADER_SIZE) != STREAM_HEADER_SIZE ||
+        get_be32(hdr) != STREAM_MAGIC || get_be32(hdr + 4) != STREAM_VERSION)
+        goto fail;
+    block_size = get_be32(hdr + 8);
+    if (block_size == 0 || block_size > STREAM_MAX_BLOCK)
+        goto fail;
+    s->block_size = block_size;
+
+    if (stream_read_index(s) < 0 ||
+        lseek(s->fd, STREAM_HEADER_SIZE, SEEK_SET) < 0 ||
+        stream_alloc_slots(s) < 0)
+        goto fail;
+
+#ifdef SNAPSHOT_STREAM_THREADS
+    if (pthread_create(&s->io_thread, NULL, stream_reader_thread, s) == 0)
+        s->threads_started = 1;
+#endif
+    return s;
+
+fail:
+    stream_free(s);
+    return NULL;
+}
+
+/* the block being consumed by the main thread, or NULL at the end */
+static StreamSlot *stream_get_block(SnapshotStream *s)
+{
+    StreamSlot *slot = &s->slots[s->next_main % STREAM_SLOTS];
+
+#ifdef SNAPSHOT_STREAM_THREADS
+    if (s->threads_started) {
+        stream_lock(s);
+        while (slot->state == SLOT_FREE)
+            stream_wait(s);
+        stream_unlock(s);
+    } else
+#endif
+    if (slot->state == SLOT_FREE)
+        slot->state = (stream_read_block(s, slot) > 0) ? SLOT_READY : SLOT_EOF;
+
+    return (slot->state == SLOT_READY) ? slot : NULL;
+}
+
+int snapshot_stream_read(SnapshotStream *s, uint8_t *buf, int len)
+{
+    int done = 0;
+
+    while (done < len) {
+        StreamSlot *slot = stream_get_block(s);
+        int n;
+
+        if (slot == NULL)
+            break;
+        n = slot->raw_len - s->main_pos;
+        if (n > len - done)
+            n = len - done;
+        memcpy(buf + done, slot->raw + s->main_pos, n);
+        s->main_pos += n;
+        done += n;
+
+        if (s->main_pos == slot->raw_len) {
+            stream_lock(s);
+            slot->state = SLOT_FREE;
+            s->next_main++;
+            stream_signal(s);
+            stream_unlock(s);
+            s->main_pos = 0;
+            s->stats.blocks++;
+        }
+    }
+    s->stats.raw_bytes += done;
+    return done;
+}
+
+int snapshot_stream_get_section(SnapshotStream *s, int n,
+                                const char **idstr,
+                                int *instance_id, int *version_id,
+                                int64_t *offset, int64_t *length)
+{
+    StreamSection *sec;
+
+    if (n < 0 || n >= s->nb_sections)
+        return -1;
+    sec = &s->sections[n];
+    *idstr = sec->idstr;
+    *instance_id = sec->instance_id;
+    *version_id = sec->version_id;
+    *offset = sec->offset;
+    *length = sec->length;
+    return 0;
+}
+
+void snapshot_stream_close(SnapshotStream *s)
+{
+#ifdef SNAPSHOT_STREAM_THREADS
+    stream_stop(s);
+#endif
+    if (s->is_writable) {
+        /* aborted */
+        s->error = s->error ? s->error : EINTR;
+        stream_complete(s);
+        last_save = s->stats;
+    } else {
+        s->stats.file_bytes = lseek(s->fd, 0, SEEK_END);
+        s->stats.resume_ms = s->stats.end_ms = qemu_get_clock(rt_clock);
+        s->stats.error = s->error;
+        last_load = s->stats;
+    }
+    stream_free(s);
+}
+
+static void stream_print_stats(const char *name, StreamStats *st)
+{
+    int64_t now = qemu_get_clock(rt_clock);
+    int64_t ms;
+
+    if (st->start_ms == 0)
+        return;
+    term_printf("%s: '%s', %" PRId64 " KB in %d blocks, %" PRId64 " KB on disk",
+                name, st->filename, st->raw_bytes >> 10, st->blocks,
+                st->file_bytes >> 10);
+    if (st->workers > 0)
+        term_printf(", %d workers", st->workers);
+    term_printf("\n");
+
+    if (st->end_ms == 0) {
+        term_printf("%s: paused %" PRId64 " ms (stalled %" PRId64 " ms), "
+                    "in progress for %" PRId64 " ms\n",
+                    name, st->resume_ms - st->start_ms, st->stall_ms,
+                    now - st->start_ms);
+        return;
+    }
+    ms = st->end_ms - st->start_ms;
+    if (st->end_ms != st->resume_ms)
+        term_printf("%s: paused %" PRId64 " ms (stalled %" PRId64 " ms), ",
+                    name, st->resume_ms - st->start_ms, st->stall_ms);
+    else
+        term_printf("%s: ", name);
+    term_printf("complete after %" PRId64 " ms, %" PRId64 " KB/s",
+                ms, st->raw_bytes * 1000 / (ms > 0 ? ms : 1) >> 10);
+    if (st->error)
+        term_printf(", failed: %s", strerror(st->error));
+    term_printf("\n");
+}
+
+void snapshot_stream_info(void)
+{
+    if (last_save.start_ms == 0 && last_load.start_ms == 0 &&
+        stream_pending == NULL) {
+        term_printf("no snapshot file saved or loaded\n");
+        return;
+    }
+    if (stream_pending)
+        stream_print_stats("savevm", &stream_pending->stats);
+    else
+        stream_print_stats("savevm", &last_save);
+    stream_print_stats("loadvm", &last_load);
+}
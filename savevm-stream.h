@@ -0,0 +1,74 @@
+/* Copyright (C) 2009 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+#ifndef SAVEVM_STREAM_H
+#define SAVEVM_STREAM_H
+
+#include <inttypes.h>
+
+/* Snapshot streams store the VM state in a standalone file, as a
+ * sequence of independently compressed blocks. The state is serialized
+ * by the main thread, the blocks are compressed by worker threads and
+ * written by a writer thread with large aligned writes, so the guest
+ * only stays paused while the state is serialized.
+ *
+ * Since a stream can't seek back, the sections are not prefixed by
+ * their length: their position in the uncompressed stream is recorded
+ * in an index written at the end of the file.
+ *
+ * When loading, a reader thread reads and decompresses the blocks ahead
+ * of the main thread.
+ */
+
+typedef struct SnapshotStream SnapshotStream;
+
+/* create a stream to save a snapshot to 'filename', NULL on error */
+SnapshotStream *snapshot_stream_create(const char *filename);
+
+/* open the snapshot in 'filename' for loading, NULL on error */
+SnapshotStream *snapshot_stream_open(const char *filename);
+
+/* append 'len' bytes to a stream being written. returns -1 if a
+ * previous write failed */
+int  snapshot_stream_write(SnapshotStream *s, const uint8_t *buf, int len);
+
+/* read up to 'len' bytes from a stream being loaded. returns the number
+ * of bytes read, 0 at the end of the stream or on error */
+int  snapshot_stream_read(SnapshotStream *s, uint8_t *buf, int len);
+
+/* record a section of 'length' bytes at 'offset' in the uncompressed
+ * stream */
+void snapshot_stream_add_section(SnapshotStream *s, const char *idstr,
+                                 int instance_id, int version_id,
+                                 int64_t offset, int64_t length);
+
+/* the sections of a stream being loaded, in the order they were saved.
+ * returns -1 if 'n' is out of range */
+int  snapshot_stream_get_section(SnapshotStream *s, int n,
+                                 const char **idstr,
+                                 int *instance_id, int *version_id,
+                                 int64_t *offset, int64_t *length);
+
+/* end a stream being written. the remaining blocks, the index and the
+ * trailer are written in the background, and the stream is released
+ * when the file is complete. errors are reported on the monitor */
+void snapshot_stream_finish(SnapshotStream *s);
+
+/* close a stream being loaded, or abort a stream being written */
+void snapshot_stream_close(SnapshotStream *s);
+
+/* wait until the snapshot being written, if any, is complete */
+void snapshot_stream_flush(void);
+
+/* print statistics for "info savevm" */
+void snapshot_stream_info(void);
+
+#endif /* SAVEVM_STREAM_H */
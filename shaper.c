@@ -46,19 +46,30 @@ _packet_is_internal( const uint8_t*  data, size_t  size )
  * we're going to implement a scheme where, when we send a packet of
  * 'count' bytes, no other packet will go through in the same direction for
  * at least 'count*8/MAX_RATE' seconds. any successive packet that is "sent"
- * in this interval is placed in a queue, associated to a timer
+ * in this interval is placed in a queue, and released when its time comes.
  *
- * there are different (queue/timer/rate) values for the input and output
+ * there are different (queue/rate) values for the input and output
  * direction of the user vlan.
  */
 typedef struct QueuedPacketRec_ {
     int64_t                    expiration;
     struct QueuedPacketRec_*   next;
     size_t                     size;
+    size_t                     capacity;  /* size of inline data area */
     void*                      opaque;
     void*                      data;
 } QueuedPacketRec, *QueuedPacket;
 
+/* queued packets are recycled through a small free list to avoid
+ * a malloc/free pair per packet when the link is saturated. copied
+ * packets that fit in an Ethernet frame come from the pool, packets
+ * that only reference their data are allocated with no payload.
+ */
+#define  PACKET_POOL_CAPACITY   1536
+#define  PACKET_POOL_MAX        256
+
+static QueuedPacket  _packet_pool;
+static int           _packet_pool_count;
 
 static QueuedPacket
 queued_packet_create( const void*   data,
@@ -67,12 +78,21 @@ queued_packet_create( const void*   data,
                       int           do_copy )
 {
     QueuedPacket   packet;
-    size_t         packet_size = sizeof(*packet);
+    size_t         capacity = 0;
 
     if (do_copy)
-        packet_size += size;
+        capacity = size;
 
-    packet = qemu_malloc(packet_size);
+    if (do_copy && capacity <= PACKET_POOL_CAPACITY && _packet_pool != NULL) {
+        packet       = _packet_pool;
+        _packet_pool = packet->next;
+        _packet_pool_count -= 1;
+    } else {
+        if (do_copy && capacity <= PACKET_POOL_CAPACITY)
+            capacity = PACKET_POOL_CAPACITY;
+        packet = qemu_malloc(sizeof(*packet) + capacity);
+        packet->capacity = capacity;
+    }
     packet->next       = NULL;
     packet->expiration = 0;
     packet->size       = (size_t)size;
@@ -91,18 +111,144 @@ static void
 queued_packet_free( QueuedPacket  packet )
 {
     if (packet) {
+        if (packet->capacity == PACKET_POOL_CAPACITY &&
+            _packet_pool_count < PACKET_POOL_MAX) {
+            packet->next = _packet_pool;
+            _packet_pool = packet;
+            _packet_pool_count += 1;
+            return;
+        }
         qemu_free( packet );
     }
 }
 
+/* all shapers and delays share a single QEMU timer. each object that
+ * waits for something registers a ShaperTimer, kept in a list sorted
+ * by expiration, and the QEMU timer is only re-armed when the head of
+ * that list changes. on expiration, every due entry is processed with
+ * the same 'now' so that packets due in the same tick are released in
+ * one batch.
+ */
+typedef void (*ShaperTimerFunc)( void*  opaque, int64_t  now );
+
+typedef struct ShaperTimerRec_ {
+    struct ShaperTimerRec_*   next;
+    struct ShaperTimerRec_**  pnext;  /* NULL if not scheduled */
+    int64_t                   expiration;
+    ShaperTimerFunc           func;
+    void*                     opaque;
+} ShaperTimerRec, *ShaperTimer;
+
+static ShaperTimer  _shaper_timers;
+static QEMUTimer*   _shaper_qtimer;
+static int64_t      _shaper_qtimer_expiration = -1;
+
+static void  _shaper_timers_expire( void*  opaque );
+
+static void
+shaper_timer_init( ShaperTimer  timer, ShaperTimerFunc  func, void*  opaque )
+{
+    timer->next       = NULL;
+    timer->pnext      = NULL;
+    timer->expiration = 0;
+    timer->func       = func;
+    timer->opaque     = opaque;
+
+    if (_shaper_qtimer == NULL)
+        _shaper_qtimer = qemu_new_timer( SHAPER_CLOCK,
+                                         _shaper_timers_expire,
+                                         NULL );
+}
+
+static void
+_shaper_timers_rearm( void )
+{
+    if (_shaper_timers == NULL) {
+        if (_shaper_qtimer_expiration >= 0) {
+            qemu_del_timer( _shaper_qtimer );
+            _shaper_qtimer_expiration = -1;
+        }
+    } else if (_shaper_timers->expiration != _shaper_qtimer_expiration) {
+        _shaper_qtimer_expiration = _shaper_timers->expiration;
+        qemu_mod_timer( _shaper_qtimer, _shaper_qtimer_expiration );
+    }
+}
+
+static void
+shaper_timer_cancel( ShaperTimer  timer )
+{
+    if (timer->pnext != NULL) {
+        *timer->pnext = timer->next;
+        if (timer->next)
+            timer->next->pnext = timer->pnext;
+        timer->next  = NULL;
+        timer->pnext = NULL;
+        _shaper_timers_rearm();
+    }
+}
+
+static void
+shaper_timer_schedule( ShaperTimer  timer, int64_t  expiration )
+{
+    ShaperTimer*  pnode;
+    ShaperTimer   node;
+
+    if (timer->pnext != NULL) {
+        if (timer->expiration == expiration)
+            return;
+        *timer->pnext = timer->next;
+        if (timer->next)
+            timer->next->pnext = timer->pnext;
+    }
+
+    timer->expiration = expiration;
+
+    pnode = &_shaper_timers;
+    for (;;) {
+        node = *pnode;
+        if (node == NULL || node->expiration > expiration)
+            break;
+        pnode = &node->next;
+    }
+    timer->next  = node;
+    timer->pnext = pnode;
+    if (node)
+        node->pnext = &timer->next;
+    *pnode = timer;
+
+    _shaper_timers_rearm();
+}
+
+static void
+_shaper_timers_expire( void*  opaque )
+{
+    ShaperTimer  timer;
+    int64_t      now = qemu_get_clock( SHAPER_CLOCK );
+
+    _shaper_qtimer_expiration = -1;
+
+    while ((timer = _shaper_timers) != NULL && timer->expiration <= now) {
+        _shaper_timers = timer->next;
+        if (timer->next)
+            timer->next->pnext = &_shaper_timers;
+        timer->next  = NULL;
+        timer->pnext = NULL;
+
+        /* this may re-schedule the timer */
+        timer->func( timer->opaque, now );
+    }
+    _shaper_timers_rearm();
+}
+
 typedef struct NetShaperRec_ {
     QueuedPacket   packets;   /* list of queued packets, ordered by expiration date */
+    QueuedPacket*  ptail;     /* where to append the next packet */
     int            num_packets;
     int            active;    /* is this shaper active ? */
-    int64_t        block_until;
+    double         block_until; /* in fractional SHAPER_CLOCK units */
     double         max_rate;  /* max rate expressed in bytes/second */
     double         inv_rate;  /* inverse of max rate                */
-    QEMUTimer*     timer;     /* QEMU timer */
+    ShaperTimerRec timer[1];
 
     int                do_copy;
     NetShaperSendFunc  send_func;
@@ -110,35 +256,40 @@ typedef struct NetShaperRec_ {
 } NetShaperRec;
 
 
+static void
+netshaper_flush( NetShaper  shaper, int  do_send )
+{
+    while (shaper->packets) {
+        QueuedPacket  packet = shaper->packets;
+        shaper->packets = packet->next;
+        packet->next    = NULL;
+        if (do_send)
+            shaper->send_func(packet->data, packet->size, packet->opaque);
+        queued_packet_free(packet);
+    }
+    shaper->ptail       = &shaper->packets;
+    shaper->num_packets = 0;
+    shaper_timer_cancel(shaper->timer);
+}
+
 void
 netshaper_destroy( NetShaper  shaper )
 {
     if (shaper) {
         shaper->active = 0;
-
-        while (shaper->packets) {
-            QueuedPacket  packet = shaper->packets;
-            shaper->packets = packet->next;
-            packet->next    = NULL;
-            queued_packet_free(packet);
-        }
-
-        qemu_del_timer(shaper->timer);
-        qemu_free_timer(shaper->timer);
-        shaper->timer = NULL;
+        netshaper_flush(shaper, 0);
         qemu_free(shaper);
     }
 }
 
-/* this function is called when the shaper's timer expires */
+/* this function is called when the shaper's first packet expires */
 static void
-netshaper_expires( NetShaper  shaper )
+netshaper_expires( void*  opaque, int64_t  now )
 {
+    NetShaper     shaper = opaque;
     QueuedPacket  packet;
 
     while ((packet = shaper->packets) != NULL) {
-        int64_t   now = qemu_get_clock( SHAPER_CLOCK );
-
        if (packet->expiration > now)
            break;
 
@@ -149,12 +300,10 @@ netshaper_expires( NetShaper  shaper )
    }
 
    /* reprogram timer if needed */
-   if (shaper->packets) {
-       shaper->block_until = shaper->packets->expiration;
-       qemu_mod_timer( shaper->timer, shaper->block_until );
-   } else {
-       shaper->block_until = -1;
-   }
+   if (shaper->packets)
+       shaper_timer_schedule( shaper->timer, shaper->packets->expiration );
+   else
+       shaper->ptail = &shaper->packets;
 }
 
 
@@ -166,10 +315,10 @@ netshaper_create( int                do_copy,
 
     shaper->active = 0;
     shaper->packets = NULL;
+    shaper->ptail   = &shaper->packets;
     shaper->num_packets = 0;
-    shaper->timer   = qemu_new_timer( SHAPER_CLOCK,
-                                      (QEMUTimerCB*) netshaper_expires,
-                                      shaper );
+    shaper_timer_init( shaper->timer, netshaper_expires, shaper );
+    shaper->do_copy   = do_copy;
     shaper->send_func = send_func;
     shaper->max_rate  = 1e6;
     shaper->inv_rate  = 0.;
@@ -184,13 +333,7 @@ netshaper_set_rate( NetShaper  shaper,
                     double     rate )
 {
     /* send all current packets when changing the rate */
-    while (shaper->packets) {
-        QueuedPacket  packet = shaper->packets;
-        shaper->packets = packet->next;
-        shaper->send_func(packet->data, packet->size, packet->opaque);
-        qemu_free(packet);
-        shaper->num_packets = 0;
-    }
+    netshaper_flush(shaper, 1);
 
     shaper->max_rate = rate;
     if (rate > 1.) {
@@ -216,38 +359,34 @@ netshaper_send_aux( NetShaper  shaper,
         return;
     }
 
+    /* never overtake queued packets, even if they are already due */
     now = qemu_get_clock( SHAPER_CLOCK );
-    if (now >= shaper->block_until) {
+    if (shaper->packets == NULL && now >= shaper->block_until) {
         shaper->send_func( data, size, opaque );
         shaper->block_until = now + size*shaper->inv_rate;
         //fprintf(stderr, "NETSHAPER: block for %.2fms\n", (shaper->block_until - now)*1.0 );
         return;
     }
 
-    /* create new packet, add it to the queue */
+    /* create new packet, add it to the queue. since block_until only
+     * grows while packets are queued, the queue stays sorted by just
+     * appending to it */
     {
         QueuedPacket   packet;
 
         packet = queued_packet_create( data, size, opaque, shaper->do_copy );
 
-        packet->expiration = shaper->block_until;
+        if (shaper->block_until < now)
+            shaper->block_until = now;
 
-        {
-            QueuedPacket  *pnode, node;
-
-            pnode = &shaper->packets;
-            for (;;) {
-                node = *pnode;
-                if (node == NULL || node->expiration > packet->expiration )
-                    break;
-                pnode = &node->next;
-            }
-            packet->next = *pnode;
-            *pnode       = packet;
+        packet->expiration = (int64_t)shaper->block_until;
+
+        *shaper->ptail = packet;
+        shaper->ptail  = &packet->next;
+
+        if (packet == shaper->packets)
+            shaper_timer_schedule( shaper->timer, packet->expiration );
 
-            if (packet == shaper->packets)
-                qemu_mod_timer( shaper->timer, packet->expiration );
-        }
         shaper->num_packets += 1;
     }
     shaper->block_until += size*shaper->inv_rate;
@@ -285,16 +424,18 @@ netshaper_can_send( NetShaper  shaper )
 
 /* this type is used to model a session connection/state
  * if session->packet is != NULL, then the connection is delayed
+ * and session->timer is scheduled to release it
  */
 typedef struct SessionRec_ {
-    int64_t               expiration;
-    struct SessionRec_*   next;
+    struct SessionRec_*   next;   /* in hash bucket */
     unsigned              src_ip;
     unsigned              dst_ip;
     unsigned short        src_port;
     unsigned short        dst_port;
     uint8_t               protocol;
     QueuedPacket          packet;
+    struct NetDelayRec_*  delay;
+    ShaperTimerRec        timer[1];
 
 } SessionRec, *Session;
 
@@ -307,6 +448,7 @@ static void
 session_free( Session  session )
 {
     if (session) {
+        shaper_timer_cancel( session->timer );
         if (session->packet) {
             queued_packet_free(session->packet);
             session->packet = NULL;
@@ -380,11 +522,12 @@ _packet_SYN_flags( const void*  _data, size_t   size, Session  info )
 }
 
 
+#define  DELAY_HASH_SIZE   256   /* must be a power of 2 */
+
 typedef struct NetDelayRec_
 {
-    Session     sessions;
+    Session     sessions[ DELAY_HASH_SIZE ];
     int         num_sessions;
-    QEMUTimer*  timer;
     int         active;
     int         min_ms;
     int         max_ms;
@@ -397,9 +540,16 @@ typedef struct NetDelayRec_
 static Session*
 netdelay_lookup_session( NetDelay  delay, Session  info )
 {
-    Session*  pnode = &delay->sessions;
+    unsigned  hash;
+    Session*  pnode;
     Session   node;
 
+    hash  = info->src_ip ^ (info->dst_ip * 31) ^ info->protocol;
+    hash ^= (info->src_port << 16) | info->dst_port;
+    hash ^= (hash >> 16);
+    hash ^= (hash >> 8);
+
+    pnode = &delay->sessions[ hash & (DELAY_HASH_SIZE-1) ];
     for (;;) {
         node = *pnode;
         if (node == NULL)
@@ -418,54 +568,30 @@ netdelay_lookup_session( NetDelay  delay, Session  info )
 }
 
 
-
-/* called by the delay's timer on expiration */
+/* called when a delayed session's SYN packet must be sent */
 static void
-netdelay_expires( NetDelay  delay )
+netdelay_session_expires( void*  opaque, int64_t  now )
 {
-    Session  session;
-    int64_t  now = qemu_get_clock( SHAPER_CLOCK );
-    int      rearm = 0;
-    int64_t  rearm_time = 0;
-
-    for (session = delay->sessions; session != NULL; session = session->next)
-    {
-        QueuedPacket  packet = session->packet;
-
-        if (packet == NULL)
-            continue;
-
-        if (session->expiration <= now) {
-            /* send the SYN packet now */
-                    //fprintf(stderr, "NetDelay:RST: sending creation for %s\n", session_to_string(session) );
-            delay->send_func( packet->data, packet->size, packet->opaque );
-            session->packet = NULL;
-            queued_packet_free( packet );
-        } else {
-            if (!rearm) {
-                rearm      = 1;
-                rearm_time = session->expiration;
-            }
-            else if ( session->expiration < rearm_time )
-                rearm_time = session->expiration;
-        }
+    Session       session = opaque;
+    NetDelay      delay   = session->delay;
+    QueuedPacket  packet  = session->packet;
+
+    if (packet != NULL) {
+        /* send the SYN packet now */
+                //fprintf(stderr, "NetDelay:RST: sending creation for %s\n", session_to_string(session) );
+        session->packet = NULL;
+        delay->send_func( packet->data, packet->size, packet->opaque );
+        queued_packet_free( packet );
     }
-
-    if (rearm)
-        qemu_mod_timer( delay->timer, rearm_time );
 }
 
 
 NetDelay
 netdelay_create( NetShaperSendFunc  send_func )
 {
-    NetDelay  delay = qemu_malloc(sizeof(*delay));
+    NetDelay  delay = qemu_mallocz(sizeof(*delay));
 
-    delay->sessions     = NULL;
     delay->num_sessions = 0;
-    delay->timer        = qemu_new_timer( SHAPER_CLOCK,
-                                          (QEMUTimerCB*) netdelay_expires,
-                                          delay );
     delay->active = 0;
     delay->min_ms = 0;
     delay->max_ms = 0;
@@ -476,21 +602,33 @@ netdelay_create( NetShaperSendFunc  send_func )
 }
 
 
+/* remove all sessions, sending their delayed packets if 'do_send' is set */
+static void
+netdelay_flush( NetDelay  delay, int  do_send )
+{
+    int  nn;
+
+    for (nn = 0; nn < DELAY_HASH_SIZE; nn++) {
+        while (delay->sessions[nn]) {
+            Session  session = delay->sessions[nn];
+            delay->sessions[nn] = session->next;
+            session->next = NULL;
+            if (do_send && session->packet) {
+                QueuedPacket  packet = session->packet;
+                delay->send_func( packet->data, packet->size, packet->opaque );
+            }
+            session_free(session);
+            delay->num_sessions--;
+        }
+    }
+}
+
+
 void
 netdelay_set_latency( NetDelay  delay, int  min_ms, int  max_ms )
 {
     /* when changing the latency, accept all sessions */
-    while (delay->sessions) {
-        Session  session = delay->sessions;
-        delay->sessions = session->next;
-        session->next = NULL;
-        if (session->packet) {
-            QueuedPacket  packet = session->packet;
-            delay->send_func( packet->data, packet->size, packet->opaque );
-        }
-        session_free(session);
-        delay->num_sessions--;
-    }
+    netdelay_flush(delay, 1);
 
     delay->min_ms = min_ms;
     delay->max_ms = max_ms;
@@ -549,21 +687,22 @@ netdelay_send_aux( NetDelay  delay, const void*  data, size_t  size, void* opaqu
                     //fprintf(stderr, "NetDelay:RST: delay creation for %s\n", session_to_string(info) );
                 session = qemu_malloc( sizeof(*session) );
 
-                session->next        = delay->sessions;
-                delay->sessions      = session;
+                session->next        = NULL;
+                *lookup              = session;
                 delay->num_sessions += 1;
 
-                session->expiration = qemu_get_clock( SHAPER_CLOCK ) + latency;
-
                 session->src_ip   = info->src_ip;
                 session->dst_ip   = info->dst_ip;
                 session->src_port = info->src_port;
                 session->dst_port = info->dst_port;
                 session->protocol = info->protocol;
+                session->delay    = delay;
 
                 session->packet = queued_packet_create( data, size, opaque, 1 );
 
-                netdelay_expires(delay);
+                shaper_timer_init( session->timer, netdelay_session_expires, session );
+                shaper_timer_schedule( session->timer,
+                                       qemu_get_clock( SHAPER_CLOCK ) + latency );
                 return;
             }
         }
@@ -577,14 +716,8 @@ void
 netdelay_destroy( NetDelay  delay )
 {
     if (delay) {
-        while (delay->sessions) {
-            Session  session = delay->sessions;
-            delay->sessions = session->next;
-            session_free(session);
-            delay->num_sessions -= 1;
-        }
+        netdelay_flush(delay, 0);
         delay->active = 0;
         qemu_free( delay );
     }
 }
-
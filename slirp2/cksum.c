@@ -37,105 +37,107 @@
 #include <slirp.h>
 
 /*
- * Checksum routine for Internet Protocol family headers (Portable Version).
+ * Checksum routine for Internet Protocol family headers.
  *
  * This routine is very heavily used in the network
  * code and should be modified for each CPU to be as fast as possible.
- * 
- * XXX Since we will never span more than 1 mbuf, we can optimise this
+ *
+ * Since we never span more than 1 mbuf, the data is summed as a flat
+ * buffer.  The one's complement sum is independent of the byte order
+ * and of the word size used, as long as the words are loaded in host
+ * order at even offsets from the start of the data, so we add 32-bit
+ * words into a 64-bit accumulator and fold the carries at the end.
  */
 
-#define ADDCARRY(x)  (x > 65535 ? x -= 65535 : x)
-#define REDUCE {l_util.l = sum; sum = l_util.s[0] + l_util.s[1]; ADDCARRY(sum);}
+static __inline__ u_int32_t
+cksum_load32(const u_int8_t*  p)
+{
+	u_int32_t  v;
+	memcpy(&v, p, 4);
+	return v;
+}
 
-int cksum(MBuf m, int len)
+/*
+ * Return the 16-bit one's complement sum of len bytes at p,
+ * not complemented.
+ */
+static u_int16_t
+cksum_data(const u_int8_t*  p, int  len)
 {
-	register u_int16_t *w;
-	register int sum = 0;
-	register int mlen = 0;
-	int byte_swapped = 0;
+	u_int64_t  sum = 0;
 
-	union {
-		u_int8_t	c[2];
-		u_int16_t	s;
-	} s_util;
-	union {
-		u_int16_t s[2];
-		u_int32_t l;
-	} l_util;
-	
-	if (m->m_len == 0)
-	   goto cont;
-	w = MBUF_TO(m, u_int16_t *);
-	
-	mlen = m->m_len;
-	
-	if (len < mlen)
-	   mlen = len;
-	len -= mlen;
-	/*
-	 * Force to even boundary.
-	 */
-	if ((1 & (long) w) && (mlen > 0)) {
-		REDUCE;
-		sum <<= 8;
-		s_util.c[0] = *(u_int8_t *)w;
-		w = (u_int16_t *)((int8_t *)w + 1);
-		mlen--;
-		byte_swapped = 1;
-	}
 	/*
 	 * Unroll the loop to make overhead from
 	 * branches &c small.
 	 */
-	while ((mlen -= 32) >= 0) {
-		sum += w[0]; sum += w[1]; sum += w[2]; sum += w[3];
-		sum += w[4]; sum += w[5]; sum += w[6]; sum += w[7];
-		sum += w[8]; sum += w[9]; sum += w[10]; sum += w[11];
-		sum += w[12]; sum += w[13]; sum += w[14]; sum += w[15];
-		w += 16;
+	while (len >= 32) {
+		sum += cksum_load32(p);      sum += cksum_load32(p + 4);
+		sum += cksum_load32(p + 8);  sum += cksum_load32(p + 12);
+		sum += cksum_load32(p + 16); sum += cksum_load32(p + 20);
+		sum += cksum_load32(p + 24); sum += cksum_load32(p + 28);
+		p   += 32;
+		len -= 32;
 	}
-	mlen += 32;
-	while ((mlen -= 8) >= 0) {
-		sum += w[0]; sum += w[1]; sum += w[2]; sum += w[3];
-		w += 4;
+	while (len >= 4) {
+		sum += cksum_load32(p);
+		p   += 4;
+		len -= 4;
 	}
-	mlen += 8;
-	if (mlen == 0 && byte_swapped == 0)
-	   goto cont;
-	REDUCE;
-	while ((mlen -= 2) >= 0) {
-		sum += *w++;
+	if (len >= 2) {
+		u_int16_t  w;
+		memcpy(&w, p, 2);
+		sum += w;
+		p   += 2;
+		len -= 2;
 	}
-	
-	if (byte_swapped) {
-		REDUCE;
-		sum <<= 8;
-		byte_swapped = 0;
-		if (mlen == -1) {
-			s_util.c[1] = *(u_int8_t *)w;
-			sum += s_util.s;
-			mlen = 0;
-		} else
-		   
-		   mlen = -1;
-	} else if (mlen == -1)
-	   s_util.c[0] = *(u_int8_t *)w;
-	
-cont:
-#ifdef DEBUG
 	if (len) {
-		DEBUG_ERROR((dfd, "cksum: out of data\n"));
-		DEBUG_ERROR((dfd, " len = %d\n", len));
-	}
-#endif
-	if (mlen == -1) {
-		/* The last mbuf has odd # of bytes. Follow the
+		/* The data has an odd # of bytes. Follow the
 		 standard (the odd byte may be shifted left by 8 bits
 			   or not as determined by endian-ness of the machine) */
+		union {
+			u_int8_t	c[2];
+			u_int16_t	s;
+		} s_util;
+		s_util.c[0] = *p;
 		s_util.c[1] = 0;
 		sum += s_util.s;
 	}
-	REDUCE;
-	return (~sum & 0xffff);
+
+	sum = (sum >> 32) + (sum & 0xffffffff);
+	sum = (sum >> 32) + (sum & 0xffffffff);
+	sum = (sum >> 16) + (sum & 0xffff);
+	sum = (sum >> 16) + (sum & 0xffff);
+	return (u_int16_t)sum;
+}
+
+int cksum(MBuf m, int len)
+{
+	int mlen = m->m_len;
+
+	if (len < mlen)
+	   mlen = len;
+#ifdef DEBUG
+	if (len > mlen) {
+		DEBUG_ERROR((dfd, "cksum: out of data\n"));
+		DEBUG_ERROR((dfd, " len = %d\n", len - mlen));
+	}
+#endif
+	if (mlen <= 0)
+	   return 0xffff;
+
+	return (~cksum_data(MBUF_TO(m, u_int8_t *), mlen) & 0xffff);
+}
+
+/*
+ * Incrementally update a checksum after a 16-bit word of the
+ * checksummed data changed from old_w to new_w (RFC 1624, eqn. 3).
+ * All values are in the same (memory) order as cksum() uses.
+ */
+u_int16_t cksum_adjust(u_int16_t sum, u_int16_t old_w, u_int16_t new_w)
+{
+	u_int32_t  x = (u_int16_t)~sum + (u_int16_t)~old_w + new_w;
+
+	x = (x >> 16) + (x & 0xffff);
+	x = (x >> 16) + (x & 0xffff);
+	return (u_int16_t)~x;
 }
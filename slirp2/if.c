@@ -313,7 +313,7 @@ if_start(void)
 	}
 	
 	/* Encapsulate the packet for sending */
-        if_encap(ifm->m_data, ifm->m_len);
+        if_encap(ifm);
 
         mbuf_free(ifm);
 
@@ -113,7 +113,14 @@ icmp_input(m, hlen)
   DEBUG_ARG("icmp_type = %d", icp->icmp_type);
   switch (icp->icmp_type) {
   case ICMP_ECHO:
-    icp->icmp_type = ICMP_ECHOREPLY;
+    {
+      /* the checksum was just verified, patch it rather than
+       * summing the whole echo payload again in icmp_reflect() */
+      u_int16_t  old_w;
+      memcpy(&old_w, icp, 2);
+      icp->icmp_type = ICMP_ECHOREPLY;
+      icp->icmp_cksum = cksum_adjust(icp->icmp_cksum, old_w, *(u_int16_t*)icp);
+    }
     ip->ip_len += hlen;	             /* since ip_input subtracts this */
     if (ip_geth(ip->ip_dst) == alias_addr_ip) {
       icmp_reflect(m);
@@ -252,7 +259,10 @@ icmp_error(msrc, type, code, minsize, message)
   if(!(m=mbuf_alloc())) goto end_error;               /* get mbuf */
   { int new_m_size;
     new_m_size=sizeof(struct ip )+ICMP_MINLEN+msrc->m_len+ICMP_MAXDATALEN;
-    if(new_m_size>m->m_size) mbuf_ensure(m, new_m_size);
+    if(new_m_size>m->m_size && mbuf_ensure(m, new_m_size) < 0) {
+      mbuf_free(m);
+      goto end_error;
+    }
   }
   memcpy(m->m_data, msrc->m_data, msrc->m_len);
   m->m_len = msrc->m_len;                        /* copy msrc to m */
@@ -324,7 +334,8 @@ end_error:
 #undef ICMP_MAXDATALEN
 
 /*
- * Reflect the ip packet back to the source
+ * Reflect the ip packet back to the source, the icmp
+ * checksum must already be up to date
  */
 void
 icmp_reflect(m)
@@ -333,21 +344,6 @@ icmp_reflect(m)
   register struct ip *ip = MBUF_TO(m, struct ip *);
   int hlen = ip->ip_hl << 2;
   int optlen = hlen - sizeof(struct ip );
-  register struct icmp *icp;
-
-  /*
-   * Send an icmp packet back to the ip level,
-   * after supplying a checksum.
-   */
-  m->m_data += hlen;
-  m->m_len -= hlen;
-  icp = MBUF_TO(m, struct icmp *);
-
-  icp->icmp_cksum = 0;
-  icp->icmp_cksum = cksum(m, ip->ip_len - hlen);
-
-  m->m_data -= hlen;
-  m->m_len += hlen;
 
   /* fill in ip */
   if (optlen > 0) {
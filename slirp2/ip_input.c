@@ -247,9 +247,9 @@ ip_reass(ip, fp)
 	register struct ipq *fp;
 {
 	register MBuf m = MBUF_FROM(ip);
-	register struct ipasfrag *q;
+	register struct ipasfrag *q, *dq;
 	int hlen = ip->ip_hl << 2;
-	int i, next;
+	int i, next, delta;
 	
 	DEBUG_CALL("ip_reass");
 	DEBUG_ARG("ip = %lx", (long)ip);
@@ -320,8 +320,9 @@ ip_reass(ip, fp)
                    break;
 		}
 		q = q->ipf_next;
-		mbuf_free(MBUF_FROM(q->ipf_prev));
-		ip_deq(q->ipf_prev);
+		dq = q->ipf_prev;
+		ip_deq(dq);
+		mbuf_free(MBUF_FROM(dq));
 	}
 
 insert:
@@ -348,11 +349,29 @@ insert:
 	q = fp->frag_link.next;
 	m = MBUF_FROM(q);
 
+	/*
+	 * The reassembly header of the first fragment lives in m,
+	 * which can already be an M_EXT mbuf for jumbo frames.
+	 * Remember where it is in the current buffer, since
+	 * appending the other fragments may move it.
+	 */
+	delta = (char *)q - ((m->m_flags & M_EXT) ? m->m_ext : m->m_dat);
+
 	q = (struct ipasfrag *) q->ipf_next;
 	while (q != (struct ipasfrag *)&fp->frag_link) {
 	  MBuf t = MBUF_FROM(q);
 	  q = (struct ipasfrag *) q->ipf_next;
-	  mbuf_append(m, t);
+	  if (mbuf_append(m, t) < 0) {
+	    /* t is freed, drop the rest of the datagram */
+	    while (q != (struct ipasfrag *)&fp->frag_link) {
+	      t = MBUF_FROM(q);
+	      q = (struct ipasfrag *) q->ipf_next;
+	      mbuf_free(t);
+	    }
+	    remque(&fp->ip_link);
+	    (void) mbuf_free(MBUF_FROM(fp));
+	    goto dropfrag;
+	  }
 	}
 
 	/*
@@ -367,13 +386,9 @@ insert:
 	 * If the fragments concatenated to an mbuf that's
 	 * bigger than the total size of the fragment, then and
 	 * m_ext buffer was alloced. But fp->ipq_next points to
-	 * the old buffer (in the mbuf), so we must point ip
-	 * into the new buffer.
+	 * the old buffer, so we must point ip into the new buffer.
 	 */
-	if (m->m_flags & M_EXT) {
-	  int delta = (char *)q - m->m_dat;
-	  q = (struct ipasfrag *)(m->m_ext + delta);
-	}
+	q = (struct ipasfrag *)(((m->m_flags & M_EXT) ? m->m_ext : m->m_dat) + delta);
 
 	/* DEBUG_ARG("ip = %lx", (long)ip); 
 	 * ip=(struct ipasfrag *)m->m_data; */
@@ -10,19 +10,233 @@
  * FreeBSD.  They are fixed size, determined by the MTU,
  * so that one whole packet can fit.  Mbuf's cannot be
  * chained together.  If there's more data than the mbuf
- * could hold, an external malloced buffer is pointed to
- * by m_ext (and the data pointers) and M_EXT is set in
+ * could hold, an external buffer taken from one of the
+ * size-class pools (or malloced, if really huge) is pointed
+ * to by m_ext (and the data pointers) and M_EXT is set in
  * the flags
  */
 
 #include <slirp.h>
 
 static int      mbuf_alloced = 0;
-static MBufRec  m_freelist, m_usedlist;
-static int      mbuf_thresh = 30;
+static MBufRec  m_usedlist;
 static int      mbuf_max = 0;
 static int      msize;
 
+/*
+ * mbufs and their M_EXT data segments are carved out of slabs, one
+ * set of slabs per size class.  every item is preceded by a cache line
+ * that records its owning slab, so the mbuf header itself always starts
+ * on a cache-line boundary and releasing an item never needs a search.
+ *
+ * a slab is returned to the system once all its items are free, except
+ * for one empty slab per class that is kept around to absorb bursts.
+ */
+#define  MBUF_CACHE_LINE   64
+#define  MBUF_ALIGN(x)     (((x) + MBUF_CACHE_LINE-1) & ~(MBUF_CACHE_LINE-1))
+#define  MBUF_SLAB_BYTES   65536  /* minimum payload bytes per slab */
+#define  MBUF_SLAB_ITEMS   4      /* minimum number of items per slab */
+
+typedef struct MSlab  MSlab;
+typedef struct MPool  MPool;
+
+struct MSlab {
+	MSlab*   next;      /* in pool's partial list */
+	MSlab*   prev;
+	MPool*   pool;
+	char*    free;      /* first free item payload */
+	int      inuse;
+};
+
+struct MPool {
+	int       size;      /* usable bytes per item */
+	int       stride;    /* bytes between two items of a slab */
+	int       count;     /* items per slab */
+	MSlab     partial;   /* slabs that have at least one free item */
+	int       slabs;
+	int       empty;     /* number of fully free slabs in 'partial' */
+	int       inuse;
+	int       peak;
+	unsigned  allocs;
+	unsigned  refills;   /* slabs malloc()ed to satisfy an allocation */
+	unsigned  failures;
+};
+
+#define  MPOOL_EXT_MIN    2048
+#define  MPOOL_EXT_COUNT  6      /* 2K .. 64K */
+#define  MPOOL_EXT_MAX    (MPOOL_EXT_MIN << (MPOOL_EXT_COUNT-1))
+
+static MPool    mpool_mbuf;
+static MPool    mpool_ext[ MPOOL_EXT_COUNT ];
+
+static int      mbuf_ext_alloced;   /* M_EXT segments too big for any pool */
+
+#define  MITEM_SLAB(p)   (*(MSlab**)((char*)(p) - MBUF_CACHE_LINE))
+
+static void
+mpool_init( MPool*  pool, int  size )
+{
+	int  count;
+
+	pool->size   = size;
+	pool->stride = MBUF_CACHE_LINE + MBUF_ALIGN(size);
+
+	count = MBUF_SLAB_BYTES / pool->stride;
+	if (count < MBUF_SLAB_ITEMS)
+		count = MBUF_SLAB_ITEMS;
+	pool->count = count;
+
+	pool->partial.next = pool->partial.prev = &pool->partial;
+}
+
+static void
+mslab_insert( MSlab*  slab, MSlab*  head )
+{
+	slab->next       = head->next;
+	slab->prev       = head;
+	head->next       = slab;
+	slab->next->prev = slab;
+}
+
+static void
+mslab_remove( MSlab*  slab )
+{
+	slab->prev->next = slab->next;
+	slab->next->prev = slab->prev;
+	slab->next = slab->prev = slab;
+}
+
+static MSlab*
+mslab_new( MPool*  pool )
+{
+	MSlab*  slab;
+	char*   item;
+	char*   last = NULL;
+	int     nn;
+
+	/* over-allocate so that we can align the first item ourselves */
+	slab = malloc( MBUF_ALIGN(sizeof(MSlab)) + MBUF_CACHE_LINE +
+	               pool->count * pool->stride );
+	if (slab == NULL)
+		return NULL;
+
+	slab->pool  = pool;
+	slab->inuse = 0;
+	slab->free  = NULL;
+
+	item = (char*)MBUF_ALIGN((unsigned long)slab + sizeof(MSlab) + MBUF_CACHE_LINE);
+
+	for (nn = 0; nn < pool->count; nn++, item += pool->stride) {
+		MITEM_SLAB(item) = slab;
+		if (last)
+			*(char**)last = item;
+		else
+			slab->free = item;
+		last = item;
+	}
+	*(char**)last = NULL;
+
+	pool->slabs  += 1;
+	pool->empty  += 1;
+	pool->refills += 1;
+	mslab_insert(slab, &pool->partial);
+	return slab;
+}
+
+static void*
+mpool_alloc( MPool*  pool )
+{
+	MSlab*  slab = pool->partial.next;
+	char*   item;
+
+	if (slab == &pool->partial) {
+		slab = mslab_new(pool);
+		if (slab == NULL) {
+			pool->failures += 1;
+			return NULL;
+		}
+	}
+
+	item       = slab->free;
+	slab->free = *(char**)item;
+	if (slab->inuse++ == 0)
+		pool->empty -= 1;
+
+	if (slab->free == NULL)
+		mslab_remove(slab);
+
+	pool->allocs += 1;
+	if (++pool->inuse > pool->peak)
+		pool->peak = pool->inuse;
+
+	return item;
+}
+
+static void
+mpool_free( void*  item )
+{
+	MSlab*  slab = MITEM_SLAB(item);
+	MPool*  pool = slab->pool;
+
+	if (slab->free == NULL) {
+		/* slab was full, make it available again, most-used first */
+		mslab_insert(slab, &pool->partial);
+	}
+	*(char**)item = slab->free;
+	slab->free    = item;
+	pool->inuse  -= 1;
+
+	if (--slab->inuse == 0) {
+		if (pool->empty > 0) {
+			/* keep a single spare slab per class */
+			mslab_remove(slab);
+			free(slab);
+			pool->slabs -= 1;
+		} else {
+			/* move it to the tail so partial slabs are drained first */
+			mslab_remove(slab);
+			mslab_insert(slab, pool->partial.prev);
+			pool->empty += 1;
+		}
+	}
+}
+
+/* return the pool that serves M_EXT segments of 'size' bytes, or NULL */
+static MPool*
+mpool_ext_for( int  size )
+{
+	int  nn, csize = MPOOL_EXT_MIN;
+
+	for (nn = 0; nn < MPOOL_EXT_COUNT; nn++, csize <<= 1) {
+		if (size <= csize)
+			return &mpool_ext[nn];
+	}
+	return NULL;
+}
+
+static char*
+mbuf_ext_alloc( int  *psize )
+{
+	MPool*  pool = mpool_ext_for(*psize);
+
+	if (pool == NULL) {
+		mbuf_ext_alloced++;
+		return malloc(*psize);
+	}
+	*psize = pool->size;
+	return mpool_alloc(pool);
+}
+
+static void
+mbuf_ext_free( char*  ext, int  size )
+{
+	if (size > MPOOL_EXT_MAX) {
+		mbuf_ext_alloced--;
+		free(ext);
+	} else
+		mpool_free(ext);
+}
+
 /* 
  * How much room is in the mbuf, from m_data to the end of the mbuf
  */
@@ -36,13 +250,24 @@ static int      msize;
  */
 #define M_FREEROOM(m) (M_ROOM(m) - (m)->m_len)
 
+/*
+ * How much room there is in front of m_data
+ */
+#define M_HEADROOM(m) ((m->m_flags & M_EXT)? \
+			((m)->m_data - (m)->m_ext) : ((m)->m_data - (m)->m_dat))
+
 
 void
 mbuf_init()
 {
-	m_freelist.m_next = m_freelist.m_prev = &m_freelist;
+	int  nn;
+
 	m_usedlist.m_next = m_usedlist.m_prev = &m_usedlist;
 	msize_init();
+
+	mpool_init(&mpool_mbuf, msize);
+	for (nn = 0; nn < MPOOL_EXT_COUNT; nn++)
+		mpool_init(&mpool_ext[nn], MPOOL_EXT_MIN << nn);
 }
 
 void
@@ -74,40 +299,27 @@ mbuf_remque(MBuf  m)
 }
 
 /*
- * Get an mbuf from the free list, if there are none
- * malloc one
- * 
- * Because fragmentation can occur if we alloc new mbufs and
- * free old mbufs, we mark all mbufs above mbuf_thresh as M_DOFREE,
- * which tells m_free to actually free() it
+ * Get an mbuf from the mbuf slab pool
  */
 MBuf
 mbuf_alloc(void)
 {
 	register MBuf m;
-	int flags = 0;
 	
 	DEBUG_CALL("mbuf_alloc");
 	
-	if (m_freelist.m_next == &m_freelist) {
-		m = (MBuf) malloc(msize);
-		if (m == NULL) goto end_error;
-		mbuf_alloced++;
-		if (mbuf_alloced > mbuf_thresh)
-			flags = M_DOFREE;
-		if (mbuf_alloced > mbuf_max)
-			mbuf_max = mbuf_alloced;
-	} else {
-		m = m_freelist.m_next;
-		mbuf_remque(m);
-	}
+	m = mpool_alloc(&mpool_mbuf);
+	if (m == NULL) goto end_error;
+
+	if (++mbuf_alloced > mbuf_max)
+		mbuf_max = mbuf_alloced;
 	
 	/* Insert it in the used list */
 	mbuf_insque(m,&m_usedlist);
-	m->m_flags = (flags | M_USEDLIST);
+	m->m_flags = M_USEDLIST;
 	
 	/* Initialise it */
-	m->m_size  = msize - sizeof(struct m_hdr);
+	m->m_size  = mpool_mbuf.size - sizeof(struct m_hdr);
 	m->m_data  = m->m_dat;
 	m->m_len   = 0;
 	m->m_next2 = NULL;
@@ -129,69 +341,79 @@ mbuf_free(MBuf  m)
 	if (m->m_flags & M_USEDLIST)
 	   mbuf_remque(m);
 	
-	/* If it's M_EXT, free() it */
+	/* If it's M_EXT, give the data segment back */
 	if (m->m_flags & M_EXT)
-	   free(m->m_ext);
+	   mbuf_ext_free(m->m_ext, m->m_size);
 
 	/*
-	 * Either free() it or put it on the free list
+	 * The item (and possibly its whole slab) is gone after this,
+	 * so callers must not free the same mbuf twice.
 	 */
-	if (m->m_flags & M_DOFREE) {
-		free(m);
-		mbuf_alloced--;
-	} else if ((m->m_flags & M_FREELIST) == 0) {
-		mbuf_insque(m,&m_freelist);
-		m->m_flags = M_FREELIST; /* Clobber other flags */
-	}
+	mpool_free(m);
+	mbuf_alloced--;
   } /* if(m) */
 }
 
 /*
  * Copy data from one mbuf to the end of
  * the other.. if result is too big for one mbuf, malloc()
- * an M_EXT data segment
+ * an M_EXT data segment. n is freed in all cases,
+ * returns -1 if m could not be enlarged
  */
-void
+int
 mbuf_append(MBuf  m, MBuf  n)
 {
 	/*
 	 * If there's no room, realloc
 	 */
-	if (M_FREEROOM(m) < n->m_len)
-		mbuf_ensure(m, m->m_size+MINCSIZE);
+	if (M_FREEROOM(m) < n->m_len) {
+		int  size = m->m_size + MINCSIZE;
+
+		if (size < m->m_size + n->m_len - M_FREEROOM(m))
+			size = m->m_size + n->m_len - M_FREEROOM(m);
+
+		if (mbuf_ensure(m, size) < 0) {
+			mbuf_free(n);
+			return -1;
+		}
+	}
 	
 	memcpy(m->m_data+m->m_len, n->m_data, n->m_len);
 	m->m_len += n->m_len;
 
 	mbuf_free(n);
+	return 0;
 }
 
 
-/* make m size bytes large */
-void
+/* make m size bytes large, returns -1 if no segment
+ * could be allocated */
+int
 mbuf_ensure(MBuf  m, int  size)
 {
+	char *dat;
 	int datasize;
 
 	/* some compiles throw up on gotos.  This one we can fake. */
-    if(m->m_size > size) return;
+    if(m->m_size > size) return 0;
+
+    dat = mbuf_ext_alloc(&size);
+    if (dat == NULL) return -1;
 
     if (m->m_flags & M_EXT) {
         datasize = m->m_data - m->m_ext;
-        m->m_ext = (char *)realloc(m->m_ext,size);
-        m->m_data = m->m_ext + datasize;
+        memcpy(dat, m->m_ext, m->m_size);
+        mbuf_ext_free(m->m_ext, m->m_size);
     } else {
-        char *dat;
         datasize = m->m_data - m->m_dat;
-        dat      = (char *)malloc(size);
         memcpy(dat, m->m_dat, m->m_size);
-
-        m->m_ext    = dat;
-        m->m_data   = m->m_ext + datasize;
-        m->m_flags |= M_EXT;
     }
- 
-    m->m_size = size;
+
+    m->m_ext    = dat;
+    m->m_data   = m->m_ext + datasize;
+    m->m_flags |= M_EXT;
+    m->m_size   = size;
+    return 0;
 }
 
 
@@ -233,6 +455,12 @@ mbuf_freeroom( MBuf  m )
 	return  M_FREEROOM(m);
 }
 
+int
+mbuf_headroom( MBuf  m )
+{
+	return  M_HEADROOM(m);
+}
+
 /*
  * Given a pointer into an mbuf, return the mbuf
  * XXX This is a kludge, I should eliminate the need for it
@@ -262,6 +490,15 @@ Exit:
 	return m;
 }
 
+static void
+mpoolstats( MPool*  pool, const char*  name )
+{
+	lprint("  %6d %-6s %6d in use (%d max), %d slabs of %d, "
+	       "%u allocs, %u refills, %u failures\r\n",
+	       pool->size, name, pool->inuse, pool->peak, pool->slabs,
+	       pool->count, pool->allocs, pool->refills, pool->failures);
+}
+
 void
 mbufstats()
 {
@@ -274,14 +511,16 @@ mbufstats()
 
 	lprint("  %6d mbufs allocated (%d max)\r\n", mbuf_alloced, mbuf_max);
 	
-	i = 0;
-	for (m = m_freelist.m_next; m != &m_freelist; m = m->m_next)
-		i++;
-	lprint("  %6d mbufs on free list\r\n",  i);
-	
 	i = 0;
 	for (m = m_usedlist.m_next; m != &m_usedlist; m = m->m_next)
 		i++;
 	lprint("  %6d mbufs on used list\r\n",  i);
-        lprint("  %6d mbufs queued as packets\r\n\r\n", if_queued);
+        lprint("  %6d mbufs queued as packets\r\n", if_queued);
+	lprint("  %6d oversized M_EXT segments\r\n\r\n", mbuf_ext_alloced);
+
+	lprint("Mbuf pools:\r\n");
+	mpoolstats(&mpool_mbuf, "mbuf");
+	for (i = 0; i < MPOOL_EXT_COUNT; i++)
+		mpoolstats(&mpool_ext[i], "ext");
+	lprint("\r\n");
 }
@@ -40,11 +40,8 @@
 #define MINCSIZE 4096	/* Amount to increase mbuf if too small */
 
 /* flags for the mh_flags field */
-#define M_EXT			0x01	/* m_ext points to more (malloced) data */
-#define M_FREELIST		0x02	/* mbuf is on free list */
+#define M_EXT			0x01	/* m_ext points to more (pooled) data */
 #define M_USEDLIST		0x04	/* XXX mbuf is on used list (for dtom()) */
-#define M_DOFREE		0x08	/* when mbuf_free is called on the mbuf, free()
-					                                  * it rather than putting it on the free list */
 
 
 /* XXX About mbufs for slirp:
@@ -107,8 +104,8 @@ void mbuf_init  (void);
 void msize_init (void);
 MBuf mbuf_alloc (void);
 void mbuf_free  (MBuf  m);
-void mbuf_append(MBuf  m1, MBuf  m2);
-void mbuf_ensure(MBuf  m, int  size);
+int  mbuf_append(MBuf  m1, MBuf  m2);
+int  mbuf_ensure(MBuf  m, int  size);
 void mbuf_trim  (MBuf  m, int  len);
 int  mbuf_copy  (MBuf  m, MBuf  n, int  n_offset, int  n_length);
 
@@ -117,5 +114,6 @@ int  mbuf_copy  (MBuf  m, MBuf  n, int  n_offset, int  n_length);
 MBuf  mbuf_from (void *);
 
 int   mbuf_freeroom( MBuf  m );
+int   mbuf_headroom( MBuf  m );
 
 #endif
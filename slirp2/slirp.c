@@ -705,12 +705,18 @@ void slirp_input(const uint8_t *pkt, int pkt_len)
         m = mbuf_alloc();
         if (!m)
             return;
-        /* Note: we add to align the IP header */
-        m->m_len = pkt_len + 2;
-        memcpy(m->m_data + 2, pkt, pkt_len);
-
+        /* jumbo frames get a pooled M_EXT segment */
+        if (pkt_len + 2 > m->m_size)
+            mbuf_ensure(m, pkt_len + 2);
+        if (pkt_len + 2 > m->m_size) {
+            mbuf_free(m);
+            return;
+        }
+        /* Note: we add to align the IP header, the ethernet header
+         * itself is not needed past this point and isn't copied */
         m->m_data += 2 + ETH_HLEN;
-        m->m_len -= 2 + ETH_HLEN;
+        m->m_len   = pkt_len - ETH_HLEN;
+        memcpy(m->m_data, pkt + ETH_HLEN, m->m_len);
 
         ip_input(m);
         break;
@@ -720,21 +726,30 @@ void slirp_input(const uint8_t *pkt, int pkt_len)
 }
 
 /* output the IP packet to the ethernet device */
-void if_encap(const uint8_t *ip_data, int ip_data_len)
+void if_encap(MBuf  m)
 {
     uint8_t buf[1600];
-    struct ethhdr *eh = (struct ethhdr *)buf;
-
-    if (ip_data_len + ETH_HLEN > sizeof(buf))
-        return;
+    struct ethhdr *eh;
+    int ip_data_len = m->m_len;
+
+    /* all outgoing mbufs reserve if_maxlinkhdr bytes in front of
+     * the IP header, so the ethernet header can be built in place
+     * and the frame handed over without a bounce copy */
+    if (mbuf_headroom(m) >= ETH_HLEN) {
+        eh = (struct ethhdr *)(m->m_data - ETH_HLEN);
+    } else {
+        if (ip_data_len + ETH_HLEN > sizeof(buf))
+            return;
+        eh = (struct ethhdr *)buf;
+        memcpy(buf + ETH_HLEN, m->m_data, ip_data_len);
+    }
 
     memcpy(eh->h_dest, client_ethaddr, ETH_ALEN);
     memcpy(eh->h_source, special_ethaddr, ETH_ALEN - 1);
     /* XXX: not correct */
     eh->h_source[5] = CTL_ALIAS;
     eh->h_proto = htons(ETH_P_IP);
-    memcpy(buf + sizeof(struct ethhdr), ip_data, ip_data_len);
-    slirp_output(buf, ip_data_len + ETH_HLEN);
+    slirp_output((const uint8_t *)eh, ip_data_len + ETH_HLEN);
 }
 
 int slirp_redir(int is_udp, int host_port,
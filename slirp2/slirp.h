@@ -215,6 +215,7 @@ extern int do_echo;
 
 /* cksum.c */
 int cksum(MBuf m, int len);
+u_int16_t cksum_adjust(u_int16_t sum, u_int16_t old_w, u_int16_t new_w);
 
 /* if.c */
 void if_init _P((void));
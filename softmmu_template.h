@@ -47,6 +47,32 @@
 #define ADDR_READ addr_read
 #endif
 
+#ifndef TLB_REFILL
+/* refill the direct mapped TLB entry for 'addr' after a miss, from the
+   victim TLB when it still holds the page and with a page table walk
+   otherwise */
+#ifdef CONFIG_PROFILER
+#define TLB_REFILL(elt, addr, is_write, mmu_idx, index, retaddr)           \
+    do {                                                                \
+        if (!tlb_victim_lookup(env, mmu_idx, index,                     \
+                               offsetof(CPUTLBEntry, elt),              \
+                               (addr) & TARGET_PAGE_MASK)) {            \
+            int64_t ti = profile_getclock();                            \
+            tlb_fill(addr, is_write, mmu_idx, retaddr);                 \
+            tlb_stats.refill_time += profile_getclock() - ti;           \
+        }                                                               \
+    } while (0)
+#else
+#define TLB_REFILL(elt, addr, is_write, mmu_idx, index, retaddr)           \
+    do {                                                                \
+        if (!tlb_victim_lookup(env, mmu_idx, index,                     \
+                               offsetof(CPUTLBEntry, elt),              \
+                               (addr) & TARGET_PAGE_MASK))              \
+            tlb_fill(addr, is_write, mmu_idx, retaddr);                 \
+    } while (0)
+#endif
+#endif
+
 static DATA_TYPE glue(glue(slow_ld, SUFFIX), MMUSUFFIX)(target_ulong addr,
                                                         int mmu_idx,
                                                         void *retaddr);
@@ -131,7 +157,7 @@ DATA_TYPE REGPARM glue(glue(__ld, SUFFIX), MMUSUFFIX)(target_ulong addr,
         if ((addr & (DATA_SIZE - 1)) != 0)
             do_unaligned_access(addr, READ_ACCESS_TYPE, mmu_idx, retaddr);
 #endif
-        tlb_fill(addr, READ_ACCESS_TYPE, mmu_idx, retaddr);
+        TLB_REFILL(ADDR_READ, addr, READ_ACCESS_TYPE, mmu_idx, index, retaddr);
         goto redo;
     }
     return res;
@@ -181,7 +207,7 @@ static DATA_TYPE glue(glue(slow_ld, SUFFIX), MMUSUFFIX)(target_ulong addr,
         }
     } else {
         /* the page is not in the TLB : fill it */
-        tlb_fill(addr, READ_ACCESS_TYPE, mmu_idx, retaddr);
+        TLB_REFILL(ADDR_READ, addr, READ_ACCESS_TYPE, mmu_idx, index, retaddr);
         goto redo;
     }
     return res;
@@ -271,7 +297,7 @@ void REGPARM glue(glue(__st, SUFFIX), MMUSUFFIX)(target_ulong addr,
         if ((addr & (DATA_SIZE - 1)) != 0)
             do_unaligned_access(addr, 1, mmu_idx, retaddr);
 #endif
-        tlb_fill(addr, 1, mmu_idx, retaddr);
+        TLB_REFILL(addr_write, addr, 1, mmu_idx, index, retaddr);
         goto redo;
     }
 }
@@ -317,7 +343,7 @@ static void glue(glue(slow_st, SUFFIX), MMUSUFFIX)(target_ulong addr,
         }
     } else {
         /* the page is not in the TLB : fill it */
-        tlb_fill(addr, 1, mmu_idx, retaddr);
+        TLB_REFILL(addr_write, addr, 1, mmu_idx, index, retaddr);
         goto redo;
     }
 }
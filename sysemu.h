@@ -44,6 +44,9 @@ void qemu_system_reset(void);
 void do_savevm(const char *name);
 void do_loadvm(const char *name);
 void do_delvm(const char *name);
+void do_savevm_file(const char *filename);
+void do_loadvm_file(const char *filename);
+void do_clone_save(const char *dir);
 void do_info_snapshots(void);
 
 void main_loop_wait(int timeout);
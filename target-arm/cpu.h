@@ -415,6 +415,21 @@ static inline void cpu_clone_regs(CPUState *env, target_ulong newsp)
 
 #define CPU_PC_FROM_TB(env, tb) env->regs[15] = tb->pc
 
+/* the subset of the CPU state a translated block depends on */
+static inline void cpu_get_tb_cpu_state(CPUState *env, target_ulong *pc,
+                                        target_ulong *cs_base, uint64_t *flags)
+{
+    *flags = env->thumb | (env->vfp.vec_len << 1)
+             | (env->vfp.vec_stride << 4);
+    if ((env->uncached_cpsr & CPSR_M) != ARM_CPU_MODE_USR)
+        *flags |= (1 << 6);
+    if (env->vfp.xregs[ARM_VFP_FPEXC] & (1 << 30))
+        *flags |= (1 << 7);
+    *flags |= (env->condexec_bits << 8);
+    *cs_base = 0;
+    *pc = env->regs[15];
+}
+
 #include "cpu-all.h"
 
 #endif
@@ -942,6 +942,8 @@ static int get_phys_addr_v5(CPUState *env, uint32_t address, int access_type,
         /* Access permission fault.  */
         goto do_fault;
     }
+    /* There are no global pages before ARMv6.  */
+    *prot |= PAGE_NONGLOBAL;
     *phys_ptr = phys_addr;
     return 0;
 do_fault:
@@ -958,6 +960,7 @@ static int get_phys_addr_v6(CPUState *env, uint32_t address, int access_type,
     int type;
     int ap;
     int domain;
+    int ng;
     uint32_t phys_addr;
 
     /* Pagetable walk.  */
@@ -999,12 +1002,14 @@ static int get_phys_addr_v6(CPUState *env, uint32_t address, int access_type,
         }
         ap = ((desc >> 10) & 3) | ((desc >> 13) & 4);
         xn = desc & (1 << 4);
+        ng = desc & (1 << 17);
         code = 13;
     } else {
         /* Lookup l2 entry.  */
         table = (desc & 0xfffffc00) | ((address >> 10) & 0x3fc);
         desc = ldl_phys(table);
         ap = ((desc >> 4) & 3) | ((desc >> 7) & 4);
+        ng = desc & (1 << 11);
         switch (desc & 3) {
         case 0: /* Page translation fault.  */
             code = 7;
@@ -1031,6 +1036,8 @@ static int get_phys_addr_v6(CPUState *env, uint32_t address, int access_type,
         /* Access permission fault.  */
         goto do_fault;
     }
+    if (ng)
+        *prot |= PAGE_NONGLOBAL;
     *phys_ptr = phys_addr;
     return 0;
 do_fault:
@@ -1269,7 +1276,7 @@ void HELPER(set_cp15)(CPUState *env, uint32_t insn, uint32_t val)
                 env->cp15.c1_sys = val;
             /* ??? Lots of these bits are not implemented.  */
             /* This may enable/disable the MMU, so do a TLB flush.  */
-            tlb_flush(env, 1);
+            tlb_flush_cause(env, 1, TLB_FLUSH_MMU_CTRL);
             break;
         case 1: /* Auxiliary cotrol register.  */
             if (arm_feature(env, ARM_FEATURE_XSCALE)) {
@@ -1319,7 +1326,8 @@ void HELPER(set_cp15)(CPUState *env, uint32_t insn, uint32_t val)
         break;
     case 3: /* MMU Domain access control / MPU write buffer control.  */
         env->cp15.c3 = val;
-        tlb_flush(env, 1); /* Flush TLB as domain not tracked in TLB */
+        /* Flush TLB as domain not tracked in TLB */
+        tlb_flush_cause(env, 1, TLB_FLUSH_MMU_CTRL);
         break;
     case 4: /* Reserved.  */
         goto bad_reg;
@@ -1381,7 +1389,7 @@ void HELPER(set_cp15)(CPUState *env, uint32_t insn, uint32_t val)
     case 8: /* MMU TLB control.  */
         switch (op2) {
         case 0: /* Invalidate all.  */
-            tlb_flush(env, 0);
+            tlb_flush_cause(env, 1, TLB_FLUSH_GUEST);
             break;
         case 1: /* Invalidate single TLB entry.  */
 #if 0
@@ -1394,15 +1402,18 @@ void HELPER(set_cp15)(CPUState *env, uint32_t insn, uint32_t val)
             tlb_flush_page(env, val + 0x800);
             tlb_flush_page(env, val + 0xc00);
 #else
-            tlb_flush(env, 1);
+            tlb_flush_cause(env, 1, TLB_FLUSH_GUEST);
 #endif
             break;
         case 2: /* Invalidate on ASID.  */
-            tlb_flush(env, val == 0);
+            /* Non-global entries of other ASIDs were already dropped
+               when switching away from them.  */
+            if (((val ^ env->cp15.c13_context) & 0xff) == 0)
+                tlb_flush_cause(env, 0, TLB_FLUSH_GUEST);
             break;
         case 3: /* Invalidate single entry on MVA.  */
             /* ??? This is like case 1, but ignores ASID.  */
-            tlb_flush(env, 1);
+            tlb_flush_cause(env, 1, TLB_FLUSH_GUEST);
             break;
         default:
             goto bad_reg;
@@ -1452,14 +1463,16 @@ void HELPER(set_cp15)(CPUState *env, uint32_t insn, uint32_t val)
                not modified virtual addresses, so this causes a TLB flush.
              */
             if (env->cp15.c13_fcse != val)
-              tlb_flush(env, 1);
+              tlb_flush_cause(env, 1, TLB_FLUSH_CONTEXT);
             env->cp15.c13_fcse = val;
             break;
         case 1:
-            /* This changes the ASID, so do a TLB flush.  */
+            /* This changes the ASID, so flush the entries that are not
+               global.  The qemu TLB isn't tagged with the ASID as the
+               generated code couldn't check it.  */
             if (env->cp15.c13_context != val
                 && !arm_feature(env, ARM_FEATURE_MPU))
-              tlb_flush(env, 0);
+              tlb_flush_cause(env, 0, TLB_FLUSH_CONTEXT);
             env->cp15.c13_context = val;
             break;
         case 2:
@@ -2256,21 +2269,29 @@ void HELPER(vfp_set_fpscr)(CPUState *env, uint32_t val)
     /* XXX: FZ and DN are not implemented.  */
 }
 
+#include "vfp_host.h"
+
 #define VFP_HELPER(name, p) HELPER(glue(glue(vfp_,name),p))
 
-#define VFP_BINOP(name) \
+#define VFP_BINOP(name, op) \
 float32 VFP_HELPER(name, s)(float32 a, float32 b, CPUState *env) \
 { \
+    float32 r; \
+    if (vfp_host_binop_s(&env->vfp.fp_status, op, a, b, &r)) \
+        return r; \
     return float32_ ## name (a, b, &env->vfp.fp_status); \
 } \
 float64 VFP_HELPER(name, d)(float64 a, float64 b, CPUState *env) \
 { \
+    float64 r; \
+    if (vfp_host_binop_d(&env->vfp.fp_status, op, a, b, &r)) \
+        return r; \
     return float64_ ## name (a, b, &env->vfp.fp_status); \
 }
-VFP_BINOP(add)
-VFP_BINOP(sub)
-VFP_BINOP(mul)
-VFP_BINOP(div)
+VFP_BINOP(add, VFP_HOST_ADD)
+VFP_BINOP(sub, VFP_HOST_SUB)
+VFP_BINOP(mul, VFP_HOST_MUL)
+VFP_BINOP(div, VFP_HOST_DIV)
 #undef VFP_BINOP
 
 float32 VFP_HELPER(neg, s)(float32 a)
@@ -2295,11 +2316,17 @@ float64 VFP_HELPER(abs, d)(float64 a)
 
 float32 VFP_HELPER(sqrt, s)(float32 a, CPUState *env)
 {
+    float32 r;
+    if (vfp_host_sqrt_s(&env->vfp.fp_status, a, &r))
+        return r;
     return float32_sqrt(a, &env->vfp.fp_status);
 }
 
 float64 VFP_HELPER(sqrt, d)(float64 a, CPUState *env)
 {
+    float64 r;
+    if (vfp_host_sqrt_d(&env->vfp.fp_status, a, &r))
+        return r;
     return float64_sqrt(a, &env->vfp.fp_status);
 }
 
@@ -2307,19 +2334,22 @@ float64 VFP_HELPER(sqrt, d)(float64 a, CPUState *env)
 #define DO_VFP_cmp(p, type) \
 void VFP_HELPER(cmp, p)(type a, type b, CPUState *env)  \
 { \
-    uint32_t flags; \
+    uint32_t flags = vfp_fast_cmp_ ## p(a, b); \
+    if (flags == -1) { \
     switch(type ## _compare_quiet(a, b, &env->vfp.fp_status)) { \
     case 0: flags = 0x6; break; \
     case -1: flags = 0x8; break; \
     case 1: flags = 0x2; break; \
     default: case 2: flags = 0x3; break; \
     } \
+    } \
     env->vfp.xregs[ARM_VFP_FPSCR] = (flags << 28) \
         | (env->vfp.xregs[ARM_VFP_FPSCR] & 0x0fffffff); \
 } \
 void VFP_HELPER(cmpe, p)(type a, type b, CPUState *env) \
 { \
-    uint32_t flags; \
+    uint32_t flags = vfp_fast_cmp_ ## p(a, b); \
+    if (flags == -1) \
     switch(type ## _compare(a, b, &env->vfp.fp_status)) { \
     case 0: flags = 0x6; break; \
     case -1: flags = 0x8; break; \
@@ -2381,73 +2411,69 @@ static inline uint64_t vfp_dtoi(float64 d)
 /* Integer to float conversion.  */
 float32 VFP_HELPER(uito, s)(float32 x, CPUState *env)
 {
+    float32 r;
+    if (vfp_host_itof_s(&env->vfp.fp_status, vfp_stoi(x), 0, &r))
+        return r;
     return uint32_to_float32(vfp_stoi(x), &env->vfp.fp_status);
 }
 
 float64 VFP_HELPER(uito, d)(float32 x, CPUState *env)
 {
+    float64 r;
+    if (vfp_host_itof_d(&env->vfp.fp_status, vfp_stoi(x), 0, &r))
+        return r;
     return uint32_to_float64(vfp_stoi(x), &env->vfp.fp_status);
 }
 
 float32 VFP_HELPER(sito, s)(float32 x, CPUState *env)
 {
+    float32 r;
+    if (vfp_host_itof_s(&env->vfp.fp_status, vfp_stoi(x), 1, &r))
+        return r;
     return int32_to_float32(vfp_stoi(x), &env->vfp.fp_status);
 }
 
 float64 VFP_HELPER(sito, d)(float32 x, CPUState *env)
 {
+    float64 r;
+    if (vfp_host_itof_d(&env->vfp.fp_status, vfp_stoi(x), 1, &r))
+        return r;
     return int32_to_float64(vfp_stoi(x), &env->vfp.fp_status);
 }
 
 /* Float to integer conversion.  */
-float32 VFP_HELPER(toui, s)(float32 x, CPUState *env)
-{
-    return vfp_itos(float32_to_uint32(x, &env->vfp.fp_status));
-}
-
-float32 VFP_HELPER(toui, d)(float64 x, CPUState *env)
-{
-    return vfp_itos(float64_to_uint32(x, &env->vfp.fp_status));
-}
-
-float32 VFP_HELPER(tosi, s)(float32 x, CPUState *env)
-{
-    return vfp_itos(float32_to_int32(x, &env->vfp.fp_status));
-}
-
-float32 VFP_HELPER(tosi, d)(float64 x, CPUState *env)
-{
-    return vfp_itos(float64_to_int32(x, &env->vfp.fp_status));
-}
-
-float32 VFP_HELPER(touiz, s)(float32 x, CPUState *env)
-{
-    return vfp_itos(float32_to_uint32_round_to_zero(x, &env->vfp.fp_status));
-}
-
-float32 VFP_HELPER(touiz, d)(float64 x, CPUState *env)
-{
-    return vfp_itos(float64_to_uint32_round_to_zero(x, &env->vfp.fp_status));
-}
-
-float32 VFP_HELPER(tosiz, s)(float32 x, CPUState *env)
-{
-    return vfp_itos(float32_to_int32_round_to_zero(x, &env->vfp.fp_status));
-}
-
-float32 VFP_HELPER(tosiz, d)(float64 x, CPUState *env)
-{
-    return vfp_itos(float64_to_int32_round_to_zero(x, &env->vfp.fp_status));
-}
+#define VFP_FTOI(name, p, ftype, is_signed, trunc, func) \
+float32 VFP_HELPER(name, p)(ftype x, CPUState *env) \
+{ \
+    uint32_t r; \
+    if (vfp_host_ftoi_##p(&env->vfp.fp_status, x, is_signed, trunc, &r)) \
+        return vfp_itos(r); \
+    return vfp_itos(func(x, &env->vfp.fp_status)); \
+}
+VFP_FTOI(toui, s, float32, 0, 0, float32_to_uint32)
+VFP_FTOI(toui, d, float64, 0, 0, float64_to_uint32)
+VFP_FTOI(tosi, s, float32, 1, 0, float32_to_int32)
+VFP_FTOI(tosi, d, float64, 1, 0, float64_to_int32)
+VFP_FTOI(touiz, s, float32, 0, 1, float32_to_uint32_round_to_zero)
+VFP_FTOI(touiz, d, float64, 0, 1, float64_to_uint32_round_to_zero)
+VFP_FTOI(tosiz, s, float32, 1, 1, float32_to_int32_round_to_zero)
+VFP_FTOI(tosiz, d, float64, 1, 1, float64_to_int32_round_to_zero)
+#undef VFP_FTOI
 
 /* floating point conversion */
 float64 VFP_HELPER(fcvtd, s)(float32 x, CPUState *env)
 {
+    float64 r;
+    if (vfp_host_fcvtd(&env->vfp.fp_status, x, &r))
+        return r;
     return float32_to_float64(x, &env->vfp.fp_status);
 }
 
 float32 VFP_HELPER(fcvts, d)(float64 x, CPUState *env)
 {
+    float32 r;
+    if (vfp_host_fcvts(&env->vfp.fp_status, x, &r))
+        return r;
     return float64_to_float32(x, &env->vfp.fp_status);
 }
 
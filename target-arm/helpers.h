@@ -68,8 +68,10 @@ static inline void gen_helper_##name(TCGv ret, \
 #define DEF_HELPER_1_2 DEF_HELPER
 #define DEF_HELPER_1_3 DEF_HELPER
 #define DEF_HELPER_1_4 DEF_HELPER
+#ifndef HELPER
 #define HELPER(x) glue(helper_,x)
 #endif
+#endif
 
 DEF_HELPER_1_1(clz, uint32_t, (uint32_t))
 DEF_HELPER_1_1(sxtb16, uint32_t, (uint32_t))
@@ -221,11 +223,6 @@ DEF_HELPER_1_2(neon_add_saturate_s64, uint64_t, (uint64_t, uint64_t))
 DEF_HELPER_1_2(neon_sub_saturate_u64, uint64_t, (uint64_t, uint64_t))
 DEF_HELPER_1_2(neon_sub_saturate_s64, uint64_t, (uint64_t, uint64_t))
 
-DEF_HELPER_1_2(add_cc, uint32_t, (uint32_t, uint32_t))
-DEF_HELPER_1_2(adc_cc, uint32_t, (uint32_t, uint32_t))
-DEF_HELPER_1_2(sub_cc, uint32_t, (uint32_t, uint32_t))
-DEF_HELPER_1_2(sbc_cc, uint32_t, (uint32_t, uint32_t))
-
 DEF_HELPER_1_2(shl, uint32_t, (uint32_t, uint32_t))
 DEF_HELPER_1_2(shr, uint32_t, (uint32_t, uint32_t))
 DEF_HELPER_1_2(sar, uint32_t, (uint32_t, uint32_t))
@@ -438,6 +435,69 @@ DEF_HELPER_1_2(neon_cgt_f32, uint32_t, (uint32_t, uint32_t))
 DEF_HELPER_1_2(neon_acge_f32, uint32_t, (uint32_t, uint32_t))
 DEF_HELPER_1_2(neon_acgt_f32, uint32_t, (uint32_t, uint32_t))
 
+/* Whole register operations.  */
+DEF_HELPER_0_2(neon_vadd_u8, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vadd_u16, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vadd_u32, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vsub_u8, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vsub_u16, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vsub_u32, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vmul_u8, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vmul_u16, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vmul_u32, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vceq_u8, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vceq_u16, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vceq_u32, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vtst_u8, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vtst_u16, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vtst_u32, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vqadd_s8, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vqadd_u8, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vqadd_s16, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vqadd_u16, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vqsub_s8, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vqsub_u8, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vqsub_s16, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vqsub_u16, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vhadd_s8, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vhadd_u8, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vhadd_s16, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vhadd_u16, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vrhadd_s8, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vrhadd_u8, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vrhadd_s16, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vrhadd_u16, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vcgt_s8, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vcgt_u8, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vcgt_s16, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vcgt_u16, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vcgt_s32, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vcgt_u32, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vcge_s8, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vcge_u8, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vcge_s16, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vcge_u16, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vcge_s32, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vcge_u32, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vmin_s8, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vmin_u8, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vmin_s16, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vmin_u16, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vmin_s32, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vmin_u32, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vmax_s8, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vmax_u8, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vmax_s16, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vmax_u16, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vmax_s32, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vmax_u32, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vabd_s8, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vabd_u8, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vabd_s16, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vabd_u16, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vabd_s32, void, (CPUState *, uint32_t))
+DEF_HELPER_0_2(neon_vabd_u32, void, (CPUState *, uint32_t))
+
 /* iwmmxt_helper.c */
 DEF_HELPER_1_2(iwmmxt_maddsq, uint64_t, (uint64_t, uint64_t))
 DEF_HELPER_1_2(iwmmxt_madduq, uint64_t, (uint64_t, uint64_t))
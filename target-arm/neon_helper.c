@@ -1455,3 +1455,292 @@ uint32_t HELPER(neon_acgt_f32)(uint32_t a, uint32_t b)
     float32 f1 = float32_abs(vfp_itos(b));
     return (float32_compare_quiet(f0, f1, NFS) > 0) ? ~0 : 0;
 }
+
+/* Whole register operations.
+   These implement the common "three registers of the same length"
+   integer operations on a complete D or Q register with a single helper
+   call, instead of one call per 32-bit pass.  'desc' holds the
+   destination and the two operand D register numbers in bits [4:0],
+   [12:8] and [20:16], and the Q flag in bit 24.  All the operations are
+   elementwise so the destination may overlap either operand.
+   Defining NEON_VEC_PORTABLE forces the portable version, which
+   tests/test-neon-vec.c uses as the reference for the SSE2 one.  */
+#define NEON_VEC_RD(desc) ((desc) & 0x1f)
+#define NEON_VEC_RN(desc) (((desc) >> 8) & 0x1f)
+#define NEON_VEC_RM(desc) (((desc) >> 16) & 0x1f)
+#define NEON_VEC_Q(desc)  (((desc) >> 24) & 1)
+
+#if defined(__SSE2__) && !defined(WORDS_BIGENDIAN) && !defined(NEON_VEC_PORTABLE)
+#include <emmintrin.h>
+#ifdef __SSE4_1__
+#include <smmintrin.h>
+#endif
+
+/* The lanes of a D register are stored in the host order, and the two
+   halves of a Q register are consecutive D registers.  D registers are
+   loaded in the low half of the vector and the high half is zero.  */
+static inline __m128i neon_vec_load(CPUState *env, int reg, int q)
+{
+    if (q)
+        return _mm_loadu_si128((const __m128i *)&env->vfp.regs[reg]);
+    return _mm_loadl_epi64((const __m128i *)&env->vfp.regs[reg]);
+}
+
+static inline void neon_vec_store(CPUState *env, int reg, int q, __m128i v)
+{
+    if (q)
+        _mm_storeu_si128((__m128i *)&env->vfp.regs[reg], v);
+    else
+        _mm_storel_epi64((__m128i *)&env->vfp.regs[reg], v);
+}
+
+#define NEON_VEC_OP(name, vexpr, sexpr) \
+void HELPER(glue(neon_v,name))(CPUState *env, uint32_t desc) \
+{ \
+    int q = NEON_VEC_Q(desc); \
+    __m128i a = neon_vec_load(env, NEON_VEC_RN(desc), q); \
+    __m128i b = neon_vec_load(env, NEON_VEC_RM(desc), q); \
+    neon_vec_store(env, NEON_VEC_RD(desc), q, vexpr); \
+}
+
+/* Saturating operations compare the result with the wrapping one to
+   find out whether any lane saturated.  */
+#define NEON_VEC_SATOP(name, vsat, vwrap, sexpr) \
+void HELPER(glue(neon_v,name))(CPUState *env, uint32_t desc) \
+{ \
+    int q = NEON_VEC_Q(desc); \
+    __m128i a = neon_vec_load(env, NEON_VEC_RN(desc), q); \
+    __m128i b = neon_vec_load(env, NEON_VEC_RM(desc), q); \
+    __m128i r = vsat; \
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(r, vwrap)) != 0xffff) \
+        SET_QC(); \
+    neon_vec_store(env, NEON_VEC_RD(desc), q, r); \
+}
+
+#define V_ONES     _mm_set1_epi32(-1)
+#define V_BIAS8    _mm_set1_epi8((char)0x80)
+#define V_BIAS16   _mm_set1_epi16((short)0x8000)
+#define V_BIAS32   _mm_set1_epi32((int)0x80000000)
+
+/* Select 'x' where 'mask' is set and 'y' elsewhere.  */
+static inline __m128i neon_vec_select(__m128i mask, __m128i x, __m128i y)
+{
+    return _mm_or_si128(_mm_and_si128(mask, x), _mm_andnot_si128(mask, y));
+}
+
+/* Unsigned comparisons flip the sign bits and compare signed.  */
+static inline __m128i neon_vec_cgt_u8(__m128i a, __m128i b)
+{
+    return _mm_cmpgt_epi8(_mm_xor_si128(a, V_BIAS8),
+                          _mm_xor_si128(b, V_BIAS8));
+}
+
+static inline __m128i neon_vec_cgt_u16(__m128i a, __m128i b)
+{
+    return _mm_cmpgt_epi16(_mm_xor_si128(a, V_BIAS16),
+                           _mm_xor_si128(b, V_BIAS16));
+}
+
+static inline __m128i neon_vec_cgt_u32(__m128i a, __m128i b)
+{
+    return _mm_cmpgt_epi32(_mm_xor_si128(a, V_BIAS32),
+                           _mm_xor_si128(b, V_BIAS32));
+}
+
+#define neon_vec_cgt_s8  _mm_cmpgt_epi8
+#define neon_vec_cgt_s16 _mm_cmpgt_epi16
+#define neon_vec_cgt_s32 _mm_cmpgt_epi32
+
+#ifdef __SSE4_1__
+#define neon_vec_min_s8  _mm_min_epi8
+#define neon_vec_max_s8  _mm_max_epi8
+#define neon_vec_min_u16 _mm_min_epu16
+#define neon_vec_max_u16 _mm_max_epu16
+#define neon_vec_min_s32 _mm_min_epi32
+#define neon_vec_max_s32 _mm_max_epi32
+#define neon_vec_min_u32 _mm_min_epu32
+#define neon_vec_max_u32 _mm_max_epu32
+#else
+#define NEON_VEC_MINMAX(vtype) \
+static inline __m128i glue(neon_vec_min_,vtype)(__m128i a, __m128i b) \
+{ \
+    return neon_vec_select(glue(neon_vec_cgt_,vtype)(a, b), b, a); \
+} \
+static inline __m128i glue(neon_vec_max_,vtype)(__m128i a, __m128i b) \
+{ \
+    return neon_vec_select(glue(neon_vec_cgt_,vtype)(a, b), a, b); \
+}
+NEON_VEC_MINMAX(s8)
+NEON_VEC_MINMAX(u16)
+NEON_VEC_MINMAX(s32)
+NEON_VEC_MINMAX(u32)
+#undef NEON_VEC_MINMAX
+#endif
+#define neon_vec_min_u8  _mm_min_epu8
+#define neon_vec_max_u8  _mm_max_epu8
+#define neon_vec_min_s16 _mm_min_epi16
+#define neon_vec_max_s16 _mm_max_epi16
+
+/* Halving adds.  pavg computes (a + b + 1) >> 1 for unsigned lanes;
+   the truncating form subtracts the carry out of the low bit, and the
+   signed forms bias both operands and the result.  */
+static inline __m128i neon_vec_hadd_u8(__m128i a, __m128i b)
+{
+    return _mm_sub_epi8(_mm_avg_epu8(a, b),
+                        _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)));
+}
+
+static inline __m128i neon_vec_hadd_u16(__m128i a, __m128i b)
+{
+    return _mm_sub_epi16(_mm_avg_epu16(a, b),
+                         _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi16(1)));
+}
+
+#define NEON_VEC_BIASED(name, bias) \
+    _mm_xor_si128(name(_mm_xor_si128(a, bias), _mm_xor_si128(b, bias)), bias)
+
+static inline __m128i neon_vec_mul_u8(__m128i a, __m128i b)
+{
+    __m128i lo = _mm_and_si128(_mm_mullo_epi16(a, b), _mm_set1_epi16(0xff));
+    __m128i hi = _mm_slli_epi16(_mm_mullo_epi16(_mm_srli_epi16(a, 8),
+                                                _mm_srli_epi16(b, 8)), 8);
+    return _mm_or_si128(lo, hi);
+}
+
+static inline __m128i neon_vec_mul_u32(__m128i a, __m128i b)
+{
+#ifdef __SSE4_1__
+    return _mm_mullo_epi32(a, b);
+#else
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                              _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+#endif
+}
+
+#define NEON_VEC_TST(size) \
+    _mm_xor_si128(glue(_mm_cmpeq_epi,size)(_mm_and_si128(a, b), \
+                                           _mm_setzero_si128()), V_ONES)
+
+/* Absolute differences are max - min; the 8 and 16-bit unsigned forms
+   use the saturating subtractions instead.  */
+#define NEON_VEC_ABD(vtype) \
+    glue(_mm_sub_epi,NEON_VEC_BITS_##vtype)(glue(neon_vec_max_,vtype)(a, b), \
+                                            glue(neon_vec_min_,vtype)(a, b))
+#define NEON_VEC_BITS_s8  8
+#define NEON_VEC_BITS_s16 16
+#define NEON_VEC_BITS_s32 32
+#define NEON_VEC_BITS_u32 32
+
+#else /* !__SSE2__ */
+
+/* Portable version, built on the 32-bit helpers above.  */
+static inline uint32_t neon_vec_get(CPUState *env, int reg, int pass)
+{
+    CPU_DoubleU u;
+    u.d = env->vfp.regs[reg + (pass >> 1)];
+    return (pass & 1) ? u.l.upper : u.l.lower;
+}
+
+static inline void neon_vec_set(CPUState *env, int reg, int pass, uint32_t val)
+{
+    CPU_DoubleU u;
+    u.d = env->vfp.regs[reg + (pass >> 1)];
+    if (pass & 1)
+        u.l.upper = val;
+    else
+        u.l.lower = val;
+    env->vfp.regs[reg + (pass >> 1)] = u.d;
+}
+
+#define NEON_VEC_OP(name, vexpr, sexpr) \
+void HELPER(glue(neon_v,name))(CPUState *env, uint32_t desc) \
+{ \
+    int pass; \
+    for (pass = 0; pass < (NEON_VEC_Q(desc) ? 4 : 2); pass++) { \
+        uint32_t a = neon_vec_get(env, NEON_VEC_RN(desc), pass); \
+        uint32_t b = neon_vec_get(env, NEON_VEC_RM(desc), pass); \
+        neon_vec_set(env, NEON_VEC_RD(desc), pass, sexpr); \
+    } \
+}
+#define NEON_VEC_SATOP(name, vsat, vwrap, sexpr) \
+    NEON_VEC_OP(name, vsat, sexpr)
+
+#endif /* !__SSE2__ */
+
+NEON_VEC_OP(add_u8, _mm_add_epi8(a, b), HELPER(neon_add_u8)(a, b))
+NEON_VEC_OP(add_u16, _mm_add_epi16(a, b), HELPER(neon_add_u16)(a, b))
+NEON_VEC_OP(add_u32, _mm_add_epi32(a, b), a + b)
+NEON_VEC_OP(sub_u8, _mm_sub_epi8(a, b), HELPER(neon_sub_u8)(a, b))
+NEON_VEC_OP(sub_u16, _mm_sub_epi16(a, b), HELPER(neon_sub_u16)(a, b))
+NEON_VEC_OP(sub_u32, _mm_sub_epi32(a, b), a - b)
+NEON_VEC_OP(mul_u8, neon_vec_mul_u8(a, b), HELPER(neon_mul_u8)(a, b))
+NEON_VEC_OP(mul_u16, _mm_mullo_epi16(a, b), HELPER(neon_mul_u16)(a, b))
+NEON_VEC_OP(mul_u32, neon_vec_mul_u32(a, b), a * b)
+NEON_VEC_OP(ceq_u8, _mm_cmpeq_epi8(a, b), HELPER(neon_ceq_u8)(a, b))
+NEON_VEC_OP(ceq_u16, _mm_cmpeq_epi16(a, b), HELPER(neon_ceq_u16)(a, b))
+NEON_VEC_OP(ceq_u32, _mm_cmpeq_epi32(a, b), HELPER(neon_ceq_u32)(a, b))
+NEON_VEC_OP(tst_u8, NEON_VEC_TST(8), HELPER(neon_tst_u8)(a, b))
+NEON_VEC_OP(tst_u16, NEON_VEC_TST(16), HELPER(neon_tst_u16)(a, b))
+NEON_VEC_OP(tst_u32, NEON_VEC_TST(32), HELPER(neon_tst_u32)(a, b))
+
+NEON_VEC_SATOP(qadd_u8, _mm_adds_epu8(a, b), _mm_add_epi8(a, b),
+               HELPER(neon_qadd_u8)(env, a, b))
+NEON_VEC_SATOP(qadd_s8, _mm_adds_epi8(a, b), _mm_add_epi8(a, b),
+               HELPER(neon_qadd_s8)(env, a, b))
+NEON_VEC_SATOP(qadd_u16, _mm_adds_epu16(a, b), _mm_add_epi16(a, b),
+               HELPER(neon_qadd_u16)(env, a, b))
+NEON_VEC_SATOP(qadd_s16, _mm_adds_epi16(a, b), _mm_add_epi16(a, b),
+               HELPER(neon_qadd_s16)(env, a, b))
+NEON_VEC_SATOP(qsub_u8, _mm_subs_epu8(a, b), _mm_sub_epi8(a, b),
+               HELPER(neon_qsub_u8)(env, a, b))
+NEON_VEC_SATOP(qsub_s8, _mm_subs_epi8(a, b), _mm_sub_epi8(a, b),
+               HELPER(neon_qsub_s8)(env, a, b))
+NEON_VEC_SATOP(qsub_u16, _mm_subs_epu16(a, b), _mm_sub_epi16(a, b),
+               HELPER(neon_qsub_u16)(env, a, b))
+NEON_VEC_SATOP(qsub_s16, _mm_subs_epi16(a, b), _mm_sub_epi16(a, b),
+               HELPER(neon_qsub_s16)(env, a, b))
+
+NEON_VEC_OP(hadd_u8, neon_vec_hadd_u8(a, b), HELPER(neon_hadd_u8)(a, b))
+NEON_VEC_OP(hadd_s8, NEON_VEC_BIASED(neon_vec_hadd_u8, V_BIAS8),
+            HELPER(neon_hadd_s8)(a, b))
+NEON_VEC_OP(hadd_u16, neon_vec_hadd_u16(a, b), HELPER(neon_hadd_u16)(a, b))
+NEON_VEC_OP(hadd_s16, NEON_VEC_BIASED(neon_vec_hadd_u16, V_BIAS16),
+            HELPER(neon_hadd_s16)(a, b))
+NEON_VEC_OP(rhadd_u8, _mm_avg_epu8(a, b), HELPER(neon_rhadd_u8)(a, b))
+NEON_VEC_OP(rhadd_s8, NEON_VEC_BIASED(_mm_avg_epu8, V_BIAS8),
+            HELPER(neon_rhadd_s8)(a, b))
+NEON_VEC_OP(rhadd_u16, _mm_avg_epu16(a, b), HELPER(neon_rhadd_u16)(a, b))
+NEON_VEC_OP(rhadd_s16, NEON_VEC_BIASED(_mm_avg_epu16, V_BIAS16),
+            HELPER(neon_rhadd_s16)(a, b))
+
+#define NEON_VEC_CMP(vtype) \
+NEON_VEC_OP(glue(cgt_,vtype), glue(neon_vec_cgt_,vtype)(a, b), \
+            HELPER(glue(neon_cgt_,vtype))(a, b)) \
+NEON_VEC_OP(glue(cge_,vtype), \
+            _mm_xor_si128(glue(neon_vec_cgt_,vtype)(b, a), V_ONES), \
+            HELPER(glue(neon_cge_,vtype))(a, b)) \
+NEON_VEC_OP(glue(min_,vtype), glue(neon_vec_min_,vtype)(a, b), \
+            HELPER(glue(neon_min_,vtype))(a, b)) \
+NEON_VEC_OP(glue(max_,vtype), glue(neon_vec_max_,vtype)(a, b), \
+            HELPER(glue(neon_max_,vtype))(a, b))
+NEON_VEC_CMP(s8)
+NEON_VEC_CMP(u8)
+NEON_VEC_CMP(s16)
+NEON_VEC_CMP(u16)
+NEON_VEC_CMP(s32)
+NEON_VEC_CMP(u32)
+#undef NEON_VEC_CMP
+
+NEON_VEC_OP(abd_u8, _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a)),
+            HELPER(neon_abd_u8)(a, b))
+NEON_VEC_OP(abd_u16, _mm_or_si128(_mm_subs_epu16(a, b), _mm_subs_epu16(b, a)),
+            HELPER(neon_abd_u16)(a, b))
+NEON_VEC_OP(abd_s8, NEON_VEC_ABD(s8), HELPER(neon_abd_s8)(a, b))
+NEON_VEC_OP(abd_s16, NEON_VEC_ABD(s16), HELPER(neon_abd_s16)(a, b))
+NEON_VEC_OP(abd_s32, NEON_VEC_ABD(s32), HELPER(neon_abd_s32)(a, b))
+NEON_VEC_OP(abd_u32, NEON_VEC_ABD(u32), HELPER(neon_abd_u32)(a, b))
+
+#undef NEON_VEC_OP
+#undef NEON_VEC_SATOP
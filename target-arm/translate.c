@@ -30,6 +30,7 @@
 #include "disas.h"
 #include "tcg-op.h"
 #include "qemu-log.h"
+#include "tb-profile.h"
 
 #ifdef CONFIG_TRACE
 #include "trace.h"
@@ -89,16 +90,51 @@ static TCGv cpu_V0, cpu_V1, cpu_M0;
 static TCGv cpu_T[2];
 static TCGv cpu_F0s, cpu_F1s, cpu_F0d, cpu_F1d;
 
+/* The core registers and the NZCV flag cache are TCG globals, so that
+   they stay in host registers until a helper call, a memory access or
+   the end of a basic block needs them in the CPU state.  */
+static TCGv cpu_R[16];
+static TCGv cpu_NF, cpu_ZF, cpu_CF, cpu_VF;
+
+static const char *regnames[] =
+    { "r0", "r1", "r2", "r3", "r4", "r5", "r6", "r7",
+      "r8", "r9", "r10", "r11", "r12", "r13", "r14", "pc" };
+
 #define ICOUNT_TEMP cpu_T[0]
 #include "gen-icount.h"
 
 /* initialize TCG globals.  */
 void arm_translate_init(void)
 {
+    int i;
+
     cpu_env = tcg_global_reg_new(TCG_TYPE_PTR, TCG_AREG0, "env");
 
     cpu_T[0] = tcg_global_reg_new(TCG_TYPE_I32, TCG_AREG1, "T0");
     cpu_T[1] = tcg_global_reg_new(TCG_TYPE_I32, TCG_AREG2, "T1");
+
+    /* N and Z are tested by most conditional instructions and the stack
+       pointer is used around every function call, so keep them in host
+       registers across TBs when the host has some to spare.  */
+    cpu_ZF = tcg_global_mem_new_pinned(TCG_TYPE_I32, TCG_AREG0,
+                                       offsetof(CPUState, ZF), "ZF");
+    cpu_NF = tcg_global_mem_new_pinned(TCG_TYPE_I32, TCG_AREG0,
+                                       offsetof(CPUState, NF), "NF");
+    for (i = 0; i < 16; i++) {
+        if (i == 13) {
+            cpu_R[i] = tcg_global_mem_new_pinned(TCG_TYPE_I32, TCG_AREG0,
+                                                 offsetof(CPUState, regs[i]),
+                                                 regnames[i]);
+        } else {
+            cpu_R[i] = tcg_global_mem_new(TCG_TYPE_I32, TCG_AREG0,
+                                          offsetof(CPUState, regs[i]),
+                                          regnames[i]);
+        }
+    }
+    cpu_CF = tcg_global_mem_new(TCG_TYPE_I32, TCG_AREG0,
+                                offsetof(CPUState, CF), "CF");
+    cpu_VF = tcg_global_mem_new(TCG_TYPE_I32, TCG_AREG0,
+                                offsetof(CPUState, VF), "VF");
 }
 
 /* The code generator doesn't like lots of temporaries, so maintain our own
@@ -171,7 +207,7 @@ static void load_reg_var(DisasContext *s, TCGv var, int reg)
             addr = (long)s->pc + 4;
         tcg_gen_movi_i32(var, addr);
     } else {
-        tcg_gen_ld_i32(var, cpu_env, offsetof(CPUState, regs[reg]));
+        tcg_gen_mov_i32(var, cpu_R[reg]);
     }
 }
 
@@ -191,7 +227,7 @@ static void store_reg(DisasContext *s, int reg, TCGv var)
         tcg_gen_andi_i32(var, var, ~1);
         s->is_jmp = DISAS_JUMP;
     }
-    tcg_gen_st_i32(var, cpu_env, offsetof(CPUState, regs[reg]));
+    tcg_gen_mov_i32(cpu_R[reg], var);
     dead_tmp(var);
 }
 
@@ -207,12 +243,12 @@ static void store_reg(DisasContext *s, int reg, TCGv var)
 #define gen_op_subl_T0_T1() tcg_gen_sub_i32(cpu_T[0], cpu_T[0], cpu_T[1])
 #define gen_op_rsbl_T0_T1() tcg_gen_sub_i32(cpu_T[0], cpu_T[1], cpu_T[0])
 
-#define gen_op_addl_T0_T1_cc() gen_helper_add_cc(cpu_T[0], cpu_T[0], cpu_T[1])
-#define gen_op_adcl_T0_T1_cc() gen_helper_adc_cc(cpu_T[0], cpu_T[0], cpu_T[1])
-#define gen_op_subl_T0_T1_cc() gen_helper_sub_cc(cpu_T[0], cpu_T[0], cpu_T[1])
-#define gen_op_sbcl_T0_T1_cc() gen_helper_sbc_cc(cpu_T[0], cpu_T[0], cpu_T[1])
-#define gen_op_rsbl_T0_T1_cc() gen_helper_sub_cc(cpu_T[0], cpu_T[1], cpu_T[0])
-#define gen_op_rscl_T0_T1_cc() gen_helper_sbc_cc(cpu_T[0], cpu_T[1], cpu_T[0])
+#define gen_op_addl_T0_T1_cc() gen_add_CC(cpu_T[0], cpu_T[0], cpu_T[1])
+#define gen_op_adcl_T0_T1_cc() gen_adc_CC(cpu_T[0], cpu_T[0], cpu_T[1])
+#define gen_op_subl_T0_T1_cc() gen_sub_CC(cpu_T[0], cpu_T[0], cpu_T[1])
+#define gen_op_sbcl_T0_T1_cc() gen_sbc_CC(cpu_T[0], cpu_T[0], cpu_T[1])
+#define gen_op_rsbl_T0_T1_cc() gen_sub_CC(cpu_T[0], cpu_T[1], cpu_T[0])
+#define gen_op_rscl_T0_T1_cc() gen_sbc_CC(cpu_T[0], cpu_T[1], cpu_T[0])
 
 #define gen_op_andl_T0_T1() tcg_gen_and_i32(cpu_T[0], cpu_T[0], cpu_T[1])
 #define gen_op_xorl_T0_T1() tcg_gen_xor_i32(cpu_T[0], cpu_T[0], cpu_T[1])
@@ -449,45 +485,87 @@ static void gen_add16(TCGv t0, TCGv t1)
     dead_tmp(t1);
 }
 
-#define gen_set_CF(var) tcg_gen_st_i32(var, cpu_env, offsetof(CPUState, CF))
+#define gen_set_CF(var) tcg_gen_mov_i32(cpu_CF, var)
 
 /* Set CF to the top bit of var.  */
 static void gen_set_CF_bit31(TCGv var)
 {
-    TCGv tmp = new_tmp();
-    tcg_gen_shri_i32(tmp, var, 31);
-    gen_set_CF(var);
-    dead_tmp(tmp);
+    tcg_gen_shri_i32(cpu_CF, var, 31);
 }
 
 /* Set N and Z flags from var.  */
 static inline void gen_logic_CC(TCGv var)
 {
-    tcg_gen_st_i32(var, cpu_env, offsetof(CPUState, NF));
-    tcg_gen_st_i32(var, cpu_env, offsetof(CPUState, ZF));
+    tcg_gen_mov_i32(cpu_NF, var);
+    tcg_gen_mov_i32(cpu_ZF, var);
 }
 
 /* T0 += T1 + CF.  */
 static void gen_adc_T0_T1(void)
 {
-    TCGv tmp;
     gen_op_addl_T0_T1();
-    tmp = load_cpu_field(CF);
-    tcg_gen_add_i32(cpu_T[0], cpu_T[0], tmp);
-    dead_tmp(tmp);
+    tcg_gen_add_i32(cpu_T[0], cpu_T[0], cpu_CF);
 }
 
 /* dest = T0 - T1 + CF - 1.  */
 static void gen_sub_carry(TCGv dest, TCGv t0, TCGv t1)
 {
-    TCGv tmp;
     tcg_gen_sub_i32(dest, t0, t1);
-    tmp = load_cpu_field(CF);
-    tcg_gen_add_i32(dest, dest, tmp);
+    tcg_gen_add_i32(dest, dest, cpu_CF);
     tcg_gen_subi_i32(dest, dest, 1);
+}
+
+/* dest = t0 + t1 + carry, setting NZCV.  carry is 0, 1 or -1 for the
+   current CF.  The flags are computed without branches: the sum is done
+   in 64 bits so that C is simply bit 32 of it, and V is set when the
+   result differs in sign from both operands.  Only the flags read before
+   being set again survive the liveness analysis.  */
+static void gen_addc_CC(TCGv dest, TCGv t0, TCGv t1, int carry)
+{
+    TCGv tmp;
+    TCGv sum, tmp64;
+
+    sum = tcg_temp_new(TCG_TYPE_I64);
+    tmp64 = tcg_temp_new(TCG_TYPE_I64);
+    tcg_gen_extu_i32_i64(sum, t0);
+    tcg_gen_extu_i32_i64(tmp64, t1);
+    tcg_gen_add_i64(sum, sum, tmp64);
+    if (carry < 0) {
+        tcg_gen_extu_i32_i64(tmp64, cpu_CF);
+        tcg_gen_add_i64(sum, sum, tmp64);
+    } else if (carry > 0) {
+        tcg_gen_addi_i64(sum, sum, 1);
+    }
+    tcg_gen_trunc_i64_i32(cpu_NF, sum);
+    tcg_gen_shri_i64(sum, sum, 32);
+    tcg_gen_trunc_i64_i32(cpu_CF, sum);
+    tcg_temp_free(tmp64);
+    tcg_temp_free(sum);
+    /* V = (result ^ t0) & (result ^ t1) */
+    tmp = new_tmp();
+    tcg_gen_xor_i32(tmp, cpu_NF, t1);
+    tcg_gen_xor_i32(cpu_VF, cpu_NF, t0);
+    tcg_gen_and_i32(cpu_VF, cpu_VF, tmp);
+    dead_tmp(tmp);
+    tcg_gen_mov_i32(cpu_ZF, cpu_NF);
+    tcg_gen_mov_i32(dest, cpu_NF);
+}
+
+#define gen_add_CC(dest, t0, t1) gen_addc_CC(dest, t0, t1, 0)
+#define gen_adc_CC(dest, t0, t1) gen_addc_CC(dest, t0, t1, -1)
+
+/* dest = t0 - t1 - !carry, computed as t0 + ~t1 + carry.  */
+static void gen_subc_CC(TCGv dest, TCGv t0, TCGv t1, int carry)
+{
+    TCGv tmp = new_tmp();
+    tcg_gen_not_i32(tmp, t1);
+    gen_addc_CC(dest, t0, tmp, carry);
     dead_tmp(tmp);
 }
 
+#define gen_sub_CC(dest, t0, t1) gen_subc_CC(dest, t0, t1, 1)
+#define gen_sbc_CC(dest, t0, t1) gen_subc_CC(dest, t0, t1, -1)
+
 #define gen_sbc_T0_T1() gen_sub_carry(cpu_T[0], cpu_T[0], cpu_T[1])
 #define gen_rsc_T0_T1() gen_sub_carry(cpu_T[0], cpu_T[1], cpu_T[0])
 
@@ -577,7 +655,8 @@ static inline void gen_arm_shift_im(TCGv var, int shiftop, int shift, int flags)
                 shifter_out_im(var, shift - 1);
             tcg_gen_rori_i32(var, var, shift); break;
         } else {
-            TCGv tmp = load_cpu_field(CF);
+            TCGv tmp = new_tmp();
+            tcg_gen_mov_i32(tmp, cpu_CF);
             if (flags)
                 shifter_out_im(var, 0);
             tcg_gen_shri_i32(var, var, 1);
@@ -701,99 +780,75 @@ static void gen_thumb2_parallel_addsub(int op1, int op2, TCGv a, TCGv b)
 static void gen_test_cc(int cc, int label)
 {
     TCGv tmp;
-    TCGv tmp2;
     int inv;
 
     switch (cc) {
     case 0: /* eq: Z */
-        tmp = load_cpu_field(ZF);
-        tcg_gen_brcondi_i32(TCG_COND_EQ, tmp, 0, label);
+        tcg_gen_brcondi_i32(TCG_COND_EQ, cpu_ZF, 0, label);
         break;
     case 1: /* ne: !Z */
-        tmp = load_cpu_field(ZF);
-        tcg_gen_brcondi_i32(TCG_COND_NE, tmp, 0, label);
+        tcg_gen_brcondi_i32(TCG_COND_NE, cpu_ZF, 0, label);
         break;
     case 2: /* cs: C */
-        tmp = load_cpu_field(CF);
-        tcg_gen_brcondi_i32(TCG_COND_NE, tmp, 0, label);
+        tcg_gen_brcondi_i32(TCG_COND_NE, cpu_CF, 0, label);
         break;
     case 3: /* cc: !C */
-        tmp = load_cpu_field(CF);
-        tcg_gen_brcondi_i32(TCG_COND_EQ, tmp, 0, label);
+        tcg_gen_brcondi_i32(TCG_COND_EQ, cpu_CF, 0, label);
         break;
     case 4: /* mi: N */
-        tmp = load_cpu_field(NF);
-        tcg_gen_brcondi_i32(TCG_COND_LT, tmp, 0, label);
+        tcg_gen_brcondi_i32(TCG_COND_LT, cpu_NF, 0, label);
         break;
     case 5: /* pl: !N */
-        tmp = load_cpu_field(NF);
-        tcg_gen_brcondi_i32(TCG_COND_GE, tmp, 0, label);
+        tcg_gen_brcondi_i32(TCG_COND_GE, cpu_NF, 0, label);
         break;
     case 6: /* vs: V */
-        tmp = load_cpu_field(VF);
-        tcg_gen_brcondi_i32(TCG_COND_LT, tmp, 0, label);
+        tcg_gen_brcondi_i32(TCG_COND_LT, cpu_VF, 0, label);
         break;
     case 7: /* vc: !V */
-        tmp = load_cpu_field(VF);
-        tcg_gen_brcondi_i32(TCG_COND_GE, tmp, 0, label);
+        tcg_gen_brcondi_i32(TCG_COND_GE, cpu_VF, 0, label);
         break;
     case 8: /* hi: C && !Z */
         inv = gen_new_label();
-        tmp = load_cpu_field(CF);
-        tcg_gen_brcondi_i32(TCG_COND_EQ, tmp, 0, inv);
-        dead_tmp(tmp);
-        tmp = load_cpu_field(ZF);
-        tcg_gen_brcondi_i32(TCG_COND_NE, tmp, 0, label);
+        tcg_gen_brcondi_i32(TCG_COND_EQ, cpu_CF, 0, inv);
+        tcg_gen_brcondi_i32(TCG_COND_NE, cpu_ZF, 0, label);
         gen_set_label(inv);
         break;
     case 9: /* ls: !C || Z */
-        tmp = load_cpu_field(CF);
-        tcg_gen_brcondi_i32(TCG_COND_EQ, tmp, 0, label);
-        dead_tmp(tmp);
-        tmp = load_cpu_field(ZF);
-        tcg_gen_brcondi_i32(TCG_COND_EQ, tmp, 0, label);
+        tcg_gen_brcondi_i32(TCG_COND_EQ, cpu_CF, 0, label);
+        tcg_gen_brcondi_i32(TCG_COND_EQ, cpu_ZF, 0, label);
         break;
     case 10: /* ge: N == V -> N ^ V == 0 */
-        tmp = load_cpu_field(VF);
-        tmp2 = load_cpu_field(NF);
-        tcg_gen_xor_i32(tmp, tmp, tmp2);
-        dead_tmp(tmp2);
+        tmp = new_tmp();
+        tcg_gen_xor_i32(tmp, cpu_VF, cpu_NF);
         tcg_gen_brcondi_i32(TCG_COND_GE, tmp, 0, label);
+        dead_tmp(tmp);
         break;
     case 11: /* lt: N != V -> N ^ V != 0 */
-        tmp = load_cpu_field(VF);
-        tmp2 = load_cpu_field(NF);
-        tcg_gen_xor_i32(tmp, tmp, tmp2);
-        dead_tmp(tmp2);
+        tmp = new_tmp();
+        tcg_gen_xor_i32(tmp, cpu_VF, cpu_NF);
         tcg_gen_brcondi_i32(TCG_COND_LT, tmp, 0, label);
+        dead_tmp(tmp);
         break;
     case 12: /* gt: !Z && N == V */
         inv = gen_new_label();
-        tmp = load_cpu_field(ZF);
-        tcg_gen_brcondi_i32(TCG_COND_EQ, tmp, 0, inv);
-        dead_tmp(tmp);
-        tmp = load_cpu_field(VF);
-        tmp2 = load_cpu_field(NF);
-        tcg_gen_xor_i32(tmp, tmp, tmp2);
-        dead_tmp(tmp2);
+        tcg_gen_brcondi_i32(TCG_COND_EQ, cpu_ZF, 0, inv);
+        tmp = new_tmp();
+        tcg_gen_xor_i32(tmp, cpu_VF, cpu_NF);
         tcg_gen_brcondi_i32(TCG_COND_GE, tmp, 0, label);
+        dead_tmp(tmp);
         gen_set_label(inv);
         break;
     case 13: /* le: Z || N != V */
-        tmp = load_cpu_field(ZF);
-        tcg_gen_brcondi_i32(TCG_COND_EQ, tmp, 0, label);
-        dead_tmp(tmp);
-        tmp = load_cpu_field(VF);
-        tmp2 = load_cpu_field(NF);
-        tcg_gen_xor_i32(tmp, tmp, tmp2);
-        dead_tmp(tmp2);
+        tcg_gen_brcondi_i32(TCG_COND_EQ, cpu_ZF, 0, label);
+        tmp = new_tmp();
+        tcg_gen_xor_i32(tmp, cpu_VF, cpu_NF);
         tcg_gen_brcondi_i32(TCG_COND_LT, tmp, 0, label);
+        dead_tmp(tmp);
         break;
     default:
         fprintf(stderr, "Bad condition code 0x%x\n", cc);
         abort();
     }
-    dead_tmp(tmp);
 }
 
 const uint8_t table_logic_cc[16] = {
@@ -826,8 +881,7 @@ static inline void gen_bx_im(DisasContext *s, uint32_t addr)
         tcg_gen_movi_i32(tmp, addr & 1);
         tcg_gen_st_i32(tmp, cpu_env, offsetof(CPUState, thumb));
     }
-    tcg_gen_movi_i32(tmp, addr & ~1);
-    tcg_gen_st_i32(tmp, cpu_env, offsetof(CPUState, regs[15]));
+    tcg_gen_movi_i32(cpu_R[15], addr & ~1);
     dead_tmp(tmp);
 }
 
@@ -840,8 +894,8 @@ static inline void gen_bx(DisasContext *s, TCGv var)
     tmp = new_tmp();
     tcg_gen_andi_i32(tmp, var, 1);
     store_cpu_field(tmp, thumb);
-    tcg_gen_andi_i32(var, var, ~1);
-    store_cpu_field(var, regs[15]);
+    tcg_gen_andi_i32(cpu_R[15], var, ~1);
+    dead_tmp(var);
 }
 
 /* TODO: This should be removed.  Use gen_bx instead.  */
@@ -926,9 +980,7 @@ static inline void gen_movl_T2_reg(DisasContext *s, int reg)
 
 static inline void gen_set_pc_im(uint32_t val)
 {
-    TCGv tmp = new_tmp();
-    tcg_gen_movi_i32(tmp, val);
-    store_cpu_field(tmp, regs[15]);
+    tcg_gen_movi_i32(cpu_R[15], val);
 }
 
 static inline void gen_movl_reg_TN(DisasContext *s, int reg, int t)
@@ -940,7 +992,7 @@ static inline void gen_movl_reg_TN(DisasContext *s, int reg, int t)
     } else {
         tmp = cpu_T[t];
     }
-    tcg_gen_st_i32(tmp, cpu_env, offsetof(CPUState, regs[reg]));
+    tcg_gen_mov_i32(cpu_R[reg], tmp);
     if (reg == 15) {
         dead_tmp(tmp);
         s->is_jmp = DISAS_JUMP;
@@ -3418,6 +3470,7 @@ static inline void gen_goto_tb(DisasContext *s, int n, uint32_t dest)
     TranslationBlock *tb;
 
     tb = s->tb;
+    tb_add_successor(dest);
     if ((tb->pc & TARGET_PAGE_MASK) == (dest & TARGET_PAGE_MASK)) {
         tcg_gen_goto_tb(n);
         gen_set_pc_im(dest);
@@ -3637,6 +3690,109 @@ static inline void gen_neon_rsb(int size)
     default: return 1; \
     }} while (0)
 
+#define GEN_NEON_VEC_OP(name) do { \
+    switch ((size << 1) | u) { \
+    case 0: gen_helper_neon_v##name##_s8(cpu_env, desc); break; \
+    case 1: gen_helper_neon_v##name##_u8(cpu_env, desc); break; \
+    case 2: gen_helper_neon_v##name##_s16(cpu_env, desc); break; \
+    case 3: gen_helper_neon_v##name##_u16(cpu_env, desc); break; \
+    case 4: gen_helper_neon_v##name##_s32(cpu_env, desc); break; \
+    case 5: gen_helper_neon_v##name##_u32(cpu_env, desc); break; \
+    default: return 0; \
+    }} while (0)
+
+/* For the operations that only have 8 and 16 bit variants.  */
+#define GEN_NEON_VEC_OP16(name) do { \
+    switch ((size << 1) | u) { \
+    case 0: gen_helper_neon_v##name##_s8(cpu_env, desc); break; \
+    case 1: gen_helper_neon_v##name##_u8(cpu_env, desc); break; \
+    case 2: gen_helper_neon_v##name##_s16(cpu_env, desc); break; \
+    case 3: gen_helper_neon_v##name##_u16(cpu_env, desc); break; \
+    default: return 0; \
+    }} while (0)
+
+#define GEN_NEON_VEC_OP_SIZE(name) do { \
+    switch (size) { \
+    case 0: gen_helper_neon_v##name##_u8(cpu_env, desc); break; \
+    case 1: gen_helper_neon_v##name##_u16(cpu_env, desc); break; \
+    case 2: gen_helper_neon_v##name##_u32(cpu_env, desc); break; \
+    default: return 0; \
+    }} while (0)
+
+/* Emit a single whole register helper call for a three register same
+   length integer operation.  Returns nonzero if the operation was
+   handled, zero if it has to be done one pass at a time.  */
+static int gen_neon_vec3(int op, int u, int size, int q,
+                         int rd, int rn, int rm)
+{
+    TCGv desc;
+
+    if (q && ((rd | rn | rm) & 1))
+        return 0;
+    switch (op) {
+    case 0: case 1: case 2: case 5: /* VHADD, VQADD, VRHADD, VQSUB */
+        if (size > 1)
+            return 0;
+        break;
+    case 19: /* VMUL */
+        if (u)
+            return 0;
+        break;
+    case 6: case 7: case 12: case 13: case 14: case 16: case 17:
+        break;
+    default:
+        return 0;
+    }
+    desc = tcg_const_i32(rd | (rn << 8) | (rm << 16) | (q << 24));
+    switch (op) {
+    case 0: /* VHADD */
+        GEN_NEON_VEC_OP16(hadd);
+        break;
+    case 1: /* VQADD */
+        GEN_NEON_VEC_OP16(qadd);
+        break;
+    case 2: /* VRHADD */
+        GEN_NEON_VEC_OP16(rhadd);
+        break;
+    case 5: /* VQSUB */
+        GEN_NEON_VEC_OP16(qsub);
+        break;
+    case 6: /* VCGT */
+        GEN_NEON_VEC_OP(cgt);
+        break;
+    case 7: /* VCGE */
+        GEN_NEON_VEC_OP(cge);
+        break;
+    case 12: /* VMAX */
+        GEN_NEON_VEC_OP(max);
+        break;
+    case 13: /* VMIN */
+        GEN_NEON_VEC_OP(min);
+        break;
+    case 14: /* VABD */
+        GEN_NEON_VEC_OP(abd);
+        break;
+    case 16:
+        if (!u) { /* VADD */
+            GEN_NEON_VEC_OP_SIZE(add);
+        } else { /* VSUB */
+            GEN_NEON_VEC_OP_SIZE(sub);
+        }
+        break;
+    case 17:
+        if (!u) { /* VTST */
+            GEN_NEON_VEC_OP_SIZE(tst);
+        } else { /* VCEQ */
+            GEN_NEON_VEC_OP_SIZE(ceq);
+        }
+        break;
+    case 19: /* VMUL */
+        GEN_NEON_VEC_OP_SIZE(mul);
+        break;
+    }
+    return 1;
+}
+
 static inline void
 gen_neon_movl_scratch_T0(int scratch)
 {
@@ -4227,6 +4383,8 @@ static int disas_neon_data_insn(CPUState * env, DisasContext *s, uint32_t insn)
             pairwise = 0;
             break;
         }
+        if (!pairwise && gen_neon_vec3(op, u, size, q, rd, rn, rm))
+            return 0;
         for (pass = 0; pass < (q ? 4 : 2); pass++) {
 
         if (pairwise) {
@@ -8683,6 +8841,7 @@ static inline void gen_intermediate_code_internal(CPUState *env,
         max_insns = CF_COUNT_MASK;
 
     gen_icount_start();
+    gen_tb_profile_start(tb);
     /* Reset the conditional execution bits immediately. This avoids
        complications trying to do it at the end of the block.  */
     if (env->condexec_bits)
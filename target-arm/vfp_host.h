@@ -0,0 +1,328 @@
+/* Copyright (C) 2009 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+#ifndef VFP_HOST_H
+#define VFP_HOST_H
+
+/* This header only depends on softfloat.h, so that tests/test-vfp-host.c
+   can check it against softfloat outside of the emulator.  */
+#include "softfloat.h"
+
+/* Native fast path for the VFP arithmetic.  FZ and DN are not
+   implemented, so in the round to nearest mode softfloat follows plain
+   IEEE 754, including tininess detection after rounding, and the SSE2
+   unit of the host gives bit identical results.  The operation is done
+   natively and only redone with softfloat when the host signals
+   anything but inexact, or returns a NaN whose encoding could differ
+   from the ARM one.  */
+static inline int vfp_nan_s(float32 x)
+{
+    return (float32_val(x) & 0x7fffffff) > 0x7f800000;
+}
+
+static inline int vfp_nan_d(float64 x)
+{
+    return (float64_val(x) & 0x7fffffffffffffffULL) > 0x7ff0000000000000ULL;
+}
+
+/* Comparisons of non-NaN values don't raise any exception, and can be
+   done on the encodings: return the NZCV flags, or -1 when an operand
+   is a NaN.  */
+static inline int vfp_fast_cmp_s(float32 a, float32 b)
+{
+    int32_t ia = float32_val(a), ib = float32_val(b);
+
+    if (vfp_nan_s(a) || vfp_nan_s(b))
+        return -1;
+    /* order sign-magnitude like two's complement, making -0 == +0 */
+    if (ia < 0)
+        ia = -(ia & 0x7fffffff);
+    if (ib < 0)
+        ib = -(ib & 0x7fffffff);
+    return ia == ib ? 0x6 : ia < ib ? 0x8 : 0x2;
+}
+
+static inline int vfp_fast_cmp_d(float64 a, float64 b)
+{
+    int64_t ia = float64_val(a), ib = float64_val(b);
+
+    if (vfp_nan_d(a) || vfp_nan_d(b))
+        return -1;
+    if (ia < 0)
+        ia = -(ia & 0x7fffffffffffffffLL);
+    if (ib < 0)
+        ib = -(ib & 0x7fffffffffffffffLL);
+    return ia == ib ? 0x6 : ia < ib ? 0x8 : 0x2;
+}
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+
+#define VFP_HOST_SLOW_EXCEPT (_MM_EXCEPT_INVALID | _MM_EXCEPT_DENORM | \
+                              _MM_EXCEPT_DIV_ZERO | _MM_EXCEPT_OVERFLOW | \
+                              _MM_EXCEPT_UNDERFLOW)
+#define VFP_HOST_DAZ 0x0040
+
+/* keep the compiler from moving SSE arithmetic across the MXCSR
+   accesses, which must not be merged either */
+#define VFP_HOST_BARRIER(v) __asm__ __volatile__("" : "+x" (v))
+
+static inline unsigned int vfp_host_getcsr(void)
+{
+    unsigned int csr;
+    __asm__ __volatile__("stmxcsr %0" : "=m" (csr));
+    return csr;
+}
+
+enum {
+    VFP_HOST_ADD,
+    VFP_HOST_SUB,
+    VFP_HOST_MUL,
+    VFP_HOST_DIV
+};
+
+static inline __m128 vfp_host_s(float32 x)
+{
+    return _mm_castsi128_ps(_mm_cvtsi32_si128(float32_val(x)));
+}
+
+static inline float32 vfp_guest_s(__m128 v)
+{
+    return make_float32(_mm_cvtsi128_si32(_mm_castps_si128(v)));
+}
+
+static inline __m128d vfp_host_d(float64 x)
+{
+    uint64_t val = float64_val(x);
+    return _mm_castsi128_pd(_mm_loadl_epi64((const __m128i *)&val));
+}
+
+static inline float64 vfp_guest_d(__m128d v)
+{
+    uint64_t val;
+    _mm_storel_epi64((__m128i *)&val, _mm_castpd_si128(v));
+    return make_float64(val);
+}
+
+/* Return 1 if the host unit can be used, with the exception flags we
+   need to observe cleared.  Writing MXCSR is slow, so this is avoided in
+   the common case: the slow path exceptions are rarely left set, and
+   inexact needn't be tracked once the guest has accumulated it.  */
+static inline int vfp_host_begin(float_status *s)
+{
+    unsigned int csr, except;
+
+    if (s->float_rounding_mode != float_round_nearest_even)
+        return 0;
+    csr = vfp_host_getcsr();
+    if (csr & (_MM_ROUND_MASK | _MM_FLUSH_ZERO_MASK | VFP_HOST_DAZ))
+        return 0;
+    except = VFP_HOST_SLOW_EXCEPT;
+    if (!(s->float_exception_flags & float_flag_inexact))
+        except |= _MM_EXCEPT_INEXACT;
+    if (csr & except)
+        _mm_setcsr(csr & ~except);
+    return 1;
+}
+
+/* Return 1 if the host result can be used, and accumulate the inexact
+   exception.  */
+static inline int vfp_host_end(float_status *s)
+{
+    unsigned int except = vfp_host_getcsr() & _MM_EXCEPT_MASK;
+
+    if (except & VFP_HOST_SLOW_EXCEPT)
+        return 0;
+    if (except & _MM_EXCEPT_INEXACT)
+        float_raise(float_flag_inexact, s);
+    return 1;
+}
+
+static inline int vfp_host_binop_s(float_status *s, int op, float32 a,
+                                   float32 b, float32 *res)
+{
+    __m128 va, vb;
+
+    if (!vfp_host_begin(s))
+        return 0;
+    va = vfp_host_s(a);
+    vb = vfp_host_s(b);
+    VFP_HOST_BARRIER(va);
+    VFP_HOST_BARRIER(vb);
+    switch (op) {
+    case VFP_HOST_ADD: va = _mm_add_ss(va, vb); break;
+    case VFP_HOST_SUB: va = _mm_sub_ss(va, vb); break;
+    case VFP_HOST_MUL: va = _mm_mul_ss(va, vb); break;
+    default:           va = _mm_div_ss(va, vb); break;
+    }
+    VFP_HOST_BARRIER(va);
+    *res = vfp_guest_s(va);
+    return vfp_host_end(s) && !vfp_nan_s(*res);
+}
+
+static inline int vfp_host_binop_d(float_status *s, int op, float64 a,
+                                   float64 b, float64 *res)
+{
+    __m128d va, vb;
+
+    if (!vfp_host_begin(s))
+        return 0;
+    va = vfp_host_d(a);
+    vb = vfp_host_d(b);
+    VFP_HOST_BARRIER(va);
+    VFP_HOST_BARRIER(vb);
+    switch (op) {
+    case VFP_HOST_ADD: va = _mm_add_sd(va, vb); break;
+    case VFP_HOST_SUB: va = _mm_sub_sd(va, vb); break;
+    case VFP_HOST_MUL: va = _mm_mul_sd(va, vb); break;
+    default:           va = _mm_div_sd(va, vb); break;
+    }
+    VFP_HOST_BARRIER(va);
+    *res = vfp_guest_d(va);
+    return vfp_host_end(s) && !vfp_nan_d(*res);
+}
+
+static inline int vfp_host_sqrt_s(float_status *s, float32 a, float32 *res)
+{
+    __m128 va;
+
+    if (!vfp_host_begin(s))
+        return 0;
+    va = vfp_host_s(a);
+    VFP_HOST_BARRIER(va);
+    va = _mm_sqrt_ss(va);
+    VFP_HOST_BARRIER(va);
+    *res = vfp_guest_s(va);
+    return vfp_host_end(s) && !vfp_nan_s(*res);
+}
+
+static inline int vfp_host_sqrt_d(float_status *s, float64 a, float64 *res)
+{
+    __m128d va;
+
+    if (!vfp_host_begin(s))
+        return 0;
+    va = vfp_host_d(a);
+    VFP_HOST_BARRIER(va);
+    va = _mm_sqrt_sd(va, va);
+    VFP_HOST_BARRIER(va);
+    *res = vfp_guest_d(va);
+    return vfp_host_end(s) && !vfp_nan_d(*res);
+}
+
+/* single <-> double precision */
+static inline int vfp_host_fcvtd(float_status *s, float32 a, float64 *res)
+{
+    __m128 va;
+    __m128d vr;
+
+    if (!vfp_host_begin(s))
+        return 0;
+    va = vfp_host_s(a);
+    VFP_HOST_BARRIER(va);
+    vr = _mm_cvtss_sd(_mm_setzero_pd(), va);
+    VFP_HOST_BARRIER(vr);
+    *res = vfp_guest_d(vr);
+    return vfp_host_end(s) && !vfp_nan_d(*res);
+}
+
+static inline int vfp_host_fcvts(float_status *s, float64 a, float32 *res)
+{
+    __m128d va;
+    __m128 vr;
+
+    if (!vfp_host_begin(s))
+        return 0;
+    va = vfp_host_d(a);
+    VFP_HOST_BARRIER(va);
+    vr = _mm_cvtsd_ss(_mm_setzero_ps(), va);
+    VFP_HOST_BARRIER(vr);
+    *res = vfp_guest_s(vr);
+    return vfp_host_end(s) && !vfp_nan_s(*res);
+}
+
+/* int32 -> float.  Unsigned values are only handled below 2^31.  */
+static inline int vfp_host_itof_s(float_status *s, uint32_t i, int is_signed,
+                                  float32 *res)
+{
+    __m128 vr;
+
+    if ((!is_signed && (int32_t)i < 0) || !vfp_host_begin(s))
+        return 0;
+    vr = _mm_cvtsi32_ss(_mm_setzero_ps(), (int32_t)i);
+    VFP_HOST_BARRIER(vr);
+    *res = vfp_guest_s(vr);
+    return vfp_host_end(s);
+}
+
+static inline int vfp_host_itof_d(float_status *s, uint32_t i, int is_signed,
+                                  float64 *res)
+{
+    /* always exact */
+    if (!is_signed && (int32_t)i < 0)
+        return 0;
+    *res = vfp_guest_d(_mm_cvtsi32_sd(_mm_setzero_pd(), (int32_t)i));
+    return 1;
+}
+
+/* float -> int32, rounding to nearest or truncating.  Results that
+   don't fit (and NaNs) raise invalid on the host and take the slow
+   path, as do negative results of unsigned conversions.  -2^31 does
+   too, because softfloat raises invalid for some exact conversions to
+   it (float64_to_int32_round_to_zero of -2^31 itself).  */
+static inline int vfp_host_ftoi_s(float_status *s, float32 a, int is_signed,
+                                  int trunc, uint32_t *res)
+{
+    __m128 va;
+    int32_t r;
+
+    if (!vfp_host_begin(s))
+        return 0;
+    va = vfp_host_s(a);
+    VFP_HOST_BARRIER(va);
+    r = trunc ? _mm_cvttss_si32(va) : _mm_cvtss_si32(va);
+    __asm__ __volatile__("" : "+r" (r));
+    *res = r;
+    return vfp_host_end(s) && (is_signed ? r != INT32_MIN : r >= 0);
+}
+
+static inline int vfp_host_ftoi_d(float_status *s, float64 a, int is_signed,
+                                  int trunc, uint32_t *res)
+{
+    __m128d va;
+    int32_t r;
+
+    if (!vfp_host_begin(s))
+        return 0;
+    va = vfp_host_d(a);
+    VFP_HOST_BARRIER(va);
+    r = trunc ? _mm_cvttsd_si32(va) : _mm_cvtsd_si32(va);
+    __asm__ __volatile__("" : "+r" (r));
+    *res = r;
+    return vfp_host_end(s) && (is_signed ? r != INT32_MIN : r >= 0);
+}
+
+#else /* !__SSE2__ */
+
+#define vfp_host_binop_s(s, op, a, b, res) 0
+#define vfp_host_binop_d(s, op, a, b, res) 0
+#define vfp_host_sqrt_s(s, a, res) 0
+#define vfp_host_sqrt_d(s, a, res) 0
+#define vfp_host_fcvtd(s, a, res) 0
+#define vfp_host_fcvts(s, a, res) 0
+#define vfp_host_itof_s(s, i, is_signed, res) 0
+#define vfp_host_itof_d(s, i, is_signed, res) 0
+#define vfp_host_ftoi_s(s, a, is_signed, trunc, res) 0
+#define vfp_host_ftoi_d(s, a, is_signed, trunc, res) 0
+
+#endif /* !__SSE2__ */
+
+#endif /* VFP_HOST_H */
@@ -0,0 +1,334 @@
+/* Copyright (C) 2009 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1   /* for REG_EIP and REG_RIP */
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include "qemu-common.h"
+#include "cpu.h"
+#include "exec-all.h"
+#include "tb-profile.h"
+
+/* the host pc of the profiling timer ticks can only be read on these
+ * hosts, the others only get execution counts */
+#if defined(__linux__) && (defined(__i386__) || defined(__x86_64__))
+#define TB_PROFILE_SAMPLING
+#include <ucontext.h>
+#include <sys/syscall.h>
+#include "qemu-timer.h"
+#endif
+
+#define  TB_PROFILE_HASH_BITS   14
+#define  TB_PROFILE_HASH_SIZE   (1 << TB_PROFILE_HASH_BITS)
+
+/* sampling period of the profiling timer, in microseconds */
+#define  TB_PROFILE_PERIOD_US   1000
+
+/* number of blocks printed on exit */
+#define  TB_PROFILE_EXIT_COUNT  50
+
+/* pending samples, and how often they are attributed to their blocks */
+#define  TB_PROFILE_RING_SIZE   1024
+#define  TB_PROFILE_FLUSH_MS    100
+
+int tb_profile_enabled;
+
+static TBProfile*  tb_profile_hash[TB_PROFILE_HASH_SIZE];
+static int         tb_profile_nb;
+
+/* ticks that hit the translated code, and ticks spent elsewhere in the
+ * emulation thread (helpers, devices, the translator, the main loop) */
+static uint64_t  tb_profile_samples;
+static uint64_t  tb_profile_samples_outside;
+
+#ifdef TB_PROFILE_SAMPLING
+/* host pcs recorded by the signal handler. the handler may interrupt
+ * tb_profile_flush_samples() and only moves the head, which is why it
+ * doesn't search the blocks itself: the translator may be running */
+static unsigned long      tb_profile_ring[TB_PROFILE_RING_SIZE];
+static volatile unsigned  tb_profile_ring_head;
+static volatile unsigned  tb_profile_ring_tail;
+static volatile uint64_t  tb_profile_samples_lost;
+static QEMUTimer*         tb_profile_flush_timer;
+#endif
+
+typedef struct {
+    unsigned long  vaddr;
+    char*          name;
+} TBProfileSymbol;
+
+/* sorted by address */
+static TBProfileSymbol*  tb_profile_syms;
+static int               tb_profile_nb_syms;
+static int               tb_profile_max_syms;
+
+static inline unsigned int tb_profile_hash_func(unsigned long pc)
+{
+    return (pc ^ (pc >> TB_PROFILE_HASH_BITS)) & (TB_PROFILE_HASH_SIZE - 1);
+}
+
+TBProfile* tb_profile_get(unsigned long pc, uint64_t flags)
+{
+    TBProfile**  pp = &tb_profile_hash[tb_profile_hash_func(pc)];
+    TBProfile*   p;
+
+    for (p = *pp; p != NULL; p = p->hash_next) {
+        if (p->pc == pc && p->flags == flags)
+            return p;
+    }
+    p = qemu_mallocz(sizeof(*p));
+    p->pc        = pc;
+    p->flags     = flags;
+    p->hash_next = *pp;
+    *pp = p;
+    tb_profile_nb++;
+    return p;
+}
+
+#ifdef TB_PROFILE_SAMPLING
+static void tb_profile_tick(int sig, siginfo_t *info, void *puc)
+{
+    ucontext_t*  uc   = puc;
+    unsigned     head = tb_profile_ring_head;
+
+    if (head - tb_profile_ring_tail >= TB_PROFILE_RING_SIZE) {
+        tb_profile_samples_lost++;
+        return;
+    }
+#ifdef __x86_64__
+    tb_profile_ring[head % TB_PROFILE_RING_SIZE] = uc->uc_mcontext.gregs[REG_RIP];
+#else
+    tb_profile_ring[head % TB_PROFILE_RING_SIZE] = uc->uc_mcontext.gregs[REG_EIP];
+#endif
+    tb_profile_ring_head = head + 1;
+}
+
+void tb_profile_flush_samples(void)
+{
+    unsigned  head = tb_profile_ring_head;
+    unsigned  tail;
+
+    for (tail = tb_profile_ring_tail; tail != head; tail++) {
+        TranslationBlock*  tb;
+
+        tb = tb_find_pc(tb_profile_ring[tail % TB_PROFILE_RING_SIZE]);
+        if (tb != NULL && tb->profile != NULL) {
+            tb->profile->samples++;
+            tb_profile_samples++;
+        } else {
+            tb_profile_samples_outside++;
+        }
+    }
+    tb_profile_ring_tail = tail;
+}
+
+static void tb_profile_flush_tick(void *opaque)
+{
+    tb_profile_flush_samples();
+    qemu_mod_timer(tb_profile_flush_timer,
+                   qemu_get_clock(rt_clock) + TB_PROFILE_FLUSH_MS);
+}
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id  _sigev_un._tid
+#endif
+
+/* the timer measures the cpu time of the calling thread (the one that
+ * runs the emulated cpu) and its signal is only sent to that thread, so
+ * that the audio and other helper threads are never sampled */
+static void tb_profile_start_timer(void)
+{
+    struct sigaction   act;
+    struct sigevent    ev;
+    struct itimerspec  its;
+    timer_t            timer;
+
+    memset(&act, 0, sizeof(act));
+    sigfillset(&act.sa_mask);
+    act.sa_flags     = SA_SIGINFO | SA_RESTART;
+    act.sa_sigaction = tb_profile_tick;
+    sigaction(SIGPROF, &act, NULL);
+
+    memset(&ev, 0, sizeof(ev));
+    ev.sigev_notify           = SIGEV_THREAD_ID;
+    ev.sigev_signo            = SIGPROF;
+    ev.sigev_notify_thread_id = syscall(SYS_gettid);
+
+    its.it_interval.tv_sec  = 0;
+    its.it_interval.tv_nsec = TB_PROFILE_PERIOD_US * 1000;
+    its.it_value            = its.it_interval;
+    if (timer_create(CLOCK_THREAD_CPUTIME_ID, &ev, &timer) < 0 ||
+        timer_settime(timer, 0, &its, NULL) < 0) {
+        fprintf(stderr, "tb profiler: could not start the profiling timer\n");
+        return;
+    }
+
+    tb_profile_flush_timer = qemu_new_timer(rt_clock, tb_profile_flush_tick, NULL);
+    qemu_mod_timer(tb_profile_flush_timer,
+                   qemu_get_clock(rt_clock) + TB_PROFILE_FLUSH_MS);
+}
+#else
+void tb_profile_flush_samples(void)
+{
+}
+#endif
+
+static void tb_profile_exit(void)
+{
+    tb_profile_dump(stderr, fprintf, TB_PROFILE_EXIT_COUNT);
+}
+
+/* must be called from the thread that runs the emulated cpu */
+void tb_profile_init(void)
+{
+    tb_profile_enabled = 1;
+#ifdef TB_PROFILE_SAMPLING
+    tb_profile_start_timer();
+#endif
+    atexit(tb_profile_exit);
+}
+
+/* return the index of the last symbol at or below 'vaddr', or -1 */
+static int tb_profile_symbol_find(unsigned long vaddr)
+{
+    int  lo = 0, hi = tb_profile_nb_syms - 1;
+
+    while (lo <= hi) {
+        int  m = (lo + hi) >> 1;
+        if (tb_profile_syms[m].vaddr <= vaddr)
+            lo = m + 1;
+        else
+            hi = m - 1;
+    }
+    return hi;
+}
+
+void tb_profile_symbol_add(unsigned long vaddr, const char *name)
+{
+    int  n;
+
+    if (!tb_profile_enabled)
+        return;
+
+    n = tb_profile_symbol_find(vaddr);
+    if (n >= 0 && tb_profile_syms[n].vaddr == vaddr) {
+        qemu_free(tb_profile_syms[n].name);
+        tb_profile_syms[n].name = qemu_strdup(name);
+        return;
+    }
+    if (tb_profile_nb_syms == tb_profile_max_syms) {
+        tb_profile_max_syms = tb_profile_max_syms ? 2*tb_profile_max_syms : 256;
+        tb_profile_syms = qemu_realloc(tb_profile_syms,
+                                       tb_profile_max_syms * sizeof(TBProfileSymbol));
+    }
+    n++;
+    memmove(tb_profile_syms + n + 1, tb_profile_syms + n,
+            (tb_profile_nb_syms - n) * sizeof(TBProfileSymbol));
+    tb_profile_syms[n].vaddr = vaddr;
+    tb_profile_syms[n].name  = qemu_strdup(name);
+    tb_profile_nb_syms++;
+}
+
+void tb_profile_symbol_remove(unsigned long vaddr)
+{
+    int  n;
+
+    if (!tb_profile_enabled)
+        return;
+
+    n = tb_profile_symbol_find(vaddr);
+    if (n < 0 || tb_profile_syms[n].vaddr != vaddr)
+        return;
+    qemu_free(tb_profile_syms[n].name);
+    memmove(tb_profile_syms + n, tb_profile_syms + n + 1,
+            (tb_profile_nb_syms - n - 1) * sizeof(TBProfileSymbol));
+    tb_profile_nb_syms--;
+}
+
+static int tb_profile_cmp(const void *a, const void *b)
+{
+    const TBProfile*  pa = *(const TBProfile**)a;
+    const TBProfile*  pb = *(const TBProfile**)b;
+
+    if (pa->count != pb->count)
+        return pa->count < pb->count ? 1 : -1;
+    if (pa->samples != pb->samples)
+        return pa->samples < pb->samples ? 1 : -1;
+    return 0;
+}
+
+void tb_profile_dump(FILE *f,
+                     int (*cpu_fprintf)(FILE *f, const char *fmt, ...),
+                     int count)
+{
+    TBProfile**  list;
+    TBProfile*   p;
+    uint64_t     total_count = 0, total_insns = 0, samples;
+    int          i, n;
+
+    if (!tb_profile_enabled) {
+        cpu_fprintf(f, "block profiling is disabled, use -tb-profile\n");
+        return;
+    }
+    tb_profile_flush_samples();
+
+    list = qemu_malloc((tb_profile_nb + 1) * sizeof(*list));
+    n = 0;
+    for (i = 0; i < TB_PROFILE_HASH_SIZE; i++) {
+        for (p = tb_profile_hash[i]; p != NULL; p = p->hash_next) {
+            list[n++] = p;
+            total_count += p->count;
+            total_insns += p->count * p->icount;
+        }
+    }
+    qsort(list, n, sizeof(*list), tb_profile_cmp);
+
+    samples = tb_profile_samples + tb_profile_samples_outside;
+    cpu_fprintf(f, "blocks            %d\n", n);
+    cpu_fprintf(f, "executions        %" PRId64 "\n", total_count);
+    cpu_fprintf(f, "guest insns       %" PRId64 "\n", total_insns);
+#ifdef TB_PROFILE_SAMPLING
+    cpu_fprintf(f, "host samples      %" PRId64 " (%d us), %" PRId64
+                " in translated code\n",
+                samples, TB_PROFILE_PERIOD_US, tb_profile_samples);
+    if (tb_profile_samples_lost)
+        cpu_fprintf(f, "lost samples      %" PRId64 "\n",
+                    (uint64_t)tb_profile_samples_lost);
+#endif
+    cpu_fprintf(f, "\n%-10s %12s %6s %5s %8s %6s  %s\n",
+                "pc", "count", "exec%", "insns", "samples", "time%",
+                "symbol");
+
+    if (count > n)
+        count = n;
+    for (i = 0; i < count; i++) {
+        int  sym;
+
+        p = list[i];
+        cpu_fprintf(f, "0x%08lx %12" PRId64 " %6.2f %5u %8" PRId64 " %6.2f  ",
+                    p->pc, p->count,
+                    total_count ? 100.0 * p->count / total_count : 0.0,
+                    p->icount, p->samples,
+                    samples ? 100.0 * p->samples / samples : 0.0);
+        sym = tb_profile_symbol_find(p->pc);
+        if (sym >= 0) {
+            cpu_fprintf(f, "%s+0x%lx\n", tb_profile_syms[sym].name,
+                        p->pc - tb_profile_syms[sym].vaddr);
+        } else {
+            cpu_fprintf(f, "?\n");
+        }
+    }
+    qemu_free(list);
+}
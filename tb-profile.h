@@ -0,0 +1,61 @@
+/* Copyright (C) 2009 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+#ifndef TB_PROFILE_H
+#define TB_PROFILE_H
+
+#include <stdio.h>
+#include <inttypes.h>
+
+/* The translated block profiler counts how many times the code of each
+ * guest block is executed, and samples the host program counter with a
+ * profiling timer to estimate how much host time is spent in it.
+ *
+ * The statistics are kept per guest pc and translation flags, so they
+ * survive the flushes and retranslations of the blocks. They are shown
+ * by the "info tbprofile" monitor command and printed on exit.
+ */
+
+typedef struct TBProfile {
+    unsigned long       pc;
+    uint64_t            flags;
+    /* incremented by the translated code itself */
+    uint64_t            count;
+    /* profiling timer ticks that hit the translated code */
+    uint64_t            samples;
+    /* guest instructions in the block */
+    unsigned int        icount;
+    struct TBProfile*   hash_next;
+} TBProfile;
+
+/* non-zero when the translator must instrument the blocks */
+extern int tb_profile_enabled;
+
+/* enable the profiler. must be called before any translation */
+void       tb_profile_init(void);
+
+/* attribute the host pcs sampled by the profiling timer to their blocks.
+ * must be called before the translated blocks are flushed */
+void       tb_profile_flush_samples(void);
+
+/* return the statistics of the block at 'pc' */
+TBProfile* tb_profile_get(unsigned long pc, uint64_t flags);
+
+/* symbols reported by the guest, used to name the hot blocks */
+void       tb_profile_symbol_add(unsigned long vaddr, const char *name);
+void       tb_profile_symbol_remove(unsigned long vaddr);
+
+/* print the 'count' most executed blocks */
+void       tb_profile_dump(FILE *f,
+                           int (*cpu_fprintf)(FILE *f, const char *fmt, ...),
+                           int count);
+
+#endif /* TB_PROFILE_H */
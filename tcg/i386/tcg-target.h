@@ -44,6 +44,11 @@ enum {
 #define TCG_TARGET_STACK_ALIGN 16
 #define TCG_TARGET_CALL_STACK_OFFSET 0
 
+#if defined(CONFIG_SOFTMMU)
+/* the qemu_ld/st TLB miss code is emitted after the end of the TB */
+#define TCG_TARGET_HAS_LDST_SLOW_PATH
+#endif
+
 /* Note: must be synced with dyngen-exec.h */
 #define TCG_AREG0 TCG_REG_EBP
 #define TCG_AREG1 TCG_REG_EBX
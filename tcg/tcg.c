@@ -28,6 +28,10 @@
 /* define it to use liveness analysis (better code) */
 #define USE_LIVENESS_ANALYSIS
 
+/* define it to run the optimization pass (constant folding, copy
+   propagation, redundant CPU state loads and stores) */
+#define USE_TCG_OPTIMIZATIONS
+
 #include <assert.h>
 #include <stdarg.h>
 #include <stdlib.h>
@@ -145,6 +149,23 @@ int gen_new_label(void)
     return idx;
 }
 
+#ifdef TCG_TARGET_HAS_LDST_SLOW_PATH
+/* allocate a qemu_ld/st slow path, the caller fills it */
+static TCGLdstSlowPath *tcg_new_ldst_slow_path(TCGContext *s)
+{
+    TCGLdstSlowPath *l;
+
+    l = tcg_malloc(sizeof(TCGLdstSlowPath));
+    memset(l, 0, sizeof(*l));
+    l->op_index = -1;
+    l->next = s->ldst_slow_paths;
+    s->ldst_slow_paths = l;
+    return l;
+}
+
+static void tcg_out_ldst_slow_path(TCGContext *s, TCGLdstSlowPath *l);
+#endif
+
 #include "tcg-target.c"
 
 /* pool based memory allocation */
@@ -196,6 +217,16 @@ void tcg_pool_reset(TCGContext *s)
     s->pool_current = NULL;
 }
 
+/* init global prologue and epilogue */
+static void tcg_prologue_init(TCGContext *s)
+{
+    s->code_buf = code_gen_prologue;
+    s->code_ptr = s->code_buf;
+    tcg_target_qemu_prologue(s);
+    flush_icache_range((unsigned long)s->code_buf, 
+                       (unsigned long)s->code_ptr);
+}
+
 void tcg_context_init(TCGContext *s)
 {
     int op, total_args, n;
@@ -230,12 +261,7 @@ void tcg_context_init(TCGContext *s)
     
     tcg_target_init(s);
 
-    /* init global prologue and epilogue */
-    s->code_buf = code_gen_prologue;
-    s->code_ptr = s->code_buf;
-    tcg_target_qemu_prologue(s);
-    flush_icache_range((unsigned long)s->code_buf, 
-                       (unsigned long)s->code_ptr);
+    tcg_prologue_init(s);
 }
 
 void tcg_set_frame(TCGContext *s, int reg,
@@ -389,6 +415,48 @@ TCGv tcg_global_mem_new(TCGType type, int reg, tcg_target_long offset,
     return MAKE_TCGV(idx);
 }
 
+/* Same as tcg_global_mem_new(), but if the host has a free register
+   for it, the global lives in that register during the whole execution
+   of the generated code, including across chained TBs: the prologue
+   loads it from 'reg' + 'offset', where 'reg' must be a fixed register
+   global (usually TCG_AREG0). The memory copy is updated at the end of
+   each basic block and before helper calls and qemu_ld/st, and the
+   register is reloaded after helper calls, so code outside of the TBs
+   always sees the current value in memory. */
+TCGv tcg_global_mem_new_pinned(TCGType type, int reg, tcg_target_long offset,
+                               const char *name)
+{
+#ifdef TCG_TARGET_HAS_PINNED_GLOBALS
+    TCGContext *s = &tcg_ctx;
+    TCGTemp *ts;
+    int i, idx, host_reg;
+
+    for(i = 0; i < ARRAY_SIZE(tcg_target_pinned_regs); i++) {
+        host_reg = tcg_target_pinned_regs[i];
+        if (tcg_regset_test_reg(s->reserved_regs, host_reg))
+            continue;
+        idx = s->nb_globals;
+        tcg_temp_alloc(s, s->nb_globals + 1);
+        ts = &s->temps[s->nb_globals];
+        ts->base_type = type;
+        ts->type = type;
+        ts->fixed_reg = 1;
+        ts->pinned = 1;
+        ts->reg = host_reg;
+        ts->mem_allocated = 1;
+        ts->mem_reg = reg;
+        ts->mem_offset = offset;
+        ts->name = name;
+        s->nb_globals++;
+        tcg_regset_set_reg(s->reserved_regs, host_reg);
+        /* the prologue must now load it */
+        tcg_prologue_init(s);
+        return MAKE_TCGV(idx);
+    }
+#endif
+    return tcg_global_mem_new(type, reg, offset, name);
+}
+
 TCGv tcg_temp_new_internal(TCGType type, int temp_local)
 {
     TCGContext *s = &tcg_ctx;
@@ -650,6 +718,8 @@ static void tcg_reg_alloc_start(TCGContext *s)
         ts = &s->temps[i];
         if (ts->fixed_reg) {
             ts->val_type = TEMP_VAL_REG;
+            /* pinned globals are saved at the end of each TB */
+            ts->mem_coherent = 1;
         } else {
             ts->val_type = TEMP_VAL_MEM;
         }
@@ -1207,6 +1277,723 @@ void tcg_liveness_analysis(TCGContext *s)
 }
 #endif
 
+#ifdef USE_TCG_OPTIMIZATIONS
+
+/* Forward optimization pass, run before the liveness analysis. Inside
+   each basic block it tracks which temporaries hold a known constant or
+   a copy of another temporary, then:
+   - replaces input arguments with the best available copy,
+   - folds operations whose inputs are all constant,
+   - simplifies trivial identities (x + 0, x & 0, x ^ x, ...),
+   - forwards a value stored to the CPU state to a later load of the
+     same location, and removes a store overwritten before anything
+     could read it.
+   The liveness analysis then deletes the computations made useless.
+
+   The operation indexes must not change (the search_pc pass relies on
+   them), so removed operations become nops. The parameter buffer is
+   compacted in place, which works because a rewritten operation never
+   has more parameters than the original one. */
+
+enum {
+    TCG_OPT_UNKNOWN = 0,
+    TCG_OPT_CONST,
+    TCG_OPT_COPY
+};
+
+typedef struct TCGOptTemp {
+    int state;
+    tcg_target_ulong val;
+    /* circular list of the temporaries holding the same value */
+    int prev_copy, next_copy;
+} TCGOptTemp;
+
+/* pending stores to the CPU state */
+#define TCG_OPT_MAX_STORES 16
+
+typedef struct TCGOptStore {
+    int opc;
+    TCGArg base;
+    tcg_target_long offset;
+    int size;
+    TCGArg val;         /* stored temporary, -1 if it was modified since */
+    int op_index;       /* store operation, -1 if the value was read */
+    TCGArg *args;       /* its parameters in the compacted buffer */
+} TCGOptStore;
+
+typedef struct TCGOptState {
+    TCGContext *s;
+    TCGOptTemp *temps;
+    TCGOptStore stores[TCG_OPT_MAX_STORES];
+    int nb_stores;
+} TCGOptState;
+
+static void tcg_opt_stores_reset(TCGOptState *os)
+{
+    os->nb_stores = 0;
+}
+
+static void tcg_opt_store_drop(TCGOptState *os, int i)
+{
+    os->stores[i] = os->stores[--os->nb_stores];
+}
+
+/* 'arg' is about to be written: forget what is known about it */
+static void tcg_opt_reset_temp(TCGOptState *os, TCGArg arg)
+{
+    TCGOptTemp *t = &os->temps[arg];
+    int i;
+
+    if (t->state == TCG_OPT_COPY) {
+        TCGOptTemp *prev = &os->temps[t->prev_copy];
+        TCGOptTemp *next = &os->temps[t->next_copy];
+
+        prev->next_copy = t->next_copy;
+        next->prev_copy = t->prev_copy;
+        /* a single remaining temporary is not a copy anymore */
+        if (prev == next)
+            prev->state = TCG_OPT_UNKNOWN;
+        t->prev_copy = t->next_copy = arg;
+    }
+    t->state = TCG_OPT_UNKNOWN;
+
+    for (i = os->nb_stores - 1; i >= 0; i--) {
+        if (os->stores[i].base == arg)
+            tcg_opt_store_drop(os, i);
+        else if (os->stores[i].val == arg)
+            os->stores[i].val = (TCGArg)-1;
+    }
+}
+
+static void tcg_opt_reset_all(TCGOptState *os, int nb_temps)
+{
+    int i;
+
+    for (i = 0; i < nb_temps; i++) {
+        os->temps[i].state = TCG_OPT_UNKNOWN;
+        os->temps[i].prev_copy = os->temps[i].next_copy = i;
+    }
+    tcg_opt_stores_reset(os);
+}
+
+static inline int tcg_opt_is_const(TCGOptState *os, TCGArg arg)
+{
+    return os->temps[arg].state == TCG_OPT_CONST;
+}
+
+/* return the copy of 'arg' that is the best to use: globals first, as
+   they are often already in a register, then local temporaries */
+static TCGArg tcg_opt_find_copy(TCGOptState *os, TCGArg arg)
+{
+    TCGContext *s = os->s;
+    TCGArg i, best;
+
+    if (os->temps[arg].state != TCG_OPT_COPY)
+        return arg;
+    best = arg;
+    for (i = os->temps[arg].next_copy; i != arg; i = os->temps[i].next_copy) {
+        if (i < s->nb_globals) {
+            if (best >= s->nb_globals || i < best)
+                best = i;
+        } else if (best >= s->nb_globals && s->temps[i].temp_local &&
+                   !s->temps[best].temp_local) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+static int tcg_opt_are_copies(TCGOptState *os, TCGArg a, TCGArg b)
+{
+    TCGArg i;
+
+    if (a == b)
+        return 1;
+    if (os->temps[a].state != TCG_OPT_COPY)
+        return 0;
+    for (i = os->temps[a].next_copy; i != a; i = os->temps[i].next_copy) {
+        if (i == b)
+            return 1;
+    }
+    return 0;
+}
+
+static void tcg_opt_set_const(TCGOptState *os, TCGArg dst,
+                              tcg_target_ulong val)
+{
+    tcg_opt_reset_temp(os, dst);
+    os->temps[dst].state = TCG_OPT_CONST;
+    os->temps[dst].val = val;
+}
+
+#if TCG_TARGET_REG_BITS == 64
+#define TCG_OPT_OPC(op, is_i32) \
+    ((is_i32) ? INDEX_op_ ## op ## _i32 : INDEX_op_ ## op ## _i64)
+#else
+#define TCG_OPT_OPC(op, is_i32) ((void)(is_i32), INDEX_op_ ## op ## _i32)
+#endif
+
+static int tcg_opt_gen_movi(TCGOptState *os, uint16_t *opc_ptr, TCGArg *out,
+                            TCGArg dst, tcg_target_ulong val)
+{
+    int is_i32 = (os->s->temps[dst].type == TCG_TYPE_I32);
+
+    if (is_i32)
+        val = (tcg_target_long)(int32_t)val;
+    *opc_ptr = TCG_OPT_OPC(movi, is_i32);
+    out[0] = dst;
+    out[1] = val;
+    tcg_opt_set_const(os, dst, val);
+    return 2;
+}
+
+/* emit 'mov dst, src' (or its constant version) at the current output
+   position, returns the number of parameters used */
+static int tcg_opt_gen_mov(TCGOptState *os, uint16_t *opc_ptr, TCGArg *out,
+                           TCGArg dst, TCGArg src)
+{
+    TCGContext *s = os->s;
+    int is_i32 = (s->temps[dst].type == TCG_TYPE_I32);
+    TCGOptTemp *t;
+
+    if (tcg_opt_is_const(os, src))
+        return tcg_opt_gen_movi(os, opc_ptr, out, dst, os->temps[src].val);
+    if (tcg_opt_are_copies(os, dst, src)) {
+        *opc_ptr = INDEX_op_nop;
+        return 0;
+    }
+    *opc_ptr = TCG_OPT_OPC(mov, is_i32);
+    out[0] = dst;
+    out[1] = src;
+    tcg_opt_reset_temp(os, dst);
+    /* insert 'dst' in the list of copies of 'src' */
+    t = &os->temps[dst];
+    t->state = TCG_OPT_COPY;
+    t->prev_copy = src;
+    t->next_copy = os->temps[src].next_copy;
+    os->temps[t->next_copy].prev_copy = dst;
+    os->temps[src].next_copy = dst;
+    os->temps[src].state = TCG_OPT_COPY;
+    return 2;
+}
+
+
+#if TCG_TARGET_REG_BITS == 64
+#define CASE_OP_32_64(x) \
+    case INDEX_op_ ## x ## _i32: \
+    case INDEX_op_ ## x ## _i64
+#else
+#define CASE_OP_32_64(x) \
+    case INDEX_op_ ## x ## _i32
+#endif
+
+static int tcg_opt_is_commutative(int opc)
+{
+    switch (opc) {
+    CASE_OP_32_64(add):
+    CASE_OP_32_64(mul):
+    CASE_OP_32_64(and):
+    CASE_OP_32_64(or):
+    CASE_OP_32_64(xor):
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/* compute 'x op y'. Returns 0 if the operation cannot be folded. */
+static int tcg_opt_fold(int opc, int bits, tcg_target_ulong x,
+                        tcg_target_ulong y, tcg_target_ulong *res)
+{
+    switch (opc) {
+    CASE_OP_32_64(add):
+        *res = x + y;
+        break;
+    CASE_OP_32_64(sub):
+        *res = x - y;
+        break;
+    CASE_OP_32_64(mul):
+        *res = x * y;
+        break;
+    CASE_OP_32_64(and):
+        *res = x & y;
+        break;
+    CASE_OP_32_64(or):
+        *res = x | y;
+        break;
+    CASE_OP_32_64(xor):
+        *res = x ^ y;
+        break;
+    CASE_OP_32_64(shl):
+        if (y >= bits)
+            return 0;
+        *res = x << y;
+        break;
+    case INDEX_op_shr_i32:
+        if (y >= 32)
+            return 0;
+        *res = (uint32_t)x >> y;
+        break;
+    case INDEX_op_sar_i32:
+        if (y >= 32)
+            return 0;
+        *res = (int32_t)x >> y;
+        break;
+#if TCG_TARGET_REG_BITS == 64
+    case INDEX_op_shr_i64:
+        if (y >= 64)
+            return 0;
+        *res = (uint64_t)x >> y;
+        break;
+    case INDEX_op_sar_i64:
+        if (y >= 64)
+            return 0;
+        *res = (int64_t)x >> y;
+        break;
+#endif
+#ifdef TCG_TARGET_HAS_neg_i32
+    case INDEX_op_neg_i32:
+        *res = -x;
+        break;
+#endif
+#ifdef TCG_TARGET_HAS_neg_i64
+    case INDEX_op_neg_i64:
+        *res = -x;
+        break;
+#endif
+#ifdef TCG_TARGET_HAS_ext8s_i32
+    case INDEX_op_ext8s_i32:
+        *res = (int8_t)x;
+        break;
+#endif
+#ifdef TCG_TARGET_HAS_ext16s_i32
+    case INDEX_op_ext16s_i32:
+        *res = (int16_t)x;
+        break;
+#endif
+#ifdef TCG_TARGET_HAS_ext8s_i64
+    case INDEX_op_ext8s_i64:
+        *res = (int8_t)x;
+        break;
+#endif
+#ifdef TCG_TARGET_HAS_ext16s_i64
+    case INDEX_op_ext16s_i64:
+        *res = (int16_t)x;
+        break;
+#endif
+#ifdef TCG_TARGET_HAS_ext32s_i64
+    case INDEX_op_ext32s_i64:
+        *res = (int32_t)x;
+        break;
+#endif
+    default:
+        return 0;
+    }
+    return 1;
+}
+
+/* size in bytes of the CPU state load or store 'opc', 0 if it is not
+   one */
+static int tcg_opt_mem_size(int opc)
+{
+    switch (opc) {
+    case INDEX_op_ld8u_i32:
+    case INDEX_op_ld8s_i32:
+    case INDEX_op_st8_i32:
+#if TCG_TARGET_REG_BITS == 64
+    case INDEX_op_ld8u_i64:
+    case INDEX_op_ld8s_i64:
+    case INDEX_op_st8_i64:
+#endif
+        return 1;
+    case INDEX_op_ld16u_i32:
+    case INDEX_op_ld16s_i32:
+    case INDEX_op_st16_i32:
+#if TCG_TARGET_REG_BITS == 64
+    case INDEX_op_ld16u_i64:
+    case INDEX_op_ld16s_i64:
+    case INDEX_op_st16_i64:
+#endif
+        return 2;
+    case INDEX_op_ld_i32:
+    case INDEX_op_st_i32:
+#if TCG_TARGET_REG_BITS == 64
+    case INDEX_op_ld32u_i64:
+    case INDEX_op_ld32s_i64:
+    case INDEX_op_st32_i64:
+#endif
+        return 4;
+#if TCG_TARGET_REG_BITS == 64
+    case INDEX_op_ld_i64:
+    case INDEX_op_st_i64:
+        return 8;
+#endif
+    default:
+        return 0;
+    }
+}
+
+/* the load that reads back exactly what 'opc' stored */
+static int tcg_opt_store_reload(int opc)
+{
+    switch (opc) {
+    case INDEX_op_st_i32:
+        return INDEX_op_ld_i32;
+#if TCG_TARGET_REG_BITS == 64
+    case INDEX_op_st_i64:
+        return INDEX_op_ld_i64;
+#endif
+    default:
+        return -1;
+    }
+}
+
+static inline int tcg_opt_overlap(TCGOptStore *st, tcg_target_long offset,
+                                  int size)
+{
+    return offset < st->offset + st->size && st->offset < offset + size;
+}
+
+/* record a store. The store itself is always kept, but an older store
+   to the same location that nothing read becomes dead and is removed */
+static void tcg_opt_store(TCGOptState *os, int opc, TCGArg *args,
+                          int op_index)
+{
+    TCGArg base = args[1];
+    tcg_target_long offset = args[2];
+    int size = tcg_opt_mem_size(opc);
+    TCGOptStore *st;
+    int i;
+
+    for (i = os->nb_stores - 1; i >= 0; i--) {
+        st = &os->stores[i];
+        if (st->base != base) {
+            /* may alias */
+            tcg_opt_store_drop(os, i);
+        } else if (tcg_opt_overlap(st, offset, size)) {
+            if (st->op_index >= 0 && st->offset == offset &&
+                st->size == size) {
+                /* nothing could read it: delete the older store */
+                gen_opc_buf[st->op_index] = INDEX_op_nopn;
+                st->args[0] = 3;
+                st->args[2] = 3;
+#ifdef CONFIG_PROFILER
+                os->s->opt_store_del_count++;
+#endif
+            }
+            tcg_opt_store_drop(os, i);
+        }
+    }
+    if (os->nb_stores == TCG_OPT_MAX_STORES)
+        tcg_opt_store_drop(os, 0);
+    st = &os->stores[os->nb_stores++];
+    st->opc = opc;
+    st->base = base;
+    st->offset = offset;
+    st->size = size;
+    st->val = args[0];
+    st->op_index = op_index;
+    st->args = args;
+}
+
+/* handle a load: returns the temporary holding the loaded value if it
+   is known, -1 otherwise */
+static TCGArg tcg_opt_load(TCGOptState *os, int opc, const TCGArg *args)
+{
+    TCGArg base = args[1];
+    tcg_target_long offset = args[2];
+    int size = tcg_opt_mem_size(opc);
+    TCGArg val = (TCGArg)-1;
+    TCGOptStore *st;
+    int i;
+
+    for (i = 0; i < os->nb_stores; i++) {
+        st = &os->stores[i];
+        if (st->base != base || tcg_opt_overlap(st, offset, size)) {
+            st->op_index = -1;
+            if (st->base == base && st->offset == offset &&
+                tcg_opt_store_reload(st->opc) == opc)
+                val = st->val;
+        }
+    }
+    return val;
+}
+
+static void tcg_optimize(TCGContext *s)
+{
+    TCGOptState os1, *os = &os1;
+    int op_index, nb_ops, opc, nb_args, nb_oargs, nb_iargs, i, bits;
+    const TCGOpDef *def;
+    TCGArg *args, *out, tmp;
+    tcg_target_ulong res;
+
+    nb_ops = gen_opc_ptr - gen_opc_buf;
+    os->s = s;
+    os->temps = tcg_malloc(s->nb_temps * sizeof(TCGOptTemp));
+    tcg_opt_reset_all(os, s->nb_temps);
+
+    args = gen_opparam_buf;
+    out = gen_opparam_buf;
+    for (op_index = 0; op_index < nb_ops; op_index++) {
+        opc = gen_opc_buf[op_index];
+        def = &tcg_op_defs[opc];
+
+        switch (opc) {
+        case INDEX_op_nop:
+        case INDEX_op_nop1:
+        case INDEX_op_nop2:
+        case INDEX_op_nop3:
+            gen_opc_buf[op_index] = INDEX_op_nop;
+            args += def->nb_args;
+            continue;
+        case INDEX_op_nopn:
+            gen_opc_buf[op_index] = INDEX_op_nop;
+            args += args[0];
+            continue;
+        case INDEX_op_call:
+            nb_oargs = args[0] >> 16;
+            nb_iargs = args[0] & 0xffff;
+            nb_args = nb_oargs + nb_iargs + 3;
+            for (i = 1 + nb_oargs; i < 1 + nb_oargs + nb_iargs; i++) {
+                if (args[i] != TCG_CALL_DUMMY_ARG)
+                    args[i] = tcg_opt_find_copy(os, args[i]);
+            }
+            for (i = 1; i < 1 + nb_oargs; i++)
+                tcg_opt_reset_temp(os, args[i]);
+            /* the helper may read and write the CPU state */
+            if (!(args[1 + nb_oargs + nb_iargs] & TCG_CALL_PURE)) {
+                for (i = 0; i < s->nb_globals; i++)
+                    tcg_opt_reset_temp(os, i);
+            }
+            tcg_opt_stores_reset(os);
+            memmove(out, args, nb_args * sizeof(TCGArg));
+            args += nb_args;
+            out += nb_args;
+            continue;
+        case INDEX_op_set_label:
+            tcg_opt_reset_all(os, s->nb_temps);
+            goto copy;
+        case INDEX_op_discard:
+            tcg_opt_reset_temp(os, args[0]);
+            goto copy;
+        default:
+            break;
+        }
+
+        if (opc < INDEX_op_end) {
+            /* legacy dyngen operations use the globals implicitly */
+            tcg_opt_reset_all(os, s->nb_temps);
+            goto copy;
+        }
+
+        nb_oargs = def->nb_oargs;
+        nb_iargs = def->nb_iargs;
+        for (i = nb_oargs; i < nb_oargs + nb_iargs; i++) {
+            tmp = tcg_opt_find_copy(os, args[i]);
+#ifdef CONFIG_PROFILER
+            if (tmp != args[i])
+                s->opt_copy_count++;
+#endif
+            args[i] = tmp;
+        }
+        bits = (nb_oargs && s->temps[args[0]].type == TCG_TYPE_I32) ? 32 : 64;
+
+        switch (opc) {
+        CASE_OP_32_64(mov):
+            nb_args = def->nb_args;
+            out += tcg_opt_gen_mov(os, &gen_opc_buf[op_index], out,
+                                   args[0], args[1]);
+            args += nb_args;
+            continue;
+        CASE_OP_32_64(movi):
+            tcg_opt_set_const(os, args[0], args[1]);
+            goto copy;
+
+        CASE_OP_32_64(add):
+        CASE_OP_32_64(sub):
+        CASE_OP_32_64(mul):
+        CASE_OP_32_64(and):
+        CASE_OP_32_64(or):
+        CASE_OP_32_64(xor):
+        CASE_OP_32_64(shl):
+        CASE_OP_32_64(shr):
+        CASE_OP_32_64(sar):
+            if (tcg_opt_is_commutative(opc) &&
+                tcg_opt_is_const(os, args[1]) &&
+                !tcg_opt_is_const(os, args[2])) {
+                tmp = args[1];
+                args[1] = args[2];
+                args[2] = tmp;
+            }
+            if (tcg_opt_is_const(os, args[1]) &&
+                tcg_opt_is_const(os, args[2]) &&
+                tcg_opt_fold(opc, bits, os->temps[args[1]].val,
+                             os->temps[args[2]].val, &res)) {
+                goto do_movi;
+            }
+            if (tcg_opt_is_const(os, args[2])) {
+                tcg_target_ulong y = os->temps[args[2]].val;
+                if (bits == 32)
+                    y = (uint32_t)y;
+                switch (opc) {
+                CASE_OP_32_64(add):
+                CASE_OP_32_64(sub):
+                CASE_OP_32_64(or):
+                CASE_OP_32_64(xor):
+                CASE_OP_32_64(shl):
+                CASE_OP_32_64(shr):
+                CASE_OP_32_64(sar):
+                    if (y == 0)
+                        goto do_mov;
+                    break;
+                CASE_OP_32_64(and):
+                    if (y == 0) {
+                        res = 0;
+                        goto do_movi;
+                    }
+                    if (y == (bits == 32 ? 0xffffffffu : (tcg_target_ulong)-1))
+                        goto do_mov;
+                    break;
+                CASE_OP_32_64(mul):
+                    if (y == 0) {
+                        res = 0;
+                        goto do_movi;
+                    }
+                    if (y == 1)
+                        goto do_mov;
+                    break;
+                }
+            } else if (tcg_opt_are_copies(os, args[1], args[2])) {
+                switch (opc) {
+                CASE_OP_32_64(sub):
+                CASE_OP_32_64(xor):
+                    res = 0;
+                    goto do_movi;
+                CASE_OP_32_64(and):
+                CASE_OP_32_64(or):
+                    goto do_mov;
+                }
+            }
+            break;
+
+#ifdef TCG_TARGET_HAS_neg_i32
+        case INDEX_op_neg_i32:
+#endif
+#ifdef TCG_TARGET_HAS_neg_i64
+        case INDEX_op_neg_i64:
+#endif
+#ifdef TCG_TARGET_HAS_ext8s_i32
+        case INDEX_op_ext8s_i32:
+#endif
+#ifdef TCG_TARGET_HAS_ext16s_i32
+        case INDEX_op_ext16s_i32:
+#endif
+#ifdef TCG_TARGET_HAS_ext8s_i64
+        case INDEX_op_ext8s_i64:
+#endif
+#ifdef TCG_TARGET_HAS_ext16s_i64
+        case INDEX_op_ext16s_i64:
+#endif
+#ifdef TCG_TARGET_HAS_ext32s_i64
+        case INDEX_op_ext32s_i64:
+#endif
+            if (tcg_opt_is_const(os, args[1]) &&
+                tcg_opt_fold(opc, bits, os->temps[args[1]].val, 0, &res))
+                goto do_movi;
+            break;
+
+        case INDEX_op_ld_i32:
+#if TCG_TARGET_REG_BITS == 64
+        case INDEX_op_ld_i64:
+#endif
+        case INDEX_op_ld8u_i32:
+        case INDEX_op_ld8s_i32:
+        case INDEX_op_ld16u_i32:
+        case INDEX_op_ld16s_i32:
+#if TCG_TARGET_REG_BITS == 64
+        case INDEX_op_ld8u_i64:
+        case INDEX_op_ld8s_i64:
+        case INDEX_op_ld16u_i64:
+        case INDEX_op_ld16s_i64:
+        case INDEX_op_ld32u_i64:
+        case INDEX_op_ld32s_i64:
+#endif
+            tmp = tcg_opt_load(os, opc, args);
+            if (tmp != (TCGArg)-1) {
+#ifdef CONFIG_PROFILER
+                s->opt_store_fwd_count++;
+#endif
+                nb_args = def->nb_args;
+                out += tcg_opt_gen_mov(os, &gen_opc_buf[op_index], out,
+                                       args[0], tmp);
+                args += nb_args;
+                continue;
+            }
+            break;
+
+        case INDEX_op_st8_i32:
+        case INDEX_op_st16_i32:
+        case INDEX_op_st_i32:
+#if TCG_TARGET_REG_BITS == 64
+        case INDEX_op_st8_i64:
+        case INDEX_op_st16_i64:
+        case INDEX_op_st32_i64:
+        case INDEX_op_st_i64:
+#endif
+            memmove(out, args, def->nb_args * sizeof(TCGArg));
+            tcg_opt_store(os, opc, out, op_index);
+            args += def->nb_args;
+            out += def->nb_args;
+            continue;
+
+        default:
+            break;
+        }
+
+        /* the operation is kept as is */
+        for (i = 0; i < nb_oargs; i++)
+            tcg_opt_reset_temp(os, args[i]);
+        if (def->flags & TCG_OPF_BB_END) {
+            tcg_opt_reset_all(os, s->nb_temps);
+        } else if (def->flags & (TCG_OPF_CALL_CLOBBER | TCG_OPF_SIDE_EFFECTS)) {
+            /* may raise an exception: the CPU state must be up to date */
+            tcg_opt_stores_reset(os);
+        }
+        goto copy;
+
+    do_mov:
+#ifdef CONFIG_PROFILER
+        s->opt_fold_count++;
+#endif
+        nb_args = def->nb_args;
+        out += tcg_opt_gen_mov(os, &gen_opc_buf[op_index], out,
+                               args[0], args[1]);
+        args += nb_args;
+        continue;
+
+    do_movi:
+#ifdef CONFIG_PROFILER
+        s->opt_fold_count++;
+#endif
+        nb_args = def->nb_args;
+        out += tcg_opt_gen_movi(os, &gen_opc_buf[op_index], out,
+                                args[0], res);
+        args += nb_args;
+        continue;
+
+    copy:
+        memmove(out, args, def->nb_args * sizeof(TCGArg));
+        args += def->nb_args;
+        out += def->nb_args;
+    }
+    gen_opparam_ptr = out;
+}
+
+#undef CASE_OP_32_64
+#undef TCG_OPT_OPC
+
+#endif /* USE_TCG_OPTIMIZATIONS */
+
 #ifndef NDEBUG
 static void dump_regs(TCGContext *s)
 {
@@ -1370,6 +2157,10 @@ static void temp_save(TCGContext *s, int temp, TCGRegSet allocated_regs)
         default:
             tcg_abort();
         }
+    } else if (ts->pinned && !ts->mem_coherent) {
+        /* the value stays in its register */
+        tcg_out_st(s, ts->type, ts->reg, ts->mem_reg, ts->mem_offset);
+        ts->mem_coherent = 1;
     }
 }
 
@@ -1385,6 +2176,22 @@ static void save_globals(TCGContext *s, TCGRegSet allocated_regs)
     }
 }
 
+/* reload the pinned globals after a helper call, which may have
+   modified their memory copy */
+static void reload_pinned_globals(TCGContext *s)
+{
+    TCGTemp *ts;
+    int i;
+
+    for(i = 0; i < s->nb_globals; i++) {
+        ts = &s->temps[i];
+        if (ts->pinned) {
+            tcg_out_ld(s, ts->type, ts->reg, ts->mem_reg, ts->mem_offset);
+            ts->mem_coherent = 1;
+        }
+    }
+}
+
 /* at the end of a basic block, we assume all temporaries are dead and
    all globals are stored at their canonical location. */
 static void tcg_reg_alloc_bb_end(TCGContext *s, TCGRegSet allocated_regs)
@@ -1421,6 +2228,7 @@ static void tcg_reg_alloc_movi(TCGContext *s, const TCGArg *args)
         /* for fixed registers, we do not do any constant
            propagation */
         tcg_out_movi(s, ots->type, ots->reg, val);
+        ots->mem_coherent = 0;
     } else {
         /* The movi is not explicitly generated here */
         if (ots->val_type == TEMP_VAL_REG)
@@ -1647,6 +2455,8 @@ static void tcg_reg_alloc_op(TCGContext *s,
         if (ts->fixed_reg && ts->reg != reg) {
             tcg_out_mov(s, ts->reg, reg);
         }
+        if (ts->pinned)
+            ts->mem_coherent = 0;
     }
 }
 
@@ -1809,6 +2619,10 @@ static int tcg_reg_alloc_call(TCGContext *s, const TCGOpDef *def,
         tcg_out_addi(s, TCG_REG_CALL_STACK, STACK_DIR(call_stack_size));
     }
 
+    /* a pure helper cannot have modified the globals */
+    if (!(flags & TCG_CALL_PURE))
+        reload_pinned_globals(s);
+
     /* assign output registers and emit moves if needed */
     for(i = 0; i < nb_oargs; i++) {
         arg = args[i];
@@ -1819,6 +2633,8 @@ static int tcg_reg_alloc_call(TCGContext *s, const TCGOpDef *def,
             if (ts->reg != reg) {
                 tcg_out_mov(s, ts->reg, reg);
             }
+            if (ts->pinned)
+                ts->mem_coherent = 0;
         } else {
             if (ts->val_type == TEMP_VAL_REG)
                 s->reg_to_temp[ts->reg] = -1;
@@ -1870,6 +2686,16 @@ static inline int tcg_gen_code_common(TCGContext *s, uint8_t *gen_code_buf,
     }
 #endif
 
+#ifdef USE_TCG_OPTIMIZATIONS
+#ifdef CONFIG_PROFILER
+    s->opt_time -= profile_getclock();
+#endif
+    tcg_optimize(s);
+#ifdef CONFIG_PROFILER
+    s->opt_time += profile_getclock();
+#endif
+#endif
+
 #ifdef CONFIG_PROFILER
     s->la_time -= profile_getclock();
 #endif
@@ -1893,6 +2719,7 @@ static inline int tcg_gen_code_common(TCGContext *s, uint8_t *gen_code_buf,
 
     args = gen_opparam_buf;
     op_index = 0;
+    s->ldst_slow_paths = NULL;
 
     for(;;) {
         opc = gen_opc_buf[op_index];
@@ -1974,6 +2801,10 @@ static inline int tcg_gen_code_common(TCGContext *s, uint8_t *gen_code_buf,
                some common argument patterns */
             dead_iargs = s->op_dead_iargs[op_index];
             tcg_reg_alloc_op(s, def, opc, args, dead_iargs);
+#ifdef TCG_TARGET_HAS_LDST_SLOW_PATH
+            if (s->ldst_slow_paths && s->ldst_slow_paths->op_index < 0)
+                s->ldst_slow_paths->op_index = op_index;
+#endif
             break;
         }
         args += def->nb_args;
@@ -1987,6 +2818,23 @@ static inline int tcg_gen_code_common(TCGContext *s, uint8_t *gen_code_buf,
 #endif
     }
  the_end:
+#ifdef TCG_TARGET_HAS_LDST_SLOW_PATH
+    {
+        /* emit the TLB miss paths after the TB. A helper called from one
+           of them is restored to the operation that jumped there */
+        TCGLdstSlowPath *l;
+        long start;
+
+        for (l = s->ldst_slow_paths; l != NULL; l = l->next) {
+            start = s->code_ptr - gen_code_buf;
+            tcg_out_ldst_slow_path(s, l);
+            if (search_pc >= start &&
+                search_pc < s->code_ptr - gen_code_buf) {
+                return l->op_index;
+            }
+        }
+    }
+#endif
     return -1;
 }
 
@@ -2063,6 +2911,16 @@ void tcg_dump_info(FILE *f,
                 (double)s->code_time / tot * 100.0);
     cpu_fprintf(f, "liveness/code time  %0.1f%%\n", 
                 (double)s->la_time / (s->code_time ? s->code_time : 1) * 100.0);
+    cpu_fprintf(f, "optimizer/code time %0.1f%%\n",
+                (double)s->opt_time / (s->code_time ? s->code_time : 1) * 100.0);
+    cpu_fprintf(f, "folded ops/TB       %0.2f\n",
+                s->tb_count ? (double)s->opt_fold_count / s->tb_count : 0);
+    cpu_fprintf(f, "copied args/TB      %0.2f\n",
+                s->tb_count ? (double)s->opt_copy_count / s->tb_count : 0);
+    cpu_fprintf(f, "fwd loads/TB        %0.2f\n",
+                s->tb_count ? (double)s->opt_store_fwd_count / s->tb_count : 0);
+    cpu_fprintf(f, "dead stores/TB      %0.2f\n",
+                s->tb_count ? (double)s->opt_store_del_count / s->tb_count : 0);
     cpu_fprintf(f, "cpu_restore count   %" PRId64 "\n",
                 s->restore_count);
     cpu_fprintf(f, "  avg cycles        %0.1f\n",
@@ -78,6 +78,21 @@ typedef struct TCGLabel {
     } u;
 } TCGLabel;
 
+/* TLB miss path of a qemu_ld/st operation. The backend emits only the
+   TLB hit path inline and records what it needs to generate the call to
+   the softmmu helper after the end of the TB. */
+typedef struct TCGLdstSlowPath {
+    struct TCGLdstSlowPath *next;
+    int is_ld;
+    int opc;                /* backend specific size and sign flags */
+    int data_reg, data_reg2;
+    int addr_reg2;          /* high part of the address, if needed */
+    int mem_index;
+    uint8_t *label_ptr[2];  /* 32 bit jump offsets to the slow path */
+    uint8_t *raddr;         /* where to resume in the TB */
+    int op_index;           /* operation index, for search_pc */
+} TCGLdstSlowPath;
+
 typedef struct TCGPool {
     struct TCGPool *next;
     int size;
@@ -196,6 +211,10 @@ typedef struct TCGTemp {
                                   basic blocks. Otherwise, it is not
                                   preserved accross basic blocks. */
     unsigned int temp_allocated:1; /* never used for code gen */
+    unsigned int pinned:1; /* If true, the global has a memory location
+                              but is kept in the fixed register 'reg'
+                              across TBs. 'mem_coherent' tells if the
+                              memory copy is up to date. */
     /* index of next free temp of same base type, -1 if end */
     int next_free_temp;
     const char *name;
@@ -241,6 +260,9 @@ struct TCGContext {
     uint8_t *code_ptr;
     TCGTemp static_temps[TCG_MAX_TEMPS];
 
+    /* qemu_ld/st slow paths of the TB being generated */
+    TCGLdstSlowPath *ldst_slow_paths;
+
     TCGHelperInfo *helpers;
     int nb_helpers;
     int allocated_helpers;
@@ -261,6 +283,11 @@ struct TCGContext {
     int64_t interm_time;
     int64_t code_time;
     int64_t la_time;
+    int64_t opt_time;
+    int64_t opt_fold_count;   /* ops replaced by a move or a constant */
+    int64_t opt_copy_count;   /* input args replaced by a copy */
+    int64_t opt_store_fwd_count; /* loads replaced by the stored value */
+    int64_t opt_store_del_count; /* overwritten stores removed */
     int64_t restore_count;
     int64_t restore_time;
 #endif
@@ -306,6 +333,8 @@ TCGv tcg_global_reg2_new_hack(TCGType type, int reg1, int reg2,
                               const char *name);
 TCGv tcg_global_mem_new(TCGType type, int reg, tcg_target_long offset,
                         const char *name);
+TCGv tcg_global_mem_new_pinned(TCGType type, int reg, tcg_target_long offset,
+                               const char *name);
 TCGv tcg_temp_new_internal(TCGType type, int temp_local);
 static inline TCGv tcg_temp_new(TCGType type)
 {
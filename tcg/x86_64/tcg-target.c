@@ -505,7 +505,7 @@ static void tcg_out_qemu_ld(TCGContext *s, const TCGArg *args,
 {
     int addr_reg, data_reg, r0, r1, mem_index, s_bits, bswap, rexw;
 #if defined(CONFIG_SOFTMMU)
-    uint8_t *label1_ptr, *label2_ptr;
+    TCGLdstSlowPath *l;
 #endif
 
     data_reg = *args++;
@@ -547,49 +547,16 @@ static void tcg_out_qemu_ld(TCGContext *s, const TCGArg *args,
     /* mov */
     tcg_out_modrm(s, 0x8b | rexw, r0, addr_reg);
     
-    /* je label1 */
-    tcg_out8(s, 0x70 + JCC_JE);
-    label1_ptr = s->code_ptr;
-    s->code_ptr++;
-
-    /* XXX: move that code at the end of the TB */
-    tcg_out_movi(s, TCG_TYPE_I32, TCG_REG_RSI, mem_index);
-    tcg_out8(s, 0xe8);
-    tcg_out32(s, (tcg_target_long)qemu_ld_helpers[s_bits] - 
-              (tcg_target_long)s->code_ptr - 4);
-
-    switch(opc) {
-    case 0 | 4:
-        /* movsbq */
-        tcg_out_modrm(s, 0xbe | P_EXT | P_REXW, data_reg, TCG_REG_RAX);
-        break;
-    case 1 | 4:
-        /* movswq */
-        tcg_out_modrm(s, 0xbf | P_EXT | P_REXW, data_reg, TCG_REG_RAX);
-        break;
-    case 2 | 4:
-        /* movslq */
-        tcg_out_modrm(s, 0x63 | P_REXW, data_reg, TCG_REG_RAX);
-        break;
-    case 0:
-    case 1:
-    case 2:
-    default:
-        /* movl */
-        tcg_out_modrm(s, 0x8b, data_reg, TCG_REG_RAX);
-        break;
-    case 3:
-        tcg_out_mov(s, data_reg, TCG_REG_RAX);
-        break;
-    }
-
-    /* jmp label2 */
-    tcg_out8(s, 0xeb);
-    label2_ptr = s->code_ptr;
-    s->code_ptr++;
-    
-    /* label1: */
-    *label1_ptr = s->code_ptr - label1_ptr - 1;
+    /* jne slow_path */
+    tcg_out8(s, 0x0f);
+    tcg_out8(s, 0x80 + JCC_JNE);
+    l = tcg_new_ldst_slow_path(s);
+    l->is_ld = 1;
+    l->opc = opc;
+    l->data_reg = data_reg;
+    l->mem_index = mem_index;
+    l->label_ptr[0] = s->code_ptr;
+    s->code_ptr += 4;
 
     /* add x(r1), r0 */
     tcg_out_modrm_offset(s, 0x03 | P_REXW, r0, r1, offsetof(CPUTLBEntry, addend) - 
@@ -672,8 +639,7 @@ static void tcg_out_qemu_ld(TCGContext *s, const TCGArg *args,
     }
 
 #if defined(CONFIG_SOFTMMU)
-    /* label2: */
-    *label2_ptr = s->code_ptr - label2_ptr - 1;
+    l->raddr = s->code_ptr;
 #endif
 }
 
@@ -682,7 +648,7 @@ static void tcg_out_qemu_st(TCGContext *s, const TCGArg *args,
 {
     int addr_reg, data_reg, r0, r1, mem_index, s_bits, bswap, rexw;
 #if defined(CONFIG_SOFTMMU)
-    uint8_t *label1_ptr, *label2_ptr;
+    TCGLdstSlowPath *l;
 #endif
 
     data_reg = *args++;
@@ -725,42 +691,16 @@ static void tcg_out_qemu_st(TCGContext *s, const TCGArg *args,
     /* mov */
     tcg_out_modrm(s, 0x8b | rexw, r0, addr_reg);
     
-    /* je label1 */
-    tcg_out8(s, 0x70 + JCC_JE);
-    label1_ptr = s->code_ptr;
-    s->code_ptr++;
-
-    /* XXX: move that code at the end of the TB */
-    switch(opc) {
-    case 0:
-        /* movzbl */
-        tcg_out_modrm(s, 0xb6 | P_EXT | P_REXB, TCG_REG_RSI, data_reg);
-        break;
-    case 1:
-        /* movzwl */
-        tcg_out_modrm(s, 0xb7 | P_EXT, TCG_REG_RSI, data_reg);
-        break;
-    case 2:
-        /* movl */
-        tcg_out_modrm(s, 0x8b, TCG_REG_RSI, data_reg);
-        break;
-    default:
-    case 3:
-        tcg_out_mov(s, TCG_REG_RSI, data_reg);
-        break;
-    }
-    tcg_out_movi(s, TCG_TYPE_I32, TCG_REG_RDX, mem_index);
-    tcg_out8(s, 0xe8);
-    tcg_out32(s, (tcg_target_long)qemu_st_helpers[s_bits] - 
-              (tcg_target_long)s->code_ptr - 4);
-
-    /* jmp label2 */
-    tcg_out8(s, 0xeb);
-    label2_ptr = s->code_ptr;
-    s->code_ptr++;
-    
-    /* label1: */
-    *label1_ptr = s->code_ptr - label1_ptr - 1;
+    /* jne slow_path */
+    tcg_out8(s, 0x0f);
+    tcg_out8(s, 0x80 + JCC_JNE);
+    l = tcg_new_ldst_slow_path(s);
+    l->is_ld = 0;
+    l->opc = opc;
+    l->data_reg = data_reg;
+    l->mem_index = mem_index;
+    l->label_ptr[0] = s->code_ptr;
+    s->code_ptr += 4;
 
     /* add x(r1), r0 */
     tcg_out_modrm_offset(s, 0x03 | P_REXW, r0, r1, offsetof(CPUTLBEntry, addend) - 
@@ -816,11 +756,85 @@ static void tcg_out_qemu_st(TCGContext *s, const TCGArg *args,
     }
 
 #if defined(CONFIG_SOFTMMU)
-    /* label2: */
-    *label2_ptr = s->code_ptr - label2_ptr - 1;
+    l->raddr = s->code_ptr;
 #endif
 }
 
+#if defined(CONFIG_SOFTMMU)
+/* TLB miss path of a qemu_ld/st: the address is in RDI */
+static void tcg_out_ldst_slow_path(TCGContext *s, TCGLdstSlowPath *l)
+{
+    int opc, data_reg, s_bits;
+
+    opc = l->opc;
+    data_reg = l->data_reg;
+
+    /* label1: */
+    *(int32_t *)l->label_ptr[0] = s->code_ptr - l->label_ptr[0] - 4;
+
+    if (l->is_ld) {
+        s_bits = opc & 3;
+        tcg_out_movi(s, TCG_TYPE_I32, TCG_REG_RSI, l->mem_index);
+        tcg_out8(s, 0xe8);
+        tcg_out32(s, (tcg_target_long)qemu_ld_helpers[s_bits] - 
+                  (tcg_target_long)s->code_ptr - 4);
+
+        switch(opc) {
+        case 0 | 4:
+            /* movsbq */
+            tcg_out_modrm(s, 0xbe | P_EXT | P_REXW, data_reg, TCG_REG_RAX);
+            break;
+        case 1 | 4:
+            /* movswq */
+            tcg_out_modrm(s, 0xbf | P_EXT | P_REXW, data_reg, TCG_REG_RAX);
+            break;
+        case 2 | 4:
+            /* movslq */
+            tcg_out_modrm(s, 0x63 | P_REXW, data_reg, TCG_REG_RAX);
+            break;
+        case 0:
+        case 1:
+        case 2:
+        default:
+            /* movl */
+            tcg_out_modrm(s, 0x8b, data_reg, TCG_REG_RAX);
+            break;
+        case 3:
+            tcg_out_mov(s, data_reg, TCG_REG_RAX);
+            break;
+        }
+    } else {
+        s_bits = opc;
+        switch(opc) {
+        case 0:
+            /* movzbl */
+            tcg_out_modrm(s, 0xb6 | P_EXT | P_REXB, TCG_REG_RSI, data_reg);
+            break;
+        case 1:
+            /* movzwl */
+            tcg_out_modrm(s, 0xb7 | P_EXT, TCG_REG_RSI, data_reg);
+            break;
+        case 2:
+            /* movl */
+            tcg_out_modrm(s, 0x8b, TCG_REG_RSI, data_reg);
+            break;
+        default:
+        case 3:
+            tcg_out_mov(s, TCG_REG_RSI, data_reg);
+            break;
+        }
+        tcg_out_movi(s, TCG_TYPE_I32, TCG_REG_RDX, l->mem_index);
+        tcg_out8(s, 0xe8);
+        tcg_out32(s, (tcg_target_long)qemu_st_helpers[s_bits] - 
+                  (tcg_target_long)s->code_ptr - 4);
+    }
+
+    /* jmp label2 */
+    tcg_out8(s, 0xe9);
+    tcg_out32(s, l->raddr - s->code_ptr - 4);
+}
+#endif
+
 static inline void tcg_out_op(TCGContext *s, int opc, const TCGArg *args,
                               const int *const_args)
 {
@@ -1151,6 +1165,15 @@ static int tcg_target_callee_save_regs[] = {
     TCG_REG_R15,
 };
 
+/* callee saved registers that can hold pinned globals. r13 is AREG3,
+   which the ARM target doesn't bind to a variable; the prologue saves
+   all of them, so the C code that calls the TBs keeps its values */
+static const int tcg_target_pinned_regs[] = {
+    TCG_REG_RBX,
+    TCG_REG_RBP,
+    TCG_REG_R13,
+};
+
 static inline void tcg_out_push(TCGContext *s, int reg)
 {
     tcg_out_opc(s, (0x50 + (reg & 7)), 0, reg, 0);
@@ -1165,6 +1188,7 @@ static inline void tcg_out_pop(TCGContext *s, int reg)
 void tcg_target_qemu_prologue(TCGContext *s)
 {
     int i, frame_size, push_size, stack_addend;
+    TCGTemp *ts;
 
     /* TB prologue */
     /* save all callee saved registers */
@@ -1180,6 +1204,14 @@ void tcg_target_qemu_prologue(TCGContext *s)
     stack_addend = frame_size - push_size;
     tcg_out_addi(s, TCG_REG_RSP, -stack_addend);
 
+    /* load the pinned globals. They are saved by the TBs, so the
+       epilogue does not need to store them back */
+    for(i = 0; i < s->nb_globals; i++) {
+        ts = &s->temps[i];
+        if (ts->pinned)
+            tcg_out_ld(s, ts->type, ts->reg, ts->mem_reg, ts->mem_offset);
+    }
+
     tcg_out_modrm(s, 0xff, 4, TCG_REG_RDI); /* jmp *%rdi */
     
     /* TB epilogue */
@@ -66,6 +66,14 @@ enum {
 #define TCG_TARGET_HAS_ext16s_i64
 #define TCG_TARGET_HAS_ext32s_i64
 
+#if defined(CONFIG_SOFTMMU)
+/* the qemu_ld/st TLB miss code is emitted after the end of the TB */
+#define TCG_TARGET_HAS_LDST_SLOW_PATH
+#endif
+
+/* globals can be kept in callee saved registers across TBs */
+#define TCG_TARGET_HAS_PINNED_GLOBALS
+
 /* Note: must be synced with dyngen-exec.h */
 #define TCG_AREG0 TCG_REG_R14
 #define TCG_AREG1 TCG_REG_R15
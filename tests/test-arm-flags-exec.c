@@ -0,0 +1,27 @@
+/* Copyright (C) 2009 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+/* Runs a translated block for tests/test-arm-flags.c. Like cpu-exec.c,
+ * this file uses the host registers as global variables, so it can't
+ * include the standard headers and is kept apart from the test itself.
+ */
+#include "exec.h"
+#include "tcg.h"
+
+void test_exec_tb(CPUState *env1, TranslationBlock *tb)
+{
+    CPUState *saved_env = env;
+
+    env = env1;
+    tcg_qemu_tb_exec(tb->tc_ptr);
+    env = saved_env;
+}
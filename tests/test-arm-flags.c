@@ -0,0 +1,467 @@
+/* Copyright (C) 2009 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+/* Check of the inline NZCV computation of the ARM translator. Each
+ * iteration translates and runs a block made of one random flag-setting
+ * data processing instruction, with any register or immediate operand
+ * form, followed by one conditional ORR per condition code. The result,
+ * the final CPSR flags and the mask of the conditions that passed inside
+ * the block must match a C model of the ARM semantics.
+ *
+ * The translator, TCG and the helpers are linked in; the rest of the
+ * emulator is replaced by the stubs at the end of this file.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+#include "cpu.h"
+#include "exec-all.h"
+#include "tcg.h"
+#include "disas.h"
+#include "qemu-log.h"
+#ifdef CONFIG_TRACE
+#include "trace.h"
+#endif
+
+#define  ITERATIONS   100000
+#define  CODE_BASE    0x8000
+#define  NUM_CONDS    14          /* EQ to LE */
+
+void test_exec_tb(CPUState *env1, TranslationBlock *tb);
+
+uint8_t  code_gen_prologue[1024] __attribute__((aligned (32)));
+
+static uint8_t   code_buffer[64 * 1024] __attribute__((aligned (32)));
+static uint32_t  guest_code[1 + NUM_CONDS + 1];
+
+static uint32_t  rng_state = 0x6b43a9b5;
+
+static uint32_t rng(void)
+{
+    /* xorshift32 */
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+/* operands biased toward the values where carries and overflows happen */
+static uint32_t rng_operand(void)
+{
+    static const uint32_t  specials[] = {
+        0x00000000, 0x00000001, 0x7fffffff, 0x80000000, 0x80000001,
+        0xffffffff, 0xfffffffe, 0x40000000, 0xc0000000,
+    };
+    switch (rng() % 4) {
+    case 0:  return specials[rng() % ARRAY_SIZE(specials)];
+    case 1:  return rng() % 64;
+    default: return rng();
+    }
+}
+
+#ifdef _WIN32
+static void map_exec(void *addr, long size)
+{
+    DWORD old_protect;
+    VirtualProtect(addr, size, PAGE_EXECUTE_READWRITE, &old_protect);
+}
+#else
+static void map_exec(void *addr, long size)
+{
+    unsigned long start, end, page_size;
+
+    page_size = getpagesize();
+    start = (unsigned long)addr & ~(page_size - 1);
+    end   = ((unsigned long)addr + size + page_size - 1) & ~(page_size - 1);
+    mprotect((void *)start, end - start, PROT_READ | PROT_WRITE | PROT_EXEC);
+}
+#endif
+
+/* the ARM model */
+
+#define  F_N  8
+#define  F_Z  4
+#define  F_C  2
+#define  F_V  1
+
+static uint32_t ror32(uint32_t x, int n)
+{
+    n &= 31;
+    return n ? (x >> n) | (x << (32 - n)) : x;
+}
+
+/* shift by an immediate, returning the shifter carry in *c */
+static uint32_t shift_imm(uint32_t x, int type, int n, int *c)
+{
+    switch (type) {
+    case 0:  /* LSL */
+        if (n == 0)
+            return x;
+        *c = (x >> (32 - n)) & 1;
+        return x << n;
+    case 1:  /* LSR, 0 means 32 */
+        if (n == 0) {
+            *c = x >> 31;
+            return 0;
+        }
+        *c = (x >> (n - 1)) & 1;
+        return x >> n;
+    case 2:  /* ASR, 0 means 32 */
+        if (n == 0) {
+            *c = x >> 31;
+            return (int32_t)x < 0 ? 0xffffffff : 0;
+        }
+        *c = (x >> (n - 1)) & 1;
+        return (uint32_t)((int32_t)x >> n);
+    default: /* ROR, 0 means RRX */
+        if (n == 0) {
+            uint32_t  r = (x >> 1) | ((uint32_t)*c << 31);
+            *c = x & 1;
+            return r;
+        }
+        *c = (x >> (n - 1)) & 1;
+        return ror32(x, n);
+    }
+}
+
+/* shift by the bottom byte of a register */
+static uint32_t shift_reg(uint32_t x, int type, uint32_t s, int *c)
+{
+    s &= 0xff;
+    if (s == 0)
+        return x;
+    switch (type) {
+    case 0:  /* LSL */
+        if (s < 32) {
+            *c = (x >> (32 - s)) & 1;
+            return x << s;
+        }
+        *c = (s == 32) ? (x & 1) : 0;
+        return 0;
+    case 1:  /* LSR */
+        if (s < 32) {
+            *c = (x >> (s - 1)) & 1;
+            return x >> s;
+        }
+        *c = (s == 32) ? (x >> 31) : 0;
+        return 0;
+    case 2:  /* ASR */
+        if (s < 32) {
+            *c = (x >> (s - 1)) & 1;
+            return (uint32_t)((int32_t)x >> s);
+        }
+        *c = x >> 31;
+        return (int32_t)x < 0 ? 0xffffffff : 0;
+    default: /* ROR */
+        if ((s & 31) == 0) {
+            *c = x >> 31;
+            return x;
+        }
+        *c = (x >> ((s & 31) - 1)) & 1;
+        return ror32(x, s & 31);
+    }
+}
+
+static uint32_t add_with_carry(uint32_t x, uint32_t y, int carry, int *nzcv)
+{
+    uint64_t  sum = (uint64_t)x + y + carry;
+    uint32_t  r   = (uint32_t)sum;
+
+    *nzcv = ((r >> 31) ? F_N : 0) | (r ? 0 : F_Z) |
+            ((sum >> 32) ? F_C : 0) |
+            ((((x ^ r) & (y ^ r)) >> 31) ? F_V : 0);
+    return r;
+}
+
+static int cond_passed(int cond, int nzcv)
+{
+    int  n = !!(nzcv & F_N), z = !!(nzcv & F_Z);
+    int  c = !!(nzcv & F_C), v = !!(nzcv & F_V);
+
+    switch (cond) {
+    case 0:  return z;
+    case 1:  return !z;
+    case 2:  return c;
+    case 3:  return !c;
+    case 4:  return n;
+    case 5:  return !n;
+    case 6:  return v;
+    case 7:  return !v;
+    case 8:  return c && !z;
+    case 9:  return !c || z;
+    case 10: return n == v;
+    case 11: return n != v;
+    case 12: return !z && n == v;
+    default: return z || n != v;
+    }
+}
+
+/* executes 'op{S} rd, rn, <operand2>' on regs[], returns the new NZCV */
+static int model_dp(int op, uint32_t *regs, int rd, int rn,
+                    uint32_t op2, int shifter_c, int nzcv)
+{
+    uint32_t  a = regs[rn], r;
+    int       c = !!(nzcv & F_C);
+    int       flags;
+
+    switch (op) {
+    case 2:  case 10: r = add_with_carry(a, ~op2, 1, &flags); break;
+    case 3:           r = add_with_carry(op2, ~a, 1, &flags); break;
+    case 4:  case 11: r = add_with_carry(a, op2, 0, &flags); break;
+    case 5:           r = add_with_carry(a, op2, c, &flags); break;
+    case 6:           r = add_with_carry(a, ~op2, c, &flags); break;
+    case 7:           r = add_with_carry(op2, ~a, c, &flags); break;
+    default:
+        switch (op) {
+        case 0:  case 8: r = a & op2; break;
+        case 1:  case 9: r = a ^ op2; break;
+        case 12:         r = a | op2; break;
+        case 13:         r = op2; break;
+        case 14:         r = a & ~op2; break;
+        default:         r = ~op2; break;
+        }
+        flags = ((r >> 31) ? F_N : 0) | (r ? 0 : F_Z) |
+                (shifter_c ? F_C : 0) | (nzcv & F_V);
+    }
+    if (op < 8 || op > 11)
+        regs[rd] = r;
+    return flags;
+}
+
+static const char*  op_names[16] = {
+    "and", "eor", "sub", "rsb", "add", "adc", "sbc", "rsc",
+    "tst", "teq", "cmp", "cmn", "orr", "mov", "bic", "mvn"
+};
+
+int main(void)
+{
+    static const char  shift_names[4][4] = { "lsl", "lsr", "asr", "ror" };
+    CPUState*          cpu;
+    TranslationBlock   tb;
+    int                iter, failures = 0, code_size;
+
+    map_exec(code_gen_prologue, sizeof(code_gen_prologue));
+    map_exec(code_buffer, sizeof(code_buffer));
+    cpu_gen_init();
+
+    cpu = cpu_arm_init("cortex-a8");
+    if (cpu == NULL) {
+        fprintf(stderr, "could not create the CPU\n");
+        return 1;
+    }
+    cpu_single_env = cpu;
+
+    /* r4 |= 1 << cond, for each condition code */
+    for (iter = 0; iter < NUM_CONDS; iter++) {
+        uint32_t  imm = (iter < 8) ? (1 << iter)                 /* rot 0 */
+                                   : (0xc00 | (1 << (iter - 8))); /* ror 24 */
+        guest_code[1 + iter] = ((uint32_t)iter << 28) | 0x03844000 | imm;
+    }
+
+    for (iter = 0; iter < ITERATIONS; iter++) {
+        uint32_t  regs[16], expected[16], insn, op2;
+        int       op = rng() % 16;
+        int       rd = rng() % 3, form = rng() % 4;
+        int       shift_type = rng() % 4, shift = 0, rot = 0;
+        int       nzcv = rng() % 16, shifter_c, expected_nzcv, n, got_nzcv;
+
+        for (n = 0; n < 16; n++)
+            regs[n] = 0;
+        regs[1] = rng_operand();
+        regs[2] = (rng() % 8) ? rng_operand() : regs[1];
+        regs[3] = (rng() % 2) ? rng() % 40 : rng();
+
+        /* op{S} rd, r1, <operand2> */
+        insn = 0xe0100000 | (op << 21) | (1 << 16) | (rd << 12);
+        shifter_c = !!(nzcv & F_C);
+        switch (form) {
+        case 0:  /* immediate */
+            rot = (rng() % 3) ? rng() % 16 : 0;
+            insn |= (1 << 25) | (rot << 8) | (regs[2] & 0xff);
+            op2 = ror32(regs[2] & 0xff, rot * 2);
+            if (rot)
+                shifter_c = op2 >> 31;
+            break;
+        case 1:  /* register shifted by register r3 */
+            insn |= (3 << 8) | (shift_type << 5) | (1 << 4) | 2;
+            op2 = shift_reg(regs[2], shift_type, regs[3], &shifter_c);
+            break;
+        default: /* register shifted by an immediate */
+            shift = rng() % 32;
+            insn |= (shift << 7) | (shift_type << 5) | 2;
+            op2 = shift_imm(regs[2], shift_type, shift, &shifter_c);
+            break;
+        }
+        guest_code[0] = insn;
+
+        memcpy(expected, regs, sizeof(regs));
+        expected_nzcv = model_dp(op, expected, rd, 1, op2, shifter_c, nzcv);
+        for (n = 0; n < NUM_CONDS; n++)
+            if (cond_passed(n, expected_nzcv))
+                expected[4] |= 1 << n;
+        expected[15] = CODE_BASE + 4 * (1 + NUM_CONDS);
+
+        /* translate and run the block */
+        memcpy(cpu->regs, regs, sizeof(regs));
+        cpu->regs[15] = CODE_BASE;
+        cpsr_write(cpu, (uint32_t)nzcv << 28, CPSR_NZCV);
+
+        memset(&tb, 0, sizeof(tb));
+        tb.pc     = CODE_BASE;
+        tb.cflags = 1 + NUM_CONDS;
+        tb.tc_ptr = code_buffer;
+        cpu_gen_code(cpu, &tb, &code_size);
+        test_exec_tb(cpu, &tb);
+
+        got_nzcv = cpsr_read(cpu) >> 28;
+        if (memcmp(cpu->regs, expected, sizeof(expected)) != 0 ||
+            got_nzcv != expected_nzcv) {
+            if (failures++ < 20) {
+                fprintf(stderr, "%ss r%d, r1, ", op_names[op], rd);
+                if (form == 0)
+                    fprintf(stderr, "#0x%x", op2);
+                else if (form == 1)
+                    fprintf(stderr, "r2, %s r3", shift_names[shift_type]);
+                else
+                    fprintf(stderr, "r2, %s #%d", shift_names[shift_type], shift);
+                fprintf(stderr, " with r1=%08x r2=%08x r3=%08x nzcv=%x:\n"
+                        "  r%d=%08x nzcv=%x conds=%04x, expected r%d=%08x "
+                        "nzcv=%x conds=%04x\n",
+                        regs[1], regs[2], regs[3], nzcv,
+                        rd, cpu->regs[rd], got_nzcv, cpu->regs[4],
+                        rd, expected[rd], expected_nzcv, expected[4]);
+            }
+        }
+    }
+
+    printf("%s\n", failures ? "FAILED" : "PASSED");
+    return failures != 0;
+}
+
+/* the parts of the emulator the translator and the helpers refer to.
+ * nothing beyond the TLB flush and the code fetch is used by the blocks
+ * generated above. */
+
+CPUState*  cpu_single_env;
+FILE*      logfile;
+int        loglevel;
+int        use_icount;
+int        semihosting_enabled;
+
+CPUWriteMemoryFunc*  io_mem_write[IO_MEM_NB_ENTRIES][4];
+CPUReadMemoryFunc*   io_mem_read[IO_MEM_NB_ENTRIES][4];
+void*                io_mem_opaque[IO_MEM_NB_ENTRIES];
+
+uint32_t REGPARM __ldl_cmmu(target_ulong addr, int mmu_idx)
+{
+    return guest_code[((addr - CODE_BASE) / 4) % ARRAY_SIZE(guest_code)];
+}
+
+uint16_t REGPARM __ldw_cmmu(target_ulong addr, int mmu_idx)
+{
+    uint32_t  insn = __ldl_cmmu(addr & ~3, mmu_idx);
+    return (addr & 2) ? insn >> 16 : insn;
+}
+
+void cpu_exec_init(CPUState *env)
+{
+}
+
+void tlb_flush_cause(CPUState *env, int flush_global, int cause)
+{
+    memset(env->tlb_table, -1, sizeof(env->tlb_table));
+    memset(env->tlb_v_table, -1, sizeof(env->tlb_v_table));
+}
+
+void tlb_flush(CPUState *env, int flush_global)
+{
+    tlb_flush_cause(env, flush_global, 0);
+}
+
+void tb_add_successor(target_ulong pc)
+{
+}
+
+void cpu_abort(CPUState *env, const char *fmt, ...)
+{
+    va_list  args;
+
+    va_start(args, fmt);
+    fprintf(stderr, "cpu_abort: ");
+    vfprintf(stderr, fmt, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+    abort();
+}
+
+void *qemu_malloc(size_t size)
+{
+    return malloc(size);
+}
+
+void *qemu_mallocz(size_t size)
+{
+    return calloc(1, size);
+}
+
+void pstrcpy(char *buf, int buf_size, const char *str)
+{
+    if (buf_size <= 0)
+        return;
+    strncpy(buf, str, buf_size - 1);
+    buf[buf_size - 1] = 0;
+}
+
+#define  UNUSED(decl)  decl { abort(); }
+
+UNUSED(void cpu_loop_exit(void))
+UNUSED(void cpu_interrupt(CPUState *s, int mask))
+UNUSED(void cpu_io_recompile(CPUState *env, void *retaddr))
+UNUSED(int tlb_set_page_exec(CPUState *env, target_ulong vaddr,
+                             target_phys_addr_t paddr, int prot,
+                             int mmu_idx, int is_softmmu))
+UNUSED(int tlb_victim_lookup(CPUState *env, int mmu_idx, int index,
+                             size_t elt_ofs, target_ulong page))
+UNUSED(void tb_flush(CPUState *env))
+UNUSED(TranslationBlock *tb_find_pc(unsigned long pc_ptr))
+UNUSED(uint32_t ldl_phys(target_phys_addr_t addr))
+UNUSED(void stl_phys(target_phys_addr_t addr, uint32_t val))
+UNUSED(void disas(FILE *out, void *code, unsigned long size))
+UNUSED(void target_disas(FILE *out, target_ulong code, target_ulong size,
+                         int flags))
+UNUSED(const char *lookup_symbol(target_ulong orig_addr))
+UNUSED(uint32_t do_arm_semihosting(CPUARMState *env))
+UNUSED(void armv7m_nvic_set_pending(void *opaque, int irq))
+UNUSED(int armv7m_nvic_acknowledge_irq(void *opaque))
+UNUSED(void armv7m_nvic_complete_irq(void *opaque, int irq))
+
+#ifdef CONFIG_TRACE
+int          tracing;
+TraceStatic  trace_static;
+uint64_t     sim_time;
+
+UNUSED(int get_insn_ticks_arm(uint32_t insn))
+UNUSED(int get_insn_ticks_thumb(uint32_t insn))
+UNUSED(void trace_add_insn(uint32_t insn, int is_thumb))
+UNUSED(void trace_bb_start(uint32_t bb_addr))
+UNUSED(void trace_bb_end())
+UNUSED(void trace_bb_helper(uint64_t bb_num, TranslationBlock *tb))
+UNUSED(void trace_insn_helper())
+UNUSED(void trace_exception(uint32 pc))
+#endif
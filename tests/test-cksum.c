@@ -0,0 +1,140 @@
+/* Copyright (C) 2009 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+/* Check of the slirp checksum routines (slirp2/cksum.c). cksum() is
+ * compared with a plain 16-bit one's complement sum for every length up
+ * to a few MTUs, at every alignment, and cksum_adjust() with a full
+ * recomputation after a word of the data changed.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "slirp.h"
+
+#define  MAX_LEN     (3*1500)
+#define  BIG_LEN     65535
+#define  ADJUSTS     200000
+
+/* normally in slirp2/debug.c, used by the DEBUG_XXX() macros */
+FILE*  dfd = NULL;
+int    slirp_debug = 0;
+
+static uint32_t  rng_state = 0x2545f491;
+
+static uint32_t rng(void)
+{
+    /* xorshift32 */
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+/* the reference: 16-bit words in memory order, the odd byte padded with
+ * a zero byte, and the carries folded after each addition */
+static int ref_cksum(const uint8_t *p, int len)
+{
+    uint32_t  sum = 0;
+    uint16_t  w;
+
+    for ( ; len >= 2; p += 2, len -= 2) {
+        memcpy(&w, p, 2);
+        sum += w;
+        sum  = (sum & 0xffff) + (sum >> 16);
+    }
+    if (len) {
+        uint8_t  last[2];
+
+        last[0] = p[0];
+        last[1] = 0;
+        memcpy(&w, last, 2);
+        sum += w;
+        sum  = (sum & 0xffff) + (sum >> 16);
+    }
+    return ~sum & 0xffff;
+}
+
+static int mbuf_cksum(uint8_t *p, int len)
+{
+    MBufRec  m;
+
+    memset(&m, 0, sizeof(m));
+    m.m_data = (caddr_t)p;
+    m.m_len  = len;
+    return cksum(&m, len);
+}
+
+int main(void)
+{
+    static uint8_t  buf[BIG_LEN + 8];
+    int             len, offset, n, failures = 0;
+
+    for (n = 0; n < (int)sizeof(buf); n++)
+        buf[n] = rng();
+
+    /* every length and alignment, on random data */
+    for (len = 0; len <= MAX_LEN; len++) {
+        for (offset = 0; offset < 8; offset++) {
+            int  expected = len ? ref_cksum(buf + offset, len) : 0xffff;
+            int  got      = mbuf_cksum(buf + offset, len);
+
+            if (got != expected && failures++ < 10)
+                fprintf(stderr, "cksum(len=%d, offset=%d) = 0x%04x, "
+                        "expected 0x%04x\n", len, offset, got, expected);
+        }
+    }
+
+    /* all ones makes the most carries, all zeroes none */
+    for (n = 0; n < 2; n++) {
+        memset(buf, n ? 0xff : 0, sizeof(buf));
+        for (len = BIG_LEN - 16; len <= BIG_LEN; len++) {
+            int  expected = ref_cksum(buf + 1, len);
+            int  got      = mbuf_cksum(buf + 1, len);
+
+            if (got != expected && failures++ < 10)
+                fprintf(stderr, "cksum(len=%d, fill=0x%02x) = 0x%04x, "
+                        "expected 0x%04x\n", len, n ? 0xff : 0,
+                        got, expected);
+        }
+    }
+
+    /* change one 16-bit word at an even offset, like icmp_input() does
+     * when it turns an echo request into a reply */
+    for (n = 0; n < ADJUSTS; n++) {
+        int       i, sum, adjusted, expected;
+        uint16_t  old_w, new_w;
+
+        len = 8 + rng() % 1500;
+        for (i = 0; i < len; i++)
+            buf[i] = (rng() & 3) ? rng() : ((rng() & 1) ? 0xff : 0);
+
+        i = (rng() % (len / 2)) * 2;
+        sum = mbuf_cksum(buf, len);
+        memcpy(&old_w, buf + i, 2);
+        switch (rng() & 3) {
+        case 0:  new_w = 0; break;
+        case 1:  new_w = 0xffff; break;
+        default: new_w = rng();
+        }
+        memcpy(buf + i, &new_w, 2);
+
+        adjusted = cksum_adjust(sum, old_w, new_w);
+        expected = mbuf_cksum(buf, len);
+        if (adjusted != expected && failures++ < 10)
+            fprintf(stderr, "cksum_adjust(0x%04x, 0x%04x, 0x%04x) = 0x%04x, "
+                    "expected 0x%04x\n", sum, old_w, new_w,
+                    adjusted, expected);
+    }
+
+    printf("%s\n", failures ? "FAILED" : "PASSED");
+    return failures != 0;
+}
@@ -0,0 +1,172 @@
+/* Copyright (C) 2009 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+/* Differential check of the whole register NEON helpers. The helpers
+ * linked from target-arm/neon_helper.c use SSE2 when the host has it;
+ * this file includes neon_helper.c again with NEON_VEC_PORTABLE, which
+ * builds the portable per-pass version under the ref_helper_ prefix.
+ * Both run on the same random register files, and the resulting
+ * registers and FPSCR (for the QC bit) must be identical.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define  NEON_VEC_PORTABLE
+#define  HELPER(x)  glue(ref_helper_,x)
+#include "neon_helper.c"
+
+#define  ITERATIONS  30000
+
+typedef void (*NeonVecFunc)(CPUState *env, uint32_t desc);
+
+typedef struct {
+    const char*  name;
+    NeonVecFunc  fast;
+    NeonVecFunc  ref;
+} NeonVecOp;
+
+#define  OP(name)  { #name, helper_neon_v##name, ref_helper_neon_v##name }
+
+static const NeonVecOp  ops[] = {
+    OP(add_u8), OP(add_u16), OP(add_u32),
+    OP(sub_u8), OP(sub_u16), OP(sub_u32),
+    OP(mul_u8), OP(mul_u16), OP(mul_u32),
+    OP(ceq_u8), OP(ceq_u16), OP(ceq_u32),
+    OP(tst_u8), OP(tst_u16), OP(tst_u32),
+    OP(qadd_s8), OP(qadd_u8), OP(qadd_s16), OP(qadd_u16),
+    OP(qsub_s8), OP(qsub_u8), OP(qsub_s16), OP(qsub_u16),
+    OP(hadd_s8), OP(hadd_u8), OP(hadd_s16), OP(hadd_u16),
+    OP(rhadd_s8), OP(rhadd_u8), OP(rhadd_s16), OP(rhadd_u16),
+    OP(cgt_s8), OP(cgt_u8), OP(cgt_s16), OP(cgt_u16), OP(cgt_s32), OP(cgt_u32),
+    OP(cge_s8), OP(cge_u8), OP(cge_s16), OP(cge_u16), OP(cge_s32), OP(cge_u32),
+    OP(min_s8), OP(min_u8), OP(min_s16), OP(min_u16), OP(min_s32), OP(min_u32),
+    OP(max_s8), OP(max_u8), OP(max_s16), OP(max_u16), OP(max_s32), OP(max_u32),
+    OP(abd_s8), OP(abd_u8), OP(abd_s16), OP(abd_u16), OP(abd_s32), OP(abd_u32),
+};
+
+static uint32_t  rng_state = 0x9e3779b9;
+
+static uint32_t rng(void)
+{
+    /* xorshift32 */
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+/* random words, biased toward the lane values where saturation,
+ * rounding and signedness matter */
+static uint32_t rng_word(void)
+{
+    static const uint8_t   bytes[] = { 0x00, 0x01, 0x7f, 0x80, 0x81, 0xff };
+    static const uint16_t  halves[] = { 0x0000, 0x0001, 0x7fff, 0x8000,
+                                        0x8001, 0xffff };
+    static const uint32_t  words[] = { 0x00000000, 0x00000001, 0x7fffffff,
+                                       0x80000000, 0x80000001, 0xffffffff };
+    uint32_t  w = 0;
+    int       n;
+
+    switch (rng() & 3) {
+    case 0:
+        for (n = 0; n < 4; n++)
+            w = (w << 8) | ((rng() & 1) ? bytes[rng() % ARRAY_SIZE(bytes)]
+                                        : (rng() & 0xff));
+        return w;
+    case 1:
+        for (n = 0; n < 2; n++)
+            w = (w << 16) | ((rng() & 1) ? halves[rng() % ARRAY_SIZE(halves)]
+                                         : (rng() & 0xffff));
+        return w;
+    case 2:
+        return words[rng() % ARRAY_SIZE(words)];
+    default:
+        return rng();
+    }
+}
+
+/* D register number for a D (q=0) or Q (q=1) operand */
+static int rng_reg(int q)
+{
+    return q ? (rng() % 16) * 2 : rng() % 32;
+}
+
+int main(void)
+{
+    CPUState*  env  = calloc(1, sizeof(*env));
+    CPUState*  env2 = calloc(1, sizeof(*env2));
+    unsigned   nn;
+    int        iter, failures = 0;
+
+#if defined(__SSE2__) && !defined(WORDS_BIGENDIAN)
+    printf("checking the SSE2 helpers against the portable ones\n");
+#else
+    printf("no SSE2: checking the portable helpers against themselves\n");
+#endif
+
+    for (nn = 0; nn < ARRAY_SIZE(ops); nn++) {
+        const NeonVecOp*  op = &ops[nn];
+
+        for (iter = 0; iter < ITERATIONS; iter++) {
+            uint32_t  desc, w;
+            int       q, rd, rn, rm, n;
+
+            for (n = 0; n < 32; n++) {
+                CPU_DoubleU  u;
+
+                u.l.upper = rng_word();
+                u.l.lower = rng_word();
+                env->vfp.regs[n] = u.d;
+            }
+            q  = rng() & 1;
+            rd = rng_reg(q);
+            rn = rng_reg(q);
+            rm = (rng() % 8) ? rng_reg(q) : rn;
+            /* equal lanes, for the comparisons and the saturation edges */
+            if (rm != rn && (rng() % 8) == 0) {
+                for (n = 0; n < (q ? 4 : 2); n++) {
+                    if (rng() & 1)
+                        continue;
+                    w = neon_vec_get(env, rn, n);
+                    neon_vec_set(env, rm, n, w);
+                }
+            }
+            desc = rd | (rn << 8) | (rm << 16) | (q << 24);
+            env->vfp.xregs[ARM_VFP_FPSCR] = 0;
+            env2->vfp = env->vfp;
+
+            op->fast(env, desc);
+            op->ref(env2, desc);
+
+            if (memcmp(env->vfp.regs, env2->vfp.regs, sizeof(env->vfp.regs)) ||
+                env->vfp.xregs[ARM_VFP_FPSCR] != env2->vfp.xregs[ARM_VFP_FPSCR]) {
+                if (failures++ < 20) {
+                    fprintf(stderr, "neon_v%s %c%d, %c%d, %c%d differs:",
+                            op->name, q ? 'q' : 'd', q ? rd/2 : rd,
+                            q ? 'q' : 'd', q ? rn/2 : rn,
+                            q ? 'q' : 'd', q ? rm/2 : rm);
+                    for (n = 0; n < (q ? 4 : 2); n++)
+                        fprintf(stderr, " %08x/%08x",
+                                neon_vec_get(env, rd, n),
+                                neon_vec_get(env2, rd, n));
+                    fprintf(stderr, " fpscr %08x/%08x\n",
+                            env->vfp.xregs[ARM_VFP_FPSCR],
+                            env2->vfp.xregs[ARM_VFP_FPSCR]);
+                }
+            }
+        }
+    }
+
+    printf("%s\n", failures ? "FAILED" : "PASSED");
+    return failures != 0;
+}
@@ -0,0 +1,385 @@
+/* Copyright (C) 2009 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+/* Check of the network shaper and delayer (shaper.c) against a fake
+ * real-time clock. The shaper must release packets exactly at the
+ * configured rate and in order, several shapers must share the single
+ * QEMU timer, and the delayer must hold each new connection's SYN for
+ * the configured latency.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "qemu-common.h"
+#include "qemu-timer.h"
+#include "shaper.h"
+
+#define  MAX_SENT   4096
+
+/* the fake clock and timer: shaper.c only ever creates one timer */
+struct QEMUTimer {
+    QEMUTimerCB*  cb;
+    void*         opaque;
+    int64_t       expire;
+    int           armed;
+};
+
+static struct QEMUTimer  fake_timer;
+static int               fake_timers_created;
+static int64_t           fake_now;
+static QEMUClock*        fake_clock = (QEMUClock*)&fake_now;
+
+QEMUClock*  rt_clock;
+
+int64_t qemu_get_clock(QEMUClock *clock)
+{
+    return fake_now;
+}
+
+QEMUTimer *qemu_new_timer(QEMUClock *clock, QEMUTimerCB *cb, void *opaque)
+{
+    fake_timers_created += 1;
+    fake_timer.cb     = cb;
+    fake_timer.opaque = opaque;
+    fake_timer.armed  = 0;
+    return &fake_timer;
+}
+
+void qemu_del_timer(QEMUTimer *ts)
+{
+    ts->armed = 0;
+}
+
+void qemu_mod_timer(QEMUTimer *ts, int64_t expire_time)
+{
+    ts->expire = expire_time;
+    ts->armed  = 1;
+}
+
+void *qemu_malloc(size_t size)
+{
+    return malloc(size);
+}
+
+void *qemu_mallocz(size_t size)
+{
+    return calloc(1, size);
+}
+
+void qemu_free(void *ptr)
+{
+    free(ptr);
+}
+
+/* advance the clock one millisecond at a time, like the main loop does */
+static void
+run_until( int64_t  t )
+{
+    for ( ; fake_now <= t; fake_now++ ) {
+        if (fake_timer.armed && fake_timer.expire <= fake_now) {
+            fake_timer.armed = 0;
+            fake_timer.cb(fake_timer.opaque);
+        }
+    }
+    fake_now = t;
+}
+
+/* what the send functions saw */
+typedef struct {
+    int64_t   time;
+    int       id;
+    int       size;
+    void*     opaque;
+} Sent;
+
+static Sent  sent[MAX_SENT];
+static int   num_sent;
+static int   failures;
+
+#define  CHECK(cond, ...) \
+    do { \
+        if (!(cond) && failures++ < 20) { \
+            fprintf(stderr, "%s:%d: ", __FUNCTION__, __LINE__); \
+            fprintf(stderr, __VA_ARGS__); \
+            fprintf(stderr, "\n"); \
+        } \
+    } while (0)
+
+static void
+record_send( void*  data, size_t  size, void*  opaque )
+{
+    const uint8_t*  p = data;
+
+    if (num_sent < MAX_SENT) {
+        sent[num_sent].time   = fake_now;
+        sent[num_sent].id     = (p[58] << 8) | p[59];
+        sent[num_sent].size   = (int)size;
+        sent[num_sent].opaque = opaque;
+    }
+    num_sent++;
+}
+
+static void
+reset_sent( void )
+{
+    num_sent = 0;
+}
+
+/* build an Ethernet + IPv4 + TCP frame from 192.168.0.1:port to
+ * 74.125.0.1:80, carrying 'id' as the first two payload bytes */
+static void
+make_packet( uint8_t*  p, size_t  size, int  port, int  tcp_flags, int  id )
+{
+    memset(p, 0, size);
+    p[12] = 0x08; p[13] = 0x00;
+    p += 14;
+    p[0]  = 0x45;
+    p[8]  = 64;
+    p[9]  = 6;
+    p[12] = 192; p[13] = 168; p[14] = 0; p[15] = 1;
+    p[16] = 74;  p[17] = 125; p[18] = 0; p[19] = 1;
+    p += 20;
+    p[0]  = (uint8_t)(port >> 8); p[1] = (uint8_t)port;
+    p[2]  = 0; p[3] = 80;
+    p[12] = 0x50;
+    p[13] = (uint8_t)tcp_flags;
+    p += 20;
+    p[4] = (uint8_t)(id >> 8); p[5] = (uint8_t)id;
+}
+
+#define  TCP_FIN   0x01
+#define  TCP_SYN   0x02
+#define  TCP_RST   0x04
+#define  TCP_ACK   0x10
+
+/* a saturated link must release packet k at k*size*8/rate exactly,
+ * in order, and the copied data must survive the caller's buffer */
+static void
+test_rate( int  size, double  rate, int  count )
+{
+    NetShaper  shaper = netshaper_create(1, record_send);
+    uint8_t    packet[1536];
+    int64_t    start = fake_now;
+    double     cost  = size * 8000. / rate;
+    int        n;
+
+    netshaper_set_rate(shaper, rate);
+    reset_sent();
+
+    for (n = 0; n < count; n++) {
+        make_packet(packet, size, 1000, TCP_ACK, n);
+        netshaper_send(shaper, packet, size);
+        memset(packet, 0xaa, size);
+    }
+    CHECK(!netshaper_can_send(shaper), "can_send with %d queued packets", count - 1);
+
+    run_until(start + (int64_t)(count * cost) + 2);
+
+    CHECK(num_sent == count, "size %d: %d packets sent, expected %d",
+          size, num_sent, count);
+    for (n = 0; n < num_sent && n < count; n++) {
+        int64_t  expected = start + (int64_t)(n * cost);
+
+        CHECK(sent[n].id == n, "size %d: packet %d sent as #%d",
+              size, sent[n].id, n);
+        CHECK(sent[n].time >= expected - 1 && sent[n].time <= expected + 1,
+              "size %d: packet %d sent at %lld, expected %lld",
+              size, n, (long long)(sent[n].time - start),
+              (long long)(expected - start));
+    }
+    CHECK(!fake_timer.armed, "timer still armed after the queue drained");
+
+    netshaper_destroy(shaper);
+}
+
+/* packets offered at a fixed interval: below the rate they go through
+ * at once, above it the output is paced at the rate and never bursts
+ * after the queue drains */
+static void
+test_offered_load( int  interval, int  count )
+{
+    NetShaper  shaper = netshaper_create(1, record_send);
+    uint8_t    packet[1500];
+    int64_t    start, last = -1;
+    int        n;
+
+    netshaper_set_rate(shaper, 1e6);  /* 12ms per 1500 bytes */
+    reset_sent();
+    start = fake_now;
+
+    for (n = 0; n < count; n++) {
+        run_until(start + (int64_t)n * interval);
+        make_packet(packet, sizeof(packet), 1000, TCP_ACK, n);
+        netshaper_send(shaper, packet, sizeof(packet));
+    }
+    run_until(fake_now + (int64_t)count * 12 + 2);
+
+    CHECK(num_sent == count, "interval %d: %d packets sent, expected %d",
+          interval, num_sent, count);
+    for (n = 0; n < num_sent && n < count; n++) {
+        int64_t  expected = start + (int64_t)n * (interval > 12 ? interval : 12);
+
+        CHECK(sent[n].id == n, "interval %d: packet %d sent as #%d",
+              interval, sent[n].id, n);
+        CHECK(sent[n].time == expected,
+              "interval %d: packet %d sent at %lld, expected %lld",
+              interval, n, (long long)(sent[n].time - start),
+              (long long)(expected - start));
+        CHECK(last < 0 || sent[n].time - last >= 12,
+              "interval %d: packet %d sent %lldms after the previous one",
+              interval, n, (long long)(sent[n].time - last));
+        last = sent[n].time;
+    }
+    netshaper_destroy(shaper);
+}
+
+/* two saturated shapers at different rates share the same timer */
+static void
+test_two_shapers( void )
+{
+    NetShaper  a = netshaper_create(1, record_send);
+    NetShaper  b = netshaper_create(1, record_send);
+    uint8_t    packet[1500];
+    int64_t    start = fake_now;
+    int        n, na = 0, nb = 0;
+
+    netshaper_set_rate(a, 1e6);   /* 12ms per packet */
+    netshaper_set_rate(b, 4e6);   /* 3ms per packet */
+    reset_sent();
+
+    for (n = 0; n < 100; n++) {
+        make_packet(packet, sizeof(packet), 1000, TCP_ACK, n);
+        netshaper_send_aux(a, packet, sizeof(packet), a);
+        make_packet(packet, sizeof(packet), 2000, TCP_ACK, n);
+        netshaper_send_aux(b, packet, sizeof(packet), b);
+    }
+    run_until(start + 100*12 + 2);
+
+    CHECK(fake_timers_created == 1, "%d QEMU timers created", fake_timers_created);
+    CHECK(num_sent == 200, "%d packets sent, expected 200", num_sent);
+    for (n = 0; n < num_sent && n < 200; n++) {
+        if (sent[n].opaque == a) {
+            CHECK(sent[n].id == na && sent[n].time == start + na*12,
+                  "shaper a: packet %d sent as #%d at %lld",
+                  sent[n].id, na, (long long)(sent[n].time - start));
+            na++;
+        } else {
+            CHECK(sent[n].id == nb && sent[n].time == start + nb*3,
+                  "shaper b: packet %d sent as #%d at %lld",
+                  sent[n].id, nb, (long long)(sent[n].time - start));
+            nb++;
+        }
+    }
+    netshaper_destroy(a);
+    netshaper_destroy(b);
+    CHECK(!fake_timer.armed, "timer still armed after destroying the shapers");
+}
+
+static int
+find_sent( int  id )
+{
+    int  n;
+
+    for (n = 0; n < num_sent && n < MAX_SENT; n++)
+        if (sent[n].id == id)
+            return n;
+    return -1;
+}
+
+/* new connections are held for the latency, everything else goes
+ * through at once */
+static void
+test_delay( void )
+{
+    NetDelay  delay = netdelay_create(record_send);
+    uint8_t   packet[64];
+    int64_t   start = fake_now;
+    int       n, k;
+
+    netdelay_set_latency(delay, 100, 100);
+    reset_sent();
+
+    /* 50 connections opened 1ms apart */
+    for (n = 0; n < 50; n++) {
+        run_until(start + n);
+        make_packet(packet, sizeof(packet), 1000 + n, TCP_SYN, n);
+        netdelay_send(delay, packet, sizeof(packet));
+        memset(packet, 0xaa, sizeof(packet));
+    }
+    CHECK(num_sent == 0, "%d packets sent before the latency", num_sent);
+
+    /* a re-sent SYN is swallowed, a reset drops the pending SYN, both
+     * pass through, and data on the same connection isn't delayed */
+    make_packet(packet, sizeof(packet), 1000, TCP_SYN, 1000);
+    netdelay_send(delay, packet, sizeof(packet));
+    make_packet(packet, sizeof(packet), 1003, TCP_RST, 1003);
+    netdelay_send(delay, packet, sizeof(packet));
+    make_packet(packet, sizeof(packet), 1004, TCP_ACK, 1004);
+    netdelay_send(delay, packet, sizeof(packet));
+
+    CHECK(num_sent == 2 && find_sent(1003) == 0 && find_sent(1004) == 1,
+          "%d packets sent at once, expected the reset and the ack", num_sent);
+    CHECK(find_sent(1000) < 0, "re-sent SYN went through");
+
+    run_until(start + 49 + 100);
+    CHECK(num_sent == 2 + 49, "%d packets sent, expected 51", num_sent);
+    for (n = 0; n < 50; n++) {
+        k = find_sent(n);
+        if (n == 3) {
+            CHECK(k < 0, "SYN of a reset connection went through");
+            continue;
+        }
+        CHECK(k >= 0 && sent[k].time == start + n + 100,
+              "SYN %d sent at %lld, expected %d", n,
+              k >= 0 ? (long long)(sent[k].time - start) : -1LL, n + 100);
+    }
+    CHECK(!fake_timer.armed, "timer still armed after the last SYN");
+
+    /* after a FIN, a new SYN is delayed again */
+    reset_sent();
+    start = fake_now;
+    make_packet(packet, sizeof(packet), 1005, TCP_FIN|TCP_ACK, 2000);
+    netdelay_send(delay, packet, sizeof(packet));
+    make_packet(packet, sizeof(packet), 1005, TCP_SYN, 2001);
+    netdelay_send(delay, packet, sizeof(packet));
+    run_until(start + 99);
+    CHECK(num_sent == 1, "%d packets sent, expected the FIN only", num_sent);
+    run_until(start + 100);
+    CHECK(num_sent == 2 && sent[1].id == 2001 && sent[1].time == start + 100,
+          "SYN after FIN not delayed by 100ms");
+
+    /* destroying the delayer cancels its pending SYNs */
+    reset_sent();
+    make_packet(packet, sizeof(packet), 3000, TCP_SYN, 3000);
+    netdelay_send(delay, packet, sizeof(packet));
+    netdelay_destroy(delay);
+    CHECK(!fake_timer.armed, "timer still armed after destroying the delayer");
+    run_until(fake_now + 200);
+    CHECK(num_sent == 0, "%d packets sent after destroying the delayer", num_sent);
+}
+
+int main(void)
+{
+    rt_clock = fake_clock;
+    fake_now = 1000;
+
+    test_rate(1500, 1e6, 1000);   /* 12ms per packet */
+    test_rate(64, 1e6, 1000);     /* 0.512ms per packet */
+    test_rate(60, 14400, 50);     /* the 'gsm' speed */
+    test_offered_load(20, 200);
+    test_offered_load(5, 200);
+    test_two_shapers();
+    test_delay();
+
+    printf("%s\n", failures ? "FAILED" : "PASSED");
+    return failures != 0;
+}
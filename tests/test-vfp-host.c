@@ -0,0 +1,294 @@
+/* Copyright (C) 2009 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+/* Differential check of the host VFP fast path (target-arm/vfp_host.h)
+ * against softfloat. Each operation is done the way the VFP helpers do
+ * it, trying the host first and falling back to softfloat, and the
+ * result and the accumulated exception flags must be identical to a
+ * softfloat-only run.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "softfloat.h"
+#include "vfp_host.h"
+
+#define  ITERATIONS  200000
+
+static uint32_t  rng_state = 0x12345678;
+
+static uint32_t rng(void)
+{
+    /* xorshift32 */
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static const uint32_t  special_s[] = {
+    0x00000000, 0x80000000, 0x3f800000, 0xbf800000, 0x3f000000,
+    0x7f800000, 0xff800000, 0x7fc00000, 0x7f800001, 0xffc00001,
+    0x00000001, 0x807fffff, 0x00800000, 0x7f7fffff, 0xff7fffff,
+    0x4f000000, 0xcf000000, 0x4f800000, 0x4effffff, 0x3effffff,
+    0x3fc00000, 0x40200000, 0xbfc00000,
+};
+
+static const uint64_t  special_d[] = {
+    0x0000000000000000ULL, 0x8000000000000000ULL, 0x3ff0000000000000ULL,
+    0xbff0000000000000ULL, 0x3fe0000000000000ULL, 0x7ff0000000000000ULL,
+    0xfff0000000000000ULL, 0x7ff8000000000000ULL, 0x7ff0000000000001ULL,
+    0x0000000000000001ULL, 0x800fffffffffffffULL, 0x0010000000000000ULL,
+    0x7fefffffffffffffULL, 0x41e0000000000000ULL, 0xc1e0000000000000ULL,
+    0x41dfffffffffffffULL, 0x41efffffffffffffULL, 0x36a0000000000000ULL,
+    0x3810000000000000ULL, 0x47efffffe0000000ULL, 0x47efffff00000000ULL,
+    0x3ff8000000000000ULL, 0xbff8000000000000ULL,
+};
+
+#define  ARRAY_SIZE(x)  (sizeof(x)/sizeof((x)[0]))
+
+/* mostly ordinary values, with a good share of special ones and of
+ * values around the single precision and int32 ranges */
+static float32 gen_s(void)
+{
+    uint32_t  r = rng();
+
+    switch (r & 7) {
+    case 0:
+        return make_float32(special_s[(r >> 8) % ARRAY_SIZE(special_s)]);
+    case 1:
+        /* small exponent range, so that results round to integers */
+        return make_float32((rng() & 0x807fffff) | ((0x7f + (r >> 8) % 34) << 23));
+    case 2:
+        /* denormals */
+        return make_float32(rng() & 0x807fffff);
+    default:
+        return make_float32(rng());
+    }
+}
+
+static float64 gen_d(void)
+{
+    uint32_t  r = rng();
+    uint64_t  v = ((uint64_t)rng() << 32) | rng();
+
+    switch (r & 7) {
+    case 0:
+        return make_float64(special_d[(r >> 8) % ARRAY_SIZE(special_d)]);
+    case 1:
+        v &= 0x800fffffffffffffULL;
+        return make_float64(v | ((uint64_t)(0x3ff + (r >> 8) % 34) << 52));
+    case 2:
+        /* around the single precision range and its denormals */
+        v &= 0x800fffffffffffffULL;
+        return make_float64(v | ((uint64_t)(0x360 + (r >> 8) % 0x120) << 52));
+    case 3:
+        return make_float64(v & 0x800fffffffffffffULL);
+    default:
+        return make_float64(v);
+    }
+}
+
+static uint32_t gen_i(void)
+{
+    uint32_t  r = rng();
+
+    switch (r & 3) {
+    case 0:
+        return rng() >> (r >> 8) % 32;
+    case 1:
+        return 0x80000000 + (int)((r >> 8) % 256) - 128;
+    default:
+        return rng();
+    }
+}
+
+enum {
+    OP_ADD_S, OP_SUB_S, OP_MUL_S, OP_DIV_S, OP_SQRT_S,
+    OP_ADD_D, OP_SUB_D, OP_MUL_D, OP_DIV_D, OP_SQRT_D,
+    OP_FCVTD, OP_FCVTS,
+    OP_UITO_S, OP_SITO_S, OP_UITO_D, OP_SITO_D,
+    OP_TOUI_S, OP_TOSI_S, OP_TOUIZ_S, OP_TOSIZ_S,
+    OP_TOUI_D, OP_TOSI_D, OP_TOUIZ_D, OP_TOSIZ_D,
+    OP_COUNT
+};
+
+static const char*  op_names[OP_COUNT] = {
+    "add.s", "sub.s", "mul.s", "div.s", "sqrt.s",
+    "add.d", "sub.d", "mul.d", "div.d", "sqrt.d",
+    "fcvtd", "fcvts",
+    "uito.s", "sito.s", "uito.d", "sito.d",
+    "toui.s", "tosi.s", "touiz.s", "tosiz.s",
+    "toui.d", "tosi.d", "touiz.d", "tosiz.d",
+};
+
+static int  host_hits[OP_COUNT];
+static int  failures[OP_COUNT];
+
+/* run operation 'op' on 'a' and 'b' with status 's'. if 'host' is set,
+ * try the host first like the helpers do. returns the result bits */
+static uint64_t run_op(int op, uint64_t a, uint64_t b, float_status *s,
+                       int host)
+{
+    float32   rs;
+    float64   rd;
+    uint32_t  ri = 0;
+    int       hit = 0;
+    uint64_t  result = 0;
+
+#define  F32(x)  make_float32((uint32_t)(x))
+#define  F64(x)  make_float64(x)
+
+#define  BINOP(hop, sop, p, ftype, res) \
+    hit = host && vfp_host_binop_##p(s, hop, ftype(a), ftype(b), &res); \
+    if (!hit) res = sop(ftype(a), ftype(b), s)
+
+    switch (op) {
+    case OP_ADD_S: BINOP(VFP_HOST_ADD, float32_add, s, F32, rs); break;
+    case OP_SUB_S: BINOP(VFP_HOST_SUB, float32_sub, s, F32, rs); break;
+    case OP_MUL_S: BINOP(VFP_HOST_MUL, float32_mul, s, F32, rs); break;
+    case OP_DIV_S: BINOP(VFP_HOST_DIV, float32_div, s, F32, rs); break;
+    case OP_ADD_D: BINOP(VFP_HOST_ADD, float64_add, d, F64, rd); break;
+    case OP_SUB_D: BINOP(VFP_HOST_SUB, float64_sub, d, F64, rd); break;
+    case OP_MUL_D: BINOP(VFP_HOST_MUL, float64_mul, d, F64, rd); break;
+    case OP_DIV_D: BINOP(VFP_HOST_DIV, float64_div, d, F64, rd); break;
+    case OP_SQRT_S:
+        hit = host && vfp_host_sqrt_s(s, F32(a), &rs);
+        if (!hit) rs = float32_sqrt(F32(a), s);
+        break;
+    case OP_SQRT_D:
+        hit = host && vfp_host_sqrt_d(s, F64(a), &rd);
+        if (!hit) rd = float64_sqrt(F64(a), s);
+        break;
+    case OP_FCVTD:
+        hit = host && vfp_host_fcvtd(s, F32(a), &rd);
+        if (!hit) rd = float32_to_float64(F32(a), s);
+        break;
+    case OP_FCVTS:
+        hit = host && vfp_host_fcvts(s, F64(a), &rs);
+        if (!hit) rs = float64_to_float32(F64(a), s);
+        break;
+    case OP_UITO_S:
+        hit = host && vfp_host_itof_s(s, (uint32_t)a, 0, &rs);
+        if (!hit) rs = uint32_to_float32((uint32_t)a, s);
+        break;
+    case OP_SITO_S:
+        hit = host && vfp_host_itof_s(s, (uint32_t)a, 1, &rs);
+        if (!hit) rs = int32_to_float32((uint32_t)a, s);
+        break;
+    case OP_UITO_D:
+        hit = host && vfp_host_itof_d(s, (uint32_t)a, 0, &rd);
+        if (!hit) rd = uint32_to_float64((uint32_t)a, s);
+        break;
+    case OP_SITO_D:
+        hit = host && vfp_host_itof_d(s, (uint32_t)a, 1, &rd);
+        if (!hit) rd = int32_to_float64((uint32_t)a, s);
+        break;
+
+#define  FTOI(p, ftype, is_signed, trunc, func) \
+        hit = host && vfp_host_ftoi_##p(s, ftype(a), is_signed, trunc, &ri); \
+        if (!hit) ri = func(ftype(a), s)
+
+    case OP_TOUI_S:  FTOI(s, F32, 0, 0, float32_to_uint32); break;
+    case OP_TOSI_S:  FTOI(s, F32, 1, 0, float32_to_int32); break;
+    case OP_TOUIZ_S: FTOI(s, F32, 0, 1, float32_to_uint32_round_to_zero); break;
+    case OP_TOSIZ_S: FTOI(s, F32, 1, 1, float32_to_int32_round_to_zero); break;
+    case OP_TOUI_D:  FTOI(d, F64, 0, 0, float64_to_uint32); break;
+    case OP_TOSI_D:  FTOI(d, F64, 1, 0, float64_to_int32); break;
+    case OP_TOUIZ_D: FTOI(d, F64, 0, 1, float64_to_uint32_round_to_zero); break;
+    case OP_TOSIZ_D: FTOI(d, F64, 1, 1, float64_to_int32_round_to_zero); break;
+    }
+
+    switch (op) {
+    case OP_ADD_S: case OP_SUB_S: case OP_MUL_S: case OP_DIV_S:
+    case OP_SQRT_S: case OP_FCVTS: case OP_UITO_S: case OP_SITO_S:
+        result = float32_val(rs);
+        break;
+    case OP_ADD_D: case OP_SUB_D: case OP_MUL_D: case OP_DIV_D:
+    case OP_SQRT_D: case OP_FCVTD: case OP_UITO_D: case OP_SITO_D:
+        result = float64_val(rd);
+        break;
+    default:
+        result = ri;
+    }
+    if (hit)
+        host_hits[op]++;
+    return result;
+}
+
+static void gen_operands(int op, uint64_t *a, uint64_t *b)
+{
+    switch (op) {
+    case OP_ADD_S: case OP_SUB_S: case OP_MUL_S: case OP_DIV_S:
+    case OP_SQRT_S: case OP_FCVTD:
+    case OP_TOUI_S: case OP_TOSI_S: case OP_TOUIZ_S: case OP_TOSIZ_S:
+        *a = float32_val(gen_s());
+        *b = float32_val(gen_s());
+        break;
+    case OP_UITO_S: case OP_SITO_S: case OP_UITO_D: case OP_SITO_D:
+        *a = gen_i();
+        *b = 0;
+        break;
+    default:
+        *a = float64_val(gen_d());
+        *b = float64_val(gen_d());
+    }
+}
+
+int main(void)
+{
+    int  op, n, total = 0;
+
+    for (op = 0; op < OP_COUNT; op++) {
+        for (n = 0; n < ITERATIONS; n++) {
+            float_status  fast, ref;
+            uint64_t      a, b, rfast, rref;
+
+            gen_operands(op, &a, &b);
+
+            /* start with and without the inexact flag accumulated, and
+             * sometimes in another rounding mode */
+            memset(&ref, 0, sizeof(ref));
+            if (rng() & 1)
+                set_float_exception_flags(float_flag_inexact, &ref);
+            if ((rng() & 15) == 0)
+                set_float_rounding_mode(rng() & 3, &ref);
+            fast = ref;
+
+            rfast = run_op(op, a, b, &fast, 1);
+            rref  = run_op(op, a, b, &ref, 0);
+
+            if (rfast != rref ||
+                get_float_exception_flags(&fast) !=
+                get_float_exception_flags(&ref)) {
+                if (failures[op]++ < 10)
+                    fprintf(stderr, "%s(0x%llx, 0x%llx): host 0x%llx flags "
+                            "0x%x, softfloat 0x%llx flags 0x%x\n",
+                            op_names[op], (unsigned long long)a,
+                            (unsigned long long)b,
+                            (unsigned long long)rfast,
+                            get_float_exception_flags(&fast),
+                            (unsigned long long)rref,
+                            get_float_exception_flags(&ref));
+            }
+        }
+        printf("%-8s %6d on the host, %d mismatches\n", op_names[op],
+               host_hits[op], failures[op]);
+        total += failures[op];
+    }
+#ifdef __SSE2__
+    printf("%s\n", total ? "FAILED" : "PASSED");
+#else
+    printf("%s (no SSE2, host path not built)\n", total ? "FAILED" : "PASSED");
+#endif
+    return total != 0;
+}
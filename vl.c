@@ -43,6 +43,10 @@
 #include "qemu-timer.h"
 #include "qemu-char.h"
 #include "block.h"
+#include "block-cache.h"
+#include "tb-profile.h"
+#include "ram-restore.h"
+#include "savevm-stream.h"
 #include "audio/audio.h"
 
 #include "qemu_file.h"
@@ -53,6 +57,7 @@
 #include "android/gps.h"
 #include "android/hw-qemud.h"
 #include "android/hw-kmsg.h"
+#include "android/utils/timeline.h"
 #include "tcpdump.h"
 
 #include <unistd.h>
@@ -6387,6 +6392,7 @@ void qemu_del_wait_object(HANDLE handle, WaitObjectFunc *func, void *opaque)
 struct QEMUFile {
     FILE *outfile;
     BlockDriverState *bs;
+    SnapshotStream *stream;
     int is_file;
     int is_writable;
     int64_t base_offset;
@@ -6437,12 +6443,29 @@ static QEMUFile *qemu_fopen_bdrv(BlockDriverState *bs, int64_t offset, int is_wr
     return f;
 }
 
+/* snapshot streams are sequential: the position can only move forward
+   when reading, and not at all when writing */
+static QEMUFile *qemu_fopen_stream(SnapshotStream *s, int is_writable)
+{
+    QEMUFile *f;
+
+    f = qemu_mallocz(sizeof(QEMUFile));
+    if (!f)
+        return NULL;
+    f->is_file = 0;
+    f->stream = s;
+    f->is_writable = is_writable;
+    return f;
+}
+
 void qemu_fflush(QEMUFile *f)
 {
     if (!f->is_writable)
         return;
     if (f->buf_index > 0) {
-        if (f->is_file) {
+        if (f->stream) {
+            snapshot_stream_write(f->stream, f->buf, f->buf_index);
+        } else if (f->is_file) {
             fseek(f->outfile, f->buf_offset, SEEK_SET);
             fwrite(f->buf, 1, f->buf_index, f->outfile);
         } else {
@@ -6460,7 +6483,9 @@ static void qemu_fill_buffer(QEMUFile *f)
 
     if (f->is_writable)
         return;
-    if (f->is_file) {
+    if (f->stream) {
+        len = snapshot_stream_read(f->stream, f->buf, IO_BUF_SIZE);
+    } else if (f->is_file) {
         fseek(f->outfile, f->buf_offset, SEEK_SET);
         len = fread(f->buf, 1, IO_BUF_SIZE, f->outfile);
         if (len < 0)
@@ -6557,6 +6582,28 @@ int64_t qemu_fseek(QEMUFile *f, int64_t pos, int whence)
         /* SEEK_END not supported */
         return -1;
     }
+    if (f->stream) {
+        int64_t cur = qemu_ftell(f);
+
+        if (f->is_writable || pos < cur)
+            return (pos == cur) ? pos : -1;
+        /* skip forward */
+        while (cur < pos) {
+            int l = f->buf_size - f->buf_index;
+
+            if (l == 0) {
+                qemu_fill_buffer(f);
+                l = f->buf_size;
+                if (l == 0)
+                    return -1;
+            }
+            if (l > pos - cur)
+                l = pos - cur;
+            f->buf_index += l;
+            cur += l;
+        }
+        return pos;
+    }
     if (f->is_writable) {
         qemu_fflush(f);
         f->buf_offset = pos;
@@ -6763,7 +6810,8 @@ int register_savevm(const char *idstr,
 #define QEMU_VM_FILE_MAGIC   0x5145564d
 #define QEMU_VM_FILE_VERSION 0x00000002
 
-static int qemu_savevm_state(QEMUFile *f)
+/* save all sections but the one named 'skip', if any */
+static int qemu_savevm_state(QEMUFile *f, const char *skip)
 {
     SaveStateEntry *se;
     int len, ret;
@@ -6778,6 +6826,8 @@ static int qemu_savevm_state(QEMUFile *f)
 	if (se->save_state == NULL)
 	    /* this one has a loader only, for backwards compatibility */
 	    continue;
+        if (skip && !strcmp(se->idstr, skip))
+            continue;
 
         /* ID string */
         len = strlen(se->idstr);
@@ -6808,6 +6858,30 @@ static int qemu_savevm_state(QEMUFile *f)
     return ret;
 }
 
+/* snapshot files can't be rewritten, so the section lengths go to the
+   index at the end of the stream instead of the section headers */
+static int qemu_savevm_state_stream(QEMUFile *f, SnapshotStream *s)
+{
+    SaveStateEntry *se;
+    int64_t start;
+
+    qemu_put_be32(f, QEMU_VM_FILE_MAGIC);
+    qemu_put_be32(f, QEMU_VM_FILE_VERSION);
+
+    for(se = first_se; se != NULL; se = se->next) {
+        if (se->save_state == NULL)
+            continue;
+
+        start = qemu_ftell(f);
+        se->save_state(f, se->opaque);
+        snapshot_stream_add_section(s, se->idstr, se->instance_id,
+                                    se->version_id, start,
+                                    qemu_ftell(f) - start);
+    }
+    qemu_fflush(f);
+    return 0;
+}
+
 static SaveStateEntry *find_se(const char *idstr, int instance_id)
 {
     SaveStateEntry *se;
@@ -6872,6 +6946,39 @@ static int qemu_loadvm_state(QEMUFile *f)
     return ret;
 }
 
+static int qemu_loadvm_state_stream(QEMUFile *f, SnapshotStream *s)
+{
+    SaveStateEntry *se;
+    const char *idstr;
+    int i, ret, instance_id, version_id;
+    int64_t offset, length;
+
+    if (qemu_get_be32(f) != QEMU_VM_FILE_MAGIC ||
+        qemu_get_be32(f) != QEMU_VM_FILE_VERSION)
+        return -1;
+
+    for(i = 0; snapshot_stream_get_section(s, i, &idstr, &instance_id,
+                                           &version_id, &offset,
+                                           &length) == 0; i++) {
+        if (qemu_fseek(f, offset, SEEK_SET) < 0)
+            return -EIO;
+        se = find_se(idstr, instance_id);
+        if (!se) {
+            fprintf(stderr, "qemu: warning: instance 0x%x of device '%s' not present in current VM\n",
+                    instance_id, idstr);
+        } else {
+            ret = se->load_state(f, se->opaque, version_id);
+            if (ret < 0) {
+                fprintf(stderr, "qemu: warning: error while loading state for instance 0x%x of device '%s'\n",
+                        instance_id, idstr);
+            }
+        }
+        if (qemu_fseek(f, offset + length, SEEK_SET) < 0)
+            return -EIO;
+    }
+    return 0;
+}
+
 /* device can contain snapshots */
 static int bdrv_can_snapshot(BlockDriverState *bs)
 {
@@ -6994,7 +7101,7 @@ void do_savevm(const char *name)
         term_printf("Could not open VM state file\n");
         goto the_end;
     }
-    ret = qemu_savevm_state(f);
+    ret = qemu_savevm_state(f, NULL);
     sn->vm_state_size = qemu_ftell(f);
     qemu_fclose(f);
     if (ret < 0) {
@@ -7097,6 +7204,209 @@ void do_loadvm(const char *name)
         vm_start();
 }
 
+/* save the VM state to a standalone file. the guest resumes as soon as
+   the state is serialized, and the file is completed in the background */
+void do_savevm_file(const char *filename)
+{
+    SnapshotStream *s;
+    QEMUFile *f;
+    int saved_vm_running;
+
+    qemu_aio_flush();
+
+    saved_vm_running = vm_running;
+    vm_stop(0);
+
+    s = snapshot_stream_create(filename);
+    if (!s) {
+        term_printf("Could not create VM state file '%s'\n", filename);
+        goto the_end;
+    }
+    f = qemu_fopen_stream(s, 1);
+    if (!f || qemu_savevm_state_stream(f, s) < 0) {
+        term_printf("Error while writing VM state\n");
+        if (f)
+            qemu_fclose(f);
+        snapshot_stream_close(s);
+        goto the_end;
+    }
+    qemu_fclose(f);
+    snapshot_stream_finish(s);
+
+ the_end:
+    if (saved_vm_running)
+        vm_start();
+}
+
+void do_loadvm_file(const char *filename)
+{
+    SnapshotStream *s;
+    QEMUFile *f;
+    int ret, saved_vm_running;
+
+    qemu_aio_flush();
+
+    saved_vm_running = vm_running;
+    vm_stop(0);
+
+    s = snapshot_stream_open(filename);
+    if (!s) {
+        term_printf("Could not open VM state file '%s'\n", filename);
+        goto the_end;
+    }
+    f = qemu_fopen_stream(s, 0);
+    ret = f ? qemu_loadvm_state_stream(f, s) : -ENOMEM;
+    if (f)
+        qemu_fclose(f);
+    snapshot_stream_close(s);
+    if (ret < 0)
+        term_printf("Error %d while loading VM state\n", ret);
+
+ the_end:
+    if (saved_vm_running)
+        vm_start();
+}
+
+/* Clones: a warm instance saves its RAM, device state and writable NAND
+   images to a directory, from which any number of instances can start.
+   The clones map the RAM image privately, so its pages are shared with
+   the page cache until they are written (the directory is best put on a
+   tmpfs), and load the device state without any RAM section. Each clone
+   writes to its own copy of the NAND images. The SD card is not part of
+   the saved state. */
+#define CLONE_RAM_FILE    "ram"
+#define CLONE_STATE_FILE  "state"
+#define CLONE_CHUNK_SIZE  65536
+
+#ifndef _WIN32
+/* write the RAM as a sparse file, the zero chunks being holes */
+static int clone_save_ram(const char *dir, int64_t *pwritten)
+{
+    char path[1024], tmp[sizeof(path) + 4];
+    ram_addr_t i;
+    int fd, len;
+
+    snprintf(path, sizeof(path), "%s/" CLONE_RAM_FILE, dir);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+    if (fd < 0)
+        return -1;
+    if (ftruncate(fd, phys_ram_size) < 0)
+        goto fail;
+
+    *pwritten = 0;
+    for(i = 0; i < phys_ram_size; i += CLONE_CHUNK_SIZE) {
+        len = CLONE_CHUNK_SIZE;
+        if (phys_ram_size - i < CLONE_CHUNK_SIZE)
+            len = phys_ram_size - i;
+        if (ram_chunk_is_zero(phys_ram_base + i, len))
+            continue;
+        if (lseek(fd, i, SEEK_SET) < 0 ||
+            unix_write(fd, phys_ram_base + i, len) != len)
+            goto fail;
+        *pwritten += len;
+    }
+    if (close(fd) < 0) {
+        fd = -1;
+        goto fail;
+    }
+    /* clones started from the previous image keep their mapping */
+    if (rename(tmp, path) < 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+
+ fail:
+    if (fd >= 0)
+        close(fd);
+    unlink(tmp);
+    return -1;
+}
+#endif
+
+void do_clone_save(const char *dir)
+{
+#ifdef _WIN32
+    term_printf("Clones are not supported on this host\n");
+#else
+    char path[1024];
+    QEMUFile *f;
+    int64_t written, start;
+    int saved_vm_running, ret;
+
+    qemu_aio_flush();
+
+    saved_vm_running = vm_running;
+    vm_stop(0);
+    start = qemu_get_clock(rt_clock);
+
+    /* the whole RAM must be there */
+    ram_restore_finish();
+
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        term_printf("Could not create directory '%s': %s\n",
+                    dir, strerror(errno));
+        goto the_end;
+    }
+    if (clone_save_ram(dir, &written) < 0) {
+        term_printf("Could not save the RAM to '%s': %s\n",
+                    dir, strerror(errno));
+        goto the_end;
+    }
+
+    snprintf(path, sizeof(path), "%s/" CLONE_STATE_FILE, dir);
+    f = qemu_fopen(path, "wb");
+    if (!f) {
+        term_printf("Could not create VM state file '%s'\n", path);
+        goto the_end;
+    }
+    ret = qemu_savevm_state(f, "ram");
+    qemu_fclose(f);
+    if (ret < 0) {
+        term_printf("Error %d while saving VM state to '%s'\n", ret, path);
+        unlink(path);
+        goto the_end;
+    }
+
+#ifdef CONFIG_NAND
+    if (nand_save_images(dir) < 0) {
+        term_printf("Could not save the NAND images to '%s'\n", dir);
+        goto the_end;
+    }
+#endif
+    term_printf("clone saved to '%s' in %" PRId64 " ms, %" PRId64
+                " of %" PRId64 " MB of RAM in use\n", dir,
+                qemu_get_clock(rt_clock) - start, written >> 20,
+                (int64_t)phys_ram_size >> 20);
+
+ the_end:
+    if (saved_vm_running)
+        vm_start();
+#endif
+}
+
+/* load the device state of a clone, its RAM is already mapped */
+static int clone_load_state(const char *dir)
+{
+    char path[1024];
+    QEMUFile *f;
+    int ret;
+
+    snprintf(path, sizeof(path), "%s/" CLONE_STATE_FILE, dir);
+    f = qemu_fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "qemu: could not open clone state '%s'\n", path);
+        return -1;
+    }
+    ret = qemu_loadvm_state(f);
+    qemu_fclose(f);
+    if (ret < 0)
+        fprintf(stderr, "qemu: error %d while loading clone state '%s'\n",
+                ret, path);
+    return ret;
+}
+
 void do_delvm(const char *name)
 {
     BlockDriverState *bs, *bs1;
@@ -7219,77 +7529,6 @@ static int ram_load_v1(QEMUFile *f, void *opaque)
 #define IOBUF_SIZE 4096
 #define RAM_CBLOCK_MAGIC 0xfabe
 
-typedef struct RamCompressState {
-    z_stream zstream;
-    QEMUFile *f;
-    uint8_t buf[IOBUF_SIZE];
-} RamCompressState;
-
-static int ram_compress_open(RamCompressState *s, QEMUFile *f)
-{
-    int ret;
-    memset(s, 0, sizeof(*s));
-    s->f = f;
-    ret = deflateInit2(&s->zstream, 1,
-                       Z_DEFLATED, 15,
-                       9, Z_DEFAULT_STRATEGY);
-    if (ret != Z_OK)
-        return -1;
-    s->zstream.avail_out = IOBUF_SIZE;
-    s->zstream.next_out = s->buf;
-    return 0;
-}
-
-static void ram_put_cblock(RamCompressState *s, const uint8_t *buf, int len)
-{
-    qemu_put_be16(s->f, RAM_CBLOCK_MAGIC);
-    qemu_put_be16(s->f, len);
-    qemu_put_buffer(s->f, buf, len);
-}
-
-static int ram_compress_buf(RamCompressState *s, const uint8_t *buf, int len)
-{
-    int ret;
-
-    s->zstream.avail_in = len;
-    s->zstream.next_in = (uint8_t *)buf;
-    while (s->zstream.avail_in > 0) {
-        ret = deflate(&s->zstream, Z_NO_FLUSH);
-        if (ret != Z_OK)
-            return -1;
-        if (s->zstream.avail_out == 0) {
-            ram_put_cblock(s, s->buf, IOBUF_SIZE);
-            s->zstream.avail_out = IOBUF_SIZE;
-            s->zstream.next_out = s->buf;
-        }
-    }
-    return 0;
-}
-
-static void ram_compress_close(RamCompressState *s)
-{
-    int len, ret;
-
-    /* compress last bytes */
-    for(;;) {
-        ret = deflate(&s->zstream, Z_FINISH);
-        if (ret == Z_OK || ret == Z_STREAM_END) {
-            len = IOBUF_SIZE - s->zstream.avail_out;
-            if (len > 0) {
-                ram_put_cblock(s, s->buf, len);
-            }
-            s->zstream.avail_out = IOBUF_SIZE;
-            s->zstream.next_out = s->buf;
-            if (ret == Z_STREAM_END)
-                break;
-        } else {
-            goto fail;
-        }
-    }
-fail:
-    deflateEnd(&s->zstream);
-}
-
 typedef struct RamDecompressState {
     z_stream zstream;
     QEMUFile *f;
@@ -7337,47 +7576,143 @@ static void ram_decompress_close(RamDecompressState *s)
     inflateEnd(&s->zstream);
 }
 
+/* versions 3 and 4 store the RAM as independently compressed chunks,
+   see ram-restore.h. version 3 has a table of the chunks before their
+   data, version 4 prefixes each chunk with its length so that it can be
+   written without seeking back */
+#define RAM_CHUNK_SIZE 65536
+
 static void ram_save(QEMUFile *f, void *opaque)
 {
-    ram_addr_t i;
-    RamCompressState s1, *s = &s1;
-    uint8_t buf[10];
+    int nb_chunks = (phys_ram_size + RAM_CHUNK_SIZE - 1) / RAM_CHUNK_SIZE;
+    uint8_t *buf = NULL;
+    int i;
+
+    /* otherwise the missing chunks would be faulted in one by one */
+    ram_restore_finish();
 
     qemu_put_be32(f, phys_ram_size);
-    if (ram_compress_open(s, f) < 0)
-        return;
-    for(i = 0; i < phys_ram_size; i+= BDRV_HASH_BLOCK_SIZE) {
-#if 0
-        if (tight_savevm_enabled) {
-            int64_t sector_num;
-            int j;
-
-            /* find if the memory block is available on a virtual
-               block device */
-            sector_num = -1;
-            for(j = 0; j < nb_drives; j++) {
-                sector_num = bdrv_hash_find(drives_table[j].bdrv,
-                                            phys_ram_base + i,
-					    BDRV_HASH_BLOCK_SIZE);
-                if (sector_num >= 0)
-                    break;
-            }
-            if (j == nb_drives)
-                goto normal_compress;
-            buf[0] = 1;
-            buf[1] = j;
-            cpu_to_be64wu((uint64_t *)(buf + 2), sector_num);
-            ram_compress_buf(s, buf, 10);
-        } else
-#endif
-        {
-            //        normal_compress:
-            buf[0] = 0;
-            ram_compress_buf(s, buf, 1);
-            ram_compress_buf(s, phys_ram_base + i, BDRV_HASH_BLOCK_SIZE);
+    qemu_put_be32(f, RAM_CHUNK_SIZE);
+    qemu_put_be32(f, nb_chunks);
+
+    /* snapshot streams compress the whole state on worker threads */
+    if (!f->stream)
+        buf = qemu_malloc(RAM_CHUNK_SIZE);
+
+    for(i = 0; i < nb_chunks; i++) {
+        ram_addr_t start = (ram_addr_t)i * RAM_CHUNK_SIZE;
+        uint8_t *p = phys_ram_base + start;
+        int len = RAM_CHUNK_SIZE;
+
+        if (phys_ram_size - start < RAM_CHUNK_SIZE)
+            len = phys_ram_size - start;
+        if (buf) {
+            len = ram_chunk_compress(buf, p, len);
+            p = buf;
+        } else if (ram_chunk_is_zero(p, len)) {
+            len = 0;
         }
+        qemu_put_be32(f, len);
+        qemu_put_buffer(f, p, len);
     }
-    ram_compress_close(s);
+
+    qemu_free(buf);
+}
+
+static int ram_load_v3(QEMUFile *f, void *opaque)
+{
+    RamChunk *chunks;
+    uint8_t *data;
+    uint32_t chunk_size, nb_chunks, data_size;
+    int i;
+
+    if (qemu_get_be32(f) != phys_ram_size)
+        return -EINVAL;
+    chunk_size = qemu_get_be32(f);
+    nb_chunks = qemu_get_be32(f);
+    if (chunk_size == 0 || chunk_size > (16 << 20) ||
+        (chunk_size & ~TARGET_PAGE_MASK) != 0 ||
+        nb_chunks != (phys_ram_size + chunk_size - 1) / chunk_size)
+        return -EINVAL;
+
+    chunks = qemu_malloc(nb_chunks * sizeof(RamChunk));
+    for(i = 0; i < nb_chunks; i++) {
+        chunks[i].offset = qemu_get_be32(f);
+        chunks[i].length = qemu_get_be32(f);
+    }
+    data_size = qemu_get_be32(f);
+    data = qemu_malloc(data_size + 1);
+    if (qemu_get_buffer(f, data, data_size) != data_size) {
+        qemu_free(data);
+        qemu_free(chunks);
+        return -EIO;
+    }
+    if (ram_restore(phys_ram_base, phys_ram_size, chunk_size,
+                    chunks, nb_chunks, data, data_size) < 0) {
+        fprintf(stderr, "Error while restoring ram from snapshot\n");
+        return -EINVAL;
+    }
+    return 0;
+}
+
+static int ram_load_v4(QEMUFile *f, void *opaque)
+{
+    RamChunk *chunks;
+    uint8_t *data;
+    uint32_t chunk_size, nb_chunks, len;
+    size_t data_size, data_max;
+    int i;
+
+    if (qemu_get_be32(f) != phys_ram_size)
+        return -EINVAL;
+    chunk_size = qemu_get_be32(f);
+    nb_chunks = qemu_get_be32(f);
+    if (chunk_size == 0 || chunk_size > (16 << 20) ||
+        (chunk_size & ~TARGET_PAGE_MASK) != 0 ||
+        nb_chunks != (phys_ram_size + chunk_size - 1) / chunk_size)
+        return -EINVAL;
+
+    chunks = qemu_malloc(nb_chunks * sizeof(RamChunk));
+    data_max = chunk_size;
+    data = qemu_malloc(data_max + 1);
+    data_size = 0;
+    for(i = 0; i < nb_chunks; i++) {
+        uint32_t chunk_len = chunk_size;
+
+        if (phys_ram_size - (ram_addr_t)i * chunk_size < chunk_size)
+            chunk_len = phys_ram_size - (ram_addr_t)i * chunk_size;
+
+        /* 0 for a zero chunk, chunk_len for a raw one, otherwise a zlib
+           stream, which has at least a 2 byte header and a 4 byte
+           checksum. streams only contain raw chunks */
+        len = qemu_get_be32(f);
+        if (len > chunk_len)
+            goto fail;
+        if (len != 0 && len != chunk_len && (f->stream || len < 6))
+            goto fail;
+        if (data_size + len > data_max) {
+            data_max *= 2;
+            if (data_max > phys_ram_size)
+                data_max = phys_ram_size;
+            data = qemu_realloc(data, data_max + 1);
+        }
+        chunks[i].offset = data_size;
+        chunks[i].length = len;
+        if (qemu_get_buffer(f, data + data_size, len) != len)
+            goto fail;
+        data_size += len;
+    }
+    if (ram_restore(phys_ram_base, phys_ram_size, chunk_size,
+                    chunks, nb_chunks, data, data_size) < 0) {
+        fprintf(stderr, "Error while restoring ram from snapshot\n");
+        return -EINVAL;
+    }
+    return 0;
+
+fail:
+    qemu_free(data);
+    qemu_free(chunks);
+    return -EIO;
 }
 
 static int ram_load(QEMUFile *f, void *opaque, int version_id)
@@ -7386,6 +7721,12 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
     uint8_t buf[10];
     ram_addr_t i;
 
+    if (version_id == 4)
+        return ram_load_v4(f, opaque);
+    if (version_id == 3)
+        return ram_load_v3(f, opaque);
+    /* the old formats overwrite everything */
+    ram_restore_finish();
     if (version_id == 1)
         return ram_load_v1(f, opaque);
     if (version_id != 2)
@@ -8071,6 +8412,10 @@ static int main_loop(void)
                     }
                 } else {
                     timeout = 10;
+                    /* use the idle time to translate the blocks the
+                       guest is likely to run next */
+                    if (tb_speculate_enabled && tb_speculate(cur_cpu, 8))
+                        timeout = 0;
                 }
             } else {
                 timeout = 0;
@@ -8250,6 +8595,25 @@ void qemu_help(int exitcode)
            "-clock          force the use of the given methods for timer alarm.\n"
            "                To see what timers are available use -clock ?\n"
            "-startdate      select initial date of the clock\n"
+           "-shared-block-cache size\n"
+           "                share read-only image clusters with other instances, using\n"
+           "                a host-wide cache of 'size' MB\n"
+           "-mem-path path  back guest RAM with a file created in directory 'path'\n"
+           "                (e.g. a hugetlbfs mount), or with a private mapping of\n"
+           "                the file 'path', shared with other instances until written\n"
+           "-mem-hugepages  use transparent huge pages for guest RAM\n"
+           "-tb-profile     count the executions of the translated blocks and sample\n"
+           "                the host time spent in them ('info tbprofile')\n"
+           "-tb-speculate   translate the likely successors of the recent blocks while\n"
+           "                the guest is idle ('info jit')\n"
+           "-lazy-restore   resume from snapshots before their RAM is restored, and\n"
+           "                restore it on first access ('info ramrestore')\n"
+           "-clone-from dir start from the state saved in 'dir' by 'clone_save', with the\n"
+           "                same options. the RAM is shared with the other clones until\n"
+           "                written. the writable NAND images are not used, each clone\n"
+           "                writes to private copies of the saved ones, discarded at\n"
+           "                exit. the SD card is not saved, clones must not share it\n"
+           "                with the template\n"
            "-icount [N|auto]\n"
            "                Enable virtual instruction counter with 2^N clock ticks per instruction\n"
            "\n"
@@ -8366,6 +8730,13 @@ enum {
     QEMU_OPTION_nand,
 #endif
     QEMU_OPTION_clock,
+    QEMU_OPTION_shared_block_cache,
+    QEMU_OPTION_mem_path,
+    QEMU_OPTION_mem_hugepages,
+    QEMU_OPTION_tb_profile,
+    QEMU_OPTION_tb_speculate,
+    QEMU_OPTION_lazy_restore,
+    QEMU_OPTION_clone_from,
     QEMU_OPTION_startdate,
     QEMU_OPTION_tb_size,
     QEMU_OPTION_icount,
@@ -8493,6 +8864,13 @@ const QEMUOption qemu_options[] = {
     { "nand", HAS_ARG, QEMU_OPTION_nand },
 #endif
     { "clock", HAS_ARG, QEMU_OPTION_clock },
+    { "shared-block-cache", HAS_ARG, QEMU_OPTION_shared_block_cache },
+    { "mem-path", HAS_ARG, QEMU_OPTION_mem_path },
+    { "mem-hugepages", 0, QEMU_OPTION_mem_hugepages },
+    { "tb-profile", 0, QEMU_OPTION_tb_profile },
+    { "tb-speculate", 0, QEMU_OPTION_tb_speculate },
+    { "lazy-restore", 0, QEMU_OPTION_lazy_restore },
+    { "clone-from", HAS_ARG, QEMU_OPTION_clone_from },
     { NULL, 0, 0 },
 };
 
@@ -8732,6 +9110,12 @@ int main(int argc, char **argv)
     int usb_devices_index;
     int fds[2];
     int tb_size;
+    int block_cache_mb = 0;
+    const char *mem_path = NULL;
+    const char *clone_from = NULL;
+    char clone_ram[1024];
+    int mem_hugepages = 0;
+    int tb_profile = 0;
     const char *pid_file = NULL;
     VLANState *vlan;
 
@@ -9293,6 +9677,31 @@ int main(int argc, char **argv)
             case QEMU_OPTION_clock:
                 configure_alarms(optarg);
                 break;
+            case QEMU_OPTION_shared_block_cache:
+                block_cache_mb = atoi(optarg);
+                if (block_cache_mb <= 0) {
+                    fprintf(stderr, "qemu: invalid shared block cache size: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case QEMU_OPTION_mem_path:
+                mem_path = optarg;
+                break;
+            case QEMU_OPTION_mem_hugepages:
+                mem_hugepages = 1;
+                break;
+            case QEMU_OPTION_tb_profile:
+                tb_profile = 1;
+                break;
+            case QEMU_OPTION_tb_speculate:
+                tb_speculate_enabled = 1;
+                break;
+            case QEMU_OPTION_lazy_restore:
+                ram_restore_lazy = 1;
+                break;
+            case QEMU_OPTION_clone_from:
+                clone_from = optarg;
+                break;
             case QEMU_OPTION_startdate:
                 {
                     struct tm tm;
@@ -9565,7 +9974,32 @@ int main(int argc, char **argv)
         phys_ram_size += ram_size;
     }
 
-    phys_ram_base = qemu_vmalloc(phys_ram_size);
+    if (clone_from) {
+        struct stat st;
+
+        if (mem_path || loadvm) {
+            fprintf(stderr, "qemu: -clone-from can't be used with -mem-path or -loadvm\n");
+            exit(1);
+        }
+#ifdef _WIN32
+        fprintf(stderr, "qemu: -clone-from is not supported on this host\n");
+        exit(1);
+#endif
+        snprintf(clone_ram, sizeof(clone_ram), "%s/" CLONE_RAM_FILE, clone_from);
+        if (stat(clone_ram, &st) < 0 || st.st_size != phys_ram_size) {
+            fprintf(stderr, "qemu: '%s' is not a RAM image of %" PRId64 " bytes\n",
+                    clone_ram, (int64_t)phys_ram_size);
+            exit(1);
+        }
+        /* mapped privately, see qemu_ram_vmalloc() */
+        mem_path = clone_ram;
+#ifdef CONFIG_NAND
+        if (nand_load_images(clone_from) < 0)
+            exit(1);
+#endif
+    }
+
+    phys_ram_base = qemu_ram_vmalloc(phys_ram_size, mem_path, mem_hugepages);
     if (!phys_ram_base) {
         fprintf(stderr, "Could not allocate physical memory\n");
         exit(1);
@@ -9573,9 +10007,14 @@ int main(int argc, char **argv)
 
     /* init the dynamic translator */
     cpu_exec_init_all(tb_size * 1024 * 1024);
+    if (tb_profile)
+        tb_profile_init();
 
     bdrv_init();
 
+    if (block_cache_mb > 0 && bdrv_cache_init(block_cache_mb) < 0)
+        fprintf(stderr, "qemu: warning: could not setup the shared block cache\n");
+
     /* we always create the cdrom drive, even if no disk is there */
 
     if (nb_drives_opt < MAX_DRIVES)
@@ -9598,7 +10037,7 @@ int main(int argc, char **argv)
 	    exit(1);
 
     register_savevm("timer", 0, 2, timer_save, timer_load, NULL);
-    register_savevm("ram", 0, 2, ram_save, ram_load, NULL);
+    register_savevm("ram", 0, 4, ram_save, ram_load, NULL);
 
     /* terminal init */
     memset(&display_state, 0, sizeof(display_state));
@@ -9699,8 +10138,10 @@ int main(int argc, char **argv)
     }
 #endif
 
+    timeline_begin("machine-init");
     machine->init(ram_size, vga_ram_size, boot_devices, ds,
                   kernel_filename, kernel_cmdline, initrd_filename, cpu_model);
+    timeline_end("machine-init");
 
     /* init USB devices */
     if (usb_enabled) {
@@ -9729,11 +10170,22 @@ int main(int argc, char **argv)
     }
 #endif
 
-    if (loadvm)
+    if (loadvm) {
+        timeline_begin("loadvm");
         do_loadvm(loadvm);
+        timeline_end("loadvm");
+    }
+    if (clone_from) {
+        timeline_begin("clone-load");
+        if (clone_load_state(clone_from) < 0)
+            exit(1);
+        timeline_end("clone-load");
+    }
 
     /* call android-specific setup function */
+    timeline_begin("emulation-setup");
     android_emulation_setup();
+    timeline_end("emulation-setup");
 
     {
         /* XXX: simplify init */
@@ -9768,6 +10220,9 @@ int main(int argc, char **argv)
 	close(fd);
     }
 
+    timeline_end("qemu-init");
+    timeline_end("startup");
+    timeline_mark("main-loop");
     main_loop();
     quit_timers();
 
@@ -28,9 +28,18 @@
 #include "sysemu.h"
 #include "qemu_socket.h"
 #include "qemu-timer.h"
+#include <zlib.h>
 
 #define VNC_REFRESH_INTERVAL (1000 / 30)
 
+/* the zlib-based encodings are compressed by a separate thread */
+#ifndef _WIN32
+#define VNC_ENCODER_THREAD
+#include <pthread.h>
+#include <signal.h>
+#include <sys/time.h>
+#endif
+
 #include "vnc_keysym.h"
 #include "keymaps.c"
 #include "d3des.h"
@@ -63,6 +72,85 @@ typedef struct Buffer
     uint8_t *buffer;
 } Buffer;
 
+typedef struct VncRect
+{
+    int x, y, w, h;
+} VncRect;
+
+/* the encodings sent by the server, see vnc_choose_encoding() */
+enum {
+    VNC_ENC_RAW = 0,
+    VNC_ENC_HEXTILE,
+    VNC_ENC_ZRLE,
+    VNC_ENC_TIGHT,
+    VNC_ENC_COUNT
+};
+
+static const char *vnc_encoding_names[VNC_ENC_COUNT] = {
+    "raw", "hextile", "zrle", "tight"
+};
+
+typedef struct VncEncodingStats
+{
+    uint64_t updates;
+    uint64_t pixels;
+    uint64_t bytes;
+    uint64_t us;
+    /* running averages of the last updates */
+    double bytes_per_pixel;
+    double us_per_pixel;
+    int last_update;
+} VncEncodingStats;
+
+/* how pixels are sent by the zlib-based encodings: ZRLE drops the unused
+   byte of 32-bit pixels, and Tight sends 24-bit colors as R, G, B */
+typedef struct VncCPixel
+{
+    int bytes;
+    int shift;
+    int big_endian;
+    int rgb;
+    int red_shift, green_shift, blue_shift;
+} VncCPixel;
+
+/* a FramebufferUpdate compressed by the encoder thread. The pixels of the
+   rectangles are copied when the job is queued, so that the display can
+   be updated while they are encoded */
+typedef struct VncJob
+{
+    int encoding;
+    int level;
+    VncCPixel cpixel;
+    VncRect *rects;
+    int nb_rects;
+    int max_rects;
+    uint64_t nb_pixels;
+    Buffer pixels;
+    Buffer out;
+    uint64_t us;
+} VncJob;
+
+enum {
+    VNC_JOB_IDLE,
+    VNC_JOB_QUEUED,
+    VNC_JOB_DONE
+};
+
+#define VNC_PALETTE_HASH 512
+
+typedef struct VncPalette
+{
+    int size;
+    int max;
+    int overflow;
+    uint32_t colors[256];
+    uint16_t slots[VNC_PALETTE_HASH]; /* index + 1 in colors, or 0 */
+} VncPalette;
+
+/* Tight uses streams 0 to 3, ZRLE has its own */
+#define VNC_ZRLE_STREAM 4
+#define VNC_ZLIB_STREAMS 5
+
 typedef struct VncState VncState;
 
 typedef int VncReadEvent(VncState *vs, uint8_t *data, size_t len);
@@ -130,6 +218,9 @@ struct VncState
     int depth; /* internal VNC frame buffer byte per pixel */
     int has_resize;
     int has_hextile;
+    int has_zrle;
+    int has_tight;
+    int compress_level;
     int has_pointer_type_change;
     int has_WMVi;
     int absolute;
@@ -173,6 +264,33 @@ struct VncState
     size_t read_handler_expect;
     /* input */
     uint8_t modifiers_state[256];
+
+    /* encoder state, only used by the encoder thread while a job is
+       queued. The streams are reset when the client disconnects */
+    VncJob job;
+    int job_state;
+    z_stream zstream[VNC_ZLIB_STREAMS];
+    int zlevel[VNC_ZLIB_STREAMS]; /* -1 until initialized */
+    Buffer zbuf;
+    Buffer zout;
+    uint32_t *enc_pixels;
+    VncPalette palette;
+#ifdef VNC_ENCODER_THREAD
+    int encoder_started;
+    int encoder_quit;
+    pthread_t encoder;
+    pthread_mutex_t job_lock;
+    pthread_cond_t job_cond;
+    int job_notify[2];
+#endif
+
+    /* encoding selection */
+    int encoding;
+    int nb_updates;
+    VncEncodingStats enc_stats[VNC_ENC_COUNT];
+    double throughput; /* bytes per second */
+    uint64_t send_start_us;
+    uint64_t send_bytes;
 };
 
 static VncState *vnc_state; /* needed for info vnc */
@@ -188,8 +306,26 @@ void do_info_vnc(void)
 
 	if (vnc_state->csock == -1)
 	    term_printf("No client connected\n");
-	else
+	else {
+	    VncState *vs = vnc_state;
+	    int i;
+
 	    term_printf("Client connected\n");
+	    term_printf("Encoding: %s, link throughput %.0f KB/s\n",
+	                vnc_encoding_names[vs->encoding],
+	                vs->throughput / 1024);
+	    for (i = 0; i < VNC_ENC_COUNT; i++) {
+	        VncEncodingStats *st = &vs->enc_stats[i];
+
+	        if (st->updates == 0)
+	            continue;
+	        term_printf("  %-8s %8" PRId64 " updates %12" PRId64 " pixels"
+	                    " %6.2f bytes/pixel %7.3f us/pixel\n",
+	                    vnc_encoding_names[i], st->updates, st->pixels,
+	                    (double)st->bytes / st->pixels,
+	                    (double)st->us / st->pixels);
+	    }
+	}
     }
 }
 
@@ -211,6 +347,19 @@ static void vnc_client_read(void *opaque);
 
 static void vnc_colordepth(DisplayState *ds, int depth);
 
+static uint64_t vnc_now_us(void);
+static int vnc_choose_encoding(VncState *vs, uint64_t nb_pixels);
+static void vnc_encoding_done(VncState *vs, int encoding, uint64_t pixels,
+                              uint64_t bytes, uint64_t us);
+static void buffer_reset(Buffer *buffer);
+static void vnc_job_add_rect(VncJob *job, int x, int y, int w, int h);
+static void vnc_job_add_pixels(VncState *vs, VncJob *job, VncRect *r);
+static int vnc_encoder_busy(VncState *vs);
+static void vnc_encoder_post(VncState *vs);
+static void vnc_encoder_wait(VncState *vs);
+static void vnc_encoder_cancel(VncState *vs);
+static void vnc_encoder_stop(VncState *vs);
+
 static inline void vnc_set_bit(uint32_t *d, int k)
 {
     d[k >> 5] |= 1 << (k & 0x1f);
@@ -292,6 +441,9 @@ static void vnc_dpy_resize(DisplayState *ds, int w, int h)
     int size_changed;
     VncState *vs = ds->opaque;
 
+    /* the pending update must be sent with the old geometry */
+    vnc_encoder_wait(vs);
+
     ds->data = qemu_realloc(ds->data, w * h * vs->depth);
     vs->old_data = qemu_realloc(vs->old_data, w * h * vs->depth);
 
@@ -331,7 +483,7 @@ static void vnc_write_pixels_copy(VncState *vs, void *pixels, int size)
 }
 
 /* slowest but generic code. */
-static void vnc_convert_pixel(VncState *vs, uint8_t *buf, uint32_t v)
+static uint32_t vnc_convert_value(VncState *vs, uint32_t v)
 {
     uint8_t r, g, b;
 
@@ -341,9 +493,14 @@ static void vnc_convert_pixel(VncState *vs, uint8_t *buf, uint32_t v)
         (vs->server_green_max + 1);
     b = ((v >> vs->server_blue_shift) & vs->server_blue_max) * (vs->client_blue_max + 1) /
         (vs->server_blue_max + 1);
-    v = (r << vs->client_red_shift) |
-        (g << vs->client_green_shift) |
-        (b << vs->client_blue_shift);
+    return (r << vs->client_red_shift) |
+           (g << vs->client_green_shift) |
+           (b << vs->client_blue_shift);
+}
+
+static void vnc_convert_pixel(VncState *vs, uint8_t *buf, uint32_t v)
+{
+    v = vnc_convert_value(vs, v);
     switch(vs->pix_bpp) {
     case 1:
         buf[0] = v;
@@ -480,9 +637,10 @@ static void send_framebuffer_update_hextile(VncState *vs, int x, int y, int w, i
 
 }
 
-static void send_framebuffer_update(VncState *vs, int x, int y, int w, int h)
+static void send_framebuffer_update(VncState *vs, int encoding,
+                                    int x, int y, int w, int h)
 {
-	if (vs->has_hextile)
+	if (encoding == VNC_ENC_HEXTILE)
 	    send_framebuffer_update_hextile(vs, x, y, w, h);
 	else
 	    send_framebuffer_update_raw(vs, x, y, w, h);
@@ -499,6 +657,7 @@ static void vnc_copy(DisplayState *ds, int src_x, int src_y, int dst_x, int dst_
     VncState *vs = ds->opaque;
 
     vnc_update_client(vs);
+    vnc_encoder_wait(vs);
 
     if (dst_y > src_y) {
 	y = h - 1;
@@ -548,14 +707,16 @@ static void vnc_update_client(void *opaque)
 {
     VncState *vs = opaque;
 
-    if (vs->need_update && vs->csock != -1) {
+    /* while the previous update is being compressed, the dirty areas
+       accumulate and are sent together */
+    if (vs->need_update && vs->csock != -1 && !vnc_encoder_busy(vs)) {
 	int y;
 	uint8_t *row;
 	char *old_row;
 	uint32_t width_mask[VNC_DIRTY_WORDS];
-	int n_rectangles;
-	int saved_offset;
 	int has_dirty = 0;
+	VncJob *job = &vs->job;
+	int i, encoding;
 
         vga_hw_update();
 
@@ -597,12 +758,9 @@ static void vnc_update_client(void *opaque)
 	    return;
 	}
 
-	/* Count rectangles */
-	n_rectangles = 0;
-	vnc_write_u8(vs, 0);  /* msg id */
-	vnc_write_u8(vs, 0);
-	saved_offset = vs->output.offset;
-	vnc_write_u16(vs, 0);
+	/* Collect rectangles */
+	job->nb_rects = 0;
+	job->nb_pixels = 0;
 
 	for (y = 0; y < vs->height; y++) {
 	    int x;
@@ -616,22 +774,39 @@ static void vnc_update_client(void *opaque)
 		} else {
 		    if (last_x != -1) {
 			int h = find_dirty_height(vs, y, last_x, x);
-			send_framebuffer_update(vs, last_x * 16, y, (x - last_x) * 16, h);
-			n_rectangles++;
+			vnc_job_add_rect(job, last_x * 16, y, (x - last_x) * 16, h);
 		    }
 		    last_x = -1;
 		}
 	    }
 	    if (last_x != -1) {
 		int h = find_dirty_height(vs, y, last_x, x);
-		send_framebuffer_update(vs, last_x * 16, y, (x - last_x) * 16, h);
-		n_rectangles++;
+		vnc_job_add_rect(job, last_x * 16, y, (x - last_x) * 16, h);
 	    }
 	}
-	vs->output.buffer[saved_offset] = (n_rectangles >> 8) & 0xFF;
-	vs->output.buffer[saved_offset + 1] = n_rectangles & 0xFF;
-	vnc_flush(vs);
 
+	encoding = vnc_choose_encoding(vs, job->nb_pixels);
+	if (encoding == VNC_ENC_ZRLE || encoding == VNC_ENC_TIGHT) {
+	    buffer_reset(&job->pixels);
+	    for (i = 0; i < job->nb_rects; i++)
+		vnc_job_add_pixels(vs, job, &job->rects[i]);
+	    job->encoding = encoding;
+	    vnc_encoder_post(vs);
+	} else {
+	    uint64_t start = vnc_now_us();
+	    size_t offset = vs->output.offset;
+
+	    vnc_write_u8(vs, 0);  /* msg id */
+	    vnc_write_u8(vs, 0);
+	    vnc_write_u16(vs, job->nb_rects);
+	    for (i = 0; i < job->nb_rects; i++) {
+		VncRect *r = &job->rects[i];
+		send_framebuffer_update(vs, encoding, r->x, r->y, r->w, r->h);
+	    }
+	    vnc_encoding_done(vs, encoding, job->nb_pixels,
+	                      vs->output.offset - offset, vnc_now_us() - start);
+	    vnc_flush(vs);
+	}
     }
 
     if (vs->csock != -1) {
@@ -651,7 +826,7 @@ static int vnc_listen_poll(void *opaque)
 static void buffer_reserve(Buffer *buffer, size_t len)
 {
     if ((buffer->capacity - buffer->offset) < len) {
-	buffer->capacity += (len + 1024);
+	buffer->capacity = MAX(buffer->capacity * 2, buffer->offset + len + 1024);
 	buffer->buffer = qemu_realloc(buffer->buffer, buffer->capacity);
 	if (buffer->buffer == NULL) {
 	    fprintf(stderr, "vnc: out of memory\n");
@@ -681,6 +856,886 @@ static void buffer_append(Buffer *buffer, const void *data, size_t len)
     buffer->offset += len;
 }
 
+static void buffer_put_u8(Buffer *buffer, uint8_t value)
+{
+    buffer_reserve(buffer, 1);
+    buffer->buffer[buffer->offset++] = value;
+}
+
+static void buffer_put_u16(Buffer *buffer, uint16_t value)
+{
+    buffer_put_u8(buffer, value >> 8);
+    buffer_put_u8(buffer, value);
+}
+
+static void buffer_put_u32(Buffer *buffer, uint32_t value)
+{
+    buffer_put_u16(buffer, value >> 16);
+    buffer_put_u16(buffer, value);
+}
+
+static void buffer_put_rect(Buffer *buffer, int x, int y, int w, int h,
+                            int32_t encoding)
+{
+    buffer_put_u16(buffer, x);
+    buffer_put_u16(buffer, y);
+    buffer_put_u16(buffer, w);
+    buffer_put_u16(buffer, h);
+    buffer_put_u32(buffer, encoding);
+}
+
+static uint64_t vnc_now_us(void)
+{
+    qemu_timeval tv;
+
+    qemu_gettimeofday(&tv);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* Encoding selection.
+ *
+ * Each update is sent with the supported encoding that minimizes the
+ * estimated time to encode and transmit it: the bytes and microseconds
+ * per pixel of the recent updates are kept for each encoding, and the
+ * throughput of the link is measured when the output buffer drains. The
+ * encodings that have not been used for a while are tried again so that
+ * their estimates follow the content of the screen. Raw is never probed,
+ * its size is known in advance.
+ */
+
+#define VNC_ENCODING_PROBE    64
+#define VNC_MIN_SEND_US       1000
+#define VNC_DEFAULT_THROUGHPUT (1024.0 * 1024.0)
+#define VNC_DEFAULT_COMPRESS  6
+
+static int vnc_has_encoding(VncState *vs, int encoding)
+{
+    switch (encoding) {
+    case VNC_ENC_HEXTILE: return vs->has_hextile;
+    case VNC_ENC_ZRLE:    return vs->has_zrle;
+    case VNC_ENC_TIGHT:   return vs->has_tight;
+    default:              return 1;
+    }
+}
+
+static int vnc_choose_encoding(VncState *vs, uint64_t nb_pixels)
+{
+    static const int probe_order[] = { VNC_ENC_TIGHT, VNC_ENC_ZRLE, VNC_ENC_HEXTILE };
+    double best_cost = 0;
+    int i, best = VNC_ENC_RAW;
+
+    vs->nb_updates++;
+
+    for (i = 0; i < ARRAY_SIZE(probe_order); i++) {
+        VncEncodingStats *st = &vs->enc_stats[probe_order[i]];
+
+        if (vnc_has_encoding(vs, probe_order[i]) &&
+            (st->updates == 0 ||
+             vs->nb_updates - st->last_update > VNC_ENCODING_PROBE)) {
+            best = probe_order[i];
+            goto out;
+        }
+    }
+
+    for (i = 0; i < VNC_ENC_COUNT; i++) {
+        VncEncodingStats *st = &vs->enc_stats[i];
+        double bytes_per_pixel = st->bytes_per_pixel;
+        double cost;
+
+        if (!vnc_has_encoding(vs, i))
+            continue;
+        if (i == VNC_ENC_RAW && st->updates == 0)
+            bytes_per_pixel = vs->pix_bpp;
+        cost = bytes_per_pixel * 1e6 / vs->throughput + st->us_per_pixel;
+        if (i == VNC_ENC_RAW || cost < best_cost) {
+            best = i;
+            best_cost = cost;
+        }
+    }
+out:
+    vs->encoding = best;
+    return best;
+}
+
+static void vnc_encoding_done(VncState *vs, int encoding, uint64_t pixels,
+                              uint64_t bytes, uint64_t us)
+{
+    VncEncodingStats *st = &vs->enc_stats[encoding];
+    double bytes_per_pixel, us_per_pixel;
+
+    if (pixels == 0)
+        return;
+
+    bytes_per_pixel = (double)bytes / pixels;
+    us_per_pixel = (double)us / pixels;
+    if (st->updates == 0) {
+        st->bytes_per_pixel = bytes_per_pixel;
+        st->us_per_pixel = us_per_pixel;
+    } else {
+        st->bytes_per_pixel = (3 * st->bytes_per_pixel + bytes_per_pixel) / 4;
+        st->us_per_pixel = (3 * st->us_per_pixel + us_per_pixel) / 4;
+    }
+    st->updates++;
+    st->pixels += pixels;
+    st->bytes += bytes;
+    st->us += us;
+    st->last_update = vs->nb_updates;
+}
+
+/* called when the output buffer is empty again, 'bytes' having been sent
+   in 'us' microseconds */
+static void vnc_update_throughput(VncState *vs, uint64_t bytes, uint64_t us)
+{
+    double rate;
+
+    if (us < VNC_MIN_SEND_US) {
+        /* the socket did not block, this is only a lower bound */
+        rate = bytes * 1e6 / VNC_MIN_SEND_US;
+        if (rate > vs->throughput)
+            vs->throughput = rate;
+    } else {
+        rate = bytes * 1e6 / us;
+        vs->throughput = (3 * vs->throughput + rate) / 4;
+    }
+}
+
+static void vnc_encoding_reset(VncState *vs)
+{
+    memset(vs->enc_stats, 0, sizeof(vs->enc_stats));
+    vs->encoding = VNC_ENC_RAW;
+    vs->nb_updates = 0;
+    vs->throughput = VNC_DEFAULT_THROUGHPUT;
+    vs->send_start_us = 0;
+    vs->send_bytes = 0;
+}
+
+static void vnc_job_add_rect(VncJob *job, int x, int y, int w, int h)
+{
+    VncRect *r;
+
+    if (job->nb_rects == job->max_rects) {
+        job->max_rects = job->max_rects ? 2 * job->max_rects : 64;
+        job->rects = qemu_realloc(job->rects, job->max_rects * sizeof(VncRect));
+    }
+    r = &job->rects[job->nb_rects++];
+    r->x = x;
+    r->y = y;
+    r->w = w;
+    r->h = h;
+    job->nb_pixels += w * h;
+}
+
+/* copy the pixels of 'r', the rows are packed */
+static void vnc_job_add_pixels(VncState *vs, VncJob *job, VncRect *r)
+{
+    int row = r->w * vs->depth;
+    uint8_t *src = vs->ds->data + r->y * vs->ds->linesize + r->x * vs->depth;
+    int i;
+
+    buffer_reserve(&job->pixels, row * r->h);
+    for (i = 0; i < r->h; i++) {
+        buffer_append(&job->pixels, src, row);
+        src += vs->ds->linesize;
+    }
+}
+
+/* read 'w' x 'h' pixels from 'src' and convert them to client pixel
+   values */
+static void vnc_load_pixels(VncState *vs, uint32_t *dst, const uint8_t *src,
+                            int stride, int w, int h)
+{
+    int convert = (vs->write_pixels != vnc_write_pixels_copy);
+    int i, j;
+    uint32_t v;
+
+    for (j = 0; j < h; j++, src += stride) {
+        for (i = 0; i < w; i++) {
+            switch (vs->depth) {
+            case 4:  v = ((const uint32_t *)src)[i]; break;
+            case 2:  v = ((const uint16_t *)src)[i]; break;
+            default: v = src[i]; break;
+            }
+            if (convert)
+                v = vnc_convert_value(vs, v);
+            *dst++ = v;
+        }
+    }
+}
+
+static void vnc_cpixel_init(VncState *vs, VncCPixel *cp, int encoding)
+{
+    uint32_t mask = (vs->client_red_max << vs->client_red_shift) |
+                    (vs->client_green_max << vs->client_green_shift) |
+                    (vs->client_blue_max << vs->client_blue_shift);
+
+    memset(cp, 0, sizeof(*cp));
+    cp->bytes = vs->pix_bpp;
+    cp->big_endian = vs->pix_big_endian;
+    if (vs->pix_bpp != 4)
+        return;
+
+    if (encoding == VNC_ENC_TIGHT) {
+        if (vs->client_red_max == 0xff && vs->client_green_max == 0xff &&
+            vs->client_blue_max == 0xff) {
+            cp->bytes = 3;
+            cp->rgb = 1;
+            cp->red_shift = vs->client_red_shift;
+            cp->green_shift = vs->client_green_shift;
+            cp->blue_shift = vs->client_blue_shift;
+        }
+    } else if ((mask & 0xff000000) == 0) {
+        cp->bytes = 3;
+    } else if ((mask & 0xff) == 0) {
+        cp->bytes = 3;
+        cp->shift = 8;
+    }
+}
+
+static inline uint8_t *vnc_put_cpixel(const VncCPixel *cp, uint8_t *p,
+                                      uint32_t v)
+{
+    if (cp->rgb) {
+        p[0] = v >> cp->red_shift;
+        p[1] = v >> cp->green_shift;
+        p[2] = v >> cp->blue_shift;
+        return p + 3;
+    }
+    v >>= cp->shift;
+    switch (cp->bytes) {
+    case 1:
+        p[0] = v;
+        break;
+    case 2:
+        if (cp->big_endian) {
+            p[0] = v >> 8;
+            p[1] = v;
+        } else {
+            p[0] = v;
+            p[1] = v >> 8;
+        }
+        break;
+    case 3:
+        if (cp->big_endian) {
+            p[0] = v >> 16;
+            p[1] = v >> 8;
+            p[2] = v;
+        } else {
+            p[0] = v;
+            p[1] = v >> 8;
+            p[2] = v >> 16;
+        }
+        break;
+    default:
+        if (cp->big_endian) {
+            p[0] = v >> 24;
+            p[1] = v >> 16;
+            p[2] = v >> 8;
+            p[3] = v;
+        } else {
+            p[0] = v;
+            p[1] = v >> 8;
+            p[2] = v >> 16;
+            p[3] = v >> 24;
+        }
+        break;
+    }
+    return p + cp->bytes;
+}
+
+static void vnc_palette_init(VncPalette *pal, int max)
+{
+    pal->size = 0;
+    pal->max = max;
+    pal->overflow = 0;
+    memset(pal->slots, 0, sizeof(pal->slots));
+}
+
+/* return the index of 'v' in the palette, adding it if needed, or -1 if
+   the palette is full */
+static int vnc_palette_put(VncPalette *pal, uint32_t v)
+{
+    unsigned int h = (v * 2654435761U) >> 23;
+
+    while (pal->slots[h]) {
+        int index = pal->slots[h] - 1;
+
+        if (pal->colors[index] == v)
+            return index;
+        h = (h + 1) & (VNC_PALETTE_HASH - 1);
+    }
+    if (pal->size == pal->max) {
+        pal->overflow = 1;
+        return -1;
+    }
+    pal->colors[pal->size] = v;
+    pal->slots[h] = ++pal->size;
+    return pal->size - 1;
+}
+
+/* compress 'len' bytes with the persistent 'stream' and append them to
+   'out' */
+static void vnc_deflate(VncState *vs, int stream, int level, Buffer *out,
+                        const uint8_t *data, size_t len)
+{
+    z_stream *z = &vs->zstream[stream];
+
+    if (level < 1)
+        level = 1;
+    if (vs->zlevel[stream] < 0) {
+        memset(z, 0, sizeof(*z));
+        if (deflateInit(z, level) != Z_OK) {
+            fprintf(stderr, "vnc: could not initialize zlib\n");
+            exit(1);
+        }
+        vs->zlevel[stream] = level;
+    }
+
+    buffer_reserve(out, len + len / 8 + 64);
+    z->next_in = (Bytef *)data;
+    z->avail_in = len;
+    z->next_out = buffer_end(out);
+    z->avail_out = out->capacity - out->offset;
+
+    /* may flush pending output at the previous level */
+    if (vs->zlevel[stream] != level) {
+        deflateParams(z, level, Z_DEFAULT_STRATEGY);
+        vs->zlevel[stream] = level;
+    }
+
+    for (;;) {
+        int ret = deflate(z, Z_SYNC_FLUSH);
+
+        out->offset = out->capacity - z->avail_out;
+        if (ret != Z_OK && ret != Z_BUF_ERROR)
+            break;
+        if (z->avail_in == 0 && z->avail_out != 0)
+            break;
+        buffer_reserve(out, 4096 + z->avail_in);
+        z->next_out = buffer_end(out);
+        z->avail_out = out->capacity - out->offset;
+    }
+}
+
+static uint8_t *vnc_put_run_length(uint8_t *p, int len)
+{
+    len--;
+    while (len >= 255) {
+        *p++ = 255;
+        len -= 255;
+    }
+    *p++ = len;
+    return p;
+}
+
+/* ZRLE: the rectangle is split in 64x64 tiles, each of them sent with the
+   smallest of the raw, solid, packed palette, RLE and palette RLE
+   subencodings, and the result is compressed with a single zlib stream */
+
+#define VNC_ZRLE_TILE 64
+
+static void vnc_zrle_tile(VncState *vs, const VncCPixel *cp, Buffer *b,
+                          const uint32_t *pix, int w, int h)
+{
+    VncPalette *pal = &vs->palette;
+    int n = w * h, cb = cp->bytes;
+    int i, j, x, y, runs = 0, len_bytes = 0, multi_bytes = 0;
+    int size, best, best_size, bits = 0;
+    uint8_t *p;
+
+    vnc_palette_init(pal, 127);
+    for (i = 0; i < n; i = j) {
+        int len;
+
+        for (j = i + 1; j < n && pix[j] == pix[i]; j++)
+            ;
+        len = (j - i - 1) / 255 + 1;
+        runs++;
+        len_bytes += len;
+        if (j - i > 1)
+            multi_bytes += len;
+        vnc_palette_put(pal, pix[i]);
+    }
+
+    buffer_reserve(b, 1 + 128 * 4 + n * 4);
+    p = buffer_end(b);
+
+    if (pal->size == 1 && !pal->overflow) {
+        *p++ = 1;
+        p = vnc_put_cpixel(cp, p, pix[0]);
+        b->offset = p - b->buffer;
+        return;
+    }
+
+    /* 0 is raw, 128 plain RLE, 2..16 packed palette and 130..255 palette
+       RLE */
+    best = 0;
+    best_size = n * cb;
+    size = runs * cb + len_bytes;
+    if (size < best_size) {
+        best = 128;
+        best_size = size;
+    }
+    if (!pal->overflow) {
+        size = pal->size * cb + runs + multi_bytes;
+        if (size < best_size) {
+            best = 128 + pal->size;
+            best_size = size;
+        }
+        if (pal->size <= 16) {
+            bits = pal->size <= 2 ? 1 : pal->size <= 4 ? 2 : 4;
+            size = pal->size * cb + h * ((w * bits + 7) / 8);
+            if (size < best_size) {
+                best = pal->size;
+                best_size = size;
+            }
+        }
+    }
+
+    *p++ = best;
+    if (best == 0) {
+        for (i = 0; i < n; i++)
+            p = vnc_put_cpixel(cp, p, pix[i]);
+    } else if (best == 128) {
+        for (i = 0; i < n; i = j) {
+            for (j = i + 1; j < n && pix[j] == pix[i]; j++)
+                ;
+            p = vnc_put_cpixel(cp, p, pix[i]);
+            p = vnc_put_run_length(p, j - i);
+        }
+    } else {
+        for (i = 0; i < pal->size; i++)
+            p = vnc_put_cpixel(cp, p, pal->colors[i]);
+
+        if (best > 128) {
+            for (i = 0; i < n; i = j) {
+                int index = vnc_palette_put(pal, pix[i]);
+
+                for (j = i + 1; j < n && pix[j] == pix[i]; j++)
+                    ;
+                if (j - i == 1) {
+                    *p++ = index;
+                } else {
+                    *p++ = index | 128;
+                    p = vnc_put_run_length(p, j - i);
+                }
+            }
+        } else {
+            for (y = 0; y < h; y++) {
+                int acc = 0, nbits = 0;
+
+                for (x = 0; x < w; x++) {
+                    acc = (acc << bits) | vnc_palette_put(pal, *pix++);
+                    nbits += bits;
+                    if (nbits == 8) {
+                        *p++ = acc;
+                        acc = nbits = 0;
+                    }
+                }
+                if (nbits)
+                    *p++ = acc << (8 - nbits);
+            }
+        }
+    }
+    b->offset = p - b->buffer;
+}
+
+static int vnc_send_zrle(VncState *vs, VncJob *job, const uint8_t *data,
+                         VncRect *r)
+{
+    Buffer *out = &job->out;
+    int stride = r->w * vs->depth;
+    size_t len_offset, start;
+    int x, y;
+
+    buffer_reset(&vs->zbuf);
+    for (y = 0; y < r->h; y += VNC_ZRLE_TILE) {
+        int h = MIN(VNC_ZRLE_TILE, r->h - y);
+
+        for (x = 0; x < r->w; x += VNC_ZRLE_TILE) {
+            int w = MIN(VNC_ZRLE_TILE, r->w - x);
+
+            vnc_load_pixels(vs, vs->enc_pixels,
+                            data + y * stride + x * vs->depth, stride, w, h);
+            vnc_zrle_tile(vs, &job->cpixel, &vs->zbuf, vs->enc_pixels, w, h);
+        }
+    }
+
+    buffer_put_rect(out, r->x, r->y, r->w, r->h, 16);
+    len_offset = out->offset;
+    buffer_put_u32(out, 0);
+    start = out->offset;
+    vnc_deflate(vs, VNC_ZRLE_STREAM, job->level, out,
+                vs->zbuf.buffer, vs->zbuf.offset);
+    out->buffer[len_offset] = (out->offset - start) >> 24;
+    out->buffer[len_offset + 1] = (out->offset - start) >> 16;
+    out->buffer[len_offset + 2] = (out->offset - start) >> 8;
+    out->buffer[len_offset + 3] = (out->offset - start);
+    return 1;
+}
+
+/* Tight without JPEG: solid rectangles use the fill compression, the
+   others the basic compression with the copy or palette filter. Full
+   color, two-color and indexed data go to zlib streams 0, 1 and 2 */
+
+#define VNC_TIGHT_MAX_WIDTH       2048
+#define VNC_TIGHT_MAX_PIXELS      65536
+#define VNC_TIGHT_MIN_TO_COMPRESS 12
+
+#define VNC_TIGHT_FILL            0x80
+#define VNC_TIGHT_EXPLICIT_FILTER 0x40
+#define VNC_TIGHT_FILTER_PALETTE  1
+
+static void buffer_put_compact_length(Buffer *buffer, size_t len)
+{
+    buffer_put_u8(buffer, (len & 0x7f) | (len > 0x7f ? 0x80 : 0));
+    if (len > 0x7f) {
+        buffer_put_u8(buffer, ((len >> 7) & 0x7f) | (len > 0x3fff ? 0x80 : 0));
+        if (len > 0x3fff)
+            buffer_put_u8(buffer, len >> 14);
+    }
+}
+
+static void vnc_tight_rect(VncState *vs, VncJob *job, const uint8_t *src,
+                           int stride, int x, int y, int w, int h)
+{
+    const VncCPixel *cp = &job->cpixel;
+    VncPalette *pal = &vs->palette;
+    uint32_t *pix = vs->enc_pixels;
+    Buffer *out = &job->out;
+    Buffer *data = &vs->zbuf;
+    int n = w * h, i, j, stream;
+    uint32_t last;
+    uint8_t *p;
+
+    vnc_load_pixels(vs, pix, src, stride, w, h);
+    vnc_palette_init(pal, 256);
+    last = pix[0];
+    vnc_palette_put(pal, last);
+    for (i = 1; i < n && !pal->overflow; i++) {
+        if (pix[i] != last) {
+            last = pix[i];
+            vnc_palette_put(pal, last);
+        }
+    }
+
+    buffer_put_rect(out, x, y, w, h, 7);
+    buffer_reserve(out, 3 + 256 * 4);
+    p = buffer_end(out);
+
+    if (pal->size == 1) {
+        *p++ = VNC_TIGHT_FILL;
+        p = vnc_put_cpixel(cp, p, pix[0]);
+        out->offset = p - out->buffer;
+        return;
+    }
+
+    buffer_reset(data);
+    buffer_reserve(data, n * 4);
+    if (pal->size == 2 && !pal->overflow) {
+        stream = 1;
+        *p++ = (stream << 4) | VNC_TIGHT_EXPLICIT_FILTER;
+        *p++ = VNC_TIGHT_FILTER_PALETTE;
+        *p++ = 1;
+        p = vnc_put_cpixel(cp, p, pal->colors[0]);
+        p = vnc_put_cpixel(cp, p, pal->colors[1]);
+        for (j = 0; j < h; j++) {
+            int acc = 0, nbits = 0;
+
+            for (i = 0; i < w; i++) {
+                acc = (acc << 1) | (*pix++ == pal->colors[1]);
+                if (++nbits == 8) {
+                    data->buffer[data->offset++] = acc;
+                    acc = nbits = 0;
+                }
+            }
+            if (nbits)
+                data->buffer[data->offset++] = acc << (8 - nbits);
+        }
+    } else if (!pal->overflow && cp->bytes > 1) {
+        stream = 2;
+        *p++ = (stream << 4) | VNC_TIGHT_EXPLICIT_FILTER;
+        *p++ = VNC_TIGHT_FILTER_PALETTE;
+        *p++ = pal->size - 1;
+        for (i = 0; i < pal->size; i++)
+            p = vnc_put_cpixel(cp, p, pal->colors[i]);
+        for (i = 0; i < n; i++)
+            data->buffer[data->offset++] = vnc_palette_put(pal, pix[i]);
+    } else {
+        uint8_t *d = buffer_end(data);
+
+        stream = 0;
+        *p++ = stream << 4;
+        for (i = 0; i < n; i++)
+            d = vnc_put_cpixel(cp, d, pix[i]);
+        data->offset = d - data->buffer;
+    }
+    out->offset = p - out->buffer;
+
+    /* short data is not compressed */
+    if (data->offset < VNC_TIGHT_MIN_TO_COMPRESS) {
+        buffer_reserve(out, data->offset);
+        buffer_append(out, data->buffer, data->offset);
+        return;
+    }
+    buffer_reset(&vs->zout);
+    vnc_deflate(vs, stream, job->level, &vs->zout,
+                data->buffer, data->offset);
+    buffer_put_compact_length(out, vs->zout.offset);
+    buffer_reserve(out, vs->zout.offset);
+    buffer_append(out, vs->zout.buffer, vs->zout.offset);
+}
+
+/* the rectangles are split to fit the limits of the Tight decoders */
+static int vnc_send_tight(VncState *vs, VncJob *job, const uint8_t *data,
+                          VncRect *r)
+{
+    int stride = r->w * vs->depth;
+    int x, y, count = 0;
+
+    for (x = 0; x < r->w; x += VNC_TIGHT_MAX_WIDTH) {
+        int w = MIN(VNC_TIGHT_MAX_WIDTH, r->w - x);
+        int rows = VNC_TIGHT_MAX_PIXELS / w;
+
+        for (y = 0; y < r->h; y += rows) {
+            int h = MIN(rows, r->h - y);
+
+            vnc_tight_rect(vs, job, data + y * stride + x * vs->depth, stride,
+                           r->x + x, r->y + y, w, h);
+            count++;
+        }
+    }
+    return count;
+}
+
+/* build the FramebufferUpdate message of 'job', called by the encoder
+   thread */
+static void vnc_encode_job(VncState *vs, VncJob *job)
+{
+    uint64_t start = vnc_now_us();
+    const uint8_t *data = job->pixels.buffer;
+    int i, count = 0;
+
+    if (vs->enc_pixels == NULL)
+        vs->enc_pixels = qemu_malloc(VNC_TIGHT_MAX_PIXELS * sizeof(uint32_t));
+
+    buffer_reset(&job->out);
+    buffer_put_u8(&job->out, 0);  /* msg id */
+    buffer_put_u8(&job->out, 0);
+    buffer_put_u16(&job->out, 0);
+
+    for (i = 0; i < job->nb_rects; i++) {
+        VncRect *r = &job->rects[i];
+
+        if (job->encoding == VNC_ENC_ZRLE)
+            count += vnc_send_zrle(vs, job, data, r);
+        else
+            count += vnc_send_tight(vs, job, data, r);
+        data += r->w * r->h * vs->depth;
+    }
+    job->out.buffer[2] = (count >> 8) & 0xFF;
+    job->out.buffer[3] = count & 0xFF;
+    job->us = vnc_now_us() - start;
+}
+
+/* Encoder thread.
+ *
+ * The main loop queues at most one job at a time, and skips the next
+ * updates until its output has been appended to the client buffer. The
+ * encoder thread signals the end of a job through a pipe. The protocol
+ * messages that must follow the pending update call vnc_encoder_wait()
+ * first. Without threads, the jobs are encoded synchronously.
+ */
+
+#ifdef VNC_ENCODER_THREAD
+#define vnc_job_lock(vs)    pthread_mutex_lock(&(vs)->job_lock)
+#define vnc_job_unlock(vs)  pthread_mutex_unlock(&(vs)->job_lock)
+
+static void *vnc_encoder_thread(void *opaque)
+{
+    VncState *vs = opaque;
+    sigset_t set;
+    char c = 0;
+
+    /* signals are handled by the main thread */
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    vnc_job_lock(vs);
+    for (;;) {
+        while (vs->job_state != VNC_JOB_QUEUED && !vs->encoder_quit)
+            pthread_cond_wait(&vs->job_cond, &vs->job_lock);
+        if (vs->encoder_quit)
+            break;
+        vnc_job_unlock(vs);
+
+        vnc_encode_job(vs, &vs->job);
+
+        vnc_job_lock(vs);
+        vs->job_state = VNC_JOB_DONE;
+        pthread_cond_broadcast(&vs->job_cond);
+        if (write(vs->job_notify[1], &c, 1) < 0) {
+            /* the main loop will pick the job on its next update */
+        }
+    }
+    vnc_job_unlock(vs);
+    return NULL;
+}
+
+static void vnc_encoder_notify(void *opaque)
+{
+    VncState *vs = opaque;
+    char buf[16];
+
+    int state;
+
+    if (read(vs->job_notify[0], buf, sizeof(buf)) < 0) {
+        /* nothing to do, the job state is checked below */
+    }
+    /* the job may already have been sent by vnc_encoder_wait() */
+    vnc_job_lock(vs);
+    state = vs->job_state;
+    vnc_job_unlock(vs);
+    if (state == VNC_JOB_DONE)
+        vnc_encoder_wait(vs);
+}
+
+static int vnc_encoder_start(VncState *vs)
+{
+    if (vs->encoder_started)
+        return 0;
+
+    if (pipe(vs->job_notify) < 0)
+        return -1;
+    vs->encoder_quit = 0;
+    if (pthread_create(&vs->encoder, NULL, vnc_encoder_thread, vs) != 0) {
+        close(vs->job_notify[0]);
+        close(vs->job_notify[1]);
+        return -1;
+    }
+    qemu_set_fd_handler2(vs->job_notify[0], NULL, vnc_encoder_notify, NULL, vs);
+    vs->encoder_started = 1;
+    return 0;
+}
+
+/* terminate the encoder thread, when the display is closed */
+static void vnc_encoder_stop(VncState *vs)
+{
+    if (!vs->encoder_started)
+        return;
+
+    /* let the thread finish a queued job, its output is dropped */
+    vnc_job_lock(vs);
+    while (vs->job_state == VNC_JOB_QUEUED)
+        pthread_cond_wait(&vs->job_cond, &vs->job_lock);
+    vs->job_state = VNC_JOB_IDLE;
+    vs->encoder_quit = 1;
+    pthread_cond_broadcast(&vs->job_cond);
+    vnc_job_unlock(vs);
+    pthread_join(vs->encoder, NULL);
+
+    qemu_set_fd_handler2(vs->job_notify[0], NULL, NULL, NULL, NULL);
+    close(vs->job_notify[0]);
+    close(vs->job_notify[1]);
+    vs->encoder_started = 0;
+}
+#else
+static void vnc_encoder_stop(VncState *vs)
+{
+}
+
+#define vnc_job_lock(vs)    do { } while (0)
+#define vnc_job_unlock(vs)  do { } while (0)
+#endif
+
+static void vnc_encoder_init(VncState *vs)
+{
+    int i;
+
+    for (i = 0; i < VNC_ZLIB_STREAMS; i++)
+        vs->zlevel[i] = -1;
+    vs->compress_level = VNC_DEFAULT_COMPRESS;
+#ifdef VNC_ENCODER_THREAD
+    pthread_mutex_init(&vs->job_lock, NULL);
+    pthread_cond_init(&vs->job_cond, NULL);
+#endif
+}
+
+static int vnc_encoder_busy(VncState *vs)
+{
+    int busy;
+
+    vnc_job_lock(vs);
+    busy = (vs->job_state != VNC_JOB_IDLE);
+    vnc_job_unlock(vs);
+    return busy;
+}
+
+static void vnc_encoder_post(VncState *vs)
+{
+    VncJob *job = &vs->job;
+
+    job->level = vs->compress_level;
+    vnc_cpixel_init(vs, &job->cpixel, job->encoding);
+
+#ifdef VNC_ENCODER_THREAD
+    if (vnc_encoder_start(vs) == 0) {
+        vnc_job_lock(vs);
+        vs->job_state = VNC_JOB_QUEUED;
+        pthread_cond_broadcast(&vs->job_cond);
+        vnc_job_unlock(vs);
+        return;
+    }
+#endif
+    vnc_encode_job(vs, job);
+    vs->job_state = VNC_JOB_DONE;
+    vnc_encoder_wait(vs);
+}
+
+/* wait for the pending job, and return its state */
+static int vnc_encoder_finish(VncState *vs)
+{
+    int state;
+
+    vnc_job_lock(vs);
+#ifdef VNC_ENCODER_THREAD
+    while (vs->job_state == VNC_JOB_QUEUED)
+        pthread_cond_wait(&vs->job_cond, &vs->job_lock);
+#endif
+    state = vs->job_state;
+    vs->job_state = VNC_JOB_IDLE;
+    vnc_job_unlock(vs);
+    return state;
+}
+
+/* send the pending update, if any */
+static void vnc_encoder_wait(VncState *vs)
+{
+    VncJob *job = &vs->job;
+
+    if (vnc_encoder_finish(vs) != VNC_JOB_DONE)
+        return;
+
+    vnc_encoding_done(vs, job->encoding, job->nb_pixels,
+                      job->out.offset, job->us);
+    if (vs->csock != -1) {
+        vnc_write(vs, job->out.buffer, job->out.offset);
+        vnc_flush(vs);
+    }
+}
+
+/* drop the pending update and reset the zlib streams, when the client
+   goes away */
+static void vnc_encoder_cancel(VncState *vs)
+{
+    int i;
+
+    vnc_encoder_finish(vs);
+    for (i = 0; i < VNC_ZLIB_STREAMS; i++) {
+        if (vs->zlevel[i] >= 0)
+            deflateReset(&vs->zstream[i]);
+    }
+}
+
 static int vnc_client_io_error(VncState *vs, int ret, int last_errno)
 {
     if (ret == 0 || ret == -1) {
@@ -705,6 +1760,7 @@ static int vnc_client_io_error(VncState *vs, int ret, int last_errno)
 	buffer_reset(&vs->input);
 	buffer_reset(&vs->output);
 	vs->need_update = 0;
+	vnc_encoder_cancel(vs);
 #ifdef CONFIG_VNC_TLS
 	if (vs->tls_session) {
 	    gnutls_deinit(vs->tls_session);
@@ -727,6 +1783,11 @@ static void vnc_client_write(void *opaque)
     long ret;
     VncState *vs = opaque;
 
+    if (vs->send_start_us == 0) {
+	vs->send_start_us = vnc_now_us();
+	vs->send_bytes = 0;
+    }
+
 #ifdef CONFIG_VNC_TLS
     if (vs->tls_session) {
 	ret = gnutls_write(vs->tls_session, vs->output.buffer, vs->output.offset);
@@ -746,9 +1807,12 @@ static void vnc_client_write(void *opaque)
 
     memmove(vs->output.buffer, vs->output.buffer + ret, (vs->output.offset - ret));
     vs->output.offset -= ret;
+    vs->send_bytes += ret;
 
     if (vs->output.offset == 0) {
 	qemu_set_fd_handler2(vs->csock, NULL, vnc_client_read, NULL, vs);
+	vnc_update_throughput(vs, vs->send_bytes, vnc_now_us() - vs->send_start_us);
+	vs->send_start_us = 0;
     }
 }
 
@@ -1127,6 +2191,9 @@ static void set_encodings(VncState *vs, int32_t *encodings, size_t n_encodings)
     int i;
 
     vs->has_hextile = 0;
+    vs->has_zrle = 0;
+    vs->has_tight = 0;
+    vs->compress_level = VNC_DEFAULT_COMPRESS;
     vs->has_resize = 0;
     vs->has_pointer_type_change = 0;
     vs->has_WMVi = 0;
@@ -1144,6 +2211,12 @@ static void set_encodings(VncState *vs, int32_t *encodings, size_t n_encodings)
 	case 5: /* Hextile */
 	    vs->has_hextile = 1;
 	    break;
+	case 7: /* Tight */
+	    vs->has_tight = 1;
+	    break;
+	case 16: /* ZRLE */
+	    vs->has_zrle = 1;
+	    break;
 	case -223: /* DesktopResize */
 	    vs->has_resize = 1;
 	    break;
@@ -1157,6 +2230,9 @@ static void set_encodings(VncState *vs, int32_t *encodings, size_t n_encodings)
             vs->has_WMVi = 1;
             break;
 	default:
+	    /* CompressLevel pseudo-encodings */
+	    if (encodings[i] >= -256 && encodings[i] <= -247)
+	        vs->compress_level = encodings[i] + 256;
 	    break;
 	}
     }
@@ -1177,6 +2253,9 @@ static void set_pixel_format(VncState *vs,
 #else
     host_big_endian_flag = 0;
 #endif
+    /* the encoder thread uses the current format */
+    vnc_encoder_wait(vs);
+
     if (!true_color_flag) {
     fail:
 	vnc_client_error(vs);
@@ -1222,7 +2301,6 @@ static void set_pixel_format(VncState *vs,
             vs->send_hextile_tile = send_hextile_tile_generic_8;
         }
 
-        vs->pix_big_endian = big_endian_flag;
         vs->write_pixels = vnc_write_pixels_generic;
     }
 
@@ -1233,6 +2311,7 @@ static void set_pixel_format(VncState *vs,
     vs->client_blue_shift = blue_shift;
     vs->client_blue_max = blue_max;
     vs->pix_bpp = bits_per_pixel / 8;
+    vs->pix_big_endian = big_endian_flag;
 
     vga_hw_invalidate();
     vga_hw_update();
@@ -1241,6 +2320,8 @@ static void set_pixel_format(VncState *vs,
 static void pixel_format_message (VncState *vs) {
     char pad[3] = { 0, 0, 0 };
 
+    vnc_encoder_wait(vs);
+
     vnc_write_u8(vs, vs->depth * 8); /* bits-per-pixel */
     if (vs->depth == 4) vnc_write_u8(vs, 24); /* depth */
     else vnc_write_u8(vs, vs->depth * 8); /* depth */
@@ -1283,7 +2364,12 @@ static void pixel_format_message (VncState *vs) {
     vs->client_red_shift = vs->server_red_shift;
     vs->client_green_shift = vs->server_green_shift;
     vs->client_blue_shift = vs->server_blue_shift;
-    vs->pix_bpp = vs->depth * 8;
+    vs->pix_bpp = vs->depth;
+#ifdef WORDS_BIGENDIAN
+    vs->pix_big_endian = 1;
+#else
+    vs->pix_big_endian = 0;
+#endif
     vs->write_pixels = vnc_write_pixels_copy;
 
     vnc_write(vs, pad, 3);           /* padding */
@@ -1294,6 +2380,8 @@ static void vnc_colordepth(DisplayState *ds, int depth)
     int host_big_endian_flag;
     struct VncState *vs = ds->opaque;
 
+    vnc_encoder_wait(vs);
+
     switch (depth) {
         case 24:
             if (ds->depth == 32) return;
@@ -2104,7 +3192,10 @@ static void vnc_connect(VncState *vs)
     memset(vs->dirty_row, 0xFF, sizeof(vs->dirty_row));
     vs->has_resize = 0;
     vs->has_hextile = 0;
+    vs->has_zrle = 0;
+    vs->has_tight = 0;
     vs->ds->dpy_copy = NULL;
+    vnc_encoding_reset(vs);
     vnc_update_client(vs);
 }
 
@@ -2153,6 +3244,8 @@ void vnc_display_init(DisplayState *ds)
 	exit(1);
 
     vs->timer = qemu_new_timer(rt_clock, vnc_update_client, vs);
+    vnc_encoder_init(vs);
+    vnc_encoding_reset(vs);
 
     vs->ds->data = NULL;
     vs->ds->dpy_update = vnc_dpy_update;
@@ -2240,6 +3333,7 @@ void vnc_display_close(DisplayState *ds)
 	buffer_reset(&vs->input);
 	buffer_reset(&vs->output);
 	vs->need_update = 0;
+	vnc_encoder_cancel(vs);
 #ifdef CONFIG_VNC_TLS
 	if (vs->tls_session) {
 	    gnutls_deinit(vs->tls_session);
@@ -2248,6 +3342,7 @@ void vnc_display_close(DisplayState *ds)
 	vs->wiremode = VNC_WIREMODE_CLEAR;
 #endif /* CONFIG_VNC_TLS */
     }
+    vnc_encoder_stop(vs);
     vs->auth = VNC_AUTH_INVALID;
 #ifdef CONFIG_VNC_TLS
     vs->subauth = VNC_AUTH_INVALID;